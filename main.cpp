@@ -17,108 +17,128 @@
  */
 
 #include "mnistDataReader.h"
+#include "batchLoader.h"
 #include "matrix.h"
+#include "network.h"
+#include "quantizedNetwork.h"
+#include "checkpoint.h"
+#include "telemetry.h"
 #include <iostream>
 #include <cassert>
 #include <cmath>
 #include <ctime>
 #include <cstdlib>
 #include <chrono>
+#include <algorithm>
+#include <cstring>
+#include <iomanip>
+#include <memory>
+#include <numeric>
+#include <string>
+#include <sstream>
+#include <thread>
+#include <vector>
 
 /**
- * @brief activate function for a neural network based on the sigmoid function
- * @param weights matrix of weights for the current layer
- * @param inputFromPrevLayer output of the activations from the previous layer
- * @param biases matrix of baises for the current layer
+ * @brief how training picks its samples
 */
-matrix<_Float64> activate(matrix<_Float64> weights, matrix<_Float64> inputFromPrevLayer, matrix<_Float64> biases)
+enum class sampleOrder : uint32_t
 {
-    matrix<_Float64> outputOfActivation = matrix<_Float64>::add(matrix<_Float64>::matrixMultiplication(weights, inputFromPrevLayer), biases);
+    // uniformly at random, a sample can come up again before others came up once
+    replacement = 0,
+    // every sample once per epoch, in a shuffled order
+    epoch = 1
+};
 
-    // The resultant matrix should be a Nx1
-    if(outputOfActivation.getNumColumns() != 1)
+/**
+ * @brief the samples one training thread picks
+ * @param order with replacement or in epochs
+ * @param numTrainingSamples number of images in the training set
+ * @param seed seed of the picks and of the epochs' order
+ * @param worker this thread's stream of picks, or its slice of every epoch
+ * @param numWorkers with epochs, slices an epoch is cut into
+ * @return the sequence
+*/
+matrixRandom::sampleSequence makeSampleSequence(sampleOrder order, uint32_t numTrainingSamples, uint32_t seed, uint32_t worker = 0, uint32_t numWorkers = 1)
+{
+    if(order == sampleOrder::epoch)
     {
-        std::cout<<"matrix<_Float64> activate(), not an Nx1 matrix, has "<< outputOfActivation.getNumColumns()<<" columns"<<std::endl;
-        assert(false);
+        return matrixRandom::sampleSequence(matrixRandom::epochSampler(numTrainingSamples, seed, worker, numWorkers));
     }
+    return matrixRandom::sampleSequence(numTrainingSamples, seed, worker);
+}
 
-    for(uint32_t iIter = 0; iIter < outputOfActivation.getNumRows(); iIter++)
+/**
+ * @brief print whether training had to wait for its samples
+ * @param loader the loader training took its samples from, nullptr prints nothing
+*/
+template <class T> void printLoaderStatistics(const batchLoader<T>* loader)
+{
+    if(loader == nullptr)
     {
-        _Float64 temp = 1.0f /(1.0f + exp(-1.0f * outputOfActivation.at(iIter)));
-        outputOfActivation.assign(temp, iIter);
+        return;
     }
-
-    return outputOfActivation;
+    const loaderStatistics statistics = loader->getStatistics();
+    std::cout<<"loader: "<<statistics.batches<<" batches, "<<statistics.stalls<<" stalls waiting "<<(statistics.stallSeconds * 1000.0)<<" ms, on average "
+             <<statistics.averageQueueDepth<<" batches loaded ahead, producers waited "<<(statistics.producerWaitSeconds * 1000.0)<<" ms for a free slot"<<std::endl;
 }
 
-int main()
+/**
+ * @brief train the network one randomly picked sample at a time
+ * @param model weights and biases to train, read and updated in place
+ * @param training training set
+ * @param stochasticIterations number of samples to train on
+ * @param learningRate learning rate, AKA eta
+ * @param telemetry gets the cost of every iteration, prints the loader's
+ *        statistics at the end too. nullptr for none
+ * @param prefetch loads the samples ahead on threads of their own, depth 0
+ *        picks and loads them in the loop. Same samples either way
+ * @param samples picks the samples
+ * @return sum of the cost over all the iterations
+*/
+template <class T> _Float64 trainSingleSample(network<T>& model, const mnistDataReader& training, uint32_t stochasticIterations, _Float64 learningRate, trainingTelemetry* telemetry,
+                           const prefetchOptions& prefetch, matrixRandom::sampleSequence& samples)
 {
-    srand(time(0));
-    
-    uint32_t numTestSamples = 10000;
-    uint32_t numTrainingSamples = 60000;
-    uint32_t totalWrong = 0;
-    mnistDataReader training("mnistDataset/train-images.idx3-ubyte", "mnistDataset/train-labels.idx1-ubyte", numTrainingSamples);
-    mnistDataReader testSamples("mnistDataset/t10k-images.idx3-ubyte", "mnistDataset/t10k-labels.idx1-ubyte", numTestSamples);
-
-    // 784 nodes
-    matrix<_Float64> inputLayer(784, 1); // 16x16 pixels = 784 nodes
-    // 16 nodes, 16 rows is number nodes in current layer, 784 columns is number nodes in previous layer
-    // Each node is connect to every other node in the previous layer
-    matrix<_Float64> hiddenLayer1_weights(16, 784); 
-    // 16 nodes, rows is number of nodes in current layer
-    matrix<_Float64> hiddenLayer1_biases(16, 1); 
-    // 16 nodes, 16 in rows in current layer, 16 columns because there are 16 nodes in previous layer
-    matrix<_Float64> hiddenLayer2_weights(16, 16); // 16 nodes
-    // 16 nodes, 16 rows because there are 16 nodes in this layer
-    matrix<_Float64> hiddenLayer2_biases(16, 1); // 16 nodes
-    // 10 nodes, 10 rows because there are 10 nodes for the current layer, and 16 columns because there are 16 nodes in the previous layer
-    matrix<_Float64> outputLayerWeights(10, 16); // 10 nodes, each corresponding to 0-9
-    // 10 nodes, 10 rows because there are 10 nodes in this layer
-    matrix<_Float64> outputLayerBiases(10, 1); // 10 nodes, so 10 biases
-
-    matrix<_Float64> onesMatrixOutput(10, 1);
-    matrix<_Float64> onesMatrixLayer2(16, 1);
-    matrix<_Float64> onesMatrixLayer1(16, 1);
-    onesMatrixOutput.fillNumber(1.0f);
-    onesMatrixLayer2.fillNumber(1.0f);
-    onesMatrixLayer1.fillNumber(1.0f);
+    // Scratch space for a training step, allocated once and reused every
+    // iteration. The worker has buffers of its own and trains model's weights
+    network<T> worker(model, 1);
+    matrix<T> sample(1, model.getLayerSizes().front());
+    // one sample as a row and as a column are the same memory, the reader
+    // gathers a row and the network takes a column
+    matrix<T> inputLayer = matrix<T>::view(sample.data(), model.getLayerSizes().front(), 1); // 28x28 pixels = 784 nodes
+    matrix<T> randomImageLabel(model.getLayerSizes().back(), 1);
+    matrix<T> costGradient(model.getLayerSizes().back(), 1);
+
+    std::unique_ptr<batchLoader<T>> loader;
+    if(prefetch.depth > 0)
+    {
+        loader = std::make_unique<batchLoader<T>>(training, 1, stochasticIterations, samples, prefetch);
+    }
 
-    //learning rate, AKA eta
-    _Float64 learningRate = 0.0015f;
-    uint32_t stochasticIterations = 60000 * 18;
     //sum of the cost over all the iterations
     _Float64 totalCost = 0.0f;
 
-    //initialize to all zeros or random value
-    inputLayer.fillZeros();
-    hiddenLayer1_weights.fillRandom(-0.5f, 0.5f);
-    hiddenLayer2_weights.fillRandom(-0.5f, 0.5f);
-    outputLayerWeights.fillRandom(-0.5f, 0.5f);
-
-    hiddenLayer1_biases.fillRandom(-0.5f, 0.5f);
-    hiddenLayer2_biases.fillRandom(-0.5f, 0.5f);
-    outputLayerBiases.fillRandom(-0.5f, 0.5f);
-
-    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
-
+    // nothing in the loop allocates, every buffer above is reused
     for(uint32_t iIter = 0; iIter < stochasticIterations; iIter++)
     {
-        //select random image from training set
-        uint32_t randomIndex = rand()%(numTrainingSamples);
-        _Float64 cost = 0;
-        matrix<uint8_t> randomImage = training.getImage(randomIndex);
-        matrix<_Float64> randomImageLabel = training.getImageLabel(randomIndex);
-        //convert image from uint8 matrix to float32 matrix
-        for(uint32_t jIter = 0; jIter < (randomImage.getNumRows() * randomImage.getNumColumns()); jIter++)
+        //select random image from training set, converted to the network's precision
+        const matrix<T>* input = &inputLayer;
+        const matrix<T>* label = &randomImageLabel;
+        if(loader)
         {
-            inputLayer.assign(static_cast<_Float64>(randomImage.at(jIter)), jIter);
+            const loadedBatch<T>& batch = loader->next();
+            input = &batch.inputLayer;
+            label = &batch.labels;
         }
+        else
+        {
+            uint32_t randomIndex = samples.next();
+            training.getBatch(&randomIndex, 1, sample, randomImageLabel);
+        }
+        _Float64 cost = 0;
 
         // forward pass through the network
-        matrix<_Float64>outputOfLayer1 = activate(hiddenLayer1_weights, inputLayer, hiddenLayer1_biases);
-        matrix<_Float64>outputOfLayer2 = activate(hiddenLayer2_weights, outputOfLayer1, hiddenLayer2_biases);
-        matrix<_Float64>outputLayer = activate(outputLayerWeights, outputOfLayer2, outputLayerBiases);
+        const matrix<T>& outputLayer = worker.forward(*input);
 
         /** 
          * 
@@ -134,11 +154,15 @@ int main()
          * Add up the squares of the differences of the outputs of the network vs the actual value.
          * cost = (outputLayer[0] - expectedOutput[0])^2 + (outputLayer[1] - expectedOutput[1])^2 + ... (outputLayer[9] - expectedOutput[9])^2
          */
-        for(uint32_t jIter = 0; jIter < randomImageLabel.getNumRows(); jIter++)
+        costGradient = outputLayer - *label;
+        for(uint32_t jIter = 0; jIter < costGradient.getNumRows(); jIter++)
         {
-            cost += pow(outputLayer.at(jIter) - randomImageLabel.at(jIter), 2.0f);
+            cost += costGradient[jIter] * costGradient[jIter];
+        }
+        if(telemetry != nullptr)
+        {
+            telemetry->record(iIter, cost);
         }
-        std::cout<< "cost/error for iteration "<< iIter << " is "<<cost<<std::endl;
         totalCost = totalCost + cost;
 
         /**
@@ -148,63 +172,1320 @@ int main()
          * the fastest change to the cost function. Which changes to which weights
          * matter the most.
         */
-        // errorOutputLayer = sigmoid'(x) hadamard (outputLayer - expected_result) = (outputLayer hadamard (1-outputLayer)) hadamard (outputLayer - expected_result)
-        matrix<_Float64> errorLayerOutput = matrix<_Float64>::hadamardProduct(matrix<_Float64>::hadamardProduct(outputLayer, (matrix<_Float64>::subtract(onesMatrixOutput,outputLayer))),(matrix<_Float64>::subtract(outputLayer, randomImageLabel)));
-        // errorLayer2 = sigmoid'(x) hadamard (outputLayerWeights * errorOutputLayer) = (outputOfLayer2 hadamard (1-outputOfLayer2)) hadamard (outputLayerWeights * errorOutputLayer)
-        matrix<_Float64> errorLayer2 = matrix<_Float64>::hadamardProduct(matrix<_Float64>::hadamardProduct(outputOfLayer2, (matrix<_Float64>::subtract(onesMatrixLayer2,outputOfLayer2))), matrix<_Float64>::matrixMultiplication(matrix<_Float64>::transpose(outputLayerWeights), errorLayerOutput));
-        // errorLayer1 = sigmoid'(x) hadamard (hiddenLayer2_weights * errorLayer2) = (outputOfLayer1 hadamard (1-outputOfLayer1)) hadamard (hiddenLayer2_weights * errorLayer2)
-        matrix<_Float64> errorLayer1 = matrix<_Float64>::hadamardProduct(matrix<_Float64>::hadamardProduct(outputOfLayer1, (matrix<_Float64>::subtract(onesMatrixLayer1,outputOfLayer1))), matrix<_Float64>::matrixMultiplication(matrix<_Float64>::transpose(outputLayerWeights), errorLayerOutput));
-
-        outputLayerWeights = matrix<_Float64>::subtract(outputLayerWeights, (matrix<_Float64>::matrixMultiplication(matrix<_Float64>::scalarMultiply(learningRate, errorLayerOutput), matrix<_Float64>::transpose(outputOfLayer2))));
-        // outputLayerBiases = outputLayerBiases - (learningRate * errorLayerOutput)
-        outputLayerBiases = matrix<_Float64>::subtract(outputLayerBiases, matrix<_Float64>::scalarMultiply(learningRate, errorLayerOutput));
-        // hiddenLayer2_weights = hiddenLayer2_weights - (learningRate * errorLayer2 * transpose(outputOfLayer1))
-        hiddenLayer2_weights = matrix<_Float64>::subtract(hiddenLayer2_weights, (matrix<_Float64>::matrixMultiplication(matrix<_Float64>::scalarMultiply(learningRate, errorLayer2), matrix<_Float64>::transpose(outputOfLayer1))));
-        // hiddenLayer2_biases = hiddenLayer2_biases - (learningRate * errorLayer2)
-        hiddenLayer2_biases = matrix<_Float64>::subtract(hiddenLayer2_biases, matrix<_Float64>::scalarMultiply(learningRate, errorLayer2));
-        // hiddenLayer1_weights = hiddenLayer1_weights - (learningRate * errorLayer1 * transpose(inputLayer))
-        hiddenLayer1_weights = matrix<_Float64>::subtract(hiddenLayer1_weights, (matrix<_Float64>::matrixMultiplication(matrix<_Float64>::scalarMultiply(learningRate, errorLayer1), matrix<_Float64>::transpose(inputLayer))));
-        // hiddenLayer1_biases = hiddenLayer1_biases - (learningRate * errorLayer1)
-        hiddenLayer1_biases = matrix<_Float64>::subtract(hiddenLayer1_biases, matrix<_Float64>::scalarMultiply(learningRate, errorLayer1));
+        /**
+         * Each layer, last to first, computes its error, hands the gradient on
+         * to the layer before it and then updates its weights and biases in place.
+         * 
+         * errorLayer = sigmoid'(x) hadamard gradient = (output hadamard (1-output)) hadamard gradient
+         * gradient for the previous layer = transpose(weights) * errorLayer, with the weights before the update
+         * weights = weights - (learningRate * errorLayer * transpose(input))
+         * biases = biases - (learningRate * errorLayer)
+         * 
+         * For the output layer the gradient of the cost is (outputLayer - expected_result),
+         * which is already in costGradient
+        */
+        worker.backwardAndStep(costGradient, static_cast<T>(learningRate));
     }
-    std::chrono::steady_clock::time_point stop = std::chrono::steady_clock::now();
 
-    // Then consider the average cost over the training examples.
-    std::cout<<"average cost is: " << totalCost/((_Float64)numTrainingSamples)<<std::endl;
-    std::cout<<"training the network took "<<std::chrono::duration_cast<std::chrono::minutes>(stop - start).count()<<" minutes"<<std::endl;
-    /**
-     * Run test images that the network has never seen before, through the network
-     */
-    for(uint32_t iIter = 0; iIter < 10000; iIter++)
+    if(telemetry != nullptr)
     {
-        matrix<uint8_t> testImage = testSamples.getImage(iIter);
-        matrix<_Float64> testImageLabel = testSamples.getImageLabel(iIter);
+        printLoaderStatistics(loader.get());
+    }
+    return totalCost;
+}
 
-        for(uint32_t jIter = 0; jIter < (testImage.getNumRows() * testImage.getNumColumns()); jIter++)
+/**
+ * @brief train the network on mini-batches of randomly picked samples
+ * @details the samples of a batch are stacked as the columns of a 784 x B
+ *          input, so every layer does matrix-matrix products instead of
+ *          matrix-vector products. The gradients are summed over the batch
+ *          and stepped with the per sample learning rate, the same as
+ *          averaging them and scaling the step by B, so an epoch moves the
+ *          weights about as far as it does one sample at a time
+ * @param model weights and biases to train, read and updated in place
+ * @param training training set
+ * @param numSamples number of samples to train on, rounded down to whole batches
+ * @param batchSize samples per batch, B
+ * @param learningRate learning rate per sample, AKA eta
+ * @param telemetry gets the cost of every batch, prints the loader's
+ *        statistics at the end too. nullptr for none
+ * @param prefetch loads the batches ahead on threads of their own, depth 0
+ *        picks and loads them in the loop. Same batches either way
+ * @param samples picks the samples
+ * @return sum of the cost over all the samples
+*/
+template <class T> _Float64 trainMiniBatch(network<T>& model, const mnistDataReader& training, uint32_t numSamples, uint32_t batchSize, _Float64 learningRate, trainingTelemetry* telemetry,
+                        const prefetchOptions& prefetch, matrixRandom::sampleSequence& samples)
+{
+    const uint32_t numInputs = model.getLayerSizes().front();
+    const uint32_t numOutputs = model.getLayerSizes().back();
+
+    // one sample per column, everything allocated once for the whole run.
+    // samples are gathered one per row first and transposed in one go,
+    // writing them straight into the columns strides through memory
+    network<T> worker(model, batchSize);
+    std::vector<uint32_t> batchIndices(batchSize);
+    matrix<T> batchSamples(batchSize, numInputs);
+    matrix<T> inputLayer(numInputs, batchSize);
+    matrix<T> labels(numOutputs, batchSize);
+    matrix<T> costGradient(numOutputs, batchSize);
+
+    std::unique_ptr<batchLoader<T>> loader;
+    if(prefetch.depth > 0)
+    {
+        loader = std::make_unique<batchLoader<T>>(training, batchSize, numSamples / batchSize, samples, prefetch);
+    }
+
+    _Float64 totalCost = 0.0f;
+
+    for(uint32_t iIter = 0; iIter < numSamples / batchSize; iIter++)
+    {
+        // column b of the input and of the labels is sample b of the batch
+        const matrix<T>* input = &inputLayer;
+        const matrix<T>* batchLabels = &labels;
+        if(loader)
         {
-            inputLayer.assign(static_cast<_Float64>(testImage.at(jIter)), jIter);
+            const loadedBatch<T>& batch = loader->next();
+            input = &batch.inputLayer;
+            batchLabels = &batch.labels;
+        }
+        else
+        {
+            for(uint32_t& index : batchIndices)
+            {
+                index = samples.next();
+            }
+            training.getBatch(batchIndices.data(), batchSize, batchSamples, labels);
+            matrix<T>::transpose(batchSamples, inputLayer);
         }
 
         // forward pass through the network
-        matrix<_Float64>outputOfLayer1 = activate(hiddenLayer1_weights, inputLayer, hiddenLayer1_biases);
-        matrix<_Float64>outputOfLayer2 = activate(hiddenLayer2_weights, outputOfLayer1, hiddenLayer2_biases);
-        matrix<_Float64>outputLayer = activate(outputLayerWeights, outputOfLayer2, outputLayerBiases);
+        const matrix<T>& outputLayer = worker.forward(*input);
+
+        // same cost as one sample at a time, summed over the batch
+        costGradient = outputLayer - *batchLabels;
+        _Float64 cost = 0;
+        for(const T& value : costGradient)
+        {
+            cost += value * value;
+        }
+        if(telemetry != nullptr)
+        {
+            telemetry->record(iIter, cost);
+        }
+        totalCost = totalCost + cost;
+
+        // backward pass through the network
+        worker.backwardAndStep(costGradient, static_cast<T>(learningRate));
+    }
+
+    if(telemetry != nullptr)
+    {
+        printLoaderStatistics(loader.get());
+    }
+    return totalCost;
+}
 
-        uint32_t outputIndex = 0;
-        for(uint32_t jIter = 0; jIter < outputLayer.getNumRows(); jIter++)
+/**
+ * @brief train one network from several threads at once, Hogwild style
+ * @details every worker runs the single sample loop of trainSingleSample on
+ *          the same weights and biases, with its own scratch and random
+ *          number generator, and updates the shared weights and biases
+ *          without any locking.
+ *
+ *          Memory model: the weights and biases are read and written by all
+ *          workers with plain loads and stores, on purpose. Each weight is an
+ *          aligned 4 byte float or 8 byte double, which x86-64 (and every
+ *          other 64 bit target we care about) loads and stores in one piece,
+ *          so a worker never sees a torn value. What it can see is a mix of
+ *          old and new values across a row, and two workers updating the same
+ *          weight at the same time can lose one of the two updates. With
+ *          sparse, small gradient steps that costs a little accuracy and no
+ *          stability, which is the Hogwild trade. Formally these are data
+ *          races, so thread sanitizer will report them. The only ordering
+ *          guaranteed is at the edges: starting the threads publishes the
+ *          initial weights to them and joining them publishes the final
+ *          weights back to the caller.
+ *
+ *          Per element relaxed atomics would make the races well defined, but
+ *          they would also turn the vectorized forward and backward kernels
+ *          back into scalar loops, which is most of the speed we are after.
+ * @param model weights and biases to train, shared by all workers
+ * @param training training set, only read
+ * @param numTrainingSamples number of images in the training set
+ * @param stochasticIterations number of samples to train on, over all workers
+ * @param learningRate learning rate, AKA eta
+ * @param numThreads number of workers
+ * @param seed seed of the picks, worker w draws stream w of it. With
+ *        epochs, worker w takes slice w of every epoch of the seed
+ * @param order with replacement or in epochs
+ * @return sum of the cost over all the iterations of all the workers
+*/
+template <class T> _Float64 trainHogwild(network<T>& model, const mnistDataReader& training, uint32_t numTrainingSamples, uint32_t stochasticIterations, _Float64 learningRate,
+                      uint32_t numThreads, uint32_t seed, sampleOrder order)
+{
+    std::vector<std::thread> workers;
+    std::vector<_Float64> costOfWorker(numThreads, 0.0);
+
+    for(uint32_t wIter = 0; wIter < numThreads; wIter++)
+    {
+        // spread the remainder over the first few workers
+        const uint32_t iterationsOfWorker = (stochasticIterations / numThreads) + ((wIter < (stochasticIterations % numThreads)) ? 1 : 0);
+        workers.emplace_back([&model, &training, &costOfWorker, numTrainingSamples, iterationsOfWorker, learningRate, numThreads, seed, order, wIter]()
         {
-            if(outputLayer.at(jIter) > outputLayer.at(outputIndex))
+            matrixRandom::sampleSequence samples = makeSampleSequence(order, numTrainingSamples, seed, wIter, numThreads);
+            costOfWorker[wIter] = trainSingleSample<T>(model, training, iterationsOfWorker, learningRate, nullptr, prefetchOptions(), samples);
+        });
+    }
+
+    _Float64 totalCost = 0.0;
+    for(uint32_t wIter = 0; wIter < numThreads; wIter++)
+    {
+        workers[wIter].join();
+        totalCost += costOfWorker[wIter];
+    }
+    return totalCost;
+}
+
+/**
+ * @brief private buffers of one shard of a data parallel mini-batch
+*/
+template <class T> struct shardWorkspace
+{
+    /**
+     * @brief buffers for up to maxSamples samples
+     * @param model weights and biases the shard reads, has to outlive the shard
+     * @param maxSamples most samples the shard will be given
+    */
+    shardWorkspace(network<T>& model, uint32_t maxSamples) :
+        replica(model, maxSamples),
+        samples(maxSamples, model.getLayerSizes().front()),
+        inputLayer(model.getLayerSizes().front(), maxSamples),
+        labels(model.getLayerSizes().back(), maxSamples),
+        costGradient(model.getLayerSizes().back(), maxSamples)
+    {
+    }
+
+    // the summed gradients of the shard's samples end up in the replica's
+    // layers, the tree all-reduce adds these up in place. The cost is summed
+    // in double whatever the precision of the network
+    network<T> replica;
+    // one sample per row as the reader gathers them, transposed into inputLayer
+    matrix<T> samples;
+    matrix<T> inputLayer;
+    matrix<T> labels;
+    matrix<T> costGradient;
+    _Float64 cost = 0.0;
+};
+
+/**
+ * @brief forward and backward pass over one shard of a mini-batch, leaving
+ *        the summed gradients of its samples in the shard's replica
+ * @param training training set
+ * @param sampleIndices indices of the shard's samples in the training set
+ * @param numSamples number of samples in the shard
+ * @param shard the shard's private buffers
+*/
+template <class T> void computeShardGradients(const mnistDataReader& training, const uint32_t* sampleIndices, uint32_t numSamples, shardWorkspace<T>& shard)
+{
+    shard.samples.resize(numSamples, shard.samples.getNumColumns());
+    shard.inputLayer.resize(shard.inputLayer.getNumRows(), numSamples);
+    shard.labels.resize(shard.labels.getNumRows(), numSamples);
+    training.getBatch(sampleIndices, numSamples, shard.samples, shard.labels);
+    matrix<T>::transpose(shard.samples, shard.inputLayer);
+
+    // forward pass through the network
+    const matrix<T>& outputLayer = shard.replica.forward(shard.inputLayer);
+
+    shard.costGradient = outputLayer - shard.labels;
+    shard.cost = 0.0;
+    for(const T& value : shard.costGradient)
+    {
+        shard.cost += value * value;
+    }
+
+    // backward pass through the network, into the shard's own gradients
+    shard.replica.backward(shard.costGradient);
+}
+
+/**
+ * @brief synchronous data parallel mini-batch training that gives the same
+ *        bits for a given seed at any thread count
+ * @details every step draws the batch from one sample sequence, cuts it into
+ *          numShards fixed slices and computes each slice's gradients into
+ *          that shard's private buffers, spread over the thread pool. The
+ *          shards are then combined by a tree all-reduce with a fixed shape:
+ *          shard 0 += shard 1, 2 += 3, ... then 0 += 2, 4 += 6, ... and so on,
+ *          so every sum is done in the same order no matter which thread does
+ *          it. The step is applied once, from shard 0.
+ *
+ *          What the result depends on is the seed, the batch size and the
+ *          shard count. The thread count only changes which thread computes
+ *          which shard, and every kernel underneath (gemm included) gives the
+ *          same bits at any thread count. The shards run on the pool as it is
+ *          sized, main() sizes it from --threads before anything runs on it.
+ * @param model weights and biases to train
+ * @param training training set, only read
+ * @param numSamples number of samples to train on, rounded down to whole batches
+ * @param batchSize samples per batch, B
+ * @param numShards slices per batch, at most B
+ * @param learningRate learning rate per sample, AKA eta
+ * @param telemetry gets the cost of every batch, nullptr for none
+ * @param samples picks the samples
+ * @return sum of the cost over all the samples
+*/
+template <class T> _Float64 trainDataParallel(network<T>& model, const mnistDataReader& training, uint32_t numSamples, uint32_t batchSize,
+                           uint32_t numShards, _Float64 learningRate, trainingTelemetry* telemetry, matrixRandom::sampleSequence& samples)
+{
+    std::vector<uint32_t> batchIndices(batchSize);
+    _Float64 totalCost = 0.0f;
+
+    // every replica trains model's weights, reserved up front so they never move
+    std::vector<shardWorkspace<T>> shards;
+    shards.reserve(numShards);
+    for(uint32_t sIter = 0; sIter < numShards; sIter++)
+    {
+        shards.emplace_back(model, (batchSize + numShards - 1) / numShards);
+    }
+
+    for(uint32_t iIter = 0; iIter < numSamples / batchSize; iIter++)
+    {
+        for(uint32_t& index : batchIndices)
+        {
+            index = samples.next();
+        }
+
+        parallelFor(0, numShards, 1, [&](uint32_t shardBegin, uint32_t shardEnd)
+        {
+            for(uint32_t sIter = shardBegin; sIter < shardEnd; sIter++)
             {
-                outputIndex = jIter;
+                const uint32_t sampleBegin = static_cast<uint32_t>((static_cast<uint64_t>(sIter) * batchSize) / numShards);
+                const uint32_t sampleEnd = static_cast<uint32_t>((static_cast<uint64_t>(sIter + 1) * batchSize) / numShards);
+                computeShardGradients(training, batchIndices.data() + sampleBegin, sampleEnd - sampleBegin, shards[sIter]);
             }
+        });
+
+        // fixed order tree all-reduce, each level's pairs are independent
+        for(uint32_t stride = 1; stride < numShards; stride *= 2)
+        {
+            parallelFor(0, (numShards + (2 * stride) - 1) / (2 * stride), 1, [&](uint32_t pairBegin, uint32_t pairEnd)
+            {
+                for(uint32_t pIter = pairBegin; pIter < pairEnd; pIter++)
+                {
+                    const uint32_t left = pIter * 2 * stride;
+                    if(left + stride < numShards)
+                    {
+                        shards[left].replica.accumulateGradients(shards[left + stride].replica);
+                        shards[left].cost += shards[left + stride].cost;
+                    }
+                }
+            });
         }
-        if(outputIndex != testSamples.getUintLabel(iIter))
+
+        // trainMiniBatch steps the summed gradients with the per sample
+        // learning rate too
+        shards[0].replica.step(static_cast<T>(learningRate));
+        totalCost += shards[0].cost;
+        if(telemetry != nullptr)
         {
-            totalWrong++;
+            telemetry->record(iIter, shards[0].cost);
         }
     }
 
-    std::cout<<"After "<<stochasticIterations<<" training iterations, with learning rate "<<learningRate<<", the network has classified "<<totalWrong<<" images wrong out of "<<numTestSamples<<", with an accuracy of "<<(((_Float64)(numTestSamples-totalWrong))/((_Float64)numTestSamples)) * 100.0f<<"%"<<std::endl;
+    return totalCost;
+}
+
+/**
+ * @brief index of the largest value in a column
+ * @param output network output, one sample per column
+ * @param column the sample
+ * @return the digit the network picked
+*/
+template <class T> uint32_t predictedDigit(const matrix<T>& output, uint32_t column)
+{
+    uint32_t outputIndex = 0;
+    for(uint32_t jIter = 1; jIter < output.getNumRows(); jIter++)
+    {
+        if(output.at(jIter, column) > output.at(outputIndex, column))
+        {
+            outputIndex = jIter;
+        }
+    }
+    return outputIndex;
+}
+
+/**
+ * @brief what evaluate() measured
+*/
+struct evaluationResult
+{
+    uint32_t numImages = 0;
+    uint32_t wrong = 0;
+    // percent
+    _Float64 accuracy = 0.0;
+    // images with label i the network took for digit j, one row per label
+    matrix<uint32_t> confusion;
+    _Float64 imagesPerSecond = 0.0;
+    // wall time of one batch, staging the images through picking the digits
+    _Float64 p50BatchMilliseconds = 0.0;
+    _Float64 p99BatchMilliseconds = 0.0;
+};
+
+/**
+ * @brief per shard buffers of evaluate(), built before the clock starts
+*/
+template <class T> struct evaluationShard
+{
+    network<T> worker;
+    // one image per row as the reader gathers them, transposed into inputLayer
+    std::vector<uint32_t> indices;
+    matrix<T> samples;
+    matrix<T> inputLayer;
+    matrix<uint32_t> confusion;
+    std::vector<_Float64> batchMilliseconds;
+
+    evaluationShard(network<T>& model, uint32_t batchSize, uint32_t numBatches) :
+        worker(model, batchSize),
+        indices(batchSize),
+        samples(batchSize, model.getLayerSizes().front()),
+        inputLayer(model.getLayerSizes().front(), batchSize),
+        confusion(model.getLayerSizes().back(), model.getLayerSizes().back())
+    {
+        // inference only, so the vectorized exp is accurate enough
+        worker.setActivationMode(matrixKernels::activationMode::fast);
+        confusion.fillZeros();
+        batchMilliseconds.reserve(numBatches);
+    }
+};
+
+/**
+ * @brief run the images of a data set that the network has never seen
+ *        before through the network, in batches, on several threads
+ * @details the set is cut into contiguous shards that the thread pool runs
+ *          as it is sized, each shard runs batches of batchSize images through
+ *          a network of its own that reads model's weights. The pool is not
+ *          resized, other threads may be using it. The counts are the same at
+ *          any batch size and shard count up to rounding of the batched
+ *          products
+ * @param model trained weights and biases, only read
+ * @param dataset images and labels to classify
+ * @param batchSize images per forward pass
+ * @param numThreads shards to cut the set into, 0 for one per thread of the
+ *        pool
+ * @param predictions if not nullptr, gets the digit picked for every image
+ * @return accuracy, confusion matrix, throughput and batch latency
+*/
+template <class T> evaluationResult evaluate(network<T>& model, const mnistDataReader& dataset, uint32_t batchSize, uint32_t numThreads, std::vector<uint32_t>* predictions = nullptr)
+{
+    evaluationResult result;
+    result.numImages = dataset.getNumImages();
+    const uint32_t numBatches = (result.numImages + batchSize - 1) / batchSize;
+
+    const uint32_t numShards = std::max(1u, std::min((numThreads != 0) ? numThreads : threadPool::instance().getNumThreads(), numBatches));
+
+    std::vector<evaluationShard<T>> shards;
+    shards.reserve(numShards);
+    for(uint32_t sIter = 0; sIter < numShards; sIter++)
+    {
+        shards.emplace_back(model, batchSize, numBatches);
+    }
+    if(predictions != nullptr)
+    {
+        predictions->resize(result.numImages);
+    }
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    parallelFor(0, numShards, 1, [&](uint32_t shardBegin, uint32_t shardEnd)
+    {
+        for(uint32_t sIter = shardBegin; sIter < shardEnd; sIter++)
+        {
+            evaluationShard<T>& shard = shards[sIter];
+            const uint32_t batchBegin = static_cast<uint32_t>((static_cast<uint64_t>(sIter) * numBatches) / numShards);
+            const uint32_t batchEnd = static_cast<uint32_t>((static_cast<uint64_t>(sIter + 1) * numBatches) / numShards);
+
+            for(uint32_t batchIter = batchBegin; batchIter < batchEnd; batchIter++)
+            {
+                std::chrono::steady_clock::time_point batchStart = std::chrono::steady_clock::now();
+
+                const uint32_t first = batchIter * batchSize;
+                const uint32_t numSamples = std::min(batchSize, result.numImages - first);
+                shard.samples.resize(numSamples, shard.samples.getNumColumns());
+                shard.inputLayer.resize(shard.inputLayer.getNumRows(), numSamples);
+                std::iota(shard.indices.begin(), shard.indices.begin() + numSamples, first);
+                dataset.getImages(shard.indices.data(), numSamples, shard.samples);
+                matrix<T>::transpose(shard.samples, shard.inputLayer);
+
+                // forward pass through the network
+                const matrix<T>& outputLayer = shard.worker.forward(shard.inputLayer);
+
+                for(uint32_t bIter = 0; bIter < numSamples; bIter++)
+                {
+                    const uint32_t digit = predictedDigit(outputLayer, bIter);
+                    shard.confusion(dataset.getUintLabel(first + bIter), digit)++;
+                    if(predictions != nullptr)
+                    {
+                        (*predictions)[first + bIter] = digit;
+                    }
+                }
+
+                std::chrono::steady_clock::time_point batchStop = std::chrono::steady_clock::now();
+                shard.batchMilliseconds.push_back(std::chrono::duration<_Float64, std::milli>(batchStop - batchStart).count());
+            }
+        }
+    });
+    std::chrono::steady_clock::time_point stop = std::chrono::steady_clock::now();
+
+    result.confusion = matrix<uint32_t>(model.getLayerSizes().back(), model.getLayerSizes().back());
+    result.confusion.fillZeros();
+    std::vector<_Float64> batchMilliseconds;
+    batchMilliseconds.reserve(numBatches);
+    for(const evaluationShard<T>& shard : shards)
+    {
+        for(uint32_t iIter = 0; iIter < shard.confusion.getNumRows() * shard.confusion.getNumColumns(); iIter++)
+        {
+            result.confusion[iIter] += shard.confusion.at(iIter);
+        }
+        batchMilliseconds.insert(batchMilliseconds.end(), shard.batchMilliseconds.begin(), shard.batchMilliseconds.end());
+    }
+
+    uint32_t right = 0;
+    for(uint32_t iIter = 0; iIter < result.confusion.getNumRows(); iIter++)
+    {
+        right += result.confusion.at(iIter, iIter);
+    }
+    result.wrong = result.numImages - right;
+    result.accuracy = (((_Float64)right)/((_Float64)result.numImages)) * 100.0f;
+    result.imagesPerSecond = result.numImages / std::chrono::duration<_Float64>(stop - start).count();
+
+    // nearest rank percentiles
+    std::sort(batchMilliseconds.begin(), batchMilliseconds.end());
+    result.p50BatchMilliseconds = batchMilliseconds[(batchMilliseconds.size() - 1) / 2];
+    result.p99BatchMilliseconds = batchMilliseconds[static_cast<size_t>(std::ceil(0.99 * batchMilliseconds.size())) - 1];
+    return result;
+}
+
+/**
+ * @brief print the confusion matrix of an evaluation, one row per label
+ * @param result the evaluation
+*/
+void printConfusionMatrix(const evaluationResult& result)
+{
+    std::cout<<"confusion matrix, rows are the labels, columns the digits the network picked"<<std::endl;
+    std::cout<<"     ";
+    for(uint32_t jIter = 0; jIter < result.confusion.getNumColumns(); jIter++)
+    {
+        std::cout<<std::setw(6)<<jIter;
+    }
+    std::cout<<std::endl;
+    for(uint32_t iIter = 0; iIter < result.confusion.getNumRows(); iIter++)
+    {
+        std::cout<<std::setw(5)<<iIter;
+        for(uint32_t jIter = 0; jIter < result.confusion.getNumColumns(); jIter++)
+        {
+            std::cout<<std::setw(6)<<result.confusion.at(iIter, jIter);
+        }
+        std::cout<<std::endl;
+    }
+}
+
+/**
+ * @brief print the confusion matrix, throughput and latency of an evaluation
+ * @param result the evaluation
+ * @param batchSize batch size it ran at
+*/
+void printEvaluation(const evaluationResult& result, uint32_t batchSize)
+{
+    printConfusionMatrix(result);
+    std::cout<<"evaluation at batch size "<<batchSize<<": "<<result.imagesPerSecond<<" images/s, batch latency p50 "<<result.p50BatchMilliseconds<<" ms, p99 "<<result.p99BatchMilliseconds<<" ms"<<std::endl;
+}
+
+/**
+ * @brief quantize a trained network to int8 and compare it with the float
+ *        network on the test set: accuracy, how often both pick the same
+ *        digit, model size and inference throughput
+ * @param model trained weights and biases, only read
+ * @param training training set, a sample of it calibrates the activations
+ * @param numTrainingSamples number of images in the training set
+ * @param testSamples test set
+ * @param numTestSamples number of images in the test set
+*/
+template <class T> void compareQuantized(network<T>& model, const mnistDataReader& training, uint32_t numTrainingSamples, const mnistDataReader& testSamples, uint32_t numTestSamples)
+{
+    // every 60th training image, spread over the whole set
+    const uint32_t numCalibrationSamples = std::min(1000u, numTrainingSamples);
+    const uint32_t numInputs = model.getLayerSizes().front();
+    std::vector<uint32_t> calibrationIndices(numCalibrationSamples);
+    for(uint32_t cIter = 0; cIter < numCalibrationSamples; cIter++)
+    {
+        calibrationIndices[cIter] = cIter * (numTrainingSamples / numCalibrationSamples);
+    }
+    matrix<T> calibrationSamples(numCalibrationSamples, numInputs);
+    matrix<T> calibrationInput(numInputs, numCalibrationSamples);
+    training.getImages(calibrationIndices.data(), numCalibrationSamples, calibrationSamples);
+    matrix<T>::transpose(calibrationSamples, calibrationInput);
+
+    // the quantized network takes the raw pixels and applies the
+    // normalization the float network was trained with itself
+    const uint32_t quantizedBatchSize = 64;
+    const mnistNormalization& normalization = training.getNormalization();
+    quantizedNetwork quantized(model, calibrationInput, quantizedBatchSize, normalization.scale, normalization.offset);
+
+    // the float network one image at a time on one thread, like the quantized one below
+    std::vector<uint32_t> floatPredictions;
+    const evaluationResult floatResult = evaluate(model, testSamples, 1, 1, &floatPredictions);
+    const uint32_t floatWrong = floatResult.wrong;
+    const _Float64 floatImagesPerSecond = floatResult.imagesPerSecond;
+
+    // one image at a time, straight from the uint8_t pixels the reader stores
+    uint32_t quantizedWrong = 0;
+    uint32_t agreements = 0;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for(uint32_t iIter = 0; iIter < numTestSamples; iIter++)
+    {
+        const uint32_t digit = predictedDigit(quantized.forward(testSamples.getImageView(iIter)), 0);
+        quantizedWrong += (digit != testSamples.getUintLabel(iIter)) ? 1 : 0;
+        agreements += (digit == floatPredictions[iIter]) ? 1 : 0;
+    }
+    std::chrono::steady_clock::time_point stop = std::chrono::steady_clock::now();
+    const _Float64 quantizedImagesPerSecond = numTestSamples / std::chrono::duration<_Float64>(stop - start).count();
+
+    // batches of quantizedBatchSize images, one per column
+    uint32_t batchedWrong = 0;
+    matrix<uint8_t> batch(numInputs, quantizedBatchSize);
+    start = std::chrono::steady_clock::now();
+    for(uint32_t first = 0; first < numTestSamples; first += quantizedBatchSize)
+    {
+        const uint32_t batchSize = std::min(quantizedBatchSize, numTestSamples - first);
+        batch.resize(numInputs, batchSize);
+        for(uint32_t bIter = 0; bIter < batchSize; bIter++)
+        {
+            const uint8_t* image = testSamples.getImagePixels(first + bIter);
+            for(uint32_t kIter = 0; kIter < numInputs; kIter++)
+            {
+                batch(kIter, bIter) = image[kIter];
+            }
+        }
+
+        const matrix<float>& output = quantized.forward(batch);
+        for(uint32_t bIter = 0; bIter < batchSize; bIter++)
+        {
+            batchedWrong += (predictedDigit(output, bIter) != testSamples.getUintLabel(first + bIter)) ? 1 : 0;
+        }
+    }
+    stop = std::chrono::steady_clock::now();
+    const _Float64 batchedImagesPerSecond = numTestSamples / std::chrono::duration<_Float64>(stop - start).count();
+
+    size_t numParameters = 0;
+    for(uint32_t lIter = 0; lIter < model.getNumLayers(); lIter++)
+    {
+        numParameters += (static_cast<size_t>(model.layer(lIter).getNumInputs()) + 1) * model.layer(lIter).getNumOutputs();
+    }
+    const size_t quantizedBytes = quantized.getModelBytes();
+
+    const _Float64 floatAccuracy = (((_Float64)(numTestSamples - floatWrong))/((_Float64)numTestSamples)) * 100.0f;
+    const _Float64 quantizedAccuracy = (((_Float64)(numTestSamples - quantizedWrong))/((_Float64)numTestSamples)) * 100.0f;
+    std::cout<<"int8 quantized with the "<<matrixKernels::activeQuantizedRowDotsName()<<" kernel: accuracy "<<quantizedAccuracy<<"% ("<<std::showpos<<(quantizedAccuracy - floatAccuracy)<<std::noshowpos
+             <<" points), "<<batchedWrong<<" wrong at batch size "<<quantizedBatchSize<<", top-1 agreement with the float network "<<(agreements * 100.0 / numTestSamples)<<"%"<<std::endl;
+    std::cout<<"model size: "<<(numParameters * sizeof(T))<<" bytes in "<<(sizeof(T) * 8)<<" bit floats, "<<quantizedBytes<<" bytes quantized, "
+             <<(static_cast<_Float64>(numParameters * sizeof(T)) / quantizedBytes)<<"x smaller, "<<(static_cast<_Float64>(numParameters * sizeof(float)) / quantizedBytes)<<"x smaller than float"<<std::endl;
+    std::cout<<"inference: float "<<floatImagesPerSecond<<" images/s, int8 "<<quantizedImagesPerSecond<<" images/s ("<<(quantizedImagesPerSecond / floatImagesPerSecond)<<"x), int8 at batch size "
+             <<quantizedBatchSize<<" "<<batchedImagesPerSecond<<" images/s ("<<(batchedImagesPerSecond / floatImagesPerSecond)<<"x)"<<std::endl;
+}
+
+/**
+ * @brief look up an activation function by name
+ * @param name name as activationFunctionName spells it
+ * @param function destination for the activation function
+ * @return false if there is no activation function of that name
+*/
+bool parseActivation(const std::string& name, matrixKernels::activationFunction& function)
+{
+    for(uint32_t iIter = 0; iIter <= static_cast<uint32_t>(matrixKernels::activationFunction::softmax); iIter++)
+    {
+        if(name == matrixKernels::activationFunctionName(static_cast<matrixKernels::activationFunction>(iIter)))
+        {
+            function = static_cast<matrixKernels::activationFunction>(iIter);
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief precision a network trains and runs in
+ * @details mixed is float weights and activations with double accumulators
+ *          for the long sums, bf16 is mixed with the forward pass reading a
+ *          bfloat16 copy of the weights, see precision.h
+*/
+enum class trainingPrecision : uint32_t
+{
+    float64 = 0,
+    float32 = 1,
+    mixed = 2,
+    bf16 = 3
+};
+
+/**
+ * @brief name of a precision, as --precision takes it
+*/
+const char* trainingPrecisionName(trainingPrecision precision)
+{
+    switch(precision)
+    {
+        case trainingPrecision::float32: return "float";
+        case trainingPrecision::mixed:   return "mixed";
+        case trainingPrecision::bf16:    return "bf16";
+        default:                         return "double";
+    }
+}
+
+/**
+ * @brief look up a precision by name
+ * @param name name as trainingPrecisionName spells it
+ * @param precision destination for the precision
+ * @return false if there is no precision of that name
+*/
+bool parsePrecision(const std::string& name, trainingPrecision& precision)
+{
+    for(uint32_t iIter = 0; iIter <= static_cast<uint32_t>(trainingPrecision::bf16); iIter++)
+    {
+        if(name == trainingPrecisionName(static_cast<trainingPrecision>(iIter)))
+        {
+            precision = static_cast<trainingPrecision>(iIter);
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief how the pixels are normalized before the network sees them
+*/
+enum class pixelNormalization : uint32_t
+{
+    // the raw 0 to 255 pixels
+    none = 0,
+    // [0, 1]
+    unit = 1,
+    // mean 0 and standard deviation 1 over the training set
+    standard = 2
+};
+
+/**
+ * @brief everything the command line sets
+*/
+struct trainingOptions
+{
+    std::vector<uint32_t> layerSizes = {784, 16, 16, 10};
+    matrixKernels::activationFunction hiddenActivation = matrixKernels::activationFunction::sigmoid;
+    matrixKernels::activationFunction outputActivation = matrixKernels::activationFunction::sigmoid;
+    trainingPrecision precision = trainingPrecision::float64;
+    uint32_t batchSize = 1;
+    uint32_t numThreads = 1;
+    uint32_t numShards = 8;
+    uint32_t seed = 0;
+    bool dataParallel = false;
+    bool benchmark = false;
+    bool hogwildBenchmark = false;
+    bool precisionBenchmark = false;
+    bool quantize = false;
+    // checkpoint to write after training, none if empty
+    std::string savePath;
+    // checkpoint to evaluate instead of training, none if empty
+    std::string loadPath;
+    uint32_t evalBatchSize = 100;
+    // 0 is the thread pool's default
+    uint32_t evalThreads = 0;
+    // milliseconds, 0 turns the training telemetry off
+    uint32_t telemetryInterval = 1000;
+    telemetryFormat telemetryOutput = telemetryFormat::text;
+    pixelNormalization normalization = pixelNormalization::none;
+    // --normalize was given, --load takes the checkpoint's normalization otherwise
+    bool normalizationGiven = false;
+    // keep the normalized pixels in files next to the datasets
+    bool pixelCache = false;
+    // batches loaded ahead of the single sample and mini-batch trainers
+    prefetchOptions prefetch;
+    sampleOrder sampling = sampleOrder::replacement;
+    weightInitialization initialization = weightInitialization::uniform;
+};
+
+/**
+ * @brief a network of the option's topology in precision T, the weights and
+ *        biases uniform, Xavier or He initialized from the seed
+ * @details the weights are drawn in double and rounded to T, so the same
+ *          seed starts every precision from the same weights. Sets the
+ *          accumulation precision the kernels use from here on
+*/
+template <class T> network<T> buildNetwork(const trainingOptions& options, trainingPrecision precision)
+{
+    const bool wide = (precision == trainingPrecision::mixed) || (precision == trainingPrecision::bf16);
+    matrixKernels::setAccumulation(wide ? matrixKernels::accumulation::wide : matrixKernels::accumulation::native);
+
+    // counter based, each layer is filled in parallel on the thread pool
+    network<T> model(options.layerSizes, 1, options.hiddenActivation, options.outputActivation);
+    model.initialize(options.initialization, options.seed);
+    if(precision == trainingPrecision::bf16)
+    {
+        model.setWeightStorage(matrixKernels::weightStorage::bf16);
+    }
+    return model;
+}
+
+/**
+ * @brief samples per second and test accuracy of one benchmark run
+*/
+struct benchmarkResult
+{
+    _Float64 samplesPerSecond = 0.0;
+    _Float64 accuracy = 0.0;
+};
+
+/**
+ * @brief train a fresh network in precision T for a fixed number of samples
+ *        at the option's batch size and test it
+ * @param options command line options, the seed picks the weights and samples
+ * @param precision precision to train in, has to match T
+ * @param training training set
+ * @param numTrainingSamples number of images in the training set
+ * @param numSamples number of samples to train on
+ * @param learningRate learning rate, AKA eta
+ * @param testSamples test set
+ * @return samples per second and accuracy in percent
+*/
+template <class T> benchmarkResult benchmarkPrecision(const trainingOptions& options, trainingPrecision precision, const mnistDataReader& training, uint32_t numTrainingSamples,
+                                                      uint32_t numSamples, _Float64 learningRate, const mnistDataReader& testSamples)
+{
+    network<T> model = buildNetwork<T>(options, precision);
+    matrixRandom::sampleSequence samples = makeSampleSequence(options.sampling, numTrainingSamples, options.seed);
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    if(options.batchSize == 1)
+    {
+        trainSingleSample(model, training, numSamples, learningRate, nullptr, options.prefetch, samples);
+    }
+    else
+    {
+        trainMiniBatch(model, training, numSamples, options.batchSize, learningRate, nullptr, options.prefetch, samples);
+    }
+    std::chrono::steady_clock::time_point stop = std::chrono::steady_clock::now();
+
+    benchmarkResult result;
+    result.samplesPerSecond = ((numSamples / options.batchSize) * options.batchSize) / std::chrono::duration<_Float64>(stop - start).count();
+    result.accuracy = evaluate(model, testSamples, options.evalBatchSize, options.evalThreads).accuracy;
+    return result;
+}
+
+/**
+ * @brief train and test a network in precision T as the options say
+ * @param options command line options
+ * @param training training set
+ * @param numTrainingSamples number of images in the training set
+ * @param testSamples test set
+ * @param numTestSamples number of images in the test set
+ * @return exit code of the program
+*/
+template <class T> int train(const trainingOptions& options, const mnistDataReader& training, uint32_t numTrainingSamples, const mnistDataReader& testSamples, uint32_t numTestSamples)
+{
+
+    //learning rate, AKA eta
+    _Float64 learningRate = 0.0015f;
+    uint32_t stochasticIterations = 60000 * 18;
+
+    network<T> model = buildNetwork<T>(options, options.precision);
+    matrixRandom::sampleSequence samples = makeSampleSequence(options.sampling, numTrainingSamples, options.seed);
+
+    if(options.benchmark)
+    {
+        // every batch size starts from the same weights and sees the same number of samples
+        const network<T> initialNetwork = model;
+        const uint32_t benchmarkSamples = numTrainingSamples * 2;
+        const uint32_t batchSizes[] = {1, 32, 128, 512};
+
+        for(uint32_t benchmarkBatchSize : batchSizes)
+        {
+            network<T> benchmarkNetwork = initialNetwork;
+
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            if(benchmarkBatchSize == 1)
+            {
+                trainSingleSample(benchmarkNetwork, training, benchmarkSamples, learningRate, nullptr, options.prefetch, samples);
+            }
+            else
+            {
+                trainMiniBatch(benchmarkNetwork, training, benchmarkSamples, benchmarkBatchSize, learningRate, nullptr, options.prefetch, samples);
+            }
+            std::chrono::steady_clock::time_point stop = std::chrono::steady_clock::now();
+
+            const _Float64 seconds = std::chrono::duration<_Float64>(stop - start).count();
+            const uint32_t samplesTrained = (benchmarkSamples / benchmarkBatchSize) * benchmarkBatchSize;
+            const _Float64 accuracy = evaluate(benchmarkNetwork, testSamples, options.evalBatchSize, options.evalThreads).accuracy;
+            std::cout<<"batch size "<<benchmarkBatchSize<<": "<<(samplesTrained / seconds)<<" samples/s, accuracy "<<accuracy<<"% after "<<samplesTrained<<" samples"<<std::endl;
+        }
+        return 0;
+    }
+
+    if(options.hogwildBenchmark)
+    {
+        // every thread count starts from the same weights and sees the same number of samples
+        const network<T> initialNetwork = model;
+        const uint32_t benchmarkSamples = numTrainingSamples * 2;
+        const uint32_t threadCounts[] = {1, 2, 4, 8, 16, 32};
+
+        std::cout<<"hardware threads: "<<std::thread::hardware_concurrency()<<std::endl;
+        for(uint32_t benchmarkThreads : threadCounts)
+        {
+            network<T> benchmarkNetwork = initialNetwork;
+
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            trainHogwild(benchmarkNetwork, training, numTrainingSamples, benchmarkSamples, learningRate, benchmarkThreads, options.seed, options.sampling);
+            std::chrono::steady_clock::time_point stop = std::chrono::steady_clock::now();
+
+            const _Float64 seconds = std::chrono::duration<_Float64>(stop - start).count();
+            const _Float64 accuracy = evaluate(benchmarkNetwork, testSamples, options.evalBatchSize, options.evalThreads).accuracy;
+            std::cout<<"threads "<<benchmarkThreads<<": "<<(benchmarkSamples / seconds)<<" samples/s, accuracy "<<accuracy<<"% after "<<benchmarkSamples<<" samples"<<std::endl;
+        }
+        return 0;
+    }
+
+    // prints from a thread of its own, the training loops only hand it their
+    // costs. Hogwild has several training threads and the ring takes one
+    std::unique_ptr<trainingTelemetry> telemetry;
+    if((options.telemetryInterval > 0) && ((options.numThreads == 1) || options.dataParallel))
+    {
+        telemetry = std::make_unique<trainingTelemetry>(std::cout, std::chrono::milliseconds(options.telemetryInterval), options.telemetryOutput);
+    }
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    _Float64 totalCost = 0.0f;
+    if(options.dataParallel)
+    {
+        totalCost = trainDataParallel(model, training, stochasticIterations, options.batchSize, options.numShards, learningRate, telemetry.get(), samples);
+    }
+    else if(options.numThreads > 1)
+    {
+        totalCost = trainHogwild(model, training, numTrainingSamples, stochasticIterations, learningRate, options.numThreads, options.seed, options.sampling);
+    }
+    else if(options.batchSize == 1)
+    {
+        totalCost = trainSingleSample(model, training, stochasticIterations, learningRate, telemetry.get(), options.prefetch, samples);
+    }
+    else
+    {
+        totalCost = trainMiniBatch(model, training, stochasticIterations, options.batchSize, learningRate, telemetry.get(), options.prefetch, samples);
+    }
+    std::chrono::steady_clock::time_point stop = std::chrono::steady_clock::now();
+    if(telemetry)
+    {
+        telemetry->stop();
+        if(telemetry->getDropped() > 0)
+        {
+            std::cout<<"telemetry dropped "<<telemetry->getDropped()<<" of "<<(telemetry->getDropped() + telemetry->getAggregated())<<" records, its ring was full"<<std::endl;
+        }
+    }
+
+    // Then consider the average cost over the training examples.
+    std::cout<<"average cost is: " << totalCost/((_Float64)numTrainingSamples)<<std::endl;
+    std::cout<<"training the network took "<<std::chrono::duration_cast<std::chrono::minutes>(stop - start).count()<<" minutes, "<<(stochasticIterations / std::chrono::duration<_Float64>(stop - start).count())<<" samples/s"<<std::endl;
+
+    std::cout<<"seed "<<options.seed<<", precision "<<trainingPrecisionName(options.precision)<<", network checksum "<<std::hex<<model.checksum()<<std::dec<<std::endl;
+
+    const evaluationResult evaluation = evaluate(model, testSamples, options.evalBatchSize, options.evalThreads);
+
+    std::cout<<"After "<<stochasticIterations<<" training iterations, with learning rate "<<learningRate<<", batch size "<<options.batchSize<<" and "<<options.numThreads<<" threads, the network has classified "<<evaluation.wrong<<" images wrong out of "<<evaluation.numImages<<", with an accuracy of "<<evaluation.accuracy<<"%"<<std::endl;
+    printEvaluation(evaluation, options.evalBatchSize);
+
+    // the checkpoint records how the pixels were normalized, --load applies it
+    const mnistNormalization& normalization = training.getNormalization();
+    if(!options.savePath.empty() && saveCheckpoint(model, options.savePath, normalization.offset, normalization.scale))
+    {
+        std::cout<<"saved the network to "<<options.savePath<<std::endl;
+    }
+
+    if(options.quantize)
+    {
+        compareQuantized(model, training, numTrainingSamples, testSamples, numTestSamples);
+    }
 
     return 0;
 }
+
+/**
+ * @brief map a saved network and test it instead of training one
+ * @param options command line options
+ * @param training training set, calibrates --quantize
+ * @param numTrainingSamples number of images in the training set
+ * @param testSamples test set
+ * @param numTestSamples number of images in the test set
+ * @return exit code of the program
+*/
+template <class T> int evaluateCheckpoint(const trainingOptions& options, const mnistDataReader& training, uint32_t numTrainingSamples, const mnistDataReader& testSamples, uint32_t numTestSamples)
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::unique_ptr<mappedNetwork<T>> loaded = loadCheckpoint<T>(options.loadPath);
+    std::chrono::steady_clock::time_point stop = std::chrono::steady_clock::now();
+    if(!loaded)
+    {
+        return 1;
+    }
+    network<T>& model = loaded->model();
+
+    std::cout<<"mapped "<<options.loadPath<<", "<<loaded->getMappedBytes()<<" bytes, in "<<std::chrono::duration<_Float64, std::milli>(stop - start).count()<<" ms, network checksum "
+             <<std::hex<<model.checksum()<<std::dec<<std::endl;
+
+    const evaluationResult evaluation = evaluate(model, testSamples, options.evalBatchSize, options.evalThreads);
+    std::cout<<"the network has classified "<<evaluation.wrong<<" images wrong out of "<<evaluation.numImages<<", with an accuracy of "<<evaluation.accuracy<<"%"<<std::endl;
+    printEvaluation(evaluation, options.evalBatchSize);
+
+    if(options.quantize)
+    {
+        compareQuantized(model, training, numTrainingSamples, testSamples, numTestSamples);
+    }
+    return 0;
+}
+
+/**
+ * usage: neuralNetFromScratch [--layers L] [--activations H,O] [--precision P] [--batch-size B] [--threads N] [--data-parallel [--shards S]] [--seed S]
+ *                             [--eval-batch-size B] [--eval-threads N] [--save PATH | --load PATH] [--quantize] [--telemetry-interval MS] [--telemetry-format F] [--normalize N [--pixel-cache]] [--prefetch D [--loader-threads N]] [--sampling S] [--init I] [--benchmark | --hogwild-benchmark | --precision-benchmark]
+ *
+ * --layers L             neurons per layer, comma separated, input layer first.
+ *                        Has to start at 784 and end at 10, default 784,16,16,10
+ * --activations H,O      activation function of the hidden layers and of the
+ *                        output layer, sigmoid, tanh, relu, leakyRelu or
+ *                        softmax, default sigmoid,sigmoid
+ * --precision P          double (the default), float, mixed (float with double
+ *                        accumulators) or bf16 (mixed with bfloat16 weights in
+ *                        the forward pass, not with Hogwild threads)
+ * --batch-size B         train on mini-batches of B samples, 1 (the default)
+ *                        trains one sample at a time
+ * --threads N            with a batch size of 1, train on N threads sharing the
+ *                        network, Hogwild style, see trainHogwild. With
+ *                        --data-parallel, the threads computing the shards
+ * --data-parallel        synchronous data parallel mini-batch training that
+ *                        gives the same weights for a seed at any thread count,
+ *                        see trainDataParallel
+ * --shards S             slices per mini-batch with --data-parallel, default 8.
+ *                        Changes the result, the thread count does not
+ * --seed S               seed of the weights and of the sample order, default
+ *                        the current time
+ * --eval-batch-size B    test images per forward pass when evaluating, default
+ *                        100
+ * --eval-threads N       shards the test set is cut into when evaluating,
+ *                        default one per thread of the pool, see evaluate
+ * --save PATH            after training, write the network to a checkpoint
+ *                        file, see checkpoint.h
+ * --load PATH            do not train, map the network saved in a checkpoint
+ *                        and test it. Its topology and precision override
+ *                        --layers, --activations and --precision
+ * --quantize             after training, quantize the network to int8 and
+ *                        compare accuracy, model size and inference speed
+ *                        with the float network, see quantizedNetwork.h
+ * --telemetry-interval MS
+ *                        print a summary of the training cost every MS
+ *                        milliseconds, default 1000, 0 for none. Not with
+ *                        Hogwild threads, see telemetry.h
+ * --telemetry-format F   text (the default) or json, one object per line
+ * --normalize N          none (the default) feeds the network the raw 0 to
+ *                        255 pixels, unit scales them to [0, 1] and standard
+ *                        to mean 0 and standard deviation 1 over the training
+ *                        set. --load normalizes like the checkpoint says and
+ *                        refuses an N that disagrees with it
+ * --pixel-cache          with --normalize, keep the normalized pixels in a
+ *                        file next to each dataset that later runs map
+ * --prefetch D           load up to D batches ahead of the single sample and
+ *                        mini-batch trainers on threads of their own, default
+ *                        0 loads them in the training loop. The same samples
+ *                        either way, see batchLoader.h
+ * --loader-threads N     threads loading batches with --prefetch, default 1
+ * --sampling S           replacement (the default) picks every sample at
+ *                        random, epoch goes through the training set once per
+ *                        epoch in a shuffled order. Hogwild threads draw
+ *                        streams of their own or take disjoint slices of
+ *                        every epoch
+ * --init I               uniform (the default) draws the weights and biases
+ *                        from [-0.5, 0.5], xavier and he scale the weights to
+ *                        each layer and zero the biases, see denseLayer.h
+ * --benchmark            train the same network for a fixed number of samples
+ *                        at B = 1, 32, 128 and 512 and report samples per
+ *                        second and accuracy for each
+ * --hogwild-benchmark    the same at 1, 2, 4, 8, 16 and 32 Hogwild threads
+ * --precision-benchmark  the same in every precision at the batch size given,
+ *                        with the accuracy change and speedup against double
+ */
+int main(int argc, char* argv[])
+{
+    trainingOptions options;
+    options.seed = static_cast<uint32_t>(time(0));
+    for(int iIter = 1; iIter < argc; iIter++)
+    {
+        if((std::strcmp(argv[iIter], "--layers") == 0) && (iIter + 1 < argc))
+        {
+            options.layerSizes.clear();
+            std::stringstream sizes(argv[++iIter]);
+            for(std::string size; std::getline(sizes, size, ',');)
+            {
+                options.layerSizes.push_back(static_cast<uint32_t>(std::stoul(size)));
+            }
+        }
+        else if((std::strcmp(argv[iIter], "--activations") == 0) && (iIter + 1 < argc))
+        {
+            const std::string names(argv[++iIter]);
+            const std::size_t comma = names.find(',');
+            if((comma == std::string::npos) || !parseActivation(names.substr(0, comma), options.hiddenActivation) || !parseActivation(names.substr(comma + 1), options.outputActivation))
+            {
+                std::cout<<"--activations takes two of sigmoid, tanh, relu, leakyRelu and softmax, like relu,softmax"<<std::endl;
+                return 1;
+            }
+        }
+        else if((std::strcmp(argv[iIter], "--precision") == 0) && (iIter + 1 < argc))
+        {
+            if(!parsePrecision(argv[++iIter], options.precision))
+            {
+                std::cout<<"--precision takes double, float, mixed or bf16"<<std::endl;
+                return 1;
+            }
+        }
+        else if((std::strcmp(argv[iIter], "--batch-size") == 0) && (iIter + 1 < argc))
+        {
+            options.batchSize = static_cast<uint32_t>(std::stoul(argv[++iIter]));
+        }
+        else if((std::strcmp(argv[iIter], "--threads") == 0) && (iIter + 1 < argc))
+        {
+            options.numThreads = static_cast<uint32_t>(std::stoul(argv[++iIter]));
+        }
+        else if((std::strcmp(argv[iIter], "--shards") == 0) && (iIter + 1 < argc))
+        {
+            options.numShards = static_cast<uint32_t>(std::stoul(argv[++iIter]));
+        }
+        else if((std::strcmp(argv[iIter], "--seed") == 0) && (iIter + 1 < argc))
+        {
+            options.seed = static_cast<uint32_t>(std::stoul(argv[++iIter]));
+        }
+        else if(std::strcmp(argv[iIter], "--data-parallel") == 0)
+        {
+            options.dataParallel = true;
+        }
+        else if((std::strcmp(argv[iIter], "--eval-batch-size") == 0) && (iIter + 1 < argc))
+        {
+            options.evalBatchSize = static_cast<uint32_t>(std::stoul(argv[++iIter]));
+        }
+        else if((std::strcmp(argv[iIter], "--eval-threads") == 0) && (iIter + 1 < argc))
+        {
+            options.evalThreads = static_cast<uint32_t>(std::stoul(argv[++iIter]));
+        }
+        else if((std::strcmp(argv[iIter], "--save") == 0) && (iIter + 1 < argc))
+        {
+            options.savePath = argv[++iIter];
+        }
+        else if((std::strcmp(argv[iIter], "--load") == 0) && (iIter + 1 < argc))
+        {
+            options.loadPath = argv[++iIter];
+        }
+        else if((std::strcmp(argv[iIter], "--telemetry-interval") == 0) && (iIter + 1 < argc))
+        {
+            options.telemetryInterval = static_cast<uint32_t>(std::stoul(argv[++iIter]));
+        }
+        else if((std::strcmp(argv[iIter], "--telemetry-format") == 0) && (iIter + 1 < argc))
+        {
+            const std::string format(argv[++iIter]);
+            if((format != "text") && (format != "json"))
+            {
+                std::cout<<"--telemetry-format takes text or json"<<std::endl;
+                return 1;
+            }
+            options.telemetryOutput = (format == "json") ? telemetryFormat::json : telemetryFormat::text;
+        }
+        else if((std::strcmp(argv[iIter], "--normalize") == 0) && (iIter + 1 < argc))
+        {
+            const std::string normalization(argv[++iIter]);
+            const char* names[] = {"none", "unit", "standard"};
+            const auto found = std::find(std::begin(names), std::end(names), normalization);
+            if(found == std::end(names))
+            {
+                std::cout<<"--normalize takes none, unit or standard"<<std::endl;
+                return 1;
+            }
+            options.normalization = static_cast<pixelNormalization>(found - std::begin(names));
+            options.normalizationGiven = true;
+        }
+        else if(std::strcmp(argv[iIter], "--pixel-cache") == 0)
+        {
+            options.pixelCache = true;
+        }
+        else if((std::strcmp(argv[iIter], "--sampling") == 0) && (iIter + 1 < argc))
+        {
+            const std::string sampling(argv[++iIter]);
+            const char* names[] = {"replacement", "epoch"};
+            const auto found = std::find(std::begin(names), std::end(names), sampling);
+            if(found == std::end(names))
+            {
+                std::cout<<"--sampling takes replacement or epoch"<<std::endl;
+                return 1;
+            }
+            options.sampling = static_cast<sampleOrder>(found - std::begin(names));
+        }
+        else if((std::strcmp(argv[iIter], "--init") == 0) && (iIter + 1 < argc))
+        {
+            const std::string initialization(argv[++iIter]);
+            // in the order of weightInitialization
+            const char* names[] = {"xavier", "he", "uniform"};
+            const auto found = std::find(std::begin(names), std::end(names), initialization);
+            if(found == std::end(names))
+            {
+                std::cout<<"--init takes uniform, xavier or he"<<std::endl;
+                return 1;
+            }
+            options.initialization = static_cast<weightInitialization>(found - std::begin(names));
+        }
+        else if((std::strcmp(argv[iIter], "--prefetch") == 0) && (iIter + 1 < argc))
+        {
+            options.prefetch.depth = static_cast<uint32_t>(std::stoul(argv[++iIter]));
+        }
+        else if((std::strcmp(argv[iIter], "--loader-threads") == 0) && (iIter + 1 < argc))
+        {
+            options.prefetch.numThreads = static_cast<uint32_t>(std::stoul(argv[++iIter]));
+        }
+        else if(std::strcmp(argv[iIter], "--quantize") == 0)
+        {
+            options.quantize = true;
+        }
+        else if(std::strcmp(argv[iIter], "--benchmark") == 0)
+        {
+            options.benchmark = true;
+        }
+        else if(std::strcmp(argv[iIter], "--hogwild-benchmark") == 0)
+        {
+            options.hogwildBenchmark = true;
+        }
+        else if(std::strcmp(argv[iIter], "--precision-benchmark") == 0)
+        {
+            options.precisionBenchmark = true;
+        }
+        else
+        {
+            std::cout<<"usage: "<<argv[0]<<" [--layers L] [--activations H,O] [--precision P] [--batch-size B] [--threads N] [--data-parallel [--shards S]] [--seed S] [--eval-batch-size B] [--eval-threads N] [--save PATH | --load PATH] [--quantize] [--telemetry-interval MS] [--telemetry-format F] [--normalize N [--pixel-cache]] [--prefetch D [--loader-threads N]] [--sampling S] [--init I] [--benchmark | --hogwild-benchmark | --precision-benchmark]"<<std::endl;
+            return 1;
+        }
+    }
+    if((options.layerSizes.size() < 2) || (options.layerSizes.front() != 784) || (options.layerSizes.back() != 10) || (std::count(options.layerSizes.begin(), options.layerSizes.end(), 0u) > 0))
+    {
+        std::cout<<"--layers has to start at 784 inputs, end at 10 outputs and have no empty layers"<<std::endl;
+        return 1;
+    }
+    if((options.batchSize == 0) || (options.numThreads == 0) || (options.numShards == 0) || (options.evalBatchSize == 0) || (options.prefetch.numThreads == 0))
+    {
+        std::cout<<"batch sizes, threads, loader threads and shards must be at least 1"<<std::endl;
+        return 1;
+    }
+    if((options.batchSize > 1) && (options.numThreads > 1) && !options.dataParallel)
+    {
+        std::cout<<"Hogwild threads train one sample at a time, use --data-parallel to train mini-batches on several threads"<<std::endl;
+        return 1;
+    }
+    // every Hogwild worker would round the whole shared weight matrix into the
+    // one bfloat16 copy after every sample, a racing full pass per step that
+    // costs more than the bfloat16 forward pass saves
+    if((options.precision == trainingPrecision::bf16) && (options.hogwildBenchmark || ((options.numThreads > 1) && !options.dataParallel)))
+    {
+        std::cout<<"bf16 does not train with Hogwild threads, use --data-parallel or another precision"<<std::endl;
+        return 1;
+    }
+    if(!options.savePath.empty() && !options.loadPath.empty())
+    {
+        std::cout<<"--load tests a saved network without training, there is nothing to --save"<<std::endl;
+        return 1;
+    }
+    if(options.dataParallel && (options.numShards > options.batchSize))
+    {
+        std::cout<<"--shards can not be more than the batch size"<<std::endl;
+        return 1;
+    }
+
+    // matrices filled without a seed of their own repeat with the run's seed
+    matrixRandom::setDefaultSeed(options.seed);
+
+    // the data parallel shards run on the pool, sized once here while nothing
+    // else uses it yet
+    if(options.dataParallel)
+    {
+        threadPool::instance().setNumThreads(options.numThreads);
+    }
+
+    uint32_t numTestSamples = 10000;
+    uint32_t numTrainingSamples = 60000;
+    // the images are views into the mapped files, training picks them at
+    // random and testing reads them in order
+    mnistDataReader training("mnistDataset/train-images.idx3-ubyte", "mnistDataset/train-labels.idx1-ubyte", numTrainingSamples, mnistLoadMode::mapped);
+    mnistDataReader testSamples("mnistDataset/t10k-images.idx3-ubyte", "mnistDataset/t10k-labels.idx1-ubyte", numTestSamples, mnistLoadMode::mapped);
+    training.adviseAccess(mnistAccessPattern::random);
+    testSamples.adviseAccess(mnistAccessPattern::sequential);
+
+    mnistNormalization normalization;
+    if(options.normalization != pixelNormalization::none)
+    {
+        normalization = (options.normalization == pixelNormalization::unit) ? mnistDataReader::unitNormalization() : training.standardization();
+    }
+
+    // a saved network is fed the pixels it was trained on
+    checkpointHeader header;
+    if(!options.loadPath.empty())
+    {
+        if(!readCheckpointHeader(options.loadPath, header))
+        {
+            return 1;
+        }
+        if(options.normalizationGiven && ((header.inputOffset != normalization.offset) || (header.inputScale != normalization.scale)))
+        {
+            std::cout<<options.loadPath<<" was trained on pixels normalized as (pixel - "<<header.inputOffset<<") * "<<header.inputScale
+                     <<", --normalize gives (pixel - "<<normalization.offset<<") * "<<normalization.scale<<std::endl;
+            return 1;
+        }
+        normalization.offset = header.inputOffset;
+        normalization.scale = header.inputScale;
+    }
+
+    // the test set is normalized like the training set
+    if((normalization.offset != 0.0f) || (normalization.scale != 1.0f))
+    {
+        training.cacheNormalized(normalization, options.pixelCache ? "mnistDataset/train-images.normalized" : "");
+        testSamples.cacheNormalized(normalization, options.pixelCache ? "mnistDataset/t10k-images.normalized" : "");
+        std::cout<<"pixels normalized as (pixel - "<<normalization.offset<<") * "<<normalization.scale<<std::endl;
+    }
+
+    if(!options.loadPath.empty())
+    {
+        if(header.elementType == static_cast<uint32_t>(checkpointElementType::float64))
+        {
+            return evaluateCheckpoint<_Float64>(options, training, numTrainingSamples, testSamples, numTestSamples);
+        }
+        return evaluateCheckpoint<float>(options, training, numTrainingSamples, testSamples, numTestSamples);
+    }
+
+    if(options.precisionBenchmark)
+    {
+        // every precision starts from the same weights, rounded, and sees the same samples
+        const uint32_t benchmarkSamples = numTrainingSamples * 2;
+        const _Float64 learningRate = 0.0015f;
+        benchmarkResult reference;
+        for(uint32_t pIter = 0; pIter <= static_cast<uint32_t>(trainingPrecision::bf16); pIter++)
+        {
+            const trainingPrecision precision = static_cast<trainingPrecision>(pIter);
+            const benchmarkResult result = (precision == trainingPrecision::float64) ?
+                benchmarkPrecision<_Float64>(options, precision, training, numTrainingSamples, benchmarkSamples, learningRate, testSamples) :
+                benchmarkPrecision<float>(options, precision, training, numTrainingSamples, benchmarkSamples, learningRate, testSamples);
+            if(precision == trainingPrecision::float64)
+            {
+                reference = result;
+            }
+            std::cout<<trainingPrecisionName(precision)<<": "<<result.samplesPerSecond<<" samples/s ("<<(result.samplesPerSecond / reference.samplesPerSecond)<<"x double), accuracy "
+                     <<result.accuracy<<"% ("<<std::showpos<<(result.accuracy - reference.accuracy)<<std::noshowpos<<" points) after "<<benchmarkSamples<<" samples at batch size "<<options.batchSize<<std::endl;
+        }
+        return 0;
+    }
+
+    if(options.precision == trainingPrecision::float64)
+    {
+        return train<_Float64>(options, training, numTrainingSamples, testSamples, numTestSamples);
+    }
+    return train<float>(options, training, numTrainingSamples, testSamples, numTestSamples);
+}
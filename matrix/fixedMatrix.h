@@ -0,0 +1,479 @@
+/**
+ * Fixed size matrix library. Matrices whose shape is known at compile time.
+ * Copyright (C) 2024  Matthew Hardenburgh, matthew@hardenburgh.io
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef FIXED_MATRIX_H
+#define FIXED_MATRIX_H
+
+#include "matrix.h"
+
+#include <stdint.h>
+#include <cstddef>
+#include <cassert>
+#include <iostream>
+#include <new>
+#include <type_traits>
+
+/*
+ * fixedMatrix<T, Rows, Columns> is the compile time sized sibling of
+ * matrix<T>. The shape is part of the type, so
+ *
+ *     fixedMatrix<_Float64, 10, 16> W;
+ *     fixedMatrix<_Float64, 16, 1> x;
+ *     auto z = fixedMatrix<_Float64, 10, 1>::matrixMultiplication(W, x); // ok
+ *     auto y = fixedMatrix<_Float64, 10, 1>::add(z, x);                  // does not compile
+ *
+ * and every loop has a constant trip count the compiler can fully unroll.
+ * Matrices up to m_inlineStorageLimit bytes keep their data inline (on the
+ * stack for locals), larger ones use aligned heap storage so a 16x784 layer
+ * does not blow the stack.
+ *
+ * fixedMatrix is a matrixExpression, so it mixes with matrix<T> in
+ * element-wise expressions (checked at run time), and it converts to and from
+ * matrix<T> with toMatrix() and the matrix<T> constructor.
+ */
+
+/**
+ * @brief storage of a fixedMatrix, inline array for small matrices
+*/
+template <class T, std::size_t size, bool isInline> class fixedStorage
+{
+    public:
+        T* data()
+        {
+            return m_data;
+        }
+
+        const T* data() const
+        {
+            return m_data;
+        }
+
+    private:
+        alignas(matrix<T>::m_alignment) T m_data[size];
+};
+
+/**
+ * @brief storage of a fixedMatrix, aligned heap buffer for large matrices
+*/
+template <class T, std::size_t size> class fixedStorage<T, size, false>
+{
+    public:
+        fixedStorage()
+        {
+            m_data = static_cast<T*>(::operator new[](sizeof(T) * size, std::align_val_t(matrix<T>::m_alignment)));
+        }
+
+        fixedStorage(const fixedStorage& other) : fixedStorage()
+        {
+            for(std::size_t iIter = 0; iIter < size; iIter++)
+            {
+                m_data[iIter] = other.m_data[iIter];
+            }
+        }
+
+        fixedStorage(fixedStorage&& other) noexcept
+        {
+            m_data = other.m_data;
+            other.m_data = nullptr;
+        }
+
+        ~fixedStorage()
+        {
+            if(m_data != nullptr)
+            {
+                ::operator delete[](m_data, std::align_val_t(matrix<T>::m_alignment));
+            }
+        }
+
+        fixedStorage& operator=(const fixedStorage& other)
+        {
+            if(this != &other)
+            {
+                for(std::size_t iIter = 0; iIter < size; iIter++)
+                {
+                    m_data[iIter] = other.m_data[iIter];
+                }
+            }
+            return *this;
+        }
+
+        fixedStorage& operator=(fixedStorage&& other) noexcept
+        {
+            if(this != &other)
+            {
+                T* temp = m_data;
+                m_data = other.m_data;
+                other.m_data = temp;
+            }
+            return *this;
+        }
+
+        T* data()
+        {
+            return m_data;
+        }
+
+        const T* data() const
+        {
+            return m_data;
+        }
+
+    private:
+        T* m_data = nullptr;
+};
+
+template <class T, uint32_t Rows, uint32_t Columns> class fixedMatrix;
+
+/**
+ * @brief true for any fixedMatrix type
+*/
+template <class E> struct isFixedMatrix : std::false_type {};
+template <class T, uint32_t Rows, uint32_t Columns> struct isFixedMatrix<fixedMatrix<T, Rows, Columns>> : std::true_type {};
+
+template <class T, uint32_t Rows, uint32_t Columns> class fixedMatrix : public matrixExpression<fixedMatrix<T, Rows, Columns>>
+{
+    static_assert((Rows > 0) && (Columns > 0), "a fixedMatrix needs at least one row and one column");
+
+    public:
+        /**
+         * @brief element type, used by the expression templates
+        */
+        using valueType = T;
+
+        static constexpr uint32_t m_rows = Rows;
+        static constexpr uint32_t m_columns = Columns;
+        static constexpr uint32_t m_size = Rows * Columns;
+        /**
+         * @brief matrices up to this many bytes store their data inline
+        */
+        static constexpr std::size_t m_inlineStorageLimit = 4096;
+
+        /**
+         * @brief creates an uninitialized Rows by Columns matrix
+        */
+        fixedMatrix()
+        {
+
+        }
+        /**
+         * @brief creates a matrix filled with data
+         * @param data array containing Rows * Columns values, row major
+        */
+        explicit fixedMatrix(const T* data)
+        {
+            if(data == nullptr)
+            {
+                std::cout<<__PRETTY_FUNCTION__<<": data is nullptr!!!!"<<std::endl;
+                assert(false);
+                return;
+            }
+
+            for(uint32_t iIter = 0; iIter < m_size; iIter++)
+            {
+                m_storage.data()[iIter] = data[iIter];
+            }
+        }
+        /**
+         * @brief creates a fixed matrix from a dynamic one, shapes must match
+         * @param other the matrix you are copying from
+        */
+        explicit fixedMatrix(const matrix<T>& other)
+        {
+            if((other.getNumRows() != Rows) || (other.getNumColumns() != Columns))
+            {
+                std::cout<<__PRETTY_FUNCTION__<<": matrix is "<<other.getNumRows()<<"x"<<other.getNumColumns()<<" but fixedMatrix is "<<Rows<<"x"<<Columns<<"!!!!"<<std::endl;
+                assert(false);
+                return;
+            }
+
+            for(uint32_t iIter = 0; iIter < m_size; iIter++)
+            {
+                m_storage.data()[iIter] = other.evaluate(iIter);
+            }
+        }
+        /**
+         * @brief creates a matrix by evaluating an element-wise expression
+         * @details a fixedMatrix of another shape is not an expression this 
+         *          converts from, so shape mismatches stay compile errors
+         * @param expression the expression to evaluate, must be Rows by Columns
+        */
+        template <class E, typename std::enable_if<!isFixedMatrix<E>::value, int>::type = 0> fixedMatrix(const matrixExpression<E>& expression)
+        {
+            *this = expression;
+        }
+
+        /**
+         * @brief copy into a dynamically sized matrix
+         * @return a matrix<T> with the same shape and data
+        */
+        matrix<T> toMatrix() const
+        {
+            matrix<T> result(Rows, Columns);
+            T* data = result.data();
+            for(uint32_t iIter = 0; iIter < m_size; iIter++)
+            {
+                data[iIter] = m_storage.data()[iIter];
+            }
+            return result;
+        }
+
+        constexpr uint32_t getNumRows() const
+        {
+            return Rows;
+        }
+        constexpr uint32_t getNumColumns() const
+        {
+            return Columns;
+        }
+
+        T* data()
+        {
+            return m_storage.data();
+        }
+        const T* data() const
+        {
+            return m_storage.data();
+        }
+
+        /**
+         * @brief Get value at row, column
+         * @param row row position of the matrix
+         * @param column column position of the matrix
+         * @return data accessed at the row, column position
+        */
+        T at(const uint32_t& row, const uint32_t& column) const
+        {
+            assert((row < Rows) && (column < Columns));
+            return m_storage.data()[(row * Columns) + column];
+        }
+        /**
+         * @brief get value at specific index
+         * @param index Index of the matrix you want to retrieve the value from
+         * @return data accessed at the index of the matrix
+        */
+        T at(const uint32_t& index) const
+        {
+            assert(index < m_size);
+            return m_storage.data()[index];
+        }
+        /**
+         * @brief unchecked value at a flat index, the leaf of an expression tree
+         * @param index index of the matrix you want to retrieve the value from
+         * @return data at the index of the matrix
+        */
+        T evaluate(const uint32_t& index) const
+        {
+            return m_storage.data()[index];
+        }
+        /**
+         * @brief Assign a value at a specific index in the matrix
+         * @param value value you want to assign
+         * @param index index of where you want to assign that value to
+        */
+        void assign(T value, const uint32_t& index)
+        {
+            assert(index < m_size);
+            m_storage.data()[index] = value;
+        }
+        /**
+         * @brief Assign a value at a specific row and column in the matrix
+         * @param value value you want to assign
+         * @param row row position of where you want to assign that value to
+         * @param column column position of where you want to assign that value to
+        */
+        void assign(T value, const uint32_t& row, const uint32_t& column)
+        {
+            assert((row < Rows) && (column < Columns));
+            m_storage.data()[(row * Columns) + column] = value;
+        }
+
+        /**
+         * @brief fill matrix with a specified value
+         * @param value value to fill each position in the matrix with
+        */
+        void fillNumber(T value)
+        {
+            T* data = m_storage.data();
+            for(uint32_t iIter = 0; iIter < m_size; iIter++)
+            {
+                data[iIter] = value;
+            }
+        }
+        /**
+         * @brief fill matrix with 0s
+        */
+        void fillZeros()
+        {
+            fillNumber(T(0));
+        }
+
+        /**
+         * @brief assign an element-wise expression, evaluated in a single loop
+         * @param expression the expression to evaluate, must be Rows by Columns
+         * @return the matrix you are assigning to
+        */
+        template <class E> fixedMatrix& operator=(const matrixExpression<E>& expression)
+        {
+            const E& tree = expression.self();
+            if((tree.getNumRows() != Rows) || (tree.getNumColumns() != Columns))
+            {
+                std::cout<<__PRETTY_FUNCTION__<<": expression is "<<tree.getNumRows()<<"x"<<tree.getNumColumns()<<" but fixedMatrix is "<<Rows<<"x"<<Columns<<"!!!!"<<std::endl;
+                assert(false);
+                return *this;
+            }
+
+            T* data = m_storage.data();
+            for(uint32_t iIter = 0; iIter < m_size; iIter++)
+            {
+                data[iIter] = tree.evaluate(iIter);
+            }
+            return *this;
+        }
+
+        /**
+         * @brief add two matrices together, C = A + B. Shapes are checked by
+         *        the compiler
+        */
+        static void add(const fixedMatrix& A, const fixedMatrix& B, fixedMatrix& C)
+        {
+            matrixKernels::elementwiseAdd(A.data(), B.data(), C.data(), m_size);
+        }
+        static fixedMatrix add(const fixedMatrix& A, const fixedMatrix& B)
+        {
+            fixedMatrix C;
+            add(A, B, C);
+            return C;
+        }
+        /**
+         * @brief subtract two matrices, C = A - B. Shapes are checked by the
+         *        compiler
+        */
+        static void subtract(const fixedMatrix& A, const fixedMatrix& B, fixedMatrix& C)
+        {
+            matrixKernels::elementwiseSubtract(A.data(), B.data(), C.data(), m_size);
+        }
+        static fixedMatrix subtract(const fixedMatrix& A, const fixedMatrix& B)
+        {
+            fixedMatrix C;
+            subtract(A, B, C);
+            return C;
+        }
+        /**
+         * @brief component-wise product of two matrices, C = A .* B. Shapes
+         *        are checked by the compiler
+        */
+        static void hadamardProduct(const fixedMatrix& A, const fixedMatrix& B, fixedMatrix& C)
+        {
+            matrixKernels::elementwiseMultiply(A.data(), B.data(), C.data(), m_size);
+        }
+        static fixedMatrix hadamardProduct(const fixedMatrix& A, const fixedMatrix& B)
+        {
+            fixedMatrix C;
+            hadamardProduct(A, B, C);
+            return C;
+        }
+        /**
+         * @brief scalar multiplication of a matrix, C = s * A
+        */
+        static void scalarMultiply(const T& scalar, const fixedMatrix& A, fixedMatrix& C)
+        {
+            matrixKernels::elementwiseScale(scalar, A.data(), C.data(), m_size);
+        }
+        static fixedMatrix scalarMultiply(const T& scalar, const fixedMatrix& A)
+        {
+            fixedMatrix C;
+            scalarMultiply(scalar, A, C);
+            return C;
+        }
+        /**
+         * @brief matrix multiplication, C = A * B, with A Rows by K and B K by
+         *        Columns. A K that does not line up does not compile
+         * @details small products are a fully unrollable loop, large ones go
+         *          through the blocked gemm kernel
+        */
+        template <uint32_t K> static void matrixMultiplication(const fixedMatrix<T, Rows, K>& A, const fixedMatrix<T, K, Columns>& B, fixedMatrix& C)
+        {
+            if constexpr ((static_cast<uint64_t>(Rows) * K * Columns) <= matrixKernels::gemmSmallProblemThreshold)
+            {
+                const T* dataA = A.data();
+                const T* dataB = B.data();
+                T* dataC = C.data();
+
+                for(uint32_t iIter = 0; iIter < Rows; iIter++)
+                {
+                    T* rowOfC = dataC + (iIter * Columns);
+                    for(uint32_t jIter = 0; jIter < Columns; jIter++)
+                    {
+                        rowOfC[jIter] = T(0);
+                    }
+                    for(uint32_t kIter = 0; kIter < K; kIter++)
+                    {
+                        const T valueOfA = dataA[(iIter * K) + kIter];
+                        const T* rowOfB = dataB + (kIter * Columns);
+                        for(uint32_t jIter = 0; jIter < Columns; jIter++)
+                        {
+                            rowOfC[jIter] += valueOfA * rowOfB[jIter];
+                        }
+                    }
+                }
+            }
+            else
+            {
+                matrixKernels::gemm<T>(Rows, Columns, K, T(1), A.data(), K, 1, B.data(), Columns, 1, T(0), C.data(), Columns);
+            }
+        }
+        template <uint32_t K> static fixedMatrix matrixMultiplication(const fixedMatrix<T, Rows, K>& A, const fixedMatrix<T, K, Columns>& B)
+        {
+            fixedMatrix C;
+            matrixMultiplication(A, B, C);
+            return C;
+        }
+        /**
+         * @brief transpose a matrix, C = A^T, with A Columns by Rows
+        */
+        static void transpose(const fixedMatrix<T, Columns, Rows>& A, fixedMatrix& C)
+        {
+            for(uint32_t iIter = 0; iIter < Columns; iIter++)
+            {
+                for(uint32_t jIter = 0; jIter < Rows; jIter++)
+                {
+                    C.data()[(jIter * Columns) + iIter] = A.data()[(iIter * Rows) + jIter];
+                }
+            }
+        }
+        static fixedMatrix transpose(const fixedMatrix<T, Columns, Rows>& A)
+        {
+            fixedMatrix C;
+            transpose(A, C);
+            return C;
+        }
+
+    private:
+        fixedStorage<T, m_size, (sizeof(T) * m_size) <= m_inlineStorageLimit> m_storage;
+};
+
+/**
+ * @brief fixed matrices are held by reference inside expression trees, the
+ *        same as matrix<T>
+*/
+template <class T, uint32_t Rows, uint32_t Columns> struct expressionOperand<fixedMatrix<T, Rows, Columns>>
+{
+    using type = const fixedMatrix<T, Rows, Columns>&;
+};
+
+#endif //FIXED_MATRIX_H
@@ -0,0 +1,473 @@
+/**
+ * General matrix multiply kernel. Cache blocked, packed, register tiled.
+ * Copyright (C) 2024  Matthew Hardenburgh, matthew@hardenburgh.io
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef GEMM_KERNEL_H
+#define GEMM_KERNEL_H
+
+#include <stdint.h>
+#include <cstddef>
+#include <vector>
+#include <algorithm>
+#include <cstring>
+
+#include "threadPool.h"
+#include "simdKernels.h"
+#include "precision.h"
+
+/*
+ * The kernel follows the usual Goto/BLIS layering:
+ *
+ *  for each NC wide column panel of B                      (L3 sized)
+ *      for each KC deep slice of K
+ *          pack the KC x NC block of B into NR wide micro-panels
+ *          for each MC tall row panel of A                 (L2 sized)
+ *              pack the MC x KC block of A into MR tall micro-panels
+ *              for each NR micro-panel of B                (L1 sized)
+ *                  for each MR micro-panel of A
+ *                      MR x NR register tile += A micro-panel * B micro-panel
+ *
+ * Packing copies the operands into the exact order the micro-kernel walks
+ * them, so the innermost loop only ever reads two contiguous streams no
+ * matter how A and B are laid out (or transposed) in memory. Partial tiles
+ * are zero padded in the packed buffers, which keeps the micro-kernel free of
+ * edge cases; only the write back to C has to care about the edges.
+ *
+ * A can be stored in a narrower type than the rest (bfloat16 weights with
+ * float everything else), packing widens it on the way into the buffer. With
+ * wide accumulation (see precision.h) float tiles are summed in double and
+ * rounded once per KC slice on the way back to C.
+ *
+ * Big enough products spread the MC x NC tiles of C over the thread pool once
+ * B is packed. Every tile of C is owned by exactly one thread and is summed in
+ * the same order as the serial loop, so the result does not depend on the
+ * thread count.
+ */
+namespace matrixKernels
+{
+    /**
+     * @brief blocking parameters of the gemm kernel for an element type
+     * @details MR x NR is the register tile, NR is one 64 byte cache line of
+     *          B per k step. KC x NR of packed B fits L1, MC x KC of packed A
+     *          fits L2
+    */
+    template <class T> struct gemmBlocking
+    {
+        static constexpr uint32_t mr = 4;
+        static constexpr uint32_t nr = (64 / sizeof(T)) < 4 ? 4 : ((64 / sizeof(T)) > 16 ? 16 : (64 / sizeof(T)));
+        static constexpr uint32_t kc = 256;
+        static constexpr uint32_t mc = 96;
+        static constexpr uint32_t nc = 2048;
+    };
+
+    /**
+     * @brief products with fewer multiply-adds than this skip packing and use
+     *        the straight loop, packing would cost more than it saves
+    */
+    static constexpr uint64_t gemmSmallProblemThreshold = 32 * 32 * 32;
+
+    /**
+     * @brief products with fewer multiply-adds than this stay on the calling
+     *        thread, waking the pool would cost more than it saves
+    */
+    static constexpr uint64_t gemmParallelThreshold = 96 * 96 * 96;
+
+    /**
+     * @brief per-thread scratch used to hold the packed panels, reused between
+     *        calls so the kernel does not allocate in steady state
+    */
+    template <class T> struct gemmScratch
+    {
+        std::vector<T> packedA;
+        std::vector<T> packedB;
+
+        static gemmScratch& local()
+        {
+            thread_local gemmScratch scratch;
+            return scratch;
+        }
+    };
+
+    /**
+     * @brief straight loop C = alpha * A * B + beta * C for small or vector
+     *        shaped problems
+     * @details sums are carried in S. When S is wider than T every element of
+     *          C is one dot product, otherwise the i-k-j loop sums straight
+     *          into C
+    */
+    template <class T, class TA, class S> void gemmSmall(uint32_t M, uint32_t N, uint32_t K, T alpha,
+                                                         const TA* A, ptrdiff_t rowStrideA, ptrdiff_t columnStrideA,
+                                                         const T* B, ptrdiff_t rowStrideB, ptrdiff_t columnStrideB,
+                                                         T beta, T* C, ptrdiff_t ldc)
+    {
+        if((N == 1) || !std::is_same<S, T>::value)
+        {
+            // one dot product per element of C, for N == 1 one per row of A
+            for(uint32_t iIter = 0; iIter < M; iIter++)
+            {
+                const TA* rowOfA = A + (iIter * rowStrideA);
+                for(uint32_t jIter = 0; jIter < N; jIter++)
+                {
+                    const T* columnOfB = B + (jIter * columnStrideB);
+                    S value = 0;
+                    for(uint32_t kIter = 0; kIter < K; kIter++)
+                    {
+                        value += static_cast<S>(static_cast<T>(rowOfA[kIter * columnStrideA])) * static_cast<S>(columnOfB[kIter * rowStrideB]);
+                    }
+                    T& element = C[(iIter * ldc) + jIter];
+                    element = (beta == T(0)) ? static_cast<T>(static_cast<S>(alpha) * value) : static_cast<T>((static_cast<S>(alpha) * value) + (static_cast<S>(beta) * static_cast<S>(element)));
+                }
+            }
+            return;
+        }
+
+        for(uint32_t iIter = 0; iIter < M; iIter++)
+        {
+            T* rowOfC = C + (iIter * ldc);
+            for(uint32_t jIter = 0; jIter < N; jIter++)
+            {
+                rowOfC[jIter] = (beta == T(0)) ? T(0) : beta * rowOfC[jIter];
+            }
+
+            // i-k-j order, the innermost loop streams along a row of B and C
+            for(uint32_t kIter = 0; kIter < K; kIter++)
+            {
+                const T scaledA = alpha * static_cast<T>(A[(iIter * rowStrideA) + (kIter * columnStrideA)]);
+                const T* rowOfB = B + (kIter * rowStrideB);
+                for(uint32_t jIter = 0; jIter < N; jIter++)
+                {
+                    rowOfC[jIter] += scaledA * rowOfB[jIter * columnStrideB];
+                }
+            }
+        }
+    }
+
+    /**
+     * @brief pack an mc x kc block of A into MR tall micro-panels, zero padded
+     * @details packed layout is panel by panel, within a panel k major so the
+     *          micro-kernel reads MR consecutive values per k step
+    */
+    template <class T, class TA> void packA(uint32_t mc, uint32_t kc, const TA* A, ptrdiff_t rowStrideA, ptrdiff_t columnStrideA, T* packed)
+    {
+        constexpr uint32_t mr = gemmBlocking<T>::mr;
+
+        for(uint32_t iPanel = 0; iPanel < mc; iPanel += mr)
+        {
+            const uint32_t rowsInPanel = std::min(mr, mc - iPanel);
+            for(uint32_t kIter = 0; kIter < kc; kIter++)
+            {
+                for(uint32_t iIter = 0; iIter < mr; iIter++)
+                {
+                    *packed++ = (iIter < rowsInPanel) ? static_cast<T>(A[((iPanel + iIter) * rowStrideA) + (kIter * columnStrideA)]) : T(0);
+                }
+            }
+        }
+    }
+
+    /**
+     * @brief pack a kc x nc block of B into NR wide micro-panels, zero padded
+     * @details packed layout is panel by panel, within a panel k major so the
+     *          micro-kernel reads NR consecutive values per k step
+    */
+    template <class T> void packB(uint32_t kc, uint32_t nc, const T* B, ptrdiff_t rowStrideB, ptrdiff_t columnStrideB, T* packed)
+    {
+        constexpr uint32_t nr = gemmBlocking<T>::nr;
+
+        for(uint32_t jPanel = 0; jPanel < nc; jPanel += nr)
+        {
+            const uint32_t columnsInPanel = std::min(nr, nc - jPanel);
+            for(uint32_t kIter = 0; kIter < kc; kIter++)
+            {
+                const T* rowOfB = B + (kIter * rowStrideB) + (jPanel * columnStrideB);
+                for(uint32_t jIter = 0; jIter < nr; jIter++)
+                {
+                    *packed++ = (jIter < columnsInPanel) ? rowOfB[jIter * columnStrideB] : T(0);
+                }
+            }
+        }
+    }
+
+    /**
+     * @brief MR x NR register tile, C = alpha * packedA * packedB + beta * C
+     * @details the accumulator tile lives in registers for the whole kc loop,
+     *          only the m x n valid corner of it is written back to C. The
+     *          body is written once and inlined into one function per
+     *          instruction set below. The tile is carried in S, T itself or
+     *          wideAccumulator<T>.
+     *
+     *          For float and double every row of the tile is held in GCC
+     *          vectors of vectorBytes each, the register width of the target
+     *          the body is inlined into. Left to itself the vectorizer picks
+     *          the k loop for float instead and transposes packed B on every
+     *          step. The vectors do the same multiply and add per element as
+     *          the plain loop, so the rounding is the same
+    */
+    template <class T, class S, uint32_t vectorBytes> __attribute__((always_inline)) inline void gemmMicroKernelBody(uint32_t kc, const T* packedA, const T* packedB, uint32_t m, uint32_t n, T alpha, T beta, T* C, ptrdiff_t ldc)
+    {
+        constexpr uint32_t mr = gemmBlocking<T>::mr;
+        constexpr uint32_t nr = gemmBlocking<T>::nr;
+
+        S accumulator[mr][nr] = {};
+
+        if constexpr (!std::is_void<typename simdType<T>::type>::value && !std::is_void<typename simdType<S>::type>::value)
+        {
+            using packedElement = typename simdType<T>::type;
+            using accumulatorElement = typename simdType<S>::type;
+            constexpr uint32_t lanes = vectorBytes / sizeof(accumulatorElement);
+            constexpr uint32_t parts = nr / lanes;
+            typedef packedElement packedVector __attribute__((vector_size(lanes * sizeof(packedElement))));
+            typedef accumulatorElement accumulatorVector __attribute__((vector_size(lanes * sizeof(accumulatorElement))));
+
+            accumulatorVector rows[mr][parts] = {};
+            for(uint32_t kIter = 0; kIter < kc; kIter++)
+            {
+                accumulatorVector rowOfB[parts];
+                for(uint32_t pIter = 0; pIter < parts; pIter++)
+                {
+                    packedVector part;
+                    std::memcpy(&part, packedB + (pIter * lanes), sizeof(part));
+                    rowOfB[pIter] = __builtin_convertvector(part, accumulatorVector);
+                }
+                for(uint32_t iIter = 0; iIter < mr; iIter++)
+                {
+                    const accumulatorElement valueOfA = static_cast<accumulatorElement>(packedA[iIter]);
+                    for(uint32_t pIter = 0; pIter < parts; pIter++)
+                    {
+                        rows[iIter][pIter] += valueOfA * rowOfB[pIter];
+                    }
+                }
+                packedA += mr;
+                packedB += nr;
+            }
+            std::memcpy(accumulator, rows, sizeof(accumulator));
+        }
+        else
+        {
+            for(uint32_t kIter = 0; kIter < kc; kIter++)
+            {
+                for(uint32_t iIter = 0; iIter < mr; iIter++)
+                {
+                    const S valueOfA = packedA[iIter];
+                    for(uint32_t jIter = 0; jIter < nr; jIter++)
+                    {
+                        accumulator[iIter][jIter] += valueOfA * static_cast<S>(packedB[jIter]);
+                    }
+                }
+                packedA += mr;
+                packedB += nr;
+            }
+        }
+
+        for(uint32_t iIter = 0; iIter < m; iIter++)
+        {
+            T* rowOfC = C + (iIter * ldc);
+            if(beta == T(0))
+            {
+                for(uint32_t jIter = 0; jIter < n; jIter++)
+                {
+                    rowOfC[jIter] = static_cast<T>(static_cast<S>(alpha) * accumulator[iIter][jIter]);
+                }
+            }
+            else
+            {
+                for(uint32_t jIter = 0; jIter < n; jIter++)
+                {
+                    rowOfC[jIter] = static_cast<T>((static_cast<S>(alpha) * accumulator[iIter][jIter]) + (static_cast<S>(beta) * static_cast<S>(rowOfC[jIter])));
+                }
+            }
+        }
+    }
+
+    template <class T, class S> void gemmMicroKernel(uint32_t kc, const T* packedA, const T* packedB, uint32_t m, uint32_t n, T alpha, T beta, T* C, ptrdiff_t ldc)
+    {
+        gemmMicroKernelBody<T, S, 16>(kc, packedA, packedB, m, n, alpha, beta, C, ldc);
+    }
+
+#if MATRIX_SIMD_X86
+    template <class T, class S> __attribute__((target("avx2"))) void gemmMicroKernelAvx2(uint32_t kc, const T* packedA, const T* packedB, uint32_t m, uint32_t n, T alpha, T beta, T* C, ptrdiff_t ldc)
+    {
+        gemmMicroKernelBody<T, S, 32>(kc, packedA, packedB, m, n, alpha, beta, C, ldc);
+    }
+
+    template <class T, class S> __attribute__((target("avx512f"))) void gemmMicroKernelAvx512(uint32_t kc, const T* packedA, const T* packedB, uint32_t m, uint32_t n, T alpha, T beta, T* C, ptrdiff_t ldc)
+    {
+        gemmMicroKernelBody<T, S, 64>(kc, packedA, packedB, m, n, alpha, beta, C, ldc);
+    }
+#endif //MATRIX_SIMD_X86
+
+    /**
+     * @brief the micro-kernel for the active simd level and accumulation
+     *        precision, see setSimdLevel() and setAccumulation()
+     * @details element types without vector kernels always get the baseline
+     *          build. No fma variant on purpose, contracting the multiply-add
+     *          would change the rounding from one level to the next
+    */
+    template <class T, class S> auto activeGemmMicroKernel() -> void (*)(uint32_t, const T*, const T*, uint32_t, uint32_t, T, T, T*, ptrdiff_t)
+    {
+#if MATRIX_SIMD_X86
+        if constexpr (!std::is_void<typename simdType<T>::type>::value)
+        {
+            switch(activeSimdLevel())
+            {
+                case simdLevel::avx512: return &gemmMicroKernelAvx512<T, S>;
+                case simdLevel::avx2:   return &gemmMicroKernelAvx2<T, S>;
+                default:                break;
+            }
+        }
+#endif
+        return &gemmMicroKernel<T, S>;
+    }
+
+    template <class T> auto activeGemmMicroKernel() -> void (*)(uint32_t, const T*, const T*, uint32_t, uint32_t, T, T, T*, ptrdiff_t)
+    {
+        return useWideAccumulator<T>() ? activeGemmMicroKernel<T, typename wideAccumulator<T>::type>() : activeGemmMicroKernel<T, T>();
+    }
+
+    /**
+     * @brief general matrix multiply, C = alpha * A * B + beta * C
+     * @details A is M x K and B is K x N, both addressed through a row and a
+     *          column stride so transposed operands cost nothing extra. C is
+     *          row major M x N with leading dimension ldc. When beta is 0, C
+     *          is write only and may hold garbage on entry. A may be stored as
+     *          a narrower TA, such as bfloat16, that converts to T
+     * @param M rows of A and C
+     * @param N columns of B and C
+     * @param K columns of A and rows of B
+     * @param alpha scalar alpha
+     * @param A pointer to the first element of A
+     * @param rowStrideA distance in elements between A(i, k) and A(i + 1, k)
+     * @param columnStrideA distance in elements between A(i, k) and A(i, k + 1)
+     * @param B pointer to the first element of B
+     * @param rowStrideB distance in elements between B(k, j) and B(k + 1, j)
+     * @param columnStrideB distance in elements between B(k, j) and B(k, j + 1)
+     * @param beta scalar beta
+     * @param C pointer to the first element of C
+     * @param ldc distance in elements between C(i, j) and C(i + 1, j)
+    */
+    template <class T, class TA = T> void gemm(uint32_t M, uint32_t N, uint32_t K, T alpha,
+                                 const TA* A, ptrdiff_t rowStrideA, ptrdiff_t columnStrideA,
+                                 const T* B, ptrdiff_t rowStrideB, ptrdiff_t columnStrideB,
+                                 T beta, T* C, ptrdiff_t ldc)
+    {
+        constexpr uint32_t mr = gemmBlocking<T>::mr;
+        constexpr uint32_t nr = gemmBlocking<T>::nr;
+        constexpr uint32_t kcMax = gemmBlocking<T>::kc;
+        constexpr uint32_t mcMax = gemmBlocking<T>::mc;
+        constexpr uint32_t ncMax = gemmBlocking<T>::nc;
+
+        if((M == 0) || (N == 0))
+        {
+            return;
+        }
+
+        if((N == 1) || (M == 1) || (K == 0) || ((static_cast<uint64_t>(M) * N * K) <= gemmSmallProblemThreshold))
+        {
+            if(useWideAccumulator<T>())
+            {
+                gemmSmall<T, TA, typename wideAccumulator<T>::type>(M, N, K, alpha, A, rowStrideA, columnStrideA, B, rowStrideB, columnStrideB, beta, C, ldc);
+            }
+            else
+            {
+                gemmSmall<T, TA, T>(M, N, K, alpha, A, rowStrideA, columnStrideA, B, rowStrideB, columnStrideB, beta, C, ldc);
+            }
+            return;
+        }
+
+        gemmScratch<T>& scratch = gemmScratch<T>::local();
+        const uint32_t paddedNc = ((std::min(ncMax, N) + nr - 1) / nr) * nr;
+        const uint32_t kcLargest = std::min(kcMax, K);
+        if(scratch.packedB.size() < static_cast<size_t>(paddedNc) * kcLargest)
+        {
+            scratch.packedB.resize(static_cast<size_t>(paddedNc) * kcLargest);
+        }
+        T* packedB = scratch.packedB.data();
+        const auto microKernel = activeGemmMicroKernel<T>();
+
+        // tile C so every thread gets at least one tile, rows first since
+        // splitting columns means packing the same block of A more than once
+        const uint32_t numThreads = ((static_cast<uint64_t>(M) * N * K) < gemmParallelThreshold) ? 1 : threadPool::instance().getNumThreads();
+        uint32_t mcTile = mcMax;
+        if(((M + mcTile - 1) / mcTile) < numThreads)
+        {
+            mcTile = std::max(mr, ((((M + numThreads - 1) / numThreads) + mr - 1) / mr) * mr);
+        }
+        const uint32_t rowTiles = (M + mcTile - 1) / mcTile;
+        const uint32_t columnSplits = (rowTiles < numThreads) ? ((numThreads + rowTiles - 1) / rowTiles) : 1;
+
+        for(uint32_t jc = 0; jc < N; jc += ncMax)
+        {
+            const uint32_t nc = std::min(ncMax, N - jc);
+            const uint32_t panels = (nc + nr - 1) / nr;
+            const uint32_t panelsPerTile = std::max(1u, (panels + columnSplits - 1) / columnSplits);
+            const uint32_t columnTiles = (panels + panelsPerTile - 1) / panelsPerTile;
+
+            for(uint32_t pc = 0; pc < K; pc += kcMax)
+            {
+                const uint32_t kc = std::min(kcMax, K - pc);
+                // the first slice of K applies the caller's beta, the rest accumulate
+                const T betaOfSlice = (pc == 0) ? beta : T(1);
+
+                packB(kc, nc, B + (pc * rowStrideB) + (jc * columnStrideB), rowStrideB, columnStrideB, packedB);
+
+                auto tileBody = [&](uint32_t tileBegin, uint32_t tileEnd)
+                {
+                    gemmScratch<T>& tileScratch = gemmScratch<T>::local();
+                    if(tileScratch.packedA.size() < static_cast<size_t>(mcTile) * kc)
+                    {
+                        tileScratch.packedA.resize(static_cast<size_t>(mcTile) * kc);
+                    }
+                    T* packedA = tileScratch.packedA.data();
+
+                    for(uint32_t tile = tileBegin; tile < tileEnd; tile++)
+                    {
+                        const uint32_t ic = (tile / columnTiles) * mcTile;
+                        const uint32_t mc = std::min(mcTile, M - ic);
+                        const uint32_t jrBegin = (tile % columnTiles) * panelsPerTile * nr;
+                        const uint32_t jrEnd = std::min(nc, jrBegin + (panelsPerTile * nr));
+
+                        // consecutive tiles of the same row block reuse the packed A
+                        if((tile == tileBegin) || ((tile % columnTiles) == 0))
+                        {
+                            packA(mc, kc, A + (ic * rowStrideA) + (pc * columnStrideA), rowStrideA, columnStrideA, packedA);
+                        }
+
+                        for(uint32_t jr = jrBegin; jr < jrEnd; jr += nr)
+                        {
+                            for(uint32_t ir = 0; ir < mc; ir += mr)
+                            {
+                                microKernel(kc, packedA + (ir * kc), packedB + (jr * kc),
+                                                std::min(mr, mc - ir), std::min(nr, nc - jr),
+                                                alpha, betaOfSlice, C + ((ic + ir) * ldc) + jc + jr, ldc);
+                            }
+                        }
+                    }
+                };
+
+                if(numThreads == 1)
+                {
+                    tileBody(0, rowTiles * columnTiles);
+                }
+                else
+                {
+                    parallelFor(0, rowTiles * columnTiles, 1, tileBody);
+                }
+            }
+        }
+    }
+}
+
+#endif //GEMM_KERNEL_H
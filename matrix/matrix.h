@@ -24,14 +24,58 @@
 #include <cassert>
 #include <iostream>
 #include <memory>
-#include <ctime>
-#include <cstdlib>
-
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <algorithm>
+
+#include "gemmKernel.h"
+#include "precision.h"
+#include "threadPool.h"
+#include "random.h"
+#include "stridedSpan.h"
+#include "simdKernels.h"
+#include "activationKernels.h"
+#include "matrixExpression.h"
+
+/*
+ * Bounds checking policy for element access. With checks on, at(), assign(),
+ * operator() and operator[] report out of range accesses and assert. With
+ * checks off they are a plain indexed load or store. The default follows
+ * NDEBUG, like assert itself, and can be forced either way by defining
+ * MATRIX_BOUNDS_CHECK to 0 or 1 before including this header.
+ */
+#ifndef MATRIX_BOUNDS_CHECK
+#ifdef NDEBUG
+#define MATRIX_BOUNDS_CHECK 0
+#else
+#define MATRIX_BOUNDS_CHECK 1
+#endif
+#endif
 
 // I suppose you could have a matrix of strings, but it would make no sense
-template <class T> class matrix
+template <class T> class matrix : public matrixExpression<matrix<T>>
 {
+    static_assert(std::is_trivially_copyable<T>::value, "matrix storage is raw aligned memory, T must be trivially copyable");
+
     public:
+        /**
+         * @brief element type, used by the expression templates
+        */
+        using valueType = T;
+
+        /**
+         * @brief alignment in bytes of the storage owned by a matrix. 64 bytes
+         *        is a cache line and the width of an AVX-512 register
+        */
+        static constexpr std::size_t m_alignment = 64;
+
+        /**
+         * @brief element-wise operations on at least this many elements are
+         *        split over the thread pool, smaller ones stay on the caller
+        */
+        static constexpr std::size_t m_parallelElementThreshold = 1 << 16;
+
         /**
          * @brief creates an empty matrix
         */
@@ -54,11 +98,81 @@ template <class T> class matrix
          * @param other the matrix you are copying from
         */
         matrix(const matrix& other);
+        /**
+         * @brief move constructor, takes ownership of the other matrix's data
+         * @details other is left as an empty 0x0 matrix
+         * @param other the matrix you are moving from
+        */
+        matrix(matrix&& other) noexcept;
+        /**
+         * @brief creates a matrix by evaluating an element-wise expression 
+         *        in a single pass, see matrixExpression.h
+         * @param expression the expression to evaluate
+        */
+        template <class E> matrix(const matrixExpression<E>& expression);
         /**
          * @brief deconstructor
         */
         ~matrix();
 
+        /**
+         * @brief non-owning matrix over memory that belongs to someone else
+         * @details the view reads and writes data in place and never frees
+         *          it, so data has to outlive the view. Copying into a view
+         *          writes through to data, copying a view makes an owning
+         *          deep copy. A view can be shrunk with resize() but not
+         *          grown past rows * columns, an assignment or resize() that
+         *          does not fit is reported and leaves the view as it was
+         * @param data first element, row major
+         * @param rows rows of the matrix
+         * @param columns columns of the matrix
+         * @return the view
+        */
+        static matrix<T> view(T* data, const uint32_t& rows, const uint32_t& columns);
+        /**
+         * @brief view over memory that must not be written, read only mapped
+         *        memory for example
+         * @details reads like view(). Everything that writes the elements,
+         *          the fills, assignments, resize() and the kernels that take
+         *          it as their destination, asserts instead. A copy owns its
+         *          data and is writable
+         * @param data first element, row major
+         * @param rows rows of the matrix
+         * @param columns columns of the matrix
+         * @return the view
+        */
+        static matrix<T> readOnlyView(const T* data, const uint32_t& rows, const uint32_t& columns);
+        /**
+         * @brief whether the matrix frees its storage, false for a view
+        */
+        bool ownsData() const;
+        /**
+         * @brief whether the matrix is a readOnlyView()
+        */
+        bool isReadOnly() const;
+        /**
+         * @brief number of elements the storage can hold without reallocating
+        */
+        uint32_t getCapacity() const;
+
+        /**
+         * @brief explicit deep copy of the matrix
+         * @return a new matrix with its own copy of the data
+        */
+        matrix<T> clone() const;
+        /**
+         * @brief raw pointer to the first element of the matrix, aligned to
+         *        m_alignment bytes. Data is stored row major
+         * @return pointer to the data of the matrix, nullptr if empty
+        */
+        T* data();
+        /**
+         * @brief raw pointer to the first element of the matrix, aligned to
+         *        m_alignment bytes. Data is stored row major
+         * @return pointer to the data of the matrix, nullptr if empty
+        */
+        const T* data() const;
+
         /**
          * @brief Get value at row, column
          * @param row row position of the matrix
@@ -72,6 +186,15 @@ template <class T> class matrix
          * @return data accessed at the index of the matrix
         */
         T at(const uint32_t& index) const;
+        /**
+         * @brief unchecked value at a flat index, the leaf of an expression tree
+         * @param index index of the matrix you want to retrieve the value from
+         * @return data at the index of the matrix
+        */
+        T evaluate(const uint32_t& index) const
+        {
+            return m_data[index];
+        }
         /**
          * @brief Assign a value at a specific index in the matrix
          * @param value value you want to assign
@@ -85,6 +208,89 @@ template <class T> class matrix
          * @param column column position of where you want to assign that value to
         */
         void assign(T value, const uint32_t& row, const uint32_t& column);
+        /**
+         * @brief reference to the element at row, column. Bounds checked only
+         *        when MATRIX_BOUNDS_CHECK is on
+         * @param row row position of the matrix
+         * @param column column position of the matrix
+         * @return reference to the element
+        */
+        T& operator()(const uint32_t& row, const uint32_t& column)
+        {
+            checkBounds(row, column, __PRETTY_FUNCTION__);
+            return m_data[(row * m_columns) + column];
+        }
+        const T& operator()(const uint32_t& row, const uint32_t& column) const
+        {
+            checkBounds(row, column, __PRETTY_FUNCTION__);
+            return m_data[(row * m_columns) + column];
+        }
+        /**
+         * @brief reference to the element at a flat, row major index. Bounds
+         *        checked only when MATRIX_BOUNDS_CHECK is on
+         * @param index index of the element
+         * @return reference to the element
+        */
+        T& operator[](const uint32_t& index)
+        {
+            checkIndex(index, __PRETTY_FUNCTION__);
+            return m_data[index];
+        }
+        const T& operator[](const uint32_t& index) const
+        {
+            checkIndex(index, __PRETTY_FUNCTION__);
+            return m_data[index];
+        }
+        /**
+         * @brief view of one row of the matrix, contiguous
+         * @param row row of the matrix
+         * @return span over the columns of that row
+        */
+        stridedSpan<T> row(const uint32_t& row)
+        {
+            checkBounds(row, 0, __PRETTY_FUNCTION__);
+            return stridedSpan<T>(m_data + (row * m_columns), m_columns, 1);
+        }
+        stridedSpan<const T> row(const uint32_t& row) const
+        {
+            checkBounds(row, 0, __PRETTY_FUNCTION__);
+            return stridedSpan<const T>(m_data + (row * m_columns), m_columns, 1);
+        }
+        /**
+         * @brief view of one column of the matrix, strided by the number of
+         *        columns
+         * @param column column of the matrix
+         * @return span over the rows of that column
+        */
+        stridedSpan<T> column(const uint32_t& column)
+        {
+            checkBounds(0, column, __PRETTY_FUNCTION__);
+            return stridedSpan<T>(m_data + column, m_rows, m_columns);
+        }
+        stridedSpan<const T> column(const uint32_t& column) const
+        {
+            checkBounds(0, column, __PRETTY_FUNCTION__);
+            return stridedSpan<const T>(m_data + column, m_rows, m_columns);
+        }
+        /**
+         * @brief iterators over every element in row major order, plain pointers
+        */
+        T* begin()
+        {
+            return m_data;
+        }
+        T* end()
+        {
+            return m_data + (m_rows * m_columns);
+        }
+        const T* begin() const
+        {
+            return m_data;
+        }
+        const T* end() const
+        {
+            return m_data + (m_rows * m_columns);
+        }
 
         /**
           * @brief set the matrix to a new set of data
@@ -102,10 +308,31 @@ template <class T> class matrix
         void fillNumber(T value);
         /**
          * @brief fill the matrix with a random value between a given range
+         * @details takes matrixRandom's default seed and the next stream, so
+         *          consecutive fills differ and a seeded run repeats itself
          * @param lowerEnd lower end of a random value to fill the matrix with
          * @param upperEnd upper end of a random value to fill the matrix with
         */
         void fillRandom(T lowerEnd, T upperEnd);
+        /**
+         * @brief fill the matrix with uniform random values, in parallel for
+         *        large matrices and the same values at any thread count
+         * @param lowerEnd lowest value
+         * @param upperEnd one past the highest value, the highest for integers
+         * @param seed seed of the values
+         * @param stream keeps fills of one seed apart
+        */
+        void fillRandom(T lowerEnd, T upperEnd, uint64_t seed, uint64_t stream);
+        /**
+         * @brief fill the matrix with normally distributed random values, in
+         *        parallel for large matrices and the same values at any
+         *        thread count
+         * @param mean mean of the values
+         * @param standardDeviation standard deviation of the values
+         * @param seed seed of the values
+         * @param stream keeps fills of one seed apart
+        */
+        void fillNormal(T mean, T standardDeviation, uint64_t seed, uint64_t stream);
         /**
          * @brief get the number of rows of the matrix
          * @return the number of rows of the matrix
@@ -116,6 +343,17 @@ template <class T> class matrix
          * @return the number of columns of the matrix
         */
         uint32_t getNumColumns() const;
+        /**
+         * @brief change the shape of the matrix to rows by columns
+         * @details storage is only reallocated when the matrix grows past its
+         *          capacity, shrinking keeps the storage so a buffer sized for
+         *          the largest batch serves every smaller one without
+         *          allocating. The contents of the matrix are unspecified 
+         *          afterwards
+         * @param rows new number of rows of the matrix
+         * @param columns new number of columns of the matrix
+        */
+        void resize(const uint32_t& rows, const uint32_t& columns);
         /**
          * @brief print the matrix out to std out
         */
@@ -162,6 +400,202 @@ template <class T> class matrix
          * @return the resultant matrix of the transpose, matrix C
         */
         static matrix<T> transpose(const matrix& A);
+
+        /**
+         * @brief add two matrices together into a destination, C = A + B
+         * @details C is resized to the shape of A if needed, C may be A or B
+         * @param A matrix A
+         * @param B matrix B
+         * @param C destination matrix C
+        */
+        static void add(const matrix& A, const matrix& B, matrix& C);
+        /**
+         * @brief subtract two matrices into a destination, C = A - B
+         * @details C is resized to the shape of A if needed, C may be A or B
+         * @param A matrix A
+         * @param B matrix B
+         * @param C destination matrix C
+        */
+        static void subtract(const matrix& A, const matrix& B, matrix& C);
+        /**
+         * @brief scalar multiplication of a matrix into a destination, C = s * A
+         * @details C is resized to the shape of A if needed, C may be A
+         * @param scalar scalar s
+         * @param A matrix A
+         * @param C destination matrix C
+        */
+        static void scalarMultiply(const T& scalar, const matrix& A, matrix& C);
+        /**
+         * @brief matrix multiplication into a destination, C = A * B
+         * @details C is resized to rows of A by columns of B if needed. C must
+         *          not be A or B
+         * @param A matrix A
+         * @param B matrix B
+         * @param C destination matrix C
+        */
+        static void matrixMultiplication(const matrix& A, const matrix& B, matrix& C);
+        /**
+         * @brief matrix multiplication into a destination, C = A * B, with A
+         *        stored in another element type, such as bfloat16 weights in
+         *        a float network
+         * @details A is widened to T as the kernel packs it, the arithmetic is
+         *          done in T. C is resized to rows of A by columns of B if
+         *          needed
+         * @param A matrix A, its elements convert to T with static_cast
+         * @param B matrix B
+         * @param C destination matrix C
+        */
+        template <class TA> static void matrixMultiplication(const matrix<TA>& A, const matrix& B, matrix& C)
+        {
+            if(A.getNumColumns() != B.getNumRows())
+            {
+                std::cout<<__PRETTY_FUNCTION__<<": columns of A and rows of B must be equal!!!!"<<std::endl;
+                assert(false);
+            }
+            if(&C == &B)
+            {
+                std::cout<<__PRETTY_FUNCTION__<<": destination C can not be B!!!!"<<std::endl;
+                assert(false);
+            }
+
+            C.resize(A.getNumRows(), B.getNumColumns());
+            matrixKernels::gemm<T, TA>(A.getNumRows(), B.getNumColumns(), A.getNumColumns(), T(1),
+                                       A.data(), A.getNumColumns(), 1,
+                                       B.m_data, B.getNumColumns(), 1,
+                                       T(0), C.m_data, C.getNumColumns());
+        }
+        /**
+         * @brief component-wise product of two matrices into a destination, C = A .* B
+         * @details C is resized to the shape of A if needed, C may be A or B
+         * @param A matrix A
+         * @param B matrix B
+         * @param C destination matrix C
+        */
+        static void hadamardProduct(const matrix& A, const matrix& B, matrix& C);
+        /**
+         * @brief transpose a matrix into a destination, C = A^T
+         * @details C is resized to columns of A by rows of A if needed. C must 
+         *          not be A
+         * @param A matrix A
+         * @param C destination matrix C
+        */
+        static void transpose(const matrix& A, matrix& C);
+        /**
+         * @brief BLAS style scaled addition, Y = alpha * X + Y
+         * @param alpha scalar alpha
+         * @param X matrix X
+         * @param Y matrix Y, updated in place
+        */
+        static void axpy(const T& alpha, const matrix& X, matrix& Y);
+        /**
+         * @brief BLAS style rank-1 update, A = A + alpha * x * y^T
+         * @details the outer product is applied row by row, it is never 
+         *          materialized and y is never transposed
+         * @param alpha scalar alpha
+         * @param x column vector x, rows of A by 1
+         * @param y column vector y, columns of A by 1
+         * @param A matrix A, updated in place
+        */
+        static void rankOneUpdate(const T& alpha, const matrix& x, const matrix& y, matrix& A);
+        /**
+         * @brief BLAS style general matrix multiplication, 
+         *        C = alpha * op(A) * op(B) + beta * C, op(X) is X or X^T
+         * @details the transposes are never materialized, the kernel reads A
+         *          and B through swapped strides. When beta is 0, C is resized
+         *          to rows of op(A) by columns of op(B) if needed, otherwise C
+         *          must already have that shape. C must not be A or B
+         * @param alpha scalar alpha
+         * @param A matrix A
+         * @param transposeA use A^T instead of A
+         * @param B matrix B
+         * @param transposeB use B^T instead of B
+         * @param beta scalar beta
+         * @param C destination matrix C
+        */
+        static void matrixMultiplication(const T& alpha, const matrix& A, bool transposeA, const matrix& B, bool transposeB, const T& beta, matrix& C);
+        /**
+         * @brief sum each row of a matrix, C[i] = sum over j of A(i, j)
+         * @details C is resized to rows of A by 1 if needed. Sums the gradient
+         *          of the biases over the columns of a mini-batch. With wide
+         *          accumulation float rows are summed in double
+         * @param A matrix A
+         * @param C destination column vector C
+        */
+        static void rowSums(const matrix& A, matrix& C);
+        /**
+         * @brief fused back propagation and gradient descent step for a layer
+         *        with a sigmoid activation
+         * @details in one pass over the weights:
+         *          delta = output .* (1 - output) .* gradient
+         *          propagatedGradient = weights^T * delta, using the weights 
+         *                               from before this update
+         *          weights = weights - learningRate * delta * input^T
+         *          biases = biases - learningRate * delta
+         * @param output sigmoid output of the layer, N x 1
+         * @param gradient gradient of the cost with respect to output, N x 1
+         * @param input input the layer was activated with, M x 1
+         * @param learningRate learning rate, AKA eta
+         * @param weights weights of the layer, N x M, updated in place
+         * @param biases biases of the layer, N x 1, updated in place
+         * @param delta destination for the error of the layer, N x 1
+         * @param propagatedGradient optional destination for the gradient
+         *        handed to the previous layer, M x 1. nullptr to skip it
+        */
+        static void sigmoidLayerBackward(const matrix& output, const matrix& gradient, const matrix& input, const T& learningRate,
+                                         matrix& weights, matrix& biases, matrix& delta, matrix* propagatedGradient = nullptr);
+        /**
+         * @brief apply an activation function, Y = f(Z)
+         * @details Y is resized to the shape of Z if needed and may be Z.
+         *          Softmax works on every column, one sample per column. See
+         *          activationKernels.h for the accuracy of the modes
+         * @param function sigmoid, tanh, relu, leakyRelu or softmax
+         * @param mode exact or fast exp, only sigmoid, tanh and softmax use exp
+         * @param Z pre-activations
+         * @param Y destination for the activations
+         * @param leak slope of leakyRelu for negative inputs
+        */
+        static void activate(matrixKernels::activationFunction function, matrixKernels::activationMode mode, const matrix& Z, matrix& Y, const T& leak = T(0.01));
+        /**
+         * @brief gradient of the cost with respect to the pre-activations,
+         *        delta = f'(Z) .* gradient, with f' taken from Y = f(Z)
+         * @details delta is resized to the shape of Y if needed and may be
+         *          gradient. For softmax this is the Jacobian of each column
+         *          times the column of gradient
+         * @param function activation Y was computed with
+         * @param Y activations
+         * @param gradient gradient of the cost with respect to Y
+         * @param delta destination for the gradient with respect to Z
+         * @param leak slope of leakyRelu for negative inputs
+        */
+        static void activationDerivative(matrixKernels::activationFunction function, const matrix& Y, const matrix& gradient, matrix& delta, const T& leak = T(0.01));
+
+        /**
+         * @brief add a matrix to this matrix in place, this = this + B
+         * @param B matrix B
+        */
+        void addInPlace(const matrix& B);
+        /**
+         * @brief subtract a matrix from this matrix in place, this = this - B
+         * @param B matrix B
+        */
+        void subtractInPlace(const matrix& B);
+        /**
+         * @brief scale this matrix in place, this = s * this
+         * @param scalar scalar s
+        */
+        void scaleInPlace(const T& scalar);
+        /**
+         * @brief component-wise multiply this matrix in place, this = this .* B
+         * @param B matrix B
+        */
+        void hadamardInPlace(const matrix& B);
+        /**
+         * @brief add a column vector to every column of this matrix in place,
+         *        this(i, j) = this(i, j) + v[i]. Broadcasts the biases of a
+         *        layer over the columns of a mini-batch
+         * @param columnVector column vector v, rows of this by 1
+        */
+        void addToEachColumn(const matrix& columnVector);
         /**
          * @brief override of the equals operator
          * @param other the matrix you are assigning from
@@ -171,17 +605,22 @@ template <class T> class matrix
         {
             if (this != &other) // self-assignment guard
             {
-                // Deallocate existing memory
-                if (m_data != nullptr)
+                checkWritable(__PRETTY_FUNCTION__);
+                if(!viewFits(other.m_rows, other.m_columns, __PRETTY_FUNCTION__))
+                {
+                    return *this;
+                }
+
+                // Only reallocate when the data does not fit
+                if((other.m_rows * other.m_columns) > m_capacity)
                 {
-                    delete[] m_data;
-                    m_data = nullptr;
+                    deallocate(m_data);
+                    m_data = allocate(other.m_rows * other.m_columns);
                 }
 
                 // Copy new data
                 m_rows = other.m_rows;
                 m_columns = other.m_columns;
-                m_data = new T[m_rows * m_columns];
                 
                 for (uint32_t i = 0; i < m_rows * m_columns; i++)
                 {
@@ -194,6 +633,84 @@ template <class T> class matrix
             }
             return *this;
         }
+        /**
+         * @brief move assignment, takes ownership of the other matrix's data
+         * @details other is left as an empty 0x0 matrix. A view keeps its
+         *          memory and copies the elements into it instead, like a copy
+         *          does, and other keeps its data
+         * @param other the matrix you are moving from
+         * @return the matrix you are assigning to
+        */
+        matrix<T>& operator=(matrix&& other) noexcept
+        {
+            if(!m_ownsData)
+            {
+                // copy assignment writes through, or refuses without
+                // allocating if other does not fit
+                return *this = static_cast<const matrix&>(other);
+            }
+            if (this != &other) // self-assignment guard
+            {
+                deallocate(m_data);
+
+                m_data = other.m_data;
+                m_capacity = other.m_capacity;
+                m_ownsData = other.m_ownsData;
+                m_readOnly = other.m_readOnly;
+                m_rows = other.m_rows;
+                m_columns = other.m_columns;
+
+                other.m_data = nullptr;
+                other.m_capacity = 0;
+                other.m_ownsData = true;
+                other.m_readOnly = false;
+                other.m_rows = 0;
+                other.m_columns = 0;
+            }
+            return *this;
+        }
+        /**
+         * @brief assign an element-wise expression, evaluated in a single 
+         *        fused loop. The expression may refer to this matrix
+         * @param expression the expression to evaluate
+         * @return the matrix you are assigning to
+        */
+        template <class E> matrix<T>& operator=(const matrixExpression<E>& expression)
+        {
+            const E& tree = expression.self();
+            if(!viewFits(tree.getNumRows(), tree.getNumColumns(), __PRETTY_FUNCTION__))
+            {
+                return *this;
+            }
+            resize(tree.getNumRows(), tree.getNumColumns());
+
+            forEachChunk(m_rows * m_columns, [this, &tree](std::size_t offset, std::size_t count)
+            {
+                for(uint32_t iIter = offset; iIter < offset + count; iIter++)
+                {
+                    m_data[iIter] = tree.evaluate(iIter);
+                }
+            });
+            return *this;
+        }
+        /**
+         * @brief add an element-wise expression to this matrix in one pass
+         * @param expression the expression to evaluate, same shape as this
+         * @return this matrix
+        */
+        template <class E> matrix<T>& operator+=(const matrixExpression<E>& expression)
+        {
+            return *this = (*this + expression);
+        }
+        /**
+         * @brief subtract an element-wise expression from this matrix in one pass
+         * @param expression the expression to evaluate, same shape as this
+         * @return this matrix
+        */
+        template <class E> matrix<T>& operator-=(const matrixExpression<E>& expression)
+        {
+            return *this = (*this - expression);
+        }
 
     private:
 
@@ -201,11 +718,178 @@ template <class T> class matrix
         T* m_data = nullptr;
         uint32_t m_rows = 0;
         uint32_t m_columns = 0;
+
+        //elements m_data can hold
+        uint32_t m_capacity = 0;
+        //false for a view, m_data belongs to someone else
+        bool m_ownsData = true;
+        //a readOnlyView(), nothing may write m_data
+        bool m_readOnly = false;
+
+        /**
+         * @brief allocate uninitialized storage aligned to m_alignment bytes
+         * @param size number of elements to allocate
+         * @return pointer to the storage, nullptr if size is 0
+        */
+        T* allocate(const uint32_t& size);
+        /**
+         * @brief release storage that came from allocate()
+         * @param data pointer returned by allocate(), may be nullptr
+        */
+        void deallocate(T* data);
+        /**
+         * @brief rowSums() with the sums carried in S
+        */
+        template <class S> static void rowSumsIn(const matrix& A, matrix& C)
+        {
+            for(uint32_t iIter = 0; iIter < A.getNumRows(); iIter++)
+            {
+                const T* rowOfA = A.m_data + (iIter * A.getNumColumns());
+                S sum = 0;
+                for(uint32_t jIter = 0; jIter < A.getNumColumns(); jIter++)
+                {
+                    sum += rowOfA[jIter];
+                }
+                C.m_data[iIter] = static_cast<T>(sum);
+            }
+        }
+        /**
+         * @brief call body(offset, count) over n elements, split into cache
+         *        line aligned chunks on the thread pool when n reaches
+         *        m_parallelElementThreshold
+         * @param n number of elements
+         * @param body callable taking (std::size_t offset, std::size_t count)
+        */
+        template <class F> static void forEachChunk(std::size_t n, const F& body)
+        {
+            // 4096 elements is a whole number of cache lines for any T
+            constexpr std::size_t chunkSize = 4096;
+
+            if(n < m_parallelElementThreshold)
+            {
+                body(0, n);
+                return;
+            }
+
+            parallelFor(0, static_cast<uint32_t>((n + chunkSize - 1) / chunkSize), 1, [n, &body](uint32_t chunkBegin, uint32_t chunkEnd)
+            {
+                const std::size_t offset = static_cast<std::size_t>(chunkBegin) * chunkSize;
+                const std::size_t end = std::min(n, static_cast<std::size_t>(chunkEnd) * chunkSize);
+                body(offset, end - offset);
+            });
+        }
+        /**
+         * @brief whether rows x columns fit the memory a view was made over,
+         *        reports and asserts if not. An owning matrix always fits, it
+         *        reallocates. Checked before anything would call allocate(),
+         *        so a view never ends up on storage of its own
+        */
+        bool viewFits(const uint32_t& rows, const uint32_t& columns, const char* function) const
+        {
+            if(m_ownsData || ((rows * columns) <= m_capacity))
+            {
+                return true;
+            }
+            std::cout<<function<<": a view of "<<m_capacity<<" elements can not hold "<<rows<<" x "<<columns<<"!!!!"<<std::endl;
+            assert(false);
+            return false;
+        }
+        /**
+         * @brief report and assert on a write to a readOnlyView()
+        */
+        void checkWritable(const char* function) const
+        {
+            if(m_readOnly)
+            {
+                std::cout<<function<<": the matrix is a read only view, copy it to change it!!!!"<<std::endl;
+                assert(false);
+            }
+        }
+        /**
+         * @brief report and assert on a row or column out of range, compiled
+         *        out when MATRIX_BOUNDS_CHECK is off
+        */
+        void checkBounds(const uint32_t& row, const uint32_t& column, const char* function) const
+        {
+#if MATRIX_BOUNDS_CHECK
+            if(m_data == nullptr)
+            {
+                std::cout<<function<<": m_data is nullptr!!!!"<<std::endl;
+                assert(false);
+            }
+            if(row >= m_rows)
+            {
+                std::cout<<function<<": row "<<row<<" is out of range of the "<<m_rows<<" rows in matrix!!!!"<<std::endl;
+                assert(false);
+            }
+            if(column >= m_columns)
+            {
+                std::cout<<function<<": column "<<column<<" is out of range of the "<<m_columns<<" columns in matrix!!!!"<<std::endl;
+                assert(false);
+            }
+#else
+            (void)row;
+            (void)column;
+            (void)function;
+#endif
+        }
+        /**
+         * @brief report and assert on a flat index out of range, compiled out
+         *        when MATRIX_BOUNDS_CHECK is off
+        */
+        void checkIndex(const uint32_t& index, const char* function) const
+        {
+#if MATRIX_BOUNDS_CHECK
+            if(m_data == nullptr)
+            {
+                std::cout<<function<<": m_data is nullptr!!!!"<<std::endl;
+                assert(false);
+            }
+            if(index >= (m_rows*m_columns))
+            {
+                std::cout<<function<<": index "<<index<<" is out of range of the "<<(m_rows*m_columns)<<" elements in matrix!!!!"<<std::endl;
+                assert(false);
+            }
+#else
+            (void)index;
+            (void)function;
+#endif
+        }
 };
 
+template <class T> T* matrix<T>::allocate(const uint32_t& size)
+{
+    if(!m_ownsData)
+    {
+        std::cout<<__PRETTY_FUNCTION__<<": a view can not grow past the memory it was made over!!!!"<<std::endl;
+        assert(false);
+    }
+
+    m_capacity = size;
+    if(size == 0)
+    {
+        return nullptr;
+    }
+
+    return static_cast<T*>(::operator new[](sizeof(T) * size, std::align_val_t(m_alignment)));
+}
+
+template <class T> void matrix<T>::deallocate(T* data)
+{
+    m_capacity = 0;
+    if(!m_ownsData)
+    {
+        return;
+    }
+    if(data != nullptr)
+    {
+        ::operator delete[](data, std::align_val_t(m_alignment));
+    }
+}
+
 template <class T> matrix<T>::matrix()
 {
-    m_data = new T[m_rows*m_columns];
+    
 }
 
 //copy constructor
@@ -213,7 +897,7 @@ template <class T> matrix<T>::matrix(const matrix& other)
 {
     m_rows = other.m_rows;
     m_columns = other.m_columns;
-    m_data = new T[m_rows * m_columns];
+    m_data = allocate(m_rows * m_columns);
 
     for (uint32_t i = 0; i < m_rows * m_columns; ++i)
     {
@@ -221,6 +905,29 @@ template <class T> matrix<T>::matrix(const matrix& other)
     }
 }
 
+//move constructor
+template <class T> matrix<T>::matrix(matrix&& other) noexcept
+{
+    m_rows = other.m_rows;
+    m_columns = other.m_columns;
+    m_data = other.m_data;
+    m_capacity = other.m_capacity;
+    m_ownsData = other.m_ownsData;
+    m_readOnly = other.m_readOnly;
+
+    other.m_data = nullptr;
+    other.m_capacity = 0;
+    other.m_ownsData = true;
+    other.m_readOnly = false;
+    other.m_rows = 0;
+    other.m_columns = 0;
+}
+
+template <class T> template <class E> matrix<T>::matrix(const matrixExpression<E>& expression)
+{
+    *this = expression;
+}
+
 template <class T> matrix<T>::matrix(const uint32_t& rows, const uint32_t& columns)
 {
     if(rows < 1)
@@ -237,7 +944,7 @@ template <class T> matrix<T>::matrix(const uint32_t& rows, const uint32_t& colum
     m_rows = rows;
     m_columns = columns;
 
-    m_data = new T[m_rows*m_columns];
+    m_data = allocate(m_rows*m_columns);
 }
 
 template <class T> matrix<T>::matrix(T* data, const uint32_t& rows, const uint32_t& columns)
@@ -262,7 +969,7 @@ template <class T> matrix<T>::matrix(T* data, const uint32_t& rows, const uint32
     m_columns = columns;
 
 
-    m_data = new T[m_rows*m_columns];
+    m_data = allocate(m_rows*m_columns);
 
     for(uint32_t iIter = 0; iIter < m_rows * m_columns; iIter++)
     {
@@ -273,11 +980,63 @@ template <class T> matrix<T>::matrix(T* data, const uint32_t& rows, const uint32
 
 template <class T> matrix<T>::~matrix()
 {
-    if(m_data != nullptr)
+    deallocate(m_data);
+    m_data = nullptr;
+}
+
+template <class T> matrix<T> matrix<T>::view(T* data, const uint32_t& rows, const uint32_t& columns)
+{
+    if((data == nullptr) && ((rows * columns) != 0))
     {
-        delete[] m_data;
-        m_data = nullptr;
+        std::cout<<__PRETTY_FUNCTION__<<": data is nullptr!!!!"<<std::endl;
+        assert(false);
     }
+
+    matrix<T> result;
+    result.m_ownsData = false;
+    result.m_data = data;
+    result.m_rows = rows;
+    result.m_columns = columns;
+    result.m_capacity = rows * columns;
+    return result;
+}
+
+template <class T> matrix<T> matrix<T>::readOnlyView(const T* data, const uint32_t& rows, const uint32_t& columns)
+{
+    // the const is kept by m_readOnly from here on
+    matrix<T> result = view(const_cast<T*>(data), rows, columns);
+    result.m_readOnly = true;
+    return result;
+}
+
+template <class T> bool matrix<T>::ownsData() const
+{
+    return m_ownsData;
+}
+
+template <class T> bool matrix<T>::isReadOnly() const
+{
+    return m_readOnly;
+}
+
+template <class T> uint32_t matrix<T>::getCapacity() const
+{
+    return m_capacity;
+}
+
+template <class T> matrix<T> matrix<T>::clone() const
+{
+    return matrix<T>(*this);
+}
+
+template <class T> T* matrix<T>::data()
+{
+    return m_data;
+}
+
+template <class T> const T* matrix<T>::data() const
+{
+    return m_data;
 }
 
 template <class T> void matrix<T>::set(T* data)
@@ -299,13 +1058,7 @@ template <class T> void matrix<T>::set(T* data)
         std::cout<<__PRETTY_FUNCTION__<<": data is is not the right size!!!!"<<std::endl;
         assert(false);
     }
-
-    if(m_data != nullptr)
-    {
-        delete[] m_data;
-    }
-
-    m_data = new T[m_rows * m_columns];
+    checkWritable(__PRETTY_FUNCTION__);
 
     for(uint32_t iIter = 0; iIter < m_rows * m_columns; iIter++)
     {
@@ -315,6 +1068,8 @@ template <class T> void matrix<T>::set(T* data)
 
 template <class T> void matrix<T>::fillZeros()
 {
+    checkWritable(__PRETTY_FUNCTION__);
+
     for(uint32_t iIter = 0; iIter < m_rows * m_columns; iIter++)
     {
         m_data[iIter] = 0;
@@ -323,6 +1078,8 @@ template <class T> void matrix<T>::fillZeros()
 
 template <class T> void matrix<T>::fillNumber(T value)
 {
+    checkWritable(__PRETTY_FUNCTION__);
+
     for(uint32_t iIter = 0; iIter < m_rows * m_columns; iIter++)
     {
         m_data[iIter] = value;
@@ -331,31 +1088,24 @@ template <class T> void matrix<T>::fillNumber(T value)
 
 template <class T> void matrix<T>::fillRandom(T lowerBound, T upperBound)
 {
-    srand (static_cast <unsigned> (time(0)));
-    for(uint32_t iIter = 0; iIter < m_rows * m_columns; iIter++)
-    {
-        m_data[iIter] = lowerBound + static_cast<T>(rand()) / (static_cast<T>(RAND_MAX/(upperBound-lowerBound)));
-    }
+    fillRandom(lowerBound, upperBound, matrixRandom::defaultSeed().load(std::memory_order_relaxed), matrixRandom::nextDefaultStream().fetch_add(1, std::memory_order_relaxed));
+}
+
+template <class T> void matrix<T>::fillRandom(T lowerBound, T upperBound, uint64_t seed, uint64_t stream)
+{
+    checkWritable(__PRETTY_FUNCTION__);
+    matrixRandom::fillUniform(m_data, static_cast<std::size_t>(m_rows) * m_columns, lowerBound, upperBound, seed, stream);
+}
+
+template <class T> void matrix<T>::fillNormal(T mean, T standardDeviation, uint64_t seed, uint64_t stream)
+{
+    checkWritable(__PRETTY_FUNCTION__);
+    matrixRandom::fillNormal(m_data, static_cast<std::size_t>(m_rows) * m_columns, mean, standardDeviation, seed, stream);
 }
 
 template <class T> T matrix<T>::at(const uint32_t& row, const uint32_t& column) const
 {
-    
-    if(m_data == nullptr)
-    {
-        std::cout<<__PRETTY_FUNCTION__<<": m_data is nullptr!!!!"<<std::endl;
-        assert(false);
-    }
-    if(row > m_rows)
-    {
-        std::cout<<__PRETTY_FUNCTION__<<": row "<<row<<" is greater than number of rows "<<m_rows<<" in matrix!!!!"<<std::endl;
-        assert(false);
-    }
-    if(column > m_columns)
-    {
-        std::cout<<__PRETTY_FUNCTION__<<": column "<<column<<" is greater than number of columns "<<m_columns<<" in matrix!!!!"<<std::endl;
-        assert(false);
-    }
+    checkBounds(row, column, __PRETTY_FUNCTION__);
 
     /*
      * 1 2 3 4 5
@@ -378,16 +1128,7 @@ template <class T> T matrix<T>::at(const uint32_t& row, const uint32_t& column)
 
 template <class T> T matrix<T>::at(const uint32_t& index) const
 {
-    if(m_data == nullptr)
-    {
-        std::cout<<__PRETTY_FUNCTION__<<": m_data is nullptr!!!!"<<std::endl;
-        assert(false);
-    }
-    if(index > (m_rows*m_columns))
-    {
-        std::cout<<__PRETTY_FUNCTION__<<": index requested is greater than size of matrix!!!!"<<std::endl;
-        assert(false);
-    }
+    checkIndex(index, __PRETTY_FUNCTION__);
     
     /**
      * generally its pretty hard to visualize a 2D matrix flattened in memory,
@@ -399,16 +1140,8 @@ template <class T> T matrix<T>::at(const uint32_t& index) const
 
 template <class T> void matrix<T>::assign(T value, const uint32_t& index)
 {
-    if(m_data == nullptr)
-    {
-        std::cout<<__PRETTY_FUNCTION__<<": m_data is nullptr!!!!"<<std::endl;
-        assert(false);
-    }
-        if(index > (m_rows*m_columns))
-    {
-        std::cout<<__PRETTY_FUNCTION__<<": index requested is greater than size of matrix!!!!"<<std::endl;
-        assert(false);
-    }
+    checkIndex(index, __PRETTY_FUNCTION__);
+    checkWritable(__PRETTY_FUNCTION__);
 
     /**
      * generally its pretty hard to visualize a 2D matrix flattened in memory,
@@ -420,22 +1153,9 @@ template <class T> void matrix<T>::assign(T value, const uint32_t& index)
 
 template <class T> void matrix<T>::assign(T value, const uint32_t& row, const uint32_t& column)
 {
-    if(m_data == nullptr)
-    {
-        std::cout<<__PRETTY_FUNCTION__<<": m_data is nullptr!!!!"<<std::endl;
-        assert(false);
-    }
-    if(row > m_rows)
-    {
-        std::cout<<__PRETTY_FUNCTION__<<": row "<<row<<" is greater than number of rows "<<m_rows<<" in matrix!!!!"<<std::endl;
-        assert(false);
-    }
-    if(column > m_columns)
-    {
-        std::cout<<__PRETTY_FUNCTION__<<": column "<<column<<" is greater than number of columns "<<m_columns<<" in matrix!!!!"<<std::endl;
-        assert(false);
-    }
-    
+    checkBounds(row, column, __PRETTY_FUNCTION__);
+    checkWritable(__PRETTY_FUNCTION__);
+
     m_data[(row * m_columns) + column] = value;
 }
 
@@ -448,7 +1168,33 @@ template <class T> uint32_t matrix<T>::getNumColumns() const
     return m_columns;
 }
 
+template <class T> void matrix<T>::resize(const uint32_t& rows, const uint32_t& columns)
+{
+    // every kernel resizes its destination first
+    checkWritable(__PRETTY_FUNCTION__);
+    if(!viewFits(rows, columns, __PRETTY_FUNCTION__))
+    {
+        return;
+    }
+
+    if((rows * columns) > m_capacity)
+    {
+        deallocate(m_data);
+        m_data = allocate(rows * columns);
+    }
+
+    m_rows = rows;
+    m_columns = columns;
+}
+
 template <class T> matrix<T> matrix<T>::add(const matrix& A, const matrix& B)
+{
+    matrix<T> C(A.getNumRows(), A.getNumColumns());
+    add(A, B, C);
+    return C;
+}
+
+template <class T> void matrix<T>::add(const matrix& A, const matrix& B, matrix& C)
 {
     if(A.getNumRows() != B.getNumRows())
     {
@@ -462,17 +1208,22 @@ template <class T> matrix<T> matrix<T>::add(const matrix& A, const matrix& B)
         assert(false);
     }
 
-    matrix<T> C(A.getNumRows(), A.getNumColumns());
+    C.resize(A.getNumRows(), A.getNumColumns());
 
-    for(uint32_t iIter = 0; iIter < (A.getNumRows()*A.getNumColumns()); iIter ++)
+    forEachChunk(A.getNumRows()*A.getNumColumns(), [&A, &B, &C](std::size_t offset, std::size_t count)
     {
-        
-        C.assign(A.at(iIter) + B.at(iIter), iIter);
-    }
-    return C;
+        matrixKernels::elementwiseAdd(A.m_data + offset, B.m_data + offset, C.m_data + offset, count);
+    });
 }
 
 template <class T> matrix<T> matrix<T>::subtract(const matrix& A, const matrix& B)
+{
+    matrix<T> C(A.getNumRows(), A.getNumColumns());
+    subtract(A, B, C);
+    return C;
+}
+
+template <class T> void matrix<T>::subtract(const matrix& A, const matrix& B, matrix& C)
 {
     if(A.getNumRows() != B.getNumRows())
     {
@@ -486,14 +1237,12 @@ template <class T> matrix<T> matrix<T>::subtract(const matrix& A, const matrix&
         assert(false);
     }
 
-    matrix<T> C(A.getNumRows(), A.getNumColumns());
+    C.resize(A.getNumRows(), A.getNumColumns());
 
-    for(uint32_t iIter = 0; iIter < (A.getNumRows()*A.getNumColumns()); iIter ++)
+    forEachChunk(A.getNumRows()*A.getNumColumns(), [&A, &B, &C](std::size_t offset, std::size_t count)
     {
-        
-        C.assign(A.at(iIter) - B.at(iIter), iIter);
-    }
-    return C;
+        matrixKernels::elementwiseSubtract(A.m_data + offset, B.m_data + offset, C.m_data + offset, count);
+    });
 }
 
 template <class T> void matrix<T>::print()
@@ -513,17 +1262,29 @@ template <class T> void matrix<T>::print()
 template <class T> matrix<T> matrix<T>::scalarMultiply(const T& scalar, const matrix& A)
 {
     matrix<T> C(A.getNumRows(), A.getNumColumns());
-    
-    for(uint32_t iIter = 0; iIter < (A.getNumRows() * A.getNumColumns()); iIter ++)
-    {
-        C.assign(scalar * A.at(iIter), iIter);
-    }
-
+    scalarMultiply(scalar, A, C);
     return C;
 }
 
+template <class T> void matrix<T>::scalarMultiply(const T& scalar, const matrix& A, matrix& C)
+{
+    C.resize(A.getNumRows(), A.getNumColumns());
+
+    forEachChunk(A.getNumRows() * A.getNumColumns(), [&scalar, &A, &C](std::size_t offset, std::size_t count)
+    {
+        matrixKernels::elementwiseScale(scalar, A.m_data + offset, C.m_data + offset, count);
+    });
+}
+
 
 template <class T> matrix<T> matrix<T>::matrixMultiplication(const matrix& A, const matrix& B)
+{
+    matrix<T> C(A.getNumRows(), B.getNumColumns());
+    matrixMultiplication(A, B, C);
+    return C;
+}
+
+template <class T> void matrix<T>::matrixMultiplication(const matrix& A, const matrix& B, matrix& C)
 {
     if(A.getNumColumns() != B.getNumRows())
     {
@@ -534,7 +1295,13 @@ template <class T> matrix<T> matrix<T>::matrixMultiplication(const matrix& A, co
         assert(false);
     }
 
-    matrix<T> C(A.getNumRows(), B.getNumColumns());
+    if((&C == &A) || (&C == &B))
+    {
+        std::cout<<__PRETTY_FUNCTION__<<": destination C can not be A or B!!!!"<<std::endl;
+        assert(false);
+    }
+
+    C.resize(A.getNumRows(), B.getNumColumns());
 
     /* 
      * matrix multiplication is always the sum of the rows of A times the columns of B
@@ -556,26 +1323,27 @@ template <class T> matrix<T> matrix<T>::matrixMultiplication(const matrix& A, co
      * 5 5 5 5
      * matrix in memory looks like
      * 1 1 1 1 2 2 2 2 3 3 3 3 4 4 4 4 5 5 5 5
+     *
+     * The sum itself is done by the blocked kernel in gemmKernel.h, which 
+     * walks row major A with strides (columns, 1) and row major B with 
+     * strides (columns, 1). Tiny and vector shaped products fall back to a
+     * straight loop inside the kernel.
      */
 
-    for(uint32_t iIter = 0; iIter < A.getNumRows(); iIter++)
-    {
-        for(uint32_t jIter = 0; jIter < B.getNumColumns(); jIter++)
-        {
-            T value = 0.0f;
-            for(uint32_t kIter = 0; kIter < A.getNumColumns(); kIter++)
-            {
-                //result[(iIter * B.getNumColumns()) + jIter] += A.at(iIter, kIter) * B.at(kIter, jIter);
-                //C.assign(C.at((iIter * B.getNumColumns()) + jIter) + A.at(iIter, kIter) * B.at(kIter, jIter), (iIter * B.getNumColumns()) + jIter);
-                value += A.at(iIter,kIter) * B.at(kIter, jIter);
-            }
-            C.assign(value, iIter, jIter);
-        }
-    }
-    return C;
+    matrixKernels::gemm<T>(A.getNumRows(), B.getNumColumns(), A.getNumColumns(), T(1),
+                           A.m_data, A.getNumColumns(), 1,
+                           B.m_data, B.getNumColumns(), 1,
+                           T(0), C.m_data, C.getNumColumns());
 }
 
 template <class T> matrix<T> matrix<T>::hadamardProduct(const matrix& A, const matrix& B)
+{
+    matrix<T> C(A.getNumRows(), A.getNumColumns());
+    hadamardProduct(A, B, C);
+    return C;
+}
+
+template <class T> void matrix<T>::hadamardProduct(const matrix& A, const matrix& B, matrix& C)
 {
     if(A.getNumRows() != B.getNumRows())
     {
@@ -589,23 +1357,30 @@ template <class T> matrix<T> matrix<T>::hadamardProduct(const matrix& A, const m
         assert(false);
     }
 
-    T* tempArr = new T[A.getNumRows()*A.getNumColumns()];
-    matrix<T> C(tempArr, A.getNumRows(), A.getNumColumns());
+    C.resize(A.getNumRows(), A.getNumColumns());
 
-    for(uint32_t iIter = 0; iIter < (A.getNumRows()*A.getNumColumns()); iIter ++)
+    forEachChunk(A.getNumRows()*A.getNumColumns(), [&A, &B, &C](std::size_t offset, std::size_t count)
     {
-        
-        C.assign(A.at(iIter) * B.at(iIter), iIter);
-    }
-
-    delete[] tempArr;
-
-    return C;
+        matrixKernels::elementwiseMultiply(A.m_data + offset, B.m_data + offset, C.m_data + offset, count);
+    });
 }
 
 template <class T> matrix<T> matrix<T>::transpose(const matrix& A)
 {
     matrix<T> C(A.getNumColumns(), A.getNumRows());
+    transpose(A, C);
+    return C;
+}
+
+template <class T> void matrix<T>::transpose(const matrix& A, matrix& C)
+{
+    if(&C == &A)
+    {
+        std::cout<<__PRETTY_FUNCTION__<<": destination C can not be A!!!!"<<std::endl;
+        assert(false);
+    }
+
+    C.resize(A.getNumColumns(), A.getNumRows());
 
     /* 3 X 5
      * 3 rows, 5 columns
@@ -626,17 +1401,274 @@ template <class T> matrix<T> matrix<T>::transpose(const matrix& A)
      * 1 1 1 2 2 2 3 3 3 4 4 4 5 5 5
      */
 
-    //iIter is rows
+    // walk the matrix in square tiles, so the column-wise writes to C stay
+    // within a few cache lines instead of touching a new line every element
+    constexpr uint32_t tileSize = 32;
+
+    for(uint32_t iTile = 0; iTile < A.getNumRows(); iTile += tileSize)
+    {
+        const uint32_t iEnd = std::min(A.getNumRows(), iTile + tileSize);
+        for(uint32_t jTile = 0; jTile < A.getNumColumns(); jTile += tileSize)
+        {
+            const uint32_t jEnd = std::min(A.getNumColumns(), jTile + tileSize);
+            //iIter is rows
+            for(uint32_t iIter = iTile; iIter < iEnd; iIter++)
+            {
+                const T* rowOfA = A.m_data + (iIter * A.getNumColumns());
+                //jIter is columns
+                for(uint32_t jIter = jTile; jIter < jEnd; jIter++)
+                {
+                    C.m_data[(jIter * C.getNumColumns()) + iIter] = rowOfA[jIter];
+                }
+            }
+        }
+    }
+}
+
+template <class T> void matrix<T>::axpy(const T& alpha, const matrix& X, matrix& Y)
+{
+    Y.checkWritable(__PRETTY_FUNCTION__);
+
+    if(X.getNumRows() != Y.getNumRows())
+    {
+        std::cout<<__PRETTY_FUNCTION__<<": rows of the matrices must be equal!!!!"<<std::endl;
+        assert(false);
+    }
+
+    if(X.getNumColumns() != Y.getNumColumns())
+    {
+        std::cout<<__PRETTY_FUNCTION__<<": columns of the matrices must be equal!!!!"<<std::endl;
+        assert(false);
+    }
+
+    forEachChunk(X.getNumRows()*X.getNumColumns(), [&alpha, &X, &Y](std::size_t offset, std::size_t count)
+    {
+        matrixKernels::elementwiseAxpy(alpha, X.m_data + offset, Y.m_data + offset, count);
+    });
+}
+
+template <class T> void matrix<T>::rankOneUpdate(const T& alpha, const matrix& x, const matrix& y, matrix& A)
+{
+    A.checkWritable(__PRETTY_FUNCTION__);
+
+    if((x.getNumRows() != A.getNumRows()) || (x.getNumColumns() != 1))
+    {
+        std::cout<<__PRETTY_FUNCTION__<<": x must be a column vector with as many rows as A!!!!"<<std::endl;
+        assert(false);
+    }
+
+    if((y.getNumRows() != A.getNumColumns()) || (y.getNumColumns() != 1))
+    {
+        std::cout<<__PRETTY_FUNCTION__<<": y must be a column vector with as many rows as A has columns!!!!"<<std::endl;
+        assert(false);
+    }
+
+    // row i of A gets alpha * x[i] times y^T added to it
     for(uint32_t iIter = 0; iIter < A.getNumRows(); iIter++)
     {
-        //jIter is columns
-        for(uint32_t jIter = 0; jIter < A.getNumColumns(); jIter++)
+        matrixKernels::elementwiseAxpy(static_cast<T>(alpha * x.m_data[iIter]), y.m_data, A.m_data + (iIter * A.getNumColumns()), A.getNumColumns());
+    }
+}
+
+template <class T> void matrix<T>::matrixMultiplication(const T& alpha, const matrix& A, bool transposeA, const matrix& B, bool transposeB, const T& beta, matrix& C)
+{
+    const uint32_t rowsOfOpA = transposeA ? A.getNumColumns() : A.getNumRows();
+    const uint32_t innerOfOpA = transposeA ? A.getNumRows() : A.getNumColumns();
+    const uint32_t innerOfOpB = transposeB ? B.getNumColumns() : B.getNumRows();
+    const uint32_t columnsOfOpB = transposeB ? B.getNumRows() : B.getNumColumns();
+
+    if(innerOfOpA != innerOfOpB)
+    {
+        std::cout<<__PRETTY_FUNCTION__<<": columns of op(A) and rows of op(B) must be equal!!!!"<<std::endl;
+        std::cout<<__PRETTY_FUNCTION__<<": columns of op(A) are "<<innerOfOpA<<std::endl;
+        std::cout<<__PRETTY_FUNCTION__<<": rows of op(B) are "<<innerOfOpB<<std::endl;
+
+        assert(false);
+    }
+
+    if((&C == &A) || (&C == &B))
+    {
+        std::cout<<__PRETTY_FUNCTION__<<": destination C can not be A or B!!!!"<<std::endl;
+        assert(false);
+    }
+
+    C.checkWritable(__PRETTY_FUNCTION__);
+    if(beta == T(0))
+    {
+        C.resize(rowsOfOpA, columnsOfOpB);
+    }
+    else if((C.getNumRows() != rowsOfOpA) || (C.getNumColumns() != columnsOfOpB))
+    {
+        std::cout<<__PRETTY_FUNCTION__<<": C must be rows of op(A) by columns of op(B) when beta is not 0!!!!"<<std::endl;
+        assert(false);
+    }
+
+    // A^T(i, k) is A(k, i), so transposing an operand just swaps its strides
+    const ptrdiff_t rowStrideA = transposeA ? 1 : A.getNumColumns();
+    const ptrdiff_t columnStrideA = transposeA ? A.getNumColumns() : 1;
+    const ptrdiff_t rowStrideB = transposeB ? 1 : B.getNumColumns();
+    const ptrdiff_t columnStrideB = transposeB ? B.getNumColumns() : 1;
+
+    matrixKernels::gemm<T>(rowsOfOpA, columnsOfOpB, innerOfOpA, alpha,
+                           A.m_data, rowStrideA, columnStrideA,
+                           B.m_data, rowStrideB, columnStrideB,
+                           beta, C.m_data, C.getNumColumns());
+}
+
+template <class T> void matrix<T>::rowSums(const matrix& A, matrix& C)
+{
+    if(&C == &A)
+    {
+        std::cout<<__PRETTY_FUNCTION__<<": destination C can not be A!!!!"<<std::endl;
+        assert(false);
+    }
+
+    C.resize(A.getNumRows(), 1);
+
+    if(matrixKernels::useWideAccumulator<T>())
+    {
+        rowSumsIn<typename matrixKernels::wideAccumulator<T>::type>(A, C);
+    }
+    else
+    {
+        rowSumsIn<T>(A, C);
+    }
+}
+
+template <class T> void matrix<T>::sigmoidLayerBackward(const matrix& output, const matrix& gradient, const matrix& input, const T& learningRate,
+                                                        matrix& weights, matrix& biases, matrix& delta, matrix* propagatedGradient)
+{
+    weights.checkWritable(__PRETTY_FUNCTION__);
+    biases.checkWritable(__PRETTY_FUNCTION__);
+
+    if((output.getNumRows() != weights.getNumRows()) || (gradient.getNumRows() != weights.getNumRows()) || (biases.getNumRows() != weights.getNumRows()))
+    {
+        std::cout<<__PRETTY_FUNCTION__<<": output, gradient and biases must have as many rows as weights!!!!"<<std::endl;
+        assert(false);
+    }
+
+    if(input.getNumRows() != weights.getNumColumns())
+    {
+        std::cout<<__PRETTY_FUNCTION__<<": input must have as many rows as weights has columns!!!!"<<std::endl;
+        assert(false);
+    }
+
+    if((output.getNumColumns() != 1) || (gradient.getNumColumns() != 1) || (input.getNumColumns() != 1) || (biases.getNumColumns() != 1))
+    {
+        std::cout<<__PRETTY_FUNCTION__<<": output, gradient, input and biases must be column vectors!!!!"<<std::endl;
+        assert(false);
+    }
+
+    const uint32_t numNeurons = weights.getNumRows();
+    const uint32_t numInputs = weights.getNumColumns();
+
+    delta.resize(numNeurons, 1);
+    if(propagatedGradient != nullptr)
+    {
+        propagatedGradient->resize(numInputs, 1);
+        propagatedGradient->fillZeros();
+    }
+
+    for(uint32_t iIter = 0; iIter < numNeurons; iIter++)
+    {
+        // sigmoid'(z) = sigmoid(z) * (1 - sigmoid(z)), and output already is sigmoid(z)
+        const T outputValue = output.m_data[iIter];
+        const T deltaValue = outputValue * (T(1) - outputValue) * gradient.m_data[iIter];
+        delta.m_data[iIter] = deltaValue;
+
+        T* rowOfWeights = weights.m_data + (iIter * numInputs);
+
+        // row i of W^T * delta is delta[i] times row i of W, taken before the row is updated
+        if(propagatedGradient != nullptr)
         {
-            C.assign(A.at(iIter, jIter), jIter, iIter);
-        }       
+            matrixKernels::elementwiseAxpy(deltaValue, rowOfWeights, propagatedGradient->m_data, numInputs);
+        }
+
+        // row i of W -= learningRate * delta[i] * input^T
+        matrixKernels::elementwiseAxpy(static_cast<T>(-learningRate * deltaValue), input.m_data, rowOfWeights, numInputs);
+        biases.m_data[iIter] -= learningRate * deltaValue;
     }
+}
 
-    return C;
+template <class T> void matrix<T>::activate(matrixKernels::activationFunction function, matrixKernels::activationMode mode, const matrix& Z, matrix& Y, const T& leak)
+{
+    Y.resize(Z.getNumRows(), Z.getNumColumns());
+
+    // softmax layers are narrow, a single pass over the block is plenty
+    if(function == matrixKernels::activationFunction::softmax)
+    {
+        matrixKernels::softmaxForward(mode, Z.m_data, Y.m_data, Z.m_rows, Z.m_columns);
+        return;
+    }
+
+    const T slope = (function == matrixKernels::activationFunction::relu) ? T(0) : leak;
+    forEachChunk(Z.getNumRows()*Z.getNumColumns(), [function, mode, slope, &Z, &Y](std::size_t offset, std::size_t count)
+    {
+        matrixKernels::activationForward(function, mode, slope, Z.m_data + offset, Y.m_data + offset, count);
+    });
+}
+
+template <class T> void matrix<T>::activationDerivative(matrixKernels::activationFunction function, const matrix& Y, const matrix& gradient, matrix& delta, const T& leak)
+{
+    if((Y.getNumRows() != gradient.getNumRows()) || (Y.getNumColumns() != gradient.getNumColumns()))
+    {
+        std::cout<<__PRETTY_FUNCTION__<<": activations and gradient must have the same shape!!!!"<<std::endl;
+        assert(false);
+    }
+
+    delta.resize(Y.getNumRows(), Y.getNumColumns());
+
+    if(function == matrixKernels::activationFunction::softmax)
+    {
+        matrixKernels::softmaxBackward(Y.m_data, gradient.m_data, delta.m_data, Y.m_rows, Y.m_columns);
+        return;
+    }
+
+    const T slope = (function == matrixKernels::activationFunction::relu) ? T(0) : leak;
+    forEachChunk(Y.getNumRows()*Y.getNumColumns(), [function, slope, &Y, &gradient, &delta](std::size_t offset, std::size_t count)
+    {
+        matrixKernels::activationBackward(function, slope, Y.m_data + offset, gradient.m_data + offset, delta.m_data + offset, count);
+    });
+}
+
+template <class T> void matrix<T>::addInPlace(const matrix& B)
+{
+    add(*this, B, *this);
+}
+
+template <class T> void matrix<T>::subtractInPlace(const matrix& B)
+{
+    subtract(*this, B, *this);
+}
+
+template <class T> void matrix<T>::scaleInPlace(const T& scalar)
+{
+    scalarMultiply(scalar, *this, *this);
+}
+
+template <class T> void matrix<T>::hadamardInPlace(const matrix& B)
+{
+    hadamardProduct(*this, B, *this);
+}
+
+template <class T> void matrix<T>::addToEachColumn(const matrix& columnVector)
+{
+    if((columnVector.getNumRows() != m_rows) || (columnVector.getNumColumns() != 1))
+    {
+        std::cout<<__PRETTY_FUNCTION__<<": columnVector must be a column vector with as many rows as this matrix!!!!"<<std::endl;
+        assert(false);
+    }
+    checkWritable(__PRETTY_FUNCTION__);
+
+    for(uint32_t iIter = 0; iIter < m_rows; iIter++)
+    {
+        T* rowOfThis = m_data + (iIter * m_columns);
+        const T value = columnVector.m_data[iIter];
+        for(uint32_t jIter = 0; jIter < m_columns; jIter++)
+        {
+            rowOfThis[jIter] += value;
+        }
+    }
 }
 
 #endif //MATRIX_H
\ No newline at end of file
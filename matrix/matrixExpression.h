@@ -0,0 +1,260 @@
+/**
+ * Expression templates for lazily evaluated, fused element-wise matrix math.
+ * Copyright (C) 2024  Matthew Hardenburgh, matthew@hardenburgh.io
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef MATRIX_EXPRESSION_H
+#define MATRIX_EXPRESSION_H
+
+#include <stdint.h>
+#include <cassert>
+#include <iostream>
+
+/*
+ * Writing
+ *
+ *     delta = hadamard(hadamard(a, 1.0 - a), a - label);
+ *
+ * does not compute anything until the assignment. The operators only build a
+ * small tree of nodes that remember their operands, and assigning the tree to
+ * a matrix runs one loop that evaluates the whole tree per element:
+ *
+ *     delta[i] = (a[i] * (1.0 - a[i])) * (a[i] - label[i])
+ *
+ * One pass over memory and no temporaries, instead of one pass and one
+ * temporary per operation. Matrices are held by reference inside the tree and
+ * sub-expressions by value, so an expression must be assigned before the
+ * matrices it refers to go away (do not store one with auto).
+ *
+ * Only element-wise operations are lazy. matrix * matrix is not an operator,
+ * use matrix::matrixMultiplication for that.
+ */
+
+template <class T> class matrix;
+
+/**
+ * @brief base of every node of an expression tree, including matrix itself
+ * @details E is the concrete node type (CRTP). Every node provides
+ *          getNumRows(), getNumColumns() and evaluate(index), and a valueType
+*/
+template <class E> class matrixExpression
+{
+    public:
+        /**
+         * @brief the concrete node
+         * @return this, as the concrete node type
+        */
+        const E& self() const
+        {
+            return static_cast<const E&>(*this);
+        }
+};
+
+/**
+ * @brief how a node stores an operand. Matrices by reference, so the tree
+ *        never copies data, sub-expressions by value since they are
+ *        temporaries that die at the end of the full expression
+*/
+template <class E> struct expressionOperand
+{
+    using type = const E;
+};
+
+template <class T> struct expressionOperand<matrix<T>>
+{
+    using type = const matrix<T>&;
+};
+
+struct expressionAdd
+{
+    template <class T> static T apply(const T& a, const T& b)
+    {
+        return a + b;
+    }
+};
+
+struct expressionSubtract
+{
+    template <class T> static T apply(const T& a, const T& b)
+    {
+        return a - b;
+    }
+};
+
+struct expressionMultiply
+{
+    template <class T> static T apply(const T& a, const T& b)
+    {
+        return a * b;
+    }
+};
+
+/**
+ * @brief element-wise operation between two expressions of the same shape
+*/
+template <class L, class R, class Op> class binaryExpression : public matrixExpression<binaryExpression<L, R, Op>>
+{
+    public:
+        using valueType = typename L::valueType;
+
+        binaryExpression(const L& left, const R& right) : m_left(left), m_right(right)
+        {
+            if(left.getNumRows() != right.getNumRows())
+            {
+                std::cout<<__PRETTY_FUNCTION__<<": rows of the matrices must be equal!!!!"<<std::endl;
+                assert(false);
+            }
+
+            if(left.getNumColumns() != right.getNumColumns())
+            {
+                std::cout<<__PRETTY_FUNCTION__<<": columns of the matrices must be equal!!!!"<<std::endl;
+                assert(false);
+            }
+        }
+
+        uint32_t getNumRows() const
+        {
+            return m_left.getNumRows();
+        }
+
+        uint32_t getNumColumns() const
+        {
+            return m_left.getNumColumns();
+        }
+
+        valueType evaluate(const uint32_t& index) const
+        {
+            return Op::apply(m_left.evaluate(index), m_right.evaluate(index));
+        }
+
+    private:
+        typename expressionOperand<L>::type m_left;
+        typename expressionOperand<R>::type m_right;
+};
+
+/**
+ * @brief element-wise operation between an expression and a scalar
+ * @details scalarOnLeft picks between scalar op expression and
+ *          expression op scalar, which matters for subtraction
+*/
+template <class E, class Op, bool scalarOnLeft> class scalarExpression : public matrixExpression<scalarExpression<E, Op, scalarOnLeft>>
+{
+    public:
+        using valueType = typename E::valueType;
+
+        scalarExpression(const E& expression, const valueType& scalar) : m_expression(expression), m_scalar(scalar)
+        {
+
+        }
+
+        uint32_t getNumRows() const
+        {
+            return m_expression.getNumRows();
+        }
+
+        uint32_t getNumColumns() const
+        {
+            return m_expression.getNumColumns();
+        }
+
+        valueType evaluate(const uint32_t& index) const
+        {
+            if constexpr (scalarOnLeft)
+            {
+                return Op::apply(m_scalar, m_expression.evaluate(index));
+            }
+            return Op::apply(m_expression.evaluate(index), m_scalar);
+        }
+
+    private:
+        typename expressionOperand<E>::type m_expression;
+        valueType m_scalar;
+};
+
+/**
+ * @brief lazy element-wise sum, A + B
+*/
+template <class L, class R> binaryExpression<L, R, expressionAdd> operator+(const matrixExpression<L>& A, const matrixExpression<R>& B)
+{
+    return binaryExpression<L, R, expressionAdd>(A.self(), B.self());
+}
+
+/**
+ * @brief lazy element-wise difference, A - B
+*/
+template <class L, class R> binaryExpression<L, R, expressionSubtract> operator-(const matrixExpression<L>& A, const matrixExpression<R>& B)
+{
+    return binaryExpression<L, R, expressionSubtract>(A.self(), B.self());
+}
+
+/**
+ * @brief lazy component-wise product, A .* B
+*/
+template <class L, class R> binaryExpression<L, R, expressionMultiply> hadamard(const matrixExpression<L>& A, const matrixExpression<R>& B)
+{
+    return binaryExpression<L, R, expressionMultiply>(A.self(), B.self());
+}
+
+/**
+ * @brief lazy scalar multiply, s * A
+*/
+template <class E> scalarExpression<E, expressionMultiply, true> operator*(const typename E::valueType& scalar, const matrixExpression<E>& A)
+{
+    return scalarExpression<E, expressionMultiply, true>(A.self(), scalar);
+}
+
+/**
+ * @brief lazy scalar multiply, A * s
+*/
+template <class E> scalarExpression<E, expressionMultiply, false> operator*(const matrixExpression<E>& A, const typename E::valueType& scalar)
+{
+    return scalarExpression<E, expressionMultiply, false>(A.self(), scalar);
+}
+
+/**
+ * @brief lazy scalar broadcast addition, s + A
+*/
+template <class E> scalarExpression<E, expressionAdd, true> operator+(const typename E::valueType& scalar, const matrixExpression<E>& A)
+{
+    return scalarExpression<E, expressionAdd, true>(A.self(), scalar);
+}
+
+/**
+ * @brief lazy scalar broadcast addition, A + s
+*/
+template <class E> scalarExpression<E, expressionAdd, false> operator+(const matrixExpression<E>& A, const typename E::valueType& scalar)
+{
+    return scalarExpression<E, expressionAdd, false>(A.self(), scalar);
+}
+
+/**
+ * @brief lazy scalar broadcast subtraction, s - A. 1 - A replaces a matrix
+ *        full of ones
+*/
+template <class E> scalarExpression<E, expressionSubtract, true> operator-(const typename E::valueType& scalar, const matrixExpression<E>& A)
+{
+    return scalarExpression<E, expressionSubtract, true>(A.self(), scalar);
+}
+
+/**
+ * @brief lazy scalar broadcast subtraction, A - s
+*/
+template <class E> scalarExpression<E, expressionSubtract, false> operator-(const matrixExpression<E>& A, const typename E::valueType& scalar)
+{
+    return scalarExpression<E, expressionSubtract, false>(A.self(), scalar);
+}
+
+#endif //MATRIX_EXPRESSION_H
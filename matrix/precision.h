@@ -0,0 +1,173 @@
+/**
+ * Reduced precision storage and the accumulation precision of the kernels.
+ * Copyright (C) 2024  Matthew Hardenburgh, matthew@hardenburgh.io
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef PRECISION_H
+#define PRECISION_H
+
+#include <stdint.h>
+#include <cstddef>
+#include <cstring>
+#include <atomic>
+#include <type_traits>
+
+/*
+ * Three precisions are in play when a network trains in float:
+ *
+ *  - storage, the type of the matrices themselves, float or double. Weights
+ *    can also be kept as bfloat16 for the forward pass, which halves the
+ *    bytes a matrix-vector product streams through
+ *  - arithmetic, always the element type, bfloat16 is widened to float as
+ *    gemm packs it
+ *  - accumulation, the type long sums (gemm dot products, rowSums) are
+ *    carried in. native keeps the element type, wide carries float sums in
+ *    double and rounds once at the end. double is never widened
+ *
+ * The accumulation precision is a process wide setting like the simd level,
+ * see setAccumulation().
+ */
+namespace matrixKernels
+{
+    /**
+     * @brief brain floating point, the top 16 bits of an IEEE float: the same
+     *        8 bit exponent and range, 7 bits of mantissa
+    */
+    struct bfloat16
+    {
+        uint16_t bits;
+
+        bfloat16() = default;
+
+        /**
+         * @brief round a float to the nearest bfloat16, ties to even. NaN
+         *        stays a quiet NaN instead of rounding into infinity
+        */
+        explicit bfloat16(float value)
+        {
+            uint32_t word;
+            std::memcpy(&word, &value, sizeof(word));
+            if((word & 0x7fffffffu) > 0x7f800000u)
+            {
+                bits = static_cast<uint16_t>((word >> 16) | 0x0040u);
+                return;
+            }
+            word += 0x7fffu + ((word >> 16) & 1u);
+            bits = static_cast<uint16_t>(word >> 16);
+        }
+
+        /**
+         * @brief widen to float, exact
+        */
+        explicit operator float() const
+        {
+            const uint32_t word = static_cast<uint32_t>(bits) << 16;
+            float value;
+            std::memcpy(&value, &word, sizeof(value));
+            return value;
+        }
+
+        explicit operator double() const
+        {
+            return static_cast<float>(*this);
+        }
+    };
+
+    /**
+     * @brief round size values to bfloat16
+     * @param in values to round
+     * @param out destination, size values
+     * @param size number of values
+    */
+    template <class T> void convertToBfloat16(const T* in, bfloat16* out, size_t size)
+    {
+        for(size_t iIter = 0; iIter < size; iIter++)
+        {
+            out[iIter] = bfloat16(static_cast<float>(in[iIter]));
+        }
+    }
+
+    /**
+     * @brief how a layer keeps the weights its forward pass reads
+    */
+    enum class weightStorage : uint32_t
+    {
+        native = 0,
+        bf16 = 1
+    };
+
+    /**
+     * @brief precision long sums are carried in
+    */
+    enum class accumulation : uint32_t
+    {
+        native = 0,
+        wide = 1
+    };
+
+    /**
+     * @brief storage for the active accumulation precision
+    */
+    inline std::atomic<uint32_t>& accumulationState()
+    {
+        static std::atomic<uint32_t> state(static_cast<uint32_t>(accumulation::native));
+        return state;
+    }
+
+    /**
+     * @brief accumulation precision the kernels currently use
+     * @return the active accumulation precision
+    */
+    inline accumulation activeAccumulation()
+    {
+        return static_cast<accumulation>(accumulationState().load(std::memory_order_relaxed));
+    }
+
+    /**
+     * @brief make float sums accumulate in float (native) or double (wide)
+     * @details like setSimdLevel(), meant to be set once before the kernels
+     *          run, not while they do
+     * @param precision requested accumulation precision
+    */
+    inline void setAccumulation(accumulation precision)
+    {
+        accumulationState().store(static_cast<uint32_t>(precision), std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief type a wide sum of T is carried in, double for float, T itself
+     *        for everything else
+    */
+    template <class T> struct wideAccumulator
+    {
+        using type = T;
+    };
+
+    template <> struct wideAccumulator<float>
+    {
+        using type = double;
+    };
+
+    /**
+     * @brief whether sums of T should be carried in wideAccumulator<T> right now
+    */
+    template <class T> bool useWideAccumulator()
+    {
+        return !std::is_same<typename wideAccumulator<T>::type, T>::value && (activeAccumulation() == accumulation::wide);
+    }
+}
+
+#endif //PRECISION_H
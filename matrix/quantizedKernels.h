@@ -0,0 +1,263 @@
+/**
+ * Integer dot product kernels for int8 quantized inference.
+ * Copyright (C) 2024  Matthew Hardenburgh, matthew@hardenburgh.io
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef QUANTIZED_KERNELS_H
+#define QUANTIZED_KERNELS_H
+
+#include <stdint.h>
+#include <cstddef>
+#include <algorithm>
+
+#include "simdKernels.h"
+
+/*
+ * A quantized layer multiplies int8 weights, one row per neuron, with uint8
+ * activations and sums in int32:
+ *
+ *     out[r] = sum over k of weights[r][k] * activations[k]
+ *
+ * Rows and activation vectors are padded with zeros to a multiple of
+ * quantizedRowAlignment bytes so every kernel works in whole 16 byte steps.
+ * A product is at most 255 * 128, a row of 784 inputs sums to well inside
+ * int32, so nothing saturates and every variant gives the same integers:
+ *
+ * avx512vnni  vpdpbusd, 64 uint8 x int8 products summed into 16 int32 lanes
+ *             per instruction, the last partial step with a masked load
+ * avx2        both operands widened to int16 and summed in pairs with
+ *             vpmaddwd. vpmaddubsw would do 32 at once but saturates at
+ *             int16, which 255 * 127 * 2 already overflows
+ * scalar      a plain int32 loop, for every other CPU
+ *
+ * The widest one the CPU has is picked within the active simd level, see
+ * setSimdLevel(). VNNI is a separate CPUID bit from avx512f, so the avx512
+ * level without it runs the avx2 kernel.
+ */
+namespace matrixKernels
+{
+    /**
+     * @brief quantized rows and activation vectors are padded to this many bytes
+    */
+    static constexpr uint32_t quantizedRowAlignment = 16;
+
+    /**
+     * @brief length of a padded row for numInputs inputs
+    */
+    inline uint32_t quantizedPaddedLength(uint32_t numInputs)
+    {
+        return ((numInputs + quantizedRowAlignment - 1) / quantizedRowAlignment) * quantizedRowAlignment;
+    }
+
+    /**
+     * @brief out[r] = weights row r . activations for numRows rows
+     * @param weights numRows x paddedLength int8, row major
+     * @param numRows rows of weights
+     * @param paddedLength length of a row, a multiple of quantizedRowAlignment
+     * @param activations paddedLength uint8
+     * @param out numRows int32
+    */
+    inline void quantizedRowDotsScalar(const int8_t* weights, uint32_t numRows, uint32_t paddedLength, const uint8_t* activations, int32_t* out)
+    {
+        for(uint32_t rIter = 0; rIter < numRows; rIter++)
+        {
+            const int8_t* rowOfWeights = weights + (static_cast<size_t>(rIter) * paddedLength);
+            int32_t sum = 0;
+            for(uint32_t kIter = 0; kIter < paddedLength; kIter++)
+            {
+                sum += static_cast<int32_t>(rowOfWeights[kIter]) * static_cast<int32_t>(activations[kIter]);
+            }
+            out[rIter] = sum;
+        }
+    }
+
+#if MATRIX_SIMD_X86
+    /*
+     * A block of rows shares every load of the activations. The number of
+     * rows is a template parameter so the accumulators stay in registers, a
+     * run time count spills them to the stack.
+     */
+
+    // out[r] = sum of the lanes of sums[r], four rows share the additions
+    template <uint32_t rows> __attribute__((target("avx2"), always_inline)) inline void horizontalSumsAvx2(const __m256i* sums, int32_t* out)
+    {
+        if constexpr(rows == 4)
+        {
+            const __m256i pairs = _mm256_hadd_epi32(_mm256_hadd_epi32(sums[0], sums[1]), _mm256_hadd_epi32(sums[2], sums[3]));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm_add_epi32(_mm256_castsi256_si128(pairs), _mm256_extracti128_si256(pairs, 1)));
+        }
+        else
+        {
+            for(uint32_t rIter = 0; rIter < rows; rIter++)
+            {
+                __m128i sum = _mm_add_epi32(_mm256_castsi256_si128(sums[rIter]), _mm256_extracti128_si256(sums[rIter], 1));
+                sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0x4e));
+                sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0xb1));
+                out[rIter] = _mm_cvtsi128_si32(sum);
+            }
+        }
+    }
+
+    template <uint32_t rows> __attribute__((target("avx2"), always_inline)) inline void quantizedRowBlockAvx2(const int8_t* weights, uint32_t paddedLength, const uint8_t* activations, int32_t* out)
+    {
+        __m256i sums[rows];
+        for(uint32_t rIter = 0; rIter < rows; rIter++)
+        {
+            sums[rIter] = _mm256_setzero_si256();
+        }
+
+        for(uint32_t kIter = 0; kIter < paddedLength; kIter += quantizedRowAlignment)
+        {
+            const __m256i wideActivations = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(activations + kIter)));
+            for(uint32_t rIter = 0; rIter < rows; rIter++)
+            {
+                const int8_t* rowOfWeights = weights + (static_cast<size_t>(rIter) * paddedLength);
+                const __m256i wideWeights = _mm256_cvtepi8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(rowOfWeights + kIter)));
+                sums[rIter] = _mm256_add_epi32(sums[rIter], _mm256_madd_epi16(wideActivations, wideWeights));
+            }
+        }
+
+        horizontalSumsAvx2<rows>(sums, out);
+    }
+
+    __attribute__((target("avx2"))) inline void quantizedRowDotsAvx2(const int8_t* weights, uint32_t numRows, uint32_t paddedLength, const uint8_t* activations, int32_t* out)
+    {
+        uint32_t rIter = 0;
+        for(; rIter + 4 <= numRows; rIter += 4)
+        {
+            quantizedRowBlockAvx2<4>(weights + (static_cast<size_t>(rIter) * paddedLength), paddedLength, activations, out + rIter);
+        }
+        for(; rIter < numRows; rIter++)
+        {
+            quantizedRowBlockAvx2<1>(weights + (static_cast<size_t>(rIter) * paddedLength), paddedLength, activations, out + rIter);
+        }
+    }
+
+    template <uint32_t rows> __attribute__((target("avx512f,avx512bw,avx512vnni"), always_inline)) inline void quantizedRowBlockAvx512Vnni(const int8_t* weights, uint32_t paddedLength, const uint8_t* activations, int32_t* out)
+    {
+        __m512i sums[rows];
+        for(uint32_t rIter = 0; rIter < rows; rIter++)
+        {
+            sums[rIter] = _mm512_setzero_si512();
+        }
+
+        for(uint32_t kIter = 0; kIter < paddedLength; kIter += 64)
+        {
+            // all ones except in the last step of a row that is not a multiple of 64
+            const uint32_t remaining = paddedLength - kIter;
+            const __mmask64 mask = (remaining >= 64) ? ~__mmask64(0) : ((__mmask64(1) << remaining) - 1);
+            const __m512i activationBytes = _mm512_maskz_loadu_epi8(mask, activations + kIter);
+            for(uint32_t rIter = 0; rIter < rows; rIter++)
+            {
+                const int8_t* rowOfWeights = weights + (static_cast<size_t>(rIter) * paddedLength);
+                sums[rIter] = _mm512_dpbusd_epi32(sums[rIter], activationBytes, _mm512_maskz_loadu_epi8(mask, rowOfWeights + kIter));
+            }
+        }
+
+        // the masked extracts, the plain ones and _mm512_reduce_add_epi32 trip
+        // -Wmaybe-uninitialized in GCC 12
+        __m256i halves[rows];
+        for(uint32_t rIter = 0; rIter < rows; rIter++)
+        {
+            halves[rIter] = _mm256_add_epi32(_mm512_maskz_extracti64x4_epi64(0xff, sums[rIter], 0), _mm512_maskz_extracti64x4_epi64(0xff, sums[rIter], 1));
+        }
+        horizontalSumsAvx2<rows>(halves, out);
+    }
+
+    __attribute__((target("avx512f,avx512bw,avx512vnni"))) inline void quantizedRowDotsAvx512Vnni(const int8_t* weights, uint32_t numRows, uint32_t paddedLength, const uint8_t* activations, int32_t* out)
+    {
+        uint32_t rIter = 0;
+        for(; rIter + 4 <= numRows; rIter += 4)
+        {
+            quantizedRowBlockAvx512Vnni<4>(weights + (static_cast<size_t>(rIter) * paddedLength), paddedLength, activations, out + rIter);
+        }
+        for(; rIter < numRows; rIter++)
+        {
+            quantizedRowBlockAvx512Vnni<1>(weights + (static_cast<size_t>(rIter) * paddedLength), paddedLength, activations, out + rIter);
+        }
+    }
+#endif //MATRIX_SIMD_X86
+
+    /**
+     * @brief whether this CPU has the 512 bit VNNI instructions
+    */
+    inline bool detectAvx512Vnni()
+    {
+#if MATRIX_SIMD_X86
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx512vnni") && __builtin_cpu_supports("avx512bw");
+#else
+        return false;
+#endif
+    }
+
+    /**
+     * @brief the row dot product kernel for the active simd level
+    */
+    inline auto activeQuantizedRowDots() -> void (*)(const int8_t*, uint32_t, uint32_t, const uint8_t*, int32_t*)
+    {
+#if MATRIX_SIMD_X86
+        static const bool hasVnni = detectAvx512Vnni();
+        switch(activeSimdLevel())
+        {
+            case simdLevel::avx512: return hasVnni ? &quantizedRowDotsAvx512Vnni : &quantizedRowDotsAvx2;
+            case simdLevel::avx2:   return &quantizedRowDotsAvx2;
+            default:                break;
+        }
+#endif
+        return &quantizedRowDotsScalar;
+    }
+
+    /**
+     * @brief name of the row dot product kernel for the active simd level
+    */
+    inline const char* activeQuantizedRowDotsName()
+    {
+        const auto kernel = activeQuantizedRowDots();
+#if MATRIX_SIMD_X86
+        if(kernel == &quantizedRowDotsAvx512Vnni)
+        {
+            return "avx512vnni";
+        }
+        if(kernel == &quantizedRowDotsAvx2)
+        {
+            return "avx2";
+        }
+#endif
+        return (kernel == &quantizedRowDotsScalar) ? "scalar" : "unknown";
+    }
+
+    /**
+     * @brief quantized matrix-matrix product, one sample per row:
+     *        out[b][r] = weights row r . activations row b
+     * @param weights numRows x paddedLength int8
+     * @param numRows rows of weights, neurons of the layer
+     * @param paddedLength length of a row of weights and of activations
+     * @param activations numSamples x paddedLength uint8
+     * @param numSamples samples in the batch
+     * @param out numSamples x numRows int32
+    */
+    inline void quantizedGemm(const int8_t* weights, uint32_t numRows, uint32_t paddedLength, const uint8_t* activations, uint32_t numSamples, int32_t* out)
+    {
+        const auto rowDots = activeQuantizedRowDots();
+        for(uint32_t bIter = 0; bIter < numSamples; bIter++)
+        {
+            rowDots(weights, numRows, paddedLength, activations + (static_cast<size_t>(bIter) * paddedLength), out + (static_cast<size_t>(bIter) * numRows));
+        }
+    }
+}
+
+#endif //QUANTIZED_KERNELS_H
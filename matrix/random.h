@@ -0,0 +1,457 @@
+/**
+ * Random number engines, parallel random fills and epoch sampling.
+ * Copyright (C) 2024  Matthew Hardenburgh, matthew@hardenburgh.io
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef MATRIX_RANDOM_H
+#define MATRIX_RANDOM_H
+
+#include <stdint.h>
+#include <cassert>
+#include <cmath>
+#include <cstddef>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <iostream>
+#include <memory>
+#include <numeric>
+#include <type_traits>
+#include <vector>
+
+#include "threadPool.h"
+
+/*
+ * Two kinds of generator, for two kinds of job.
+ *
+ * xoshiro256 is a small, fast sequential engine, one per thread. It works
+ * with the <random> distributions, and jump() moves it 2^128 draws ahead, so
+ * stream s of a seed never overlaps another stream of that seed.
+ *
+ * philox4x32 is counter based: block n of (seed, stream) is a pure function
+ * of the three, with no state to carry from one block to the next. fillUniform()
+ * and fillNormal() use it to give element i the same value whether one
+ * thread fills the whole range or the thread pool splits it, which makes
+ * parallel initialization reproducible.
+ *
+ * matrix::fillRandom() without a seed takes the process wide default seed,
+ * set with setDefaultSeed(), and a new stream on every call, so two matrices
+ * filled one after the other differ while a run with the same seed repeats
+ * itself.
+ *
+ * epochSampler visits every sample exactly once per epoch in a shuffled
+ * order that depends only on the seed and the epoch number. Worker w of W
+ * takes slice w of each epoch, so workers share no state and never pick the
+ * same sample within an epoch.
+ */
+namespace matrixRandom
+{
+    /**
+     * @brief one step of splitmix64, spreads a seed over 64 well mixed bits
+     * @param state advanced by the step
+     * @return the mixed value
+    */
+    inline uint64_t splitMix64(uint64_t& state)
+    {
+        uint64_t value = (state += 0x9e3779b97f4a7c15ull);
+        value = (value ^ (value >> 30)) * 0xbf58476d1ce4e5b9ull;
+        value = (value ^ (value >> 27)) * 0x94d049bb133111ebull;
+        return value ^ (value >> 31);
+    }
+
+    /**
+     * @brief xoshiro256++, a uniform random bit generator for <random>
+    */
+    class xoshiro256
+    {
+        public:
+            using result_type = uint64_t;
+
+            /**
+             * @brief seed the engine
+             * @param seed any value, spread over the 256 bit state with splitmix64
+             * @param stream jumps the engine stream * 2^128 draws ahead, one
+             *        stream per thread keeps the threads apart
+            */
+            explicit xoshiro256(uint64_t seed = 0, uint64_t stream = 0)
+            {
+                for(uint64_t& word : m_state)
+                {
+                    word = splitMix64(seed);
+                }
+                for(uint64_t sIter = 0; sIter < stream; sIter++)
+                {
+                    jump();
+                }
+            }
+
+            static constexpr result_type min() { return 0; }
+            static constexpr result_type max() { return ~result_type(0); }
+
+            result_type operator()()
+            {
+                const uint64_t result = rotateLeft(m_state[0] + m_state[3], 23) + m_state[0];
+                const uint64_t shifted = m_state[1] << 17;
+                m_state[2] ^= m_state[0];
+                m_state[3] ^= m_state[1];
+                m_state[1] ^= m_state[2];
+                m_state[0] ^= m_state[3];
+                m_state[2] ^= shifted;
+                m_state[3] = rotateLeft(m_state[3], 45);
+                return result;
+            }
+
+            /**
+             * @brief advance the engine by 2^128 draws
+            */
+            void jump()
+            {
+                static constexpr uint64_t polynomial[] = {0x180ec6d33cfd0abaull, 0xd5a61266f0c9392cull, 0xa9582618e03fc9aaull, 0x39abdc4529b1661cull};
+                std::array<uint64_t, 4> jumped = {0, 0, 0, 0};
+                for(uint64_t word : polynomial)
+                {
+                    for(uint32_t bIter = 0; bIter < 64; bIter++)
+                    {
+                        if(word & (uint64_t(1) << bIter))
+                        {
+                            for(uint32_t sIter = 0; sIter < 4; sIter++)
+                            {
+                                jumped[sIter] ^= m_state[sIter];
+                            }
+                        }
+                        (*this)();
+                    }
+                }
+                m_state = jumped;
+            }
+
+        private:
+            std::array<uint64_t, 4> m_state;
+
+            static uint64_t rotateLeft(uint64_t value, int shift)
+            {
+                return (value << shift) | (value >> (64 - shift));
+            }
+    };
+
+    /**
+     * @brief an unbiased integer in [0, bound), Lemire's multiply and reject
+     * @details one multiply in the common case, a division only when the
+     *          draw lands in the few values that would bias the result
+     * @param generator engine giving 64 random bits, the top 32 are used
+     * @param bound number of values, at least 1
+    */
+    template <class G> uint32_t uniformBelow(G& generator, uint32_t bound)
+    {
+        static_assert(std::is_same<typename G::result_type, uint64_t>::value, "uniformBelow takes 64 bit engines");
+        uint64_t product = static_cast<uint64_t>(static_cast<uint32_t>(generator() >> 32)) * bound;
+        uint32_t low = static_cast<uint32_t>(product);
+        if(low < bound)
+        {
+            const uint32_t threshold = static_cast<uint32_t>(-bound) % bound;
+            while(low < threshold)
+            {
+                product = static_cast<uint64_t>(static_cast<uint32_t>(generator() >> 32)) * bound;
+                low = static_cast<uint32_t>(product);
+            }
+        }
+        return static_cast<uint32_t>(product >> 32);
+    }
+
+    /**
+     * @brief Philox4x32-10, a counter based generator
+    */
+    struct philox4x32
+    {
+        using block = std::array<uint32_t, 4>;
+        using key = std::array<uint32_t, 2>;
+
+        /**
+         * @brief the 128 random bits of a counter under a key
+        */
+        static block generate(block counter, key k)
+        {
+            for(uint32_t rIter = 0; rIter < 10; rIter++)
+            {
+                const uint64_t first = static_cast<uint64_t>(0xd2511f53u) * counter[0];
+                const uint64_t second = static_cast<uint64_t>(0xcd9e8d57u) * counter[2];
+                counter = {static_cast<uint32_t>(second >> 32) ^ counter[1] ^ k[0], static_cast<uint32_t>(second),
+                           static_cast<uint32_t>(first >> 32) ^ counter[3] ^ k[1], static_cast<uint32_t>(first)};
+                k[0] += 0x9e3779b9u;
+                k[1] += 0xbb67ae85u;
+            }
+            return counter;
+        }
+
+        /**
+         * @brief block index of stream under seed
+        */
+        static block generate(uint64_t seed, uint64_t stream, uint64_t index)
+        {
+            return generate({static_cast<uint32_t>(index), static_cast<uint32_t>(index >> 32), static_cast<uint32_t>(stream), static_cast<uint32_t>(stream >> 32)},
+                            {static_cast<uint32_t>(seed), static_cast<uint32_t>(seed >> 32)});
+        }
+    };
+
+    /**
+     * @brief 32 random bits to a double in (0, 1), never 0 so it can be logged
+    */
+    inline double toOpenUnit(uint32_t bits)
+    {
+        return (static_cast<double>(bits) + 0.5) * (1.0 / 4294967296.0);
+    }
+
+    /**
+     * @brief call body(blockBegin, blockEnd) over the Philox blocks that cover
+     *        n values, on the thread pool once n is large
+    */
+    template <class F> void forEachBlock(std::size_t n, const F& body)
+    {
+        // four values per block, 1024 blocks are a few pages of any T
+        constexpr uint32_t blocksPerChunk = 1024;
+        const uint64_t numBlocks = (n + 3) / 4;
+        if(n < (std::size_t(1) << 16))
+        {
+            body(0, numBlocks);
+            return;
+        }
+        parallelFor(0, static_cast<uint32_t>((numBlocks + blocksPerChunk - 1) / blocksPerChunk), 1, [numBlocks, &body](uint32_t chunkBegin, uint32_t chunkEnd)
+        {
+            body(static_cast<uint64_t>(chunkBegin) * blocksPerChunk, std::min(numBlocks, static_cast<uint64_t>(chunkEnd) * blocksPerChunk));
+        });
+    }
+
+    /**
+     * @brief fill values with uniform random values, the same for a seed and
+     *        stream at any thread count
+     * @details value i comes from lane i % 4 of block i / 4. Floating point
+     *          types get [low, high), drawn in double and rounded to T, so a
+     *          seed and stream give the same values in every precision.
+     *          Integer types get [low, high] by multiply and shift, off by at
+     *          most (high - low + 1) / 2^32 from uniform
+     * @param values n values to fill
+     * @param n number of values
+     * @param low lowest value
+     * @param high highest value, or one past it for floating point types
+     * @param seed Philox key
+     * @param stream keeps fills under one seed apart
+    */
+    template <class T> void fillUniform(T* values, std::size_t n, double low, double high, uint64_t seed, uint64_t stream)
+    {
+        forEachBlock(n, [&](uint64_t blockBegin, uint64_t blockEnd)
+        {
+            for(uint64_t bIter = blockBegin; bIter < blockEnd; bIter++)
+            {
+                const philox4x32::block bits = philox4x32::generate(seed, stream, bIter);
+                for(uint32_t lIter = 0; (lIter < 4) && ((bIter * 4) + lIter < n); lIter++)
+                {
+                    if constexpr(std::is_integral<T>::value)
+                    {
+                        const uint64_t range = static_cast<uint64_t>(static_cast<int64_t>(high) - static_cast<int64_t>(low)) + 1;
+                        values[(bIter * 4) + lIter] = static_cast<T>(static_cast<int64_t>(low) + static_cast<int64_t>((bits[lIter] * range) >> 32));
+                    }
+                    else
+                    {
+                        const double unit = bits[lIter] * (1.0 / 4294967296.0);
+                        values[(bIter * 4) + lIter] = static_cast<T>(low + (unit * (high - low)));
+                    }
+                }
+            }
+        });
+    }
+
+    /**
+     * @brief fill values with normally distributed values, the same for a
+     *        seed and stream at any thread count
+     * @details Box-Muller in double, rounded to T. Lanes 0 and 1 of block
+     *          i / 4 give values i and i + 1, lanes 2 and 3 the next two
+     * @param values n values to fill
+     * @param n number of values
+     * @param mean mean of the distribution
+     * @param standardDeviation standard deviation of the distribution
+     * @param seed Philox key
+     * @param stream keeps fills under one seed apart
+    */
+    template <class T> void fillNormal(T* values, std::size_t n, double mean, double standardDeviation, uint64_t seed, uint64_t stream)
+    {
+        constexpr double twoPi = 6.283185307179586476925286766559;
+        forEachBlock(n, [&](uint64_t blockBegin, uint64_t blockEnd)
+        {
+            for(uint64_t bIter = blockBegin; bIter < blockEnd; bIter++)
+            {
+                const philox4x32::block bits = philox4x32::generate(seed, stream, bIter);
+                for(uint32_t pIter = 0; pIter < 4; pIter += 2)
+                {
+                    const double radius = std::sqrt(-2.0 * std::log(toOpenUnit(bits[pIter])));
+                    const double angle = twoPi * toOpenUnit(bits[pIter + 1]);
+                    const double pair[2] = {radius * std::cos(angle), radius * std::sin(angle)};
+                    for(uint32_t lIter = 0; (lIter < 2) && ((bIter * 4) + pIter + lIter < n); lIter++)
+                    {
+                        values[(bIter * 4) + pIter + lIter] = static_cast<T>(mean + (standardDeviation * pair[lIter]));
+                    }
+                }
+            }
+        });
+    }
+
+    /**
+     * @brief seed fills without one of their own use, 0 until set
+    */
+    inline std::atomic<uint64_t>& defaultSeed()
+    {
+        static std::atomic<uint64_t> seed{0};
+        return seed;
+    }
+
+    /**
+     * @brief stream the next fill without a seed of its own takes
+    */
+    inline std::atomic<uint64_t>& nextDefaultStream()
+    {
+        static std::atomic<uint64_t> stream{0};
+        return stream;
+    }
+
+    /**
+     * @brief seed the fills that have no seed of their own, and start their
+     *        streams over, so a run repeats itself
+    */
+    inline void setDefaultSeed(uint64_t seed)
+    {
+        defaultSeed().store(seed, std::memory_order_relaxed);
+        nextDefaultStream().store(0, std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief visits every sample once per epoch, in a shuffled order
+    */
+    class epochSampler
+    {
+        public:
+            /**
+             * @brief start at epoch 0
+             * @param numSamples samples in an epoch, at least numWorkers
+             * @param seed picks the order of every epoch
+             * @param worker this worker's slice of each epoch
+             * @param numWorkers slices an epoch is split into, the workers
+             *        of one seed never pick the same sample within an epoch
+            */
+            epochSampler(uint32_t numSamples, uint64_t seed, uint32_t worker = 0, uint32_t numWorkers = 1) :
+                m_seed(seed),
+                m_order(numSamples),
+                m_begin(static_cast<uint32_t>((static_cast<uint64_t>(worker) * numSamples) / std::max(numWorkers, 1u))),
+                m_end(static_cast<uint32_t>((static_cast<uint64_t>(worker + 1) * numSamples) / std::max(numWorkers, 1u))),
+                m_position(m_begin)
+            {
+                if((numWorkers == 0) || (worker >= numWorkers) || (m_begin == m_end))
+                {
+                    std::cout<<__PRETTY_FUNCTION__<<": worker "<<worker<<" of "<<numWorkers<<" has no samples out of "<<numSamples<<"!!!!"<<std::endl;
+                    assert(false);
+                }
+                shuffle();
+            }
+
+            /**
+             * @brief the next sample of this worker's slice, moving on to the
+             *        next epoch after the last one
+            */
+            uint32_t next()
+            {
+                if(m_position == m_end)
+                {
+                    m_epoch++;
+                    shuffle();
+                    m_position = m_begin;
+                }
+                return m_order[m_position++];
+            }
+
+            /**
+             * @brief epoch the next sample comes from, or the one just finished
+            */
+            uint64_t getEpoch() const { return m_epoch; }
+
+            /**
+             * @brief order of every sample in the current epoch, all workers'
+             *        slices
+            */
+            const std::vector<uint32_t>& getOrder() const { return m_order; }
+
+            uint32_t getBegin() const { return m_begin; }
+            uint32_t getEnd() const { return m_end; }
+
+        private:
+            uint64_t m_seed;
+            uint64_t m_epoch = 0;
+            std::vector<uint32_t> m_order;
+            uint32_t m_begin;
+            uint32_t m_end;
+            uint32_t m_position;
+
+            // Fisher-Yates from the identity, so an epoch's order depends on
+            // nothing but the seed and the epoch number
+            void shuffle()
+            {
+                uint64_t mixer = m_seed ^ (m_epoch * 0xd1b54a32d192ed03ull);
+                xoshiro256 generator(splitMix64(mixer));
+                std::iota(m_order.begin(), m_order.end(), 0u);
+                for(uint32_t iIter = static_cast<uint32_t>(m_order.size()); iIter > 1; iIter--)
+                {
+                    std::swap(m_order[iIter - 1], m_order[uniformBelow(generator, iIter)]);
+                }
+            }
+    };
+
+    /**
+     * @brief the sample indices a trainer takes, picked with replacement or
+     *        in shuffled epochs
+    */
+    class sampleSequence
+    {
+        public:
+            /**
+             * @brief uniform picks with replacement, xoshiro256 and uniformBelow
+             * @param numSamples samples to pick from
+             * @param seed seed of the picks
+             * @param stream one per training thread keeps their picks apart
+            */
+            sampleSequence(uint32_t numSamples, uint64_t seed, uint64_t stream) :
+                m_engine(seed, stream),
+                m_numSamples(numSamples)
+            {
+            }
+
+            /**
+             * @brief every sample once per epoch
+            */
+            explicit sampleSequence(const epochSampler& epochs) :
+                m_epochs(std::make_unique<epochSampler>(epochs))
+            {
+            }
+
+            uint32_t next()
+            {
+                return m_epochs ? m_epochs->next() : uniformBelow(m_engine, m_numSamples);
+            }
+
+        private:
+            xoshiro256 m_engine;
+            uint32_t m_numSamples = 0;
+            std::unique_ptr<epochSampler> m_epochs;
+    };
+}
+
+#endif //MATRIX_RANDOM_H
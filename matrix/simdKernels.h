@@ -0,0 +1,475 @@
+/**
+ * Element-wise vector kernels with run time instruction set dispatch.
+ * Copyright (C) 2024  Matthew Hardenburgh, matthew@hardenburgh.io
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef SIMD_KERNELS_H
+#define SIMD_KERNELS_H
+
+#include <stdint.h>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <atomic>
+#include <type_traits>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define MATRIX_SIMD_X86 1
+#include <immintrin.h>
+#else
+#define MATRIX_SIMD_X86 0
+#endif
+
+/*
+ * Every instruction set variant of a kernel is compiled into the binary with
+ * a per-function target attribute, so the build itself does not need -mavx2
+ * or similar and runs on any x86-64. The first call picks the widest variant
+ * the CPU supports (CPUID through __builtin_cpu_supports). The choice can be
+ * capped by the MATRIX_SIMD_LEVEL environment variable (scalar, sse4, avx2 or
+ * avx512) or at run time with setSimdLevel(), which is how the unit tests
+ * compare the variants against each other.
+ *
+ * Only float and double (and _Float64, which has the layout of double) have
+ * vector kernels, every other element type uses the scalar loops.
+ */
+namespace matrixKernels
+{
+    /**
+     * @brief instruction set levels the element-wise kernels are built for
+    */
+    enum class simdLevel : uint32_t
+    {
+        scalar = 0,
+        sse4 = 1,
+        avx2 = 2,
+        avx512 = 3
+    };
+
+    /**
+     * @brief human readable name of a simd level
+     * @param level the simd level
+     * @return name of the level, same spelling MATRIX_SIMD_LEVEL accepts
+    */
+    inline const char* simdLevelName(simdLevel level)
+    {
+        switch(level)
+        {
+            case simdLevel::sse4:   return "sse4";
+            case simdLevel::avx2:   return "avx2";
+            case simdLevel::avx512: return "avx512";
+            default:                return "scalar";
+        }
+    }
+
+    /**
+     * @brief widest simd level this CPU and OS support
+     * @return the detected simd level
+    */
+    inline simdLevel detectSimdLevel()
+    {
+#if MATRIX_SIMD_X86
+        __builtin_cpu_init();
+        if(__builtin_cpu_supports("avx512f"))
+        {
+            return simdLevel::avx512;
+        }
+        if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+        {
+            return simdLevel::avx2;
+        }
+        if(__builtin_cpu_supports("sse4.1"))
+        {
+            return simdLevel::sse4;
+        }
+#endif
+        return simdLevel::scalar;
+    }
+
+    /**
+     * @brief storage for the active simd level, resolved on first use
+    */
+    inline std::atomic<uint32_t>& simdLevelState()
+    {
+        static std::atomic<uint32_t> state([]()
+        {
+            simdLevel level = detectSimdLevel();
+            const char* requested = std::getenv("MATRIX_SIMD_LEVEL");
+            if(requested != nullptr)
+            {
+                for(uint32_t iIter = 0; iIter <= static_cast<uint32_t>(simdLevel::avx512); iIter++)
+                {
+                    if((std::strcmp(requested, simdLevelName(static_cast<simdLevel>(iIter))) == 0) && (iIter < static_cast<uint32_t>(level)))
+                    {
+                        level = static_cast<simdLevel>(iIter);
+                    }
+                }
+            }
+            return static_cast<uint32_t>(level);
+        }());
+        return state;
+    }
+
+    /**
+     * @brief simd level the element-wise kernels currently dispatch to
+     * @return the active simd level
+    */
+    inline simdLevel activeSimdLevel()
+    {
+        return static_cast<simdLevel>(simdLevelState().load(std::memory_order_relaxed));
+    }
+
+    /**
+     * @brief force the element-wise kernels to a simd level
+     * @details levels the CPU does not support are clamped to the widest one
+     *          it does support
+     * @param level requested simd level
+     * @return the simd level now in effect
+    */
+    inline simdLevel setSimdLevel(simdLevel level)
+    {
+        const simdLevel supported = detectSimdLevel();
+        if(static_cast<uint32_t>(level) > static_cast<uint32_t>(supported))
+        {
+            level = supported;
+        }
+        simdLevelState().store(static_cast<uint32_t>(level), std::memory_order_relaxed);
+        return level;
+    }
+
+    /**
+     * @brief maps an element type to the type its vector kernels work on,
+     *        void when there are no vector kernels for it
+    */
+    template <class T> struct simdType
+    {
+        using type = typename std::conditional<std::is_same<T, float>::value, float,
+                     typename std::conditional<std::is_floating_point<T>::value && (sizeof(T) == sizeof(double)) && !std::is_same<T, long double>::value, double,
+                     void>::type>::type;
+    };
+
+    /**
+     * @brief one set of element-wise kernels, all take n elements
+    */
+    template <class S> struct elementwiseKernels
+    {
+        void (*add)(const S* a, const S* b, S* c, size_t n);
+        void (*subtract)(const S* a, const S* b, S* c, size_t n);
+        void (*multiply)(const S* a, const S* b, S* c, size_t n);
+        void (*scale)(S scalar, const S* a, S* c, size_t n);
+        void (*axpy)(S alpha, const S* x, S* y, size_t n);
+    };
+
+    template <class T> void scalarAdd(const T* a, const T* b, T* c, size_t n)
+    {
+        for(size_t iIter = 0; iIter < n; iIter++)
+        {
+            c[iIter] = a[iIter] + b[iIter];
+        }
+    }
+
+    template <class T> void scalarSubtract(const T* a, const T* b, T* c, size_t n)
+    {
+        for(size_t iIter = 0; iIter < n; iIter++)
+        {
+            c[iIter] = a[iIter] - b[iIter];
+        }
+    }
+
+    template <class T> void scalarMultiply(const T* a, const T* b, T* c, size_t n)
+    {
+        for(size_t iIter = 0; iIter < n; iIter++)
+        {
+            c[iIter] = a[iIter] * b[iIter];
+        }
+    }
+
+    template <class T> void scalarScale(T scalar, const T* a, T* c, size_t n)
+    {
+        for(size_t iIter = 0; iIter < n; iIter++)
+        {
+            c[iIter] = scalar * a[iIter];
+        }
+    }
+
+    template <class T> void scalarAxpy(T alpha, const T* x, T* y, size_t n)
+    {
+        for(size_t iIter = 0; iIter < n; iIter++)
+        {
+            y[iIter] += alpha * x[iIter];
+        }
+    }
+
+    /**
+     * @brief c[i] = (a[i] - offset) * scale, bytes widened to float
+     * @details a subtract and a multiply, each rounded, never fused, so every
+     *          variant gives the same bits
+    */
+    inline void scalarConvertBytes(const uint8_t* a, float offset, float scale, float* c, size_t n)
+    {
+        for(size_t iIter = 0; iIter < n; iIter++)
+        {
+            c[iIter] = (static_cast<float>(a[iIter]) - offset) * scale;
+        }
+    }
+
+#if MATRIX_SIMD_X86
+
+/*
+ * Generates the five element-wise kernels for one instruction set and one
+ * element type. The vector body handles WIDTH elements per step, the scalar
+ * tail finishes the rest. Loads and stores are unaligned so the kernels also
+ * work on sub-ranges and views, on aligned matrix storage they cost the same.
+ */
+#define MATRIX_SIMD_ELEMENTWISE(SUFFIX, TARGET, S, REG, WIDTH, LOAD, STORE, ADD, SUB, MUL, SET1, FMADD) \
+    __attribute__((target(TARGET))) inline void add##SUFFIX(const S* a, const S* b, S* c, size_t n) \
+    { \
+        size_t iIter = 0; \
+        for(; iIter + WIDTH <= n; iIter += WIDTH) \
+        { \
+            STORE(c + iIter, ADD(LOAD(a + iIter), LOAD(b + iIter))); \
+        } \
+        for(; iIter < n; iIter++) \
+        { \
+            c[iIter] = a[iIter] + b[iIter]; \
+        } \
+    } \
+    __attribute__((target(TARGET))) inline void subtract##SUFFIX(const S* a, const S* b, S* c, size_t n) \
+    { \
+        size_t iIter = 0; \
+        for(; iIter + WIDTH <= n; iIter += WIDTH) \
+        { \
+            STORE(c + iIter, SUB(LOAD(a + iIter), LOAD(b + iIter))); \
+        } \
+        for(; iIter < n; iIter++) \
+        { \
+            c[iIter] = a[iIter] - b[iIter]; \
+        } \
+    } \
+    __attribute__((target(TARGET))) inline void multiply##SUFFIX(const S* a, const S* b, S* c, size_t n) \
+    { \
+        size_t iIter = 0; \
+        for(; iIter + WIDTH <= n; iIter += WIDTH) \
+        { \
+            STORE(c + iIter, MUL(LOAD(a + iIter), LOAD(b + iIter))); \
+        } \
+        for(; iIter < n; iIter++) \
+        { \
+            c[iIter] = a[iIter] * b[iIter]; \
+        } \
+    } \
+    __attribute__((target(TARGET))) inline void scale##SUFFIX(S scalar, const S* a, S* c, size_t n) \
+    { \
+        const REG scalarVector = SET1(scalar); \
+        size_t iIter = 0; \
+        for(; iIter + WIDTH <= n; iIter += WIDTH) \
+        { \
+            STORE(c + iIter, MUL(scalarVector, LOAD(a + iIter))); \
+        } \
+        for(; iIter < n; iIter++) \
+        { \
+            c[iIter] = scalar * a[iIter]; \
+        } \
+    } \
+    __attribute__((target(TARGET))) inline void axpy##SUFFIX(S alpha, const S* x, S* y, size_t n) \
+    { \
+        const REG alphaVector = SET1(alpha); \
+        size_t iIter = 0; \
+        for(; iIter + WIDTH <= n; iIter += WIDTH) \
+        { \
+            STORE(y + iIter, FMADD(alphaVector, LOAD(x + iIter), LOAD(y + iIter))); \
+        } \
+        for(; iIter < n; iIter++) \
+        { \
+            y[iIter] += alpha * x[iIter]; \
+        } \
+    }
+
+// SSE has no fused multiply-add, axpy is a multiply then an add
+#define MATRIX_SSE_FMADD_PS(a, b, c) _mm_add_ps(_mm_mul_ps(a, b), c)
+#define MATRIX_SSE_FMADD_PD(a, b, c) _mm_add_pd(_mm_mul_pd(a, b), c)
+
+    MATRIX_SIMD_ELEMENTWISE(Sse4Float, "sse4.1", float, __m128, 4, _mm_loadu_ps, _mm_storeu_ps, _mm_add_ps, _mm_sub_ps, _mm_mul_ps, _mm_set1_ps, MATRIX_SSE_FMADD_PS)
+    MATRIX_SIMD_ELEMENTWISE(Sse4Double, "sse4.1", double, __m128d, 2, _mm_loadu_pd, _mm_storeu_pd, _mm_add_pd, _mm_sub_pd, _mm_mul_pd, _mm_set1_pd, MATRIX_SSE_FMADD_PD)
+    MATRIX_SIMD_ELEMENTWISE(Avx2Float, "avx2,fma", float, __m256, 8, _mm256_loadu_ps, _mm256_storeu_ps, _mm256_add_ps, _mm256_sub_ps, _mm256_mul_ps, _mm256_set1_ps, _mm256_fmadd_ps)
+    MATRIX_SIMD_ELEMENTWISE(Avx2Double, "avx2,fma", double, __m256d, 4, _mm256_loadu_pd, _mm256_storeu_pd, _mm256_add_pd, _mm256_sub_pd, _mm256_mul_pd, _mm256_set1_pd, _mm256_fmadd_pd)
+    MATRIX_SIMD_ELEMENTWISE(Avx512Float, "avx512f", float, __m512, 16, _mm512_loadu_ps, _mm512_storeu_ps, _mm512_add_ps, _mm512_sub_ps, _mm512_mul_ps, _mm512_set1_ps, _mm512_fmadd_ps)
+    MATRIX_SIMD_ELEMENTWISE(Avx512Double, "avx512f", double, __m512d, 8, _mm512_loadu_pd, _mm512_storeu_pd, _mm512_add_pd, _mm512_sub_pd, _mm512_mul_pd, _mm512_set1_pd, _mm512_fmadd_pd)
+
+#undef MATRIX_SSE_FMADD_PS
+#undef MATRIX_SSE_FMADD_PD
+#undef MATRIX_SIMD_ELEMENTWISE
+
+/*
+ * Byte to float conversion for one instruction set, WIDTH bytes are widened
+ * to 32 bit integers and converted per step. The integers are exact in
+ * float, the subtract and the multiply round the same as the scalar loop.
+ */
+#define MATRIX_SIMD_CONVERT_BYTES(SUFFIX, TARGET, REG, WIDTH, WIDEN, CONVERT, STORE, SUB, MUL, SET1) \
+    __attribute__((target(TARGET))) inline void convertBytes##SUFFIX(const uint8_t* a, float offset, float scale, float* c, size_t n) \
+    { \
+        const REG offsetVector = SET1(offset); \
+        const REG scaleVector = SET1(scale); \
+        size_t iIter = 0; \
+        for(; iIter + WIDTH <= n; iIter += WIDTH) \
+        { \
+            STORE(c + iIter, MUL(SUB(CONVERT(WIDEN(a + iIter)), offsetVector), scaleVector)); \
+        } \
+        scalarConvertBytes(a + iIter, offset, scale, c + iIter, n - iIter); \
+    }
+
+#define MATRIX_WIDEN_SSE4(p) _mm_cvtepu8_epi32(_mm_loadu_si32(p))
+#define MATRIX_WIDEN_AVX2(p) _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(p)))
+// the unmasked avx512 conversions trip -Wmaybe-uninitialized in GCC 12
+#define MATRIX_WIDEN_AVX512(p) _mm512_maskz_cvtepu8_epi32(0xffff, _mm_loadu_si128(reinterpret_cast<const __m128i*>(p)))
+#define MATRIX_CONVERT_AVX512(v) _mm512_maskz_cvtepi32_ps(0xffff, v)
+
+    MATRIX_SIMD_CONVERT_BYTES(Sse4, "sse4.1", __m128, 4, MATRIX_WIDEN_SSE4, _mm_cvtepi32_ps, _mm_storeu_ps, _mm_sub_ps, _mm_mul_ps, _mm_set1_ps)
+    MATRIX_SIMD_CONVERT_BYTES(Avx2, "avx2", __m256, 8, MATRIX_WIDEN_AVX2, _mm256_cvtepi32_ps, _mm256_storeu_ps, _mm256_sub_ps, _mm256_mul_ps, _mm256_set1_ps)
+    MATRIX_SIMD_CONVERT_BYTES(Avx512, "avx512f", __m512, 16, MATRIX_WIDEN_AVX512, MATRIX_CONVERT_AVX512, _mm512_storeu_ps, _mm512_sub_ps, _mm512_mul_ps, _mm512_set1_ps)
+
+#undef MATRIX_WIDEN_SSE4
+#undef MATRIX_WIDEN_AVX2
+#undef MATRIX_WIDEN_AVX512
+#undef MATRIX_CONVERT_AVX512
+#undef MATRIX_SIMD_CONVERT_BYTES
+
+#endif //MATRIX_SIMD_X86
+
+    /**
+     * @brief the element-wise kernels for the active simd level
+     * @return table of kernels, indexable by S = float or double
+    */
+    template <class S> const elementwiseKernels<S>& activeElementwiseKernels();
+
+    template <> inline const elementwiseKernels<float>& activeElementwiseKernels<float>()
+    {
+        static const elementwiseKernels<float> tables[] =
+        {
+            {scalarAdd<float>, scalarSubtract<float>, scalarMultiply<float>, scalarScale<float>, scalarAxpy<float>},
+#if MATRIX_SIMD_X86
+            {addSse4Float, subtractSse4Float, multiplySse4Float, scaleSse4Float, axpySse4Float},
+            {addAvx2Float, subtractAvx2Float, multiplyAvx2Float, scaleAvx2Float, axpyAvx2Float},
+            {addAvx512Float, subtractAvx512Float, multiplyAvx512Float, scaleAvx512Float, axpyAvx512Float}
+#endif
+        };
+        return tables[static_cast<uint32_t>(activeSimdLevel())];
+    }
+
+    template <> inline const elementwiseKernels<double>& activeElementwiseKernels<double>()
+    {
+        static const elementwiseKernels<double> tables[] =
+        {
+            {scalarAdd<double>, scalarSubtract<double>, scalarMultiply<double>, scalarScale<double>, scalarAxpy<double>},
+#if MATRIX_SIMD_X86
+            {addSse4Double, subtractSse4Double, multiplySse4Double, scaleSse4Double, axpySse4Double},
+            {addAvx2Double, subtractAvx2Double, multiplyAvx2Double, scaleAvx2Double, axpyAvx2Double},
+            {addAvx512Double, subtractAvx512Double, multiplyAvx512Double, scaleAvx512Double, axpyAvx512Double}
+#endif
+        };
+        return tables[static_cast<uint32_t>(activeSimdLevel())];
+    }
+
+    /*
+     * Entry points used by the matrix class. Element types with vector
+     * kernels go through the dispatch table, everything else through the
+     * scalar loops.
+     */
+
+    template <class T> void elementwiseAdd(const T* a, const T* b, T* c, size_t n)
+    {
+        using S = typename simdType<T>::type;
+        if constexpr (std::is_void<S>::value)
+        {
+            scalarAdd(a, b, c, n);
+        }
+        else
+        {
+            activeElementwiseKernels<S>().add(reinterpret_cast<const S*>(a), reinterpret_cast<const S*>(b), reinterpret_cast<S*>(c), n);
+        }
+    }
+
+    template <class T> void elementwiseSubtract(const T* a, const T* b, T* c, size_t n)
+    {
+        using S = typename simdType<T>::type;
+        if constexpr (std::is_void<S>::value)
+        {
+            scalarSubtract(a, b, c, n);
+        }
+        else
+        {
+            activeElementwiseKernels<S>().subtract(reinterpret_cast<const S*>(a), reinterpret_cast<const S*>(b), reinterpret_cast<S*>(c), n);
+        }
+    }
+
+    template <class T> void elementwiseMultiply(const T* a, const T* b, T* c, size_t n)
+    {
+        using S = typename simdType<T>::type;
+        if constexpr (std::is_void<S>::value)
+        {
+            scalarMultiply(a, b, c, n);
+        }
+        else
+        {
+            activeElementwiseKernels<S>().multiply(reinterpret_cast<const S*>(a), reinterpret_cast<const S*>(b), reinterpret_cast<S*>(c), n);
+        }
+    }
+
+    template <class T> void elementwiseScale(T scalar, const T* a, T* c, size_t n)
+    {
+        using S = typename simdType<T>::type;
+        if constexpr (std::is_void<S>::value)
+        {
+            scalarScale(scalar, a, c, n);
+        }
+        else
+        {
+            activeElementwiseKernels<S>().scale(static_cast<S>(scalar), reinterpret_cast<const S*>(a), reinterpret_cast<S*>(c), n);
+        }
+    }
+
+    template <class T> void elementwiseAxpy(T alpha, const T* x, T* y, size_t n)
+    {
+        using S = typename simdType<T>::type;
+        if constexpr (std::is_void<S>::value)
+        {
+            scalarAxpy(alpha, x, y, n);
+        }
+        else
+        {
+            activeElementwiseKernels<S>().axpy(static_cast<S>(alpha), reinterpret_cast<const S*>(x), reinterpret_cast<S*>(y), n);
+        }
+    }
+
+    /**
+     * @brief c[i] = (a[i] - offset) * scale for n bytes, with the kernel of
+     *        the active simd level. Normalizes pixels
+    */
+    inline void convertBytes(const uint8_t* a, float offset, float scale, float* c, size_t n)
+    {
+        static void (*const kernels[])(const uint8_t*, float, float, float*, size_t) =
+        {
+            scalarConvertBytes,
+#if MATRIX_SIMD_X86
+            convertBytesSse4,
+            convertBytesAvx2,
+            convertBytesAvx512
+#endif
+        };
+        kernels[static_cast<uint32_t>(activeSimdLevel())](a, offset, scale, c, n);
+    }
+}
+
+#endif //SIMD_KERNELS_H
@@ -0,0 +1,144 @@
+/**
+ * Non-owning, strided view over a run of matrix elements, i.e. a row or a
+ * column of a matrix.
+ * Copyright (C) 2024  Matthew Hardenburgh, matthew@hardenburgh.io
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef STRIDED_SPAN_H
+#define STRIDED_SPAN_H
+
+#include <stdint.h>
+#include <cstddef>
+#include <iterator>
+
+/*
+ * A row of a row major matrix is contiguous, stride 1. A column is every
+ * m_columns'th element, stride m_columns. stridedSpan covers both with one
+ * type, something like std::span plus a stride (we are on C++17, so no
+ * std::span). T may be const to get a read only view.
+ *
+ * The span does not own anything, it is only valid while the matrix it came
+ * from is alive and not resized.
+ */
+template <class T> class stridedSpan
+{
+    public:
+        /**
+         * @brief random access iterator that steps by the stride of the span
+        */
+        class iterator
+        {
+            public:
+                using iterator_category = std::random_access_iterator_tag;
+                using value_type = typename std::remove_const<T>::type;
+                using difference_type = std::ptrdiff_t;
+                using pointer = T*;
+                using reference = T&;
+
+                iterator() {}
+                iterator(T* position, std::ptrdiff_t stride) : m_position(position), m_stride(stride) {}
+
+                reference operator*() const { return *m_position; }
+                pointer operator->() const { return m_position; }
+                reference operator[](difference_type offset) const { return m_position[offset * m_stride]; }
+
+                iterator& operator++() { m_position += m_stride; return *this; }
+                iterator operator++(int) { iterator previous = *this; m_position += m_stride; return previous; }
+                iterator& operator--() { m_position -= m_stride; return *this; }
+                iterator operator--(int) { iterator previous = *this; m_position -= m_stride; return previous; }
+                iterator& operator+=(difference_type offset) { m_position += offset * m_stride; return *this; }
+                iterator& operator-=(difference_type offset) { m_position -= offset * m_stride; return *this; }
+                iterator operator+(difference_type offset) const { return iterator(m_position + (offset * m_stride), m_stride); }
+                iterator operator-(difference_type offset) const { return iterator(m_position - (offset * m_stride), m_stride); }
+                friend iterator operator+(difference_type offset, const iterator& other) { return other + offset; }
+                difference_type operator-(const iterator& other) const { return (m_position - other.m_position) / m_stride; }
+
+                bool operator==(const iterator& other) const { return m_position == other.m_position; }
+                bool operator!=(const iterator& other) const { return m_position != other.m_position; }
+                bool operator<(const iterator& other) const { return (*this - other) < 0; }
+                bool operator>(const iterator& other) const { return (*this - other) > 0; }
+                bool operator<=(const iterator& other) const { return (*this - other) <= 0; }
+                bool operator>=(const iterator& other) const { return (*this - other) >= 0; }
+
+            private:
+                T* m_position = nullptr;
+                std::ptrdiff_t m_stride = 1;
+        };
+
+        /**
+         * @brief creates a view of size elements starting at data, stride
+         *        elements apart
+         * @param data first element of the view
+         * @param size number of elements in the view
+         * @param stride distance in elements between neighbours in the view
+        */
+        stridedSpan(T* data, uint32_t size, std::ptrdiff_t stride) : m_data(data), m_size(size), m_stride(stride)
+        {
+
+        }
+
+        /**
+         * @brief unchecked element access
+         * @param index position in the view
+         * @return reference to the element
+        */
+        T& operator[](uint32_t index) const
+        {
+            return m_data[index * m_stride];
+        }
+
+        /**
+         * @brief number of elements in the view
+        */
+        uint32_t size() const
+        {
+            return m_size;
+        }
+
+        /**
+         * @brief distance in elements between neighbours in the view, 1 if
+         *        the view is contiguous
+        */
+        std::ptrdiff_t stride() const
+        {
+            return m_stride;
+        }
+
+        /**
+         * @brief first element of the view
+        */
+        T* data() const
+        {
+            return m_data;
+        }
+
+        iterator begin() const
+        {
+            return iterator(m_data, m_stride);
+        }
+
+        iterator end() const
+        {
+            return iterator(m_data + (static_cast<std::ptrdiff_t>(m_size) * m_stride), m_stride);
+        }
+
+    private:
+        T* m_data = nullptr;
+        uint32_t m_size = 0;
+        std::ptrdiff_t m_stride = 1;
+};
+
+#endif //STRIDED_SPAN_H
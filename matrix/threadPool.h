@@ -0,0 +1,348 @@
+/**
+ * Work-stealing thread pool and parallel for loop used by the matrix library.
+ * Copyright (C) 2024  Matthew Hardenburgh, matthew@hardenburgh.io
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <stdint.h>
+#include <cstddef>
+#include <cstdlib>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+ * One process wide pool, started the first time something asks for it.
+ *
+ * parallelFor() cuts a range into chunks and deals them round robin onto the
+ * per-worker deques. A worker pops chunks off the back of its own deque and,
+ * once that is empty, steals from the front of the others, so an uneven split
+ * evens itself out. The calling thread does not sit idle, it steals chunks as
+ * well until the loop is done, which is why a pool of N threads has N - 1
+ * workers.
+ *
+ * The thread count comes from setNumThreads(), else the MATRIX_NUM_THREADS
+ * environment variable, else std::thread::hardware_concurrency(). A
+ * parallelFor called from inside a chunk runs serially on the calling worker
+ * instead of waiting on the pool it is part of.
+ */
+class threadPool
+{
+    public:
+        /**
+         * @brief the process wide pool, started on first use
+         * @return the thread pool
+        */
+        static threadPool& instance()
+        {
+            static threadPool pool;
+            return pool;
+        }
+
+        /**
+         * @brief number of threads that run a parallelFor, including the caller
+         * @return thread count
+        */
+        uint32_t getNumThreads() const
+        {
+            return static_cast<uint32_t>(m_workers.size()) + 1;
+        }
+
+        /**
+         * @brief resize the pool. Must not be called while a parallelFor is
+         *        running
+         * @param numThreads thread count including the caller, 0 picks the default
+        */
+        void setNumThreads(uint32_t numThreads)
+        {
+            stopWorkers();
+            startWorkers(numThreads == 0 ? defaultNumThreads() : numThreads);
+        }
+
+        /**
+         * @brief run body(chunkBegin, chunkEnd) over [begin, end) in parallel
+         * @details the range is cut into chunks of at least grainSize
+         *          iterations. Ranges of grainSize or less run serially on the
+         *          calling thread
+         * @param begin first iteration
+         * @param end one past the last iteration
+         * @param grainSize smallest chunk worth handing to another thread
+         * @param body callable taking (uint32_t chunkBegin, uint32_t chunkEnd)
+        */
+        template <class F> void parallelFor(uint32_t begin, uint32_t end, uint32_t grainSize, const F& body)
+        {
+            if(end <= begin)
+            {
+                return;
+            }
+
+            const uint32_t count = end - begin;
+            grainSize = (grainSize == 0) ? 1 : grainSize;
+
+            if(m_workers.empty() || (count <= grainSize) || isWorkerThread())
+            {
+                body(begin, end);
+                return;
+            }
+
+            // a few chunks per thread so stealing has something to balance with
+            uint32_t numChunks = getNumThreads() * 4;
+            if(numChunks > ((count + grainSize - 1) / grainSize))
+            {
+                numChunks = (count + grainSize - 1) / grainSize;
+            }
+            const uint32_t chunkSize = (count + numChunks - 1) / numChunks;
+            numChunks = (count + chunkSize - 1) / chunkSize;
+
+            job currentJob;
+            currentJob.context = &body;
+            currentJob.invoke = [](const void* context, uint32_t chunkBegin, uint32_t chunkEnd)
+            {
+                (*static_cast<const F*>(context))(chunkBegin, chunkEnd);
+            };
+            currentJob.remaining.store(numChunks, std::memory_order_relaxed);
+
+            for(uint32_t iIter = 0; iIter < numChunks; iIter++)
+            {
+                const uint32_t chunkBegin = begin + (iIter * chunkSize);
+                const uint32_t chunkEnd = (chunkBegin + chunkSize < end) ? chunkBegin + chunkSize : end;
+                workerQueue& queue = *m_queues[iIter % m_queues.size()];
+                std::lock_guard<std::mutex> lock(queue.mutex);
+                queue.tasks.push_back(task{&currentJob, chunkBegin, chunkEnd});
+            }
+            {
+                std::lock_guard<std::mutex> lock(m_sleepMutex);
+                m_pendingTasks += numChunks;
+            }
+            m_wakeWorkers.notify_all();
+
+            // help out until every chunk has been picked up, then wait for the
+            // stragglers. The wait takes the job's mutex, so currentJob cannot
+            // go out of scope while the last worker is still signalling it
+            task stolen;
+            while(steal(0, stolen))
+            {
+                runTask(stolen);
+            }
+            std::unique_lock<std::mutex> lock(currentJob.mutex);
+            currentJob.done.wait(lock, [&currentJob]()
+            {
+                return currentJob.remaining.load(std::memory_order_acquire) == 0;
+            });
+        }
+
+        ~threadPool()
+        {
+            stopWorkers();
+        }
+
+    private:
+        /**
+         * @brief one parallelFor call, shared by all of its chunks
+        */
+        struct job
+        {
+            const void* context = nullptr;
+            void (*invoke)(const void* context, uint32_t chunkBegin, uint32_t chunkEnd) = nullptr;
+            std::atomic<uint32_t> remaining{0};
+            std::mutex mutex;
+            std::condition_variable done;
+        };
+
+        /**
+         * @brief one chunk of a job
+        */
+        struct task
+        {
+            job* owner = nullptr;
+            uint32_t begin = 0;
+            uint32_t end = 0;
+        };
+
+        /**
+         * @brief a worker's deque. The owner works from the back, thieves from
+         *        the front
+        */
+        struct workerQueue
+        {
+            std::mutex mutex;
+            std::deque<task> tasks;
+        };
+
+        std::vector<std::thread> m_workers;
+        std::vector<std::unique_ptr<workerQueue>> m_queues;
+        std::mutex m_sleepMutex;
+        std::condition_variable m_wakeWorkers;
+        uint32_t m_pendingTasks = 0;
+        bool m_stopping = false;
+
+        threadPool()
+        {
+            startWorkers(defaultNumThreads());
+        }
+
+        threadPool(const threadPool&) = delete;
+        threadPool& operator=(const threadPool&) = delete;
+
+        static uint32_t defaultNumThreads()
+        {
+            const char* requested = std::getenv("MATRIX_NUM_THREADS");
+            if(requested != nullptr)
+            {
+                const long numThreads = std::strtol(requested, nullptr, 10);
+                if(numThreads > 0)
+                {
+                    return static_cast<uint32_t>(numThreads);
+                }
+            }
+
+            const uint32_t hardwareThreads = std::thread::hardware_concurrency();
+            return (hardwareThreads == 0) ? 1 : hardwareThreads;
+        }
+
+        static bool& isWorkerThread()
+        {
+            thread_local bool workerThread = false;
+            return workerThread;
+        }
+
+        void startWorkers(uint32_t numThreads)
+        {
+            m_stopping = false;
+            m_pendingTasks = 0;
+            m_queues.clear();
+            // queue 0 is also used by the calling thread's chunks when there are no workers
+            for(uint32_t iIter = 0; iIter < ((numThreads > 1) ? numThreads - 1 : 1); iIter++)
+            {
+                m_queues.push_back(std::unique_ptr<workerQueue>(new workerQueue()));
+            }
+            for(uint32_t iIter = 1; iIter < numThreads; iIter++)
+            {
+                m_workers.emplace_back([this, iIter]()
+                {
+                    workerLoop(iIter - 1);
+                });
+            }
+        }
+
+        void stopWorkers()
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_sleepMutex);
+                m_stopping = true;
+            }
+            m_wakeWorkers.notify_all();
+            for(std::thread& worker : m_workers)
+            {
+                worker.join();
+            }
+            m_workers.clear();
+        }
+
+        /**
+         * @brief take a task, own queue first (from the back), then the
+         *        others (from the front)
+        */
+        bool steal(uint32_t ownQueue, task& stolen)
+        {
+            {
+                workerQueue& queue = *m_queues[ownQueue];
+                std::lock_guard<std::mutex> lock(queue.mutex);
+                if(!queue.tasks.empty())
+                {
+                    stolen = queue.tasks.back();
+                    queue.tasks.pop_back();
+                    return true;
+                }
+            }
+
+            for(uint32_t iIter = 1; iIter < m_queues.size(); iIter++)
+            {
+                workerQueue& queue = *m_queues[(ownQueue + iIter) % m_queues.size()];
+                std::lock_guard<std::mutex> lock(queue.mutex);
+                if(!queue.tasks.empty())
+                {
+                    stolen = queue.tasks.front();
+                    queue.tasks.pop_front();
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        void runTask(const task& current)
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_sleepMutex);
+                m_pendingTasks--;
+            }
+
+            current.owner->invoke(current.owner->context, current.begin, current.end);
+
+            // the last chunk wakes the thread that called parallelFor
+            std::lock_guard<std::mutex> lock(current.owner->mutex);
+            if(current.owner->remaining.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            {
+                current.owner->done.notify_all();
+            }
+        }
+
+        void workerLoop(uint32_t ownQueue)
+        {
+            isWorkerThread() = true;
+            task current;
+
+            while(true)
+            {
+                if(steal(ownQueue, current))
+                {
+                    runTask(current);
+                    continue;
+                }
+
+                std::unique_lock<std::mutex> lock(m_sleepMutex);
+                m_wakeWorkers.wait(lock, [this]()
+                {
+                    return m_stopping || (m_pendingTasks > 0);
+                });
+                if(m_stopping)
+                {
+                    return;
+                }
+            }
+        }
+};
+
+/**
+ * @brief run body(chunkBegin, chunkEnd) over [begin, end) on the process wide
+ *        thread pool, see threadPool::parallelFor
+ * @param begin first iteration
+ * @param end one past the last iteration
+ * @param grainSize smallest chunk worth handing to another thread
+ * @param body callable taking (uint32_t chunkBegin, uint32_t chunkEnd)
+*/
+template <class F> void parallelFor(uint32_t begin, uint32_t end, uint32_t grainSize, const F& body)
+{
+    threadPool::instance().parallelFor(begin, end, grainSize, body);
+}
+
+#endif //THREAD_POOL_H
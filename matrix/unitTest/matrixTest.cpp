@@ -20,6 +20,15 @@
 #include <gtest/gtest.h>
 
 #include "matrix.h"
+#include "fixedMatrix.h"
+#include "quantizedKernels.h"
+
+#include <type_traits>
+#include <utility>
+#include <atomic>
+#include <vector>
+#include <cmath>
+#include <cstring>
 
 TEST(matrixTest, test_transpose_function_square_matrix)
 {
@@ -610,4 +619,1286 @@ TEST(matrixTest, test_multiply_tall_with_wide_matrix_float)
             EXPECT_NEAR(expectedDut.at(iIter, jIter), resultMatrix.at(iIter, jIter), 0.01);
         }
     }
-}
\ No newline at end of file
+}
+TEST(matrixTest, test_move_constructor_and_assignment)
+{
+    const uint32_t rows = 2;
+    const uint32_t columns = 3;
+
+    uint32_t dataA[rows * columns] 
+    {
+        1, 2, 3, 
+        4, 5, 6
+    };
+
+    matrix<uint32_t> matrixA(dataA, rows, columns);
+    const uint32_t* originalData = matrixA.data();
+
+    // moving must hand over the buffer, not copy it
+    matrix<uint32_t> matrixB(std::move(matrixA));
+    EXPECT_EQ(originalData, matrixB.data());
+    EXPECT_EQ(nullptr, matrixA.data());
+    EXPECT_EQ(0u, matrixA.getNumRows());
+    EXPECT_EQ(0u, matrixA.getNumColumns());
+
+    matrix<uint32_t> matrixC;
+    matrixC = std::move(matrixB);
+    EXPECT_EQ(originalData, matrixC.data());
+    EXPECT_EQ(nullptr, matrixB.data());
+    EXPECT_EQ(rows, matrixC.getNumRows());
+    EXPECT_EQ(columns, matrixC.getNumColumns());
+
+    for(uint32_t iIter = 0; iIter < rows * columns; iIter++)
+    {
+        EXPECT_EQ(dataA[iIter], matrixC.at(iIter));
+    }
+}
+
+TEST(matrixTest, test_clone_is_deep_copy)
+{
+    const uint32_t rows = 3;
+    const uint32_t columns = 2;
+
+    _Float64 dataA[rows * columns] 
+    {
+        1.5, 2.5, 
+        3.5, 4.5, 
+        5.5, 6.5
+    };
+
+    matrix<_Float64> matrixA(dataA, rows, columns);
+    matrix<_Float64> copyOfA = matrixA.clone();
+
+    EXPECT_NE(matrixA.data(), copyOfA.data());
+
+    matrixA.fillZeros();
+
+    for(uint32_t iIter = 0; iIter < rows * columns; iIter++)
+    {
+        EXPECT_EQ(dataA[iIter], copyOfA.at(iIter));
+    }
+}
+
+TEST(matrixTest, test_storage_is_aligned)
+{
+    matrix<uint8_t> byteMatrix(7, 3);
+    matrix<float> floatMatrix(5, 1);
+    matrix<_Float64> doubleMatrix(16, 784);
+
+    EXPECT_EQ(0u, reinterpret_cast<uintptr_t>(byteMatrix.data()) % matrix<uint8_t>::m_alignment);
+    EXPECT_EQ(0u, reinterpret_cast<uintptr_t>(floatMatrix.data()) % matrix<float>::m_alignment);
+    EXPECT_EQ(0u, reinterpret_cast<uintptr_t>(doubleMatrix.data()) % matrix<_Float64>::m_alignment);
+
+    matrix<_Float64> result = matrix<_Float64>::transpose(doubleMatrix);
+    EXPECT_EQ(0u, reinterpret_cast<uintptr_t>(result.data()) % matrix<_Float64>::m_alignment);
+}
+
+TEST(matrixTest, test_output_parameter_operations)
+{
+    const uint32_t rows = 2;
+    const uint32_t columns = 3;
+
+    _Float64 dataA[rows * columns] 
+    {
+        1.0, 2.0, 3.0, 
+        4.0, 5.0, 6.0
+    };
+
+    _Float64 dataB[rows * columns] 
+    {
+        0.5, 1.5, 2.5, 
+        3.5, 4.5, 5.5
+    };
+
+    matrix<_Float64> matrixA(dataA, rows, columns);
+    matrix<_Float64> matrixB(dataB, rows, columns);
+    // destination starts empty and gets resized by the operation
+    matrix<_Float64> result;
+
+    matrix<_Float64>::add(matrixA, matrixB, result);
+    EXPECT_EQ(rows, result.getNumRows());
+    EXPECT_EQ(columns, result.getNumColumns());
+    const _Float64* resultData = result.data();
+    for(uint32_t iIter = 0; iIter < rows * columns; iIter++)
+    {
+        EXPECT_DOUBLE_EQ(dataA[iIter] + dataB[iIter], result.at(iIter));
+    }
+
+    // same shape again must reuse the storage
+    matrix<_Float64>::subtract(matrixA, matrixB, result);
+    EXPECT_EQ(resultData, result.data());
+    for(uint32_t iIter = 0; iIter < rows * columns; iIter++)
+    {
+        EXPECT_DOUBLE_EQ(dataA[iIter] - dataB[iIter], result.at(iIter));
+    }
+
+    matrix<_Float64>::hadamardProduct(matrixA, matrixB, result);
+    for(uint32_t iIter = 0; iIter < rows * columns; iIter++)
+    {
+        EXPECT_DOUBLE_EQ(dataA[iIter] * dataB[iIter], result.at(iIter));
+    }
+
+    matrix<_Float64>::scalarMultiply(3.0, matrixA, result);
+    for(uint32_t iIter = 0; iIter < rows * columns; iIter++)
+    {
+        EXPECT_DOUBLE_EQ(3.0 * dataA[iIter], result.at(iIter));
+    }
+
+    matrix<_Float64>::transpose(matrixA, result);
+    EXPECT_EQ(columns, result.getNumRows());
+    EXPECT_EQ(rows, result.getNumColumns());
+    EXPECT_EQ(resultData, result.data());
+    for(uint32_t iIter = 0; iIter < rows; iIter++)
+    {
+        for(uint32_t jIter = 0; jIter < columns; jIter++)
+        {
+            EXPECT_DOUBLE_EQ(matrixA.at(iIter, jIter), result.at(jIter, iIter));
+        }
+    }
+
+    matrix<_Float64> product;
+    matrix<_Float64>::matrixMultiplication(matrixA, result, product);
+    matrix<_Float64> expectedProduct = matrix<_Float64>::matrixMultiplication(matrixA, result);
+    EXPECT_EQ(rows, product.getNumRows());
+    EXPECT_EQ(rows, product.getNumColumns());
+    for(uint32_t iIter = 0; iIter < rows * rows; iIter++)
+    {
+        EXPECT_DOUBLE_EQ(expectedProduct.at(iIter), product.at(iIter));
+    }
+}
+
+TEST(matrixTest, test_in_place_operations_and_axpy)
+{
+    const uint32_t rows = 3;
+    const uint32_t columns = 2;
+
+    _Float64 dataA[rows * columns] 
+    {
+        1.0, 2.0, 
+        3.0, 4.0, 
+        5.0, 6.0
+    };
+
+    _Float64 dataB[rows * columns] 
+    {
+        2.0, 2.0, 
+        0.5, 0.5, 
+        1.0, 3.0
+    };
+
+    matrix<_Float64> matrixA(dataA, rows, columns);
+    matrix<_Float64> matrixB(dataB, rows, columns);
+    const _Float64* storageOfA = matrixA.data();
+
+    matrixA.addInPlace(matrixB);
+    matrixA.hadamardInPlace(matrixB);
+    matrixA.scaleInPlace(0.5);
+    matrixA.subtractInPlace(matrixB);
+
+    // Y = alpha * X + Y
+    matrix<_Float64>::axpy(-2.0, matrixB, matrixA);
+
+    EXPECT_EQ(storageOfA, matrixA.data());
+    for(uint32_t iIter = 0; iIter < rows * columns; iIter++)
+    {
+        _Float64 expected = ((dataA[iIter] + dataB[iIter]) * dataB[iIter] * 0.5) - dataB[iIter] - (2.0 * dataB[iIter]);
+        EXPECT_DOUBLE_EQ(expected, matrixA.at(iIter));
+    }
+}
+
+TEST(matrixTest, test_blocked_multiply_matches_naive_multiply)
+{
+    // shapes on both sides of the small problem fallback and of the kc/mc
+    // block edges, none of them multiples of the register tile
+    const uint32_t shapes[][3] 
+    {
+        {3, 5, 2},
+        {16, 784, 1},
+        {1, 16, 10},
+        {33, 35, 37},
+        {101, 67, 300},
+        {130, 9, 513}
+    };
+
+    for(const auto& shape : shapes)
+    {
+        const uint32_t rowsA = shape[0];
+        const uint32_t columnsA = shape[1];
+        const uint32_t columnsB = shape[2];
+
+        matrix<_Float64> matrixA(rowsA, columnsA);
+        matrix<_Float64> matrixB(columnsA, columnsB);
+        matrixA.fillRandom(-1.0, 1.0);
+        matrixB.fillRandom(-1.0, 1.0);
+
+        matrix<_Float64> result = matrix<_Float64>::matrixMultiplication(matrixA, matrixB);
+
+        ASSERT_EQ(rowsA, result.getNumRows());
+        ASSERT_EQ(columnsB, result.getNumColumns());
+
+        for(uint32_t iIter = 0; iIter < rowsA; iIter++)
+        {
+            for(uint32_t jIter = 0; jIter < columnsB; jIter++)
+            {
+                _Float64 expected = 0.0;
+                for(uint32_t kIter = 0; kIter < columnsA; kIter++)
+                {
+                    expected += matrixA.at(iIter, kIter) * matrixB.at(kIter, jIter);
+                }
+                EXPECT_NEAR(expected, result.at(iIter, jIter), 1e-9);
+            }
+        }
+    }
+}
+
+TEST(matrixTest, test_gemm_kernel_strided_operands_alpha_beta)
+{
+    // C = 2 * A^T * B^T - C, with A stored K x M and B stored N x K
+    const uint32_t M = 70;
+    const uint32_t N = 45;
+    const uint32_t K = 260;
+
+    matrix<float> storedA(K, M);
+    matrix<float> storedB(N, K);
+    matrix<float> matrixC(M, N);
+    storedA.fillRandom(-1.0f, 1.0f);
+    storedB.fillRandom(-1.0f, 1.0f);
+    matrixC.fillRandom(-1.0f, 1.0f);
+    matrix<float> originalC = matrixC.clone();
+
+    matrixKernels::gemm<float>(M, N, K, 2.0f,
+                               storedA.data(), 1, M,
+                               storedB.data(), 1, K,
+                               -1.0f, matrixC.data(), N);
+
+    for(uint32_t iIter = 0; iIter < M; iIter++)
+    {
+        for(uint32_t jIter = 0; jIter < N; jIter++)
+        {
+            float expected = 0.0f;
+            for(uint32_t kIter = 0; kIter < K; kIter++)
+            {
+                expected += storedA.at(kIter, iIter) * storedB.at(jIter, kIter);
+            }
+            expected = (2.0f * expected) - originalC.at(iIter, jIter);
+            EXPECT_NEAR(expected, matrixC.at(iIter, jIter), 1e-3);
+        }
+    }
+}
+
+template <class T> void checkElementwiseKernelsAtEverySimdLevel()
+{
+    // odd size so every variant also runs its scalar tail
+    const uint32_t rows = 37;
+    const uint32_t columns = 3;
+    const T scalar = static_cast<T>(-0.75);
+
+    matrix<T> matrixA(rows, columns);
+    matrix<T> matrixB(rows, columns);
+    matrixA.fillRandom(-2, 2);
+    matrixB.fillRandom(-2, 2);
+
+    const matrixKernels::simdLevel original = matrixKernels::activeSimdLevel();
+
+    matrixKernels::setSimdLevel(matrixKernels::simdLevel::scalar);
+    matrix<T> expectedSum = matrix<T>::add(matrixA, matrixB);
+    matrix<T> expectedDifference = matrix<T>::subtract(matrixA, matrixB);
+    matrix<T> expectedProduct = matrix<T>::hadamardProduct(matrixA, matrixB);
+    matrix<T> expectedScaled = matrix<T>::scalarMultiply(scalar, matrixA);
+    matrix<T> expectedAxpy = matrixB.clone();
+    matrix<T>::axpy(scalar, matrixA, expectedAxpy);
+
+    for(uint32_t level = 0; level <= static_cast<uint32_t>(matrixKernels::simdLevel::avx512); level++)
+    {
+        const matrixKernels::simdLevel inEffect = matrixKernels::setSimdLevel(static_cast<matrixKernels::simdLevel>(level));
+        std::cout<<"checking simd level "<<matrixKernels::simdLevelName(inEffect)<<std::endl;
+
+        matrix<T> sum = matrix<T>::add(matrixA, matrixB);
+        matrix<T> difference = matrix<T>::subtract(matrixA, matrixB);
+        matrix<T> product = matrix<T>::hadamardProduct(matrixA, matrixB);
+        matrix<T> scaled = matrix<T>::scalarMultiply(scalar, matrixA);
+        matrix<T> axpyResult = matrixB.clone();
+        matrix<T>::axpy(scalar, matrixA, axpyResult);
+
+        for(uint32_t iIter = 0; iIter < rows * columns; iIter++)
+        {
+            EXPECT_EQ(expectedSum.at(iIter), sum.at(iIter));
+            EXPECT_EQ(expectedDifference.at(iIter), difference.at(iIter));
+            EXPECT_EQ(expectedProduct.at(iIter), product.at(iIter));
+            EXPECT_EQ(expectedScaled.at(iIter), scaled.at(iIter));
+            // fused multiply-add rounds once instead of twice
+            EXPECT_NEAR(expectedAxpy.at(iIter), axpyResult.at(iIter), 1e-5);
+        }
+    }
+
+    matrixKernels::setSimdLevel(original);
+}
+
+TEST(matrixTest, test_simd_kernels_match_scalar_float)
+{
+    checkElementwiseKernelsAtEverySimdLevel<float>();
+}
+
+TEST(matrixTest, test_simd_kernels_match_scalar_double)
+{
+    checkElementwiseKernelsAtEverySimdLevel<_Float64>();
+}
+
+TEST(matrixTest, test_set_simd_level_clamps_to_detected)
+{
+    const matrixKernels::simdLevel original = matrixKernels::activeSimdLevel();
+    const matrixKernels::simdLevel detected = matrixKernels::detectSimdLevel();
+
+    EXPECT_EQ(detected, matrixKernels::setSimdLevel(matrixKernels::simdLevel::avx512));
+    EXPECT_EQ(matrixKernels::simdLevel::scalar, matrixKernels::setSimdLevel(matrixKernels::simdLevel::scalar));
+    EXPECT_EQ(matrixKernels::simdLevel::scalar, matrixKernels::activeSimdLevel());
+
+    matrixKernels::setSimdLevel(original);
+}
+
+TEST(matrixTest, test_rank_one_update)
+{
+    _Float64 dataX[3] {1.0, -2.0, 0.5};
+    _Float64 dataY[4] {2.0, 0.0, -1.0, 3.0};
+
+    matrix<_Float64> x(dataX, 3, 1);
+    matrix<_Float64> y(dataY, 4, 1);
+    matrix<_Float64> A(3, 4);
+    A.fillNumber(1.0);
+
+    matrix<_Float64>::rankOneUpdate(0.5, x, y, A);
+
+    for(uint32_t iIter = 0; iIter < 3; iIter++)
+    {
+        for(uint32_t jIter = 0; jIter < 4; jIter++)
+        {
+            EXPECT_DOUBLE_EQ(1.0 + (0.5 * dataX[iIter] * dataY[jIter]), A.at(iIter, jIter));
+        }
+    }
+}
+
+TEST(matrixTest, test_sigmoid_layer_backward_matches_unfused_math)
+{
+    const uint32_t numNeurons = 10;
+    const uint32_t numInputs = 16;
+    const _Float64 learningRate = 0.25;
+
+    matrix<_Float64> weights(numNeurons, numInputs);
+    matrix<_Float64> biases(numNeurons, 1);
+    matrix<_Float64> input(numInputs, 1);
+    matrix<_Float64> output(numNeurons, 1);
+    matrix<_Float64> gradient(numNeurons, 1);
+    weights.fillRandom(-0.5, 0.5);
+    biases.fillRandom(-0.5, 0.5);
+    input.fillRandom(0.0, 1.0);
+    output.fillRandom(0.0, 1.0);
+    gradient.fillRandom(-1.0, 1.0);
+
+    // the same step written out with the unfused operations
+    matrix<_Float64> ones(numNeurons, 1);
+    ones.fillNumber(1.0);
+    matrix<_Float64> expectedDelta = matrix<_Float64>::hadamardProduct(matrix<_Float64>::hadamardProduct(output, matrix<_Float64>::subtract(ones, output)), gradient);
+    matrix<_Float64> expectedPropagated = matrix<_Float64>::matrixMultiplication(matrix<_Float64>::transpose(weights), expectedDelta);
+    matrix<_Float64> expectedWeights = matrix<_Float64>::subtract(weights, matrix<_Float64>::matrixMultiplication(matrix<_Float64>::scalarMultiply(learningRate, expectedDelta), matrix<_Float64>::transpose(input)));
+    matrix<_Float64> expectedBiases = matrix<_Float64>::subtract(biases, matrix<_Float64>::scalarMultiply(learningRate, expectedDelta));
+
+    matrix<_Float64> delta;
+    matrix<_Float64> propagated;
+    matrix<_Float64>::sigmoidLayerBackward(output, gradient, input, learningRate, weights, biases, delta, &propagated);
+
+    ASSERT_EQ(numInputs, propagated.getNumRows());
+    for(uint32_t iIter = 0; iIter < numNeurons; iIter++)
+    {
+        EXPECT_NEAR(expectedDelta.at(iIter), delta.at(iIter), 1e-12);
+        EXPECT_NEAR(expectedBiases.at(iIter), biases.at(iIter), 1e-12);
+    }
+    for(uint32_t iIter = 0; iIter < numInputs; iIter++)
+    {
+        EXPECT_NEAR(expectedPropagated.at(iIter), propagated.at(iIter), 1e-12);
+    }
+    for(uint32_t iIter = 0; iIter < numNeurons * numInputs; iIter++)
+    {
+        EXPECT_NEAR(expectedWeights.at(iIter), weights.at(iIter), 1e-12);
+    }
+}
+
+TEST(matrixTest, test_expression_templates_fused_evaluation)
+{
+    const uint32_t rows = 10;
+
+    matrix<_Float64> output(rows, 1);
+    matrix<_Float64> label(rows, 1);
+    output.fillRandom(0.0, 1.0);
+    label.fillZeros();
+    label.assign(1.0, 3);
+
+    // no ones matrix, the scalar is broadcast
+    matrix<_Float64> delta = hadamard(hadamard(output, 1.0 - output), output - label);
+    const _Float64* storageOfDelta = delta.data();
+
+    ASSERT_EQ(rows, delta.getNumRows());
+    ASSERT_EQ(1u, delta.getNumColumns());
+    for(uint32_t iIter = 0; iIter < rows; iIter++)
+    {
+        _Float64 expected = (output.at(iIter) * (1.0 - output.at(iIter))) * (output.at(iIter) - label.at(iIter));
+        EXPECT_DOUBLE_EQ(expected, delta.at(iIter));
+    }
+
+    // assigning into an existing matrix of the same shape reuses its storage,
+    // and an expression may read the matrix it is assigned to
+    delta = 2.0 * delta + output * 0.5 - 1.0;
+    EXPECT_EQ(storageOfDelta, delta.data());
+    for(uint32_t iIter = 0; iIter < rows; iIter++)
+    {
+        _Float64 previous = (output.at(iIter) * (1.0 - output.at(iIter))) * (output.at(iIter) - label.at(iIter));
+        EXPECT_DOUBLE_EQ((2.0 * previous) + (output.at(iIter) * 0.5) - 1.0, delta.at(iIter));
+    }
+
+    matrix<_Float64> accumulated = output.clone();
+    accumulated += hadamard(output, output);
+    accumulated -= label;
+    for(uint32_t iIter = 0; iIter < rows; iIter++)
+    {
+        EXPECT_DOUBLE_EQ(output.at(iIter) + (output.at(iIter) * output.at(iIter)) - label.at(iIter), accumulated.at(iIter));
+    }
+}
+
+// detects whether fixedMatrix<T, Rows, Columns>::matrixMultiplication(A, B) compiles
+template <class Result, class A, class B, class = void> struct canMultiply : std::false_type {};
+template <class Result, class A, class B> struct canMultiply<Result, A, B, std::void_t<decltype(Result::matrixMultiplication(std::declval<const A&>(), std::declval<const B&>()))>> : std::true_type {};
+
+// detects whether fixedMatrix<T, Rows, Columns>::add(A, B) compiles
+template <class Result, class A, class B, class = void> struct canAdd : std::false_type {};
+template <class Result, class A, class B> struct canAdd<Result, A, B, std::void_t<decltype(Result::add(std::declval<const A&>(), std::declval<const B&>()))>> : std::true_type {};
+
+TEST(matrixTest, test_fixed_matrix_shapes_are_checked_at_compile_time)
+{
+    using weights = fixedMatrix<_Float64, 10, 16>;
+    using input = fixedMatrix<_Float64, 16, 1>;
+    using output = fixedMatrix<_Float64, 10, 1>;
+
+    static_assert(canMultiply<output, weights, input>::value, "10x16 * 16x1 is a 10x1");
+    static_assert(!canMultiply<output, weights, output>::value, "10x16 * 10x1 must not compile");
+    static_assert(!canMultiply<input, weights, input>::value, "10x16 * 16x1 is not a 16x1");
+    static_assert(canAdd<output, output, output>::value, "10x1 + 10x1 is a 10x1");
+    static_assert(!canAdd<output, output, input>::value, "10x1 + 16x1 must not compile");
+
+    static_assert(output::m_rows == 10 && output::m_columns == 1, "shape is constexpr");
+    // 10x16 doubles is 1280 bytes, kept inline. 16x784 doubles is not
+    static_assert(sizeof(weights) >= sizeof(_Float64) * 10 * 16, "small matrices store data inline");
+    static_assert(sizeof(fixedMatrix<_Float64, 16, 784>) < sizeof(_Float64) * 16 * 784, "large matrices store data on the heap");
+}
+
+TEST(matrixTest, test_fixed_matrix_matches_dynamic_matrix)
+{
+    matrix<_Float64> dynamicWeights(10, 16);
+    matrix<_Float64> dynamicInput(16, 1);
+    matrix<_Float64> dynamicBiases(10, 1);
+    dynamicWeights.fillRandom(-0.5, 0.5);
+    dynamicInput.fillRandom(0.0, 1.0);
+    dynamicBiases.fillRandom(-0.5, 0.5);
+
+    fixedMatrix<_Float64, 10, 16> weights(dynamicWeights);
+    fixedMatrix<_Float64, 16, 1> input(dynamicInput);
+    fixedMatrix<_Float64, 10, 1> biases(dynamicBiases);
+
+    EXPECT_EQ(0u, reinterpret_cast<uintptr_t>(weights.data()) % matrix<_Float64>::m_alignment);
+
+    fixedMatrix<_Float64, 10, 1> weighted = fixedMatrix<_Float64, 10, 1>::matrixMultiplication(weights, input);
+    fixedMatrix<_Float64, 10, 1> activation = fixedMatrix<_Float64, 10, 1>::add(weighted, biases);
+    matrix<_Float64> expected = matrix<_Float64>::add(matrix<_Float64>::matrixMultiplication(dynamicWeights, dynamicInput), dynamicBiases);
+
+    // fixed and dynamic matrices mix in expressions and convert both ways
+    matrix<_Float64> difference = activation - expected;
+    matrix<_Float64> converted = activation.toMatrix();
+    fixedMatrix<_Float64, 10, 1> mixed = 2.0 * activation + dynamicBiases;
+
+    for(uint32_t iIter = 0; iIter < 10; iIter++)
+    {
+        EXPECT_NEAR(expected.at(iIter), activation.at(iIter), 1e-12);
+        EXPECT_NEAR(0.0, difference.at(iIter), 1e-12);
+        EXPECT_EQ(activation.at(iIter), converted.at(iIter));
+        EXPECT_DOUBLE_EQ((2.0 * activation.at(iIter)) + dynamicBiases.at(iIter), mixed.at(iIter));
+    }
+
+    // a large fixed matrix goes through the blocked kernel
+    matrix<_Float64> dynamicLarge(16, 784);
+    matrix<_Float64> dynamicImage(784, 1);
+    dynamicLarge.fillRandom(-0.5, 0.5);
+    dynamicImage.fillRandom(0.0, 1.0);
+    fixedMatrix<_Float64, 16, 784> large(dynamicLarge);
+    fixedMatrix<_Float64, 784, 1> image(dynamicImage);
+    fixedMatrix<_Float64, 16, 1> largeProduct = fixedMatrix<_Float64, 16, 1>::matrixMultiplication(large, image);
+    matrix<_Float64> expectedLarge = matrix<_Float64>::matrixMultiplication(dynamicLarge, dynamicImage);
+    for(uint32_t iIter = 0; iIter < 16; iIter++)
+    {
+        EXPECT_NEAR(expectedLarge.at(iIter), largeProduct.at(iIter), 1e-12);
+    }
+
+    fixedMatrix<_Float64, 16, 10> transposed = fixedMatrix<_Float64, 16, 10>::transpose(weights);
+    for(uint32_t iIter = 0; iIter < 10; iIter++)
+    {
+        for(uint32_t jIter = 0; jIter < 16; jIter++)
+        {
+            EXPECT_EQ(weights.at(iIter, jIter), transposed.at(jIter, iIter));
+        }
+    }
+}
+
+TEST(matrixTest, test_reference_accessors_views_and_iterators)
+{
+    const uint32_t rows = 3;
+    const uint32_t columns = 4;
+
+    uint32_t data[rows * columns] 
+    {
+        1, 2, 3, 4, 
+        5, 6, 7, 8, 
+        9, 10, 11, 12
+    };
+
+    matrix<uint32_t> dut(data, rows, columns);
+
+    EXPECT_EQ(7u, dut(1, 2));
+    dut(1, 2) = 70;
+    EXPECT_EQ(70u, dut.at(1, 2));
+    dut[0] = 100;
+    EXPECT_EQ(100u, dut.at(0, 0));
+
+    stridedSpan<uint32_t> secondRow = dut.row(1);
+    ASSERT_EQ(columns, secondRow.size());
+    EXPECT_EQ(1, secondRow.stride());
+    EXPECT_EQ(5u, secondRow[0]);
+    EXPECT_EQ(70u, secondRow[2]);
+
+    const matrix<uint32_t>& constDut = dut;
+    stridedSpan<const uint32_t> lastColumn = constDut.column(3);
+    ASSERT_EQ(rows, lastColumn.size());
+    std::vector<uint32_t> columnValues(lastColumn.begin(), lastColumn.end());
+    EXPECT_EQ((std::vector<uint32_t>{4, 8, 12}), columnValues);
+
+    // columns are writable through the view too
+    for(uint32_t& value : dut.column(0))
+    {
+        value = 0;
+    }
+    EXPECT_EQ(0u, dut(0, 0));
+    EXPECT_EQ(0u, dut(1, 0));
+    EXPECT_EQ(0u, dut(2, 0));
+
+    // the matrix itself iterates as a flat row major range
+    uint32_t sum = 0;
+    for(const uint32_t& value : constDut)
+    {
+        sum += value;
+    }
+    EXPECT_EQ(2u + 3u + 4u + 6u + 70u + 8u + 10u + 11u + 12u, sum);
+    EXPECT_EQ(rows * columns, static_cast<uint32_t>(dut.end() - dut.begin()));
+    EXPECT_EQ(dut.data(), dut.begin());
+}
+
+#if MATRIX_BOUNDS_CHECK
+TEST(matrixTest, test_bounds_check_catches_one_past_the_end)
+{
+    matrix<uint32_t> dut(3, 4);
+    dut.fillZeros();
+
+    // the checks used to compare with > and let index == size through.
+    // volatile keeps the compiler from flagging the access it can see is out
+    // of bounds, the check has to catch it at run time
+    volatile uint32_t opaqueRows = 3;
+    volatile uint32_t opaqueColumns = 4;
+    const uint32_t numRows = opaqueRows;
+    const uint32_t numColumns = opaqueColumns;
+    EXPECT_DEATH(dut.at(numRows * numColumns), "Assertion");
+    EXPECT_DEATH(dut.at(numRows, 0), "Assertion");
+    EXPECT_DEATH(dut.assign(1, 0, numColumns), "Assertion");
+    EXPECT_DEATH(dut(numRows, 0), "Assertion");
+}
+#endif
+
+TEST(matrixTest, test_parallel_for_covers_every_index_once)
+{
+    threadPool::instance().setNumThreads(4);
+    ASSERT_EQ(4u, threadPool::instance().getNumThreads());
+
+    std::vector<uint32_t> hits(10007, 0);
+    parallelFor(3, 10007, 16, [&hits](uint32_t chunkBegin, uint32_t chunkEnd)
+    {
+        for(uint32_t iIter = chunkBegin; iIter < chunkEnd; iIter++)
+        {
+            hits[iIter]++;
+        }
+    });
+
+    for(uint32_t iIter = 0; iIter < hits.size(); iIter++)
+    {
+        EXPECT_EQ((iIter < 3) ? 0u : 1u, hits[iIter]);
+    }
+
+    // a parallelFor inside a chunk runs serially instead of deadlocking
+    std::atomic<uint32_t> inner{0};
+    parallelFor(0, 64, 1, [&inner](uint32_t chunkBegin, uint32_t chunkEnd)
+    {
+        parallelFor(0, 100, 1, [&inner, chunkBegin, chunkEnd](uint32_t innerBegin, uint32_t innerEnd)
+        {
+            inner += (chunkEnd - chunkBegin) * (innerEnd - innerBegin);
+        });
+    });
+    EXPECT_EQ(6400u, inner.load());
+
+    threadPool::instance().setNumThreads(0);
+}
+
+TEST(matrixTest, test_parallel_operations_match_serial)
+{
+    // every tile of C is owned by one thread and summed in the serial order,
+    // so the results must be bit for bit the same at any thread count
+    matrix<_Float64> matrixA(301, 517);
+    matrix<_Float64> matrixB(517, 133);
+    matrixA.fillRandom(-1.0, 1.0);
+    matrixB.fillRandom(-1.0, 1.0);
+    matrix<_Float64> bigA(400, 300);
+    matrix<_Float64> bigB(400, 300);
+    bigA.fillRandom(-1.0, 1.0);
+    bigB.fillRandom(-1.0, 1.0);
+
+    threadPool::instance().setNumThreads(1);
+    matrix<_Float64> serialProduct = matrix<_Float64>::matrixMultiplication(matrixA, matrixB);
+    matrix<_Float64> serialSum = matrix<_Float64>::add(bigA, bigB);
+    matrix<_Float64> serialExpression = hadamard(bigA, 1.0 - bigA) * 0.5;
+
+    for(uint32_t numThreads : {2u, 3u, 8u})
+    {
+        threadPool::instance().setNumThreads(numThreads);
+        matrix<_Float64> product = matrix<_Float64>::matrixMultiplication(matrixA, matrixB);
+        matrix<_Float64> sum = matrix<_Float64>::add(bigA, bigB);
+        matrix<_Float64> expression = hadamard(bigA, 1.0 - bigA) * 0.5;
+
+        for(uint32_t iIter = 0; iIter < product.getNumRows() * product.getNumColumns(); iIter++)
+        {
+            ASSERT_EQ(serialProduct.at(iIter), product.at(iIter));
+        }
+        for(uint32_t iIter = 0; iIter < sum.getNumRows() * sum.getNumColumns(); iIter++)
+        {
+            ASSERT_EQ(serialSum.at(iIter), sum.at(iIter));
+            ASSERT_EQ(serialExpression.at(iIter), expression.at(iIter));
+        }
+    }
+
+    threadPool::instance().setNumThreads(0);
+}
+
+TEST(matrixTest, test_transposed_multiply_row_sums_and_column_broadcast)
+{
+    matrix<_Float64> matrixA(37, 90);
+    matrix<_Float64> matrixB(37, 41);
+    matrix<_Float64> matrixC(90, 41);
+    matrixA.fillRandom(-1.0, 1.0);
+    matrixB.fillRandom(-1.0, 1.0);
+    matrixC.fillRandom(-1.0, 1.0);
+    const matrix<_Float64> originalC = matrixC;
+
+    // C = 0.5 * A^T * B + 2 * C against the explicit transpose
+    matrix<_Float64> transposeOfA = matrix<_Float64>::transpose(matrixA);
+    matrix<_Float64> expected = matrix<_Float64>::matrixMultiplication(transposeOfA, matrixB);
+    matrix<_Float64>::matrixMultiplication(0.5, matrixA, true, matrixB, false, 2.0, matrixC);
+    for(uint32_t iIter = 0; iIter < 90 * 41; iIter++)
+    {
+        EXPECT_NEAR((0.5 * expected.at(iIter)) + (2.0 * originalC.at(iIter)), matrixC.at(iIter), 1e-9);
+    }
+
+    // C = A * B^T with beta 0 resizes the destination
+    matrix<_Float64> matrixD(41, 90);
+    matrixD.fillRandom(-1.0, 1.0);
+    matrix<_Float64> result;
+    matrix<_Float64>::matrixMultiplication(1.0, matrixA, false, matrixD, true, 0.0, result);
+    expected = matrix<_Float64>::matrixMultiplication(matrixA, matrix<_Float64>::transpose(matrixD));
+    ASSERT_EQ(37u, result.getNumRows());
+    ASSERT_EQ(41u, result.getNumColumns());
+    for(uint32_t iIter = 0; iIter < 37 * 41; iIter++)
+    {
+        EXPECT_NEAR(expected.at(iIter), result.at(iIter), 1e-9);
+    }
+
+    matrix<_Float64> sums;
+    matrix<_Float64>::rowSums(matrixA, sums);
+    matrix<_Float64> broadcast = matrixA;
+    broadcast.addToEachColumn(sums);
+    ASSERT_EQ(37u, sums.getNumRows());
+    ASSERT_EQ(1u, sums.getNumColumns());
+    for(uint32_t iIter = 0; iIter < 37; iIter++)
+    {
+        _Float64 expectedSum = 0.0;
+        for(uint32_t jIter = 0; jIter < 90; jIter++)
+        {
+            expectedSum += matrixA.at(iIter, jIter);
+            EXPECT_EQ(matrixA.at(iIter, jIter) + sums.at(iIter), broadcast.at(iIter, jIter));
+        }
+        EXPECT_NEAR(expectedSum, sums.at(iIter), 1e-12);
+    }
+}
+
+TEST(matrixTest, test_gemm_micro_kernels_match_across_simd_levels)
+{
+    const matrixKernels::simdLevel original = matrixKernels::activeSimdLevel();
+
+    matrix<_Float64> matrixA(70, 300);
+    matrix<_Float64> matrixB(300, 45);
+    matrixA.fillRandom(-1.0, 1.0);
+    matrixB.fillRandom(-1.0, 1.0);
+
+    // each element of the tile is its own accumulator, wider vectors do not
+    // reorder the sums, so every level must give the same bits
+    matrixKernels::setSimdLevel(matrixKernels::simdLevel::scalar);
+    const matrix<_Float64> reference = matrix<_Float64>::matrixMultiplication(matrixA, matrixB);
+
+    for(uint32_t level = 1; level <= static_cast<uint32_t>(matrixKernels::simdLevel::avx512); level++)
+    {
+        matrixKernels::setSimdLevel(static_cast<matrixKernels::simdLevel>(level));
+        const matrix<_Float64> result = matrix<_Float64>::matrixMultiplication(matrixA, matrixB);
+        for(uint32_t iIter = 0; iIter < 70 * 45; iIter++)
+        {
+            ASSERT_EQ(reference.at(iIter), result.at(iIter));
+        }
+    }
+
+    matrixKernels::setSimdLevel(original);
+}
+
+TEST(matrixTest, test_views_and_capacity_reuse)
+{
+    matrix<_Float64> owner(4, 6);
+    owner.fillZeros();
+
+    // a view reads and writes the owner's memory and never frees it
+    {
+        matrix<_Float64> window = matrix<_Float64>::view(owner.data(), 4, 6);
+        EXPECT_FALSE(window.ownsData());
+        EXPECT_EQ(owner.data(), window.data());
+        window(2, 3) = 5.0;
+
+        // shrinking stays on the same memory
+        window.resize(2, 6);
+        EXPECT_EQ(owner.data(), window.data());
+
+        // copying a view makes an owning copy
+        matrix<_Float64> copy = window;
+        EXPECT_TRUE(copy.ownsData());
+        EXPECT_NE(owner.data(), copy.data());
+    }
+    EXPECT_EQ(5.0, owner.at(2, 3));
+
+    // assigning a temporary to a view writes through as well, the view does
+    // not take over the temporary's storage
+    {
+        matrix<_Float64> ones(2, 3);
+        ones.fillNumber(1.0);
+        matrix<_Float64> window = matrix<_Float64>::view(owner.data(), 2, 3);
+        window = matrix<_Float64>::add(ones, ones);
+        EXPECT_FALSE(window.ownsData());
+        EXPECT_EQ(owner.data(), window.data());
+    }
+    EXPECT_EQ(2.0, owner.at(0, 3));
+    EXPECT_EQ(2.0, owner.at(0, 5));
+    EXPECT_EQ(0.0, owner.at(1, 0));
+
+    // what does not fit a view is refused, the view never moves to storage
+    // of its own
+    {
+        matrix<_Float64> window = matrix<_Float64>::view(owner.data(), 2, 3);
+        matrix<_Float64> tooBig(4, 6);
+        tooBig.fillNumber(9.0);
+#ifndef NDEBUG
+        EXPECT_DEATH(window = tooBig, "Assertion");
+        EXPECT_DEATH(window = std::move(tooBig), "Assertion");
+        EXPECT_DEATH(window.resize(3, 3), "Assertion");
+#else
+        window = tooBig;
+        window = std::move(tooBig);
+        window.resize(3, 3);
+#endif
+        EXPECT_FALSE(window.ownsData());
+        EXPECT_EQ(owner.data(), window.data());
+        EXPECT_EQ(2u, window.getNumRows());
+        EXPECT_EQ(3u, window.getNumColumns());
+        EXPECT_EQ(2.0, owner.at(0, 3));
+    }
+
+    // a read only view reads like a view, its copies are writable and
+    // everything that writes it asserts
+    {
+        const matrix<_Float64>& constOwner = owner;
+        matrix<_Float64> frozen = matrix<_Float64>::readOnlyView(constOwner.data(), 4, 6);
+        EXPECT_TRUE(frozen.isReadOnly());
+        EXPECT_FALSE(frozen.ownsData());
+        EXPECT_EQ(5.0, frozen.at(2, 3));
+
+        matrix<_Float64> moved = std::move(frozen);
+        EXPECT_TRUE(moved.isReadOnly());
+        EXPECT_FALSE(frozen.isReadOnly());
+
+        matrix<_Float64> copy = moved;
+        EXPECT_FALSE(copy.isReadOnly());
+        copy.fillZeros();
+        EXPECT_EQ(5.0, owner.at(2, 3));
+
+#ifndef NDEBUG
+        EXPECT_DEATH(moved.fillZeros(), "Assertion");
+        EXPECT_DEATH(moved = copy, "Assertion");
+        EXPECT_DEATH(moved.resize(2, 6), "Assertion");
+        EXPECT_DEATH(matrix<_Float64>::axpy(1.0, copy, moved), "Assertion");
+#endif
+    }
+
+    // a buffer sized for the largest batch serves every smaller one in place
+    matrix<_Float64> buffer(16, 32);
+    const _Float64* storage = buffer.data();
+    buffer.resize(16, 7);
+    EXPECT_EQ(storage, buffer.data());
+    EXPECT_EQ(16u * 32u, buffer.getCapacity());
+    buffer = matrix<_Float64>(16, 20);
+    buffer.resize(16, 32);
+    EXPECT_EQ(16u * 32u, buffer.getCapacity());
+}
+
+template <class S, class B> static B ulpDistance(S a, S b)
+{
+    B bitsOfA;
+    B bitsOfB;
+    std::memcpy(&bitsOfA, &a, sizeof(a));
+    std::memcpy(&bitsOfB, &b, sizeof(b));
+    return (bitsOfA > bitsOfB) ? (bitsOfA - bitsOfB) : (bitsOfB - bitsOfA);
+}
+
+TEST(matrixTest, test_fast_activations_within_documented_ulp)
+{
+    using matrixKernels::activationFunction;
+    using matrixKernels::activationMode;
+
+    matrix<double> z(1, 20001);
+    matrix<float> zFloat(1, 20001);
+    for(uint32_t iIter = 0; iIter < z.getNumColumns(); iIter++)
+    {
+        z[iIter] = -700.0 + (0.07 * iIter);
+        zFloat[iIter] = -86.0f + (0.0086f * iIter);
+    }
+
+    for(uint32_t iIter = 0; iIter < z.getNumColumns(); iIter++)
+    {
+        EXPECT_LE((ulpDistance<double, uint64_t>(matrixKernels::fastExp(z[iIter]), std::exp(z[iIter]))), 1u) << z[iIter];
+        EXPECT_LE((ulpDistance<float, uint32_t>(matrixKernels::fastExp(zFloat[iIter]), std::exp(zFloat[iIter]))), 1u) << zFloat[iIter];
+    }
+
+    matrix<double> exact;
+    matrix<double> fast;
+    matrix<float> exactFloat;
+    matrix<float> fastFloat;
+    matrix<double>::activate(activationFunction::sigmoid, activationMode::exact, z, exact);
+    matrix<double>::activate(activationFunction::sigmoid, activationMode::fast, z, fast);
+    matrix<float>::activate(activationFunction::sigmoid, activationMode::exact, zFloat, exactFloat);
+    matrix<float>::activate(activationFunction::sigmoid, activationMode::fast, zFloat, fastFloat);
+    for(uint32_t iIter = 0; iIter < z.getNumColumns(); iIter++)
+    {
+        EXPECT_LE((ulpDistance<double, uint64_t>(fast[iIter], exact[iIter])), 4u) << z[iIter];
+        EXPECT_LE((ulpDistance<float, uint32_t>(fastFloat[iIter], exactFloat[iIter])), 4u) << zFloat[iIter];
+    }
+
+    matrix<double>::activate(activationFunction::tanh, activationMode::exact, z, exact);
+    matrix<double>::activate(activationFunction::tanh, activationMode::fast, z, fast);
+    for(uint32_t iIter = 0; iIter < z.getNumColumns(); iIter++)
+    {
+        if(std::fabs(z[iIter]) > 0.5)
+        {
+            EXPECT_LE((ulpDistance<double, uint64_t>(fast[iIter], exact[iIter])), 6u) << z[iIter];
+        }
+        EXPECT_NEAR(exact[iIter], fast[iIter], 4e-16);
+    }
+}
+
+TEST(matrixTest, test_activation_kernels_match_across_simd_levels)
+{
+    using matrixKernels::activationFunction;
+    using matrixKernels::activationMode;
+
+    const matrixKernels::simdLevel original = matrixKernels::activeSimdLevel();
+
+    // odd sizes so the vector tails run too
+    matrix<_Float64> z(13, 37);
+    matrix<_Float64> gradient(13, 37);
+    z.fillRandom(-20.0, 20.0);
+    gradient.fillRandom(-1.0, 1.0);
+
+    for(uint32_t function = 0; function <= static_cast<uint32_t>(activationFunction::softmax); function++)
+    {
+        matrixKernels::setSimdLevel(matrixKernels::simdLevel::scalar);
+        matrix<_Float64> referenceOutput;
+        matrix<_Float64> referenceDelta;
+        matrix<_Float64>::activate(static_cast<activationFunction>(function), activationMode::fast, z, referenceOutput);
+        matrix<_Float64>::activationDerivative(static_cast<activationFunction>(function), referenceOutput, gradient, referenceDelta);
+
+        for(uint32_t level = 1; level <= static_cast<uint32_t>(matrixKernels::simdLevel::avx512); level++)
+        {
+            matrixKernels::setSimdLevel(static_cast<matrixKernels::simdLevel>(level));
+            matrix<_Float64> output;
+            matrix<_Float64> delta;
+            matrix<_Float64>::activate(static_cast<activationFunction>(function), activationMode::fast, z, output);
+            matrix<_Float64>::activationDerivative(static_cast<activationFunction>(function), output, gradient, delta);
+            for(uint32_t iIter = 0; iIter < 13 * 37; iIter++)
+            {
+                ASSERT_EQ(referenceOutput[iIter], output[iIter]) << matrixKernels::activationFunctionName(static_cast<activationFunction>(function));
+                ASSERT_EQ(referenceDelta[iIter], delta[iIter]) << matrixKernels::activationFunctionName(static_cast<activationFunction>(function));
+            }
+        }
+    }
+
+    matrixKernels::setSimdLevel(original);
+}
+
+TEST(matrixTest, test_activation_derivatives_and_stable_softmax)
+{
+    using matrixKernels::activationFunction;
+    using matrixKernels::activationMode;
+
+    // away from 0 so ReLU's kink is not inside the finite difference
+    matrix<_Float64> z(6, 5);
+    matrix<_Float64> gradient(6, 5);
+    z.fillRandom(0.1, 3.0);
+    gradient.fillRandom(-1.0, 1.0);
+    for(uint32_t iIter = 0; iIter < 30; iIter += 2)
+    {
+        z[iIter] = -z[iIter];
+    }
+
+    const _Float64 epsilon = 1e-6;
+    for(uint32_t function = 0; function <= static_cast<uint32_t>(activationFunction::softmax); function++)
+    {
+        const activationFunction f = static_cast<activationFunction>(function);
+        matrix<_Float64> y;
+        matrix<_Float64> delta;
+        matrix<_Float64>::activate(f, activationMode::exact, z, y);
+        matrix<_Float64>::activationDerivative(f, y, gradient, delta);
+
+        // delta is the gradient of gradient . f(z) with respect to z
+        for(uint32_t iIter = 0; iIter < 30; iIter++)
+        {
+            matrix<_Float64> nudged = z;
+            matrix<_Float64> up;
+            matrix<_Float64> down;
+            nudged[iIter] = z[iIter] + epsilon;
+            matrix<_Float64>::activate(f, activationMode::exact, nudged, up);
+            nudged[iIter] = z[iIter] - epsilon;
+            matrix<_Float64>::activate(f, activationMode::exact, nudged, down);
+
+            _Float64 change = 0.0;
+            for(uint32_t jIter = 0; jIter < 30; jIter++)
+            {
+                change += gradient[jIter] * (up[jIter] - down[jIter]);
+            }
+            EXPECT_NEAR(change / (2.0 * epsilon), delta[iIter], 1e-8) << matrixKernels::activationFunctionName(f);
+        }
+    }
+
+    // inputs that would overflow exp on their own
+    matrix<_Float64> large(3, 2);
+    large(0, 0) = 1000.0; large(0, 1) = -1000.0;
+    large(1, 0) = 999.0;  large(1, 1) = -1001.0;
+    large(2, 0) = 998.0;  large(2, 1) = -5000.0;
+    for(activationMode mode : {activationMode::exact, activationMode::fast})
+    {
+        matrix<_Float64> probabilities;
+        matrix<_Float64>::activate(activationFunction::softmax, mode, large, probabilities);
+        for(uint32_t jIter = 0; jIter < 2; jIter++)
+        {
+            EXPECT_NEAR(1.0, probabilities(0, jIter) + probabilities(1, jIter) + probabilities(2, jIter), 1e-15);
+        }
+        EXPECT_NEAR(1.0 / (1.0 + std::exp(-1.0) + std::exp(-2.0)), probabilities(0, 0), 1e-15);
+        EXPECT_NEAR(0.0, probabilities(2, 1), 1e-300);
+    }
+}
+
+TEST(matrixTest, test_wide_accumulation_and_bfloat16_operands)
+{
+    using matrixKernels::bfloat16;
+
+    // round to nearest, ties to even, NaN stays NaN
+    EXPECT_EQ(0x3f80, bfloat16(1.0f).bits);
+    EXPECT_EQ(0x3f80, bfloat16(1.0f + std::ldexp(1.0f, -8)).bits);
+    EXPECT_EQ(0x3f82, bfloat16(1.0f + 3.0f * std::ldexp(1.0f, -8)).bits);
+    EXPECT_EQ(0xc2f7, bfloat16(-123.5f).bits);
+    EXPECT_EQ(-123.5f, static_cast<float>(bfloat16(-123.5f)));
+    EXPECT_TRUE(std::isnan(static_cast<float>(bfloat16(std::nanf("")))));
+
+    // one kc slice deep, so a wide tile is summed in double from start to end.
+    // 64 x 64 goes through the packed kernel, 64 x 1 through the straight loop
+    matrix<float> A(64, 256);
+    matrix<float> B(256, 64);
+    A.fillRandom(-1.0f, 1.0f);
+    B.fillRandom(-1.0f, 1.0f);
+    matrix<float> vectorOfB(256, 1);
+    std::copy(B.column(0).begin(), B.column(0).end(), vectorOfB.begin());
+
+    for(matrixKernels::accumulation precision : {matrixKernels::accumulation::native, matrixKernels::accumulation::wide})
+    {
+        matrixKernels::setAccumulation(precision);
+        matrix<float> C;
+        matrix<float> vectorOfC;
+        matrix<float> sums;
+        matrix<float>::matrixMultiplication(A, B, C);
+        matrix<float>::matrixMultiplication(A, vectorOfB, vectorOfC);
+        matrix<float>::rowSums(A, sums);
+
+        double error = 0.0;
+        for(uint32_t iIter = 0; iIter < 64; iIter++)
+        {
+            double rowSum = 0.0;
+            for(uint32_t kIter = 0; kIter < 256; kIter++)
+            {
+                rowSum += A(iIter, kIter);
+            }
+            for(uint32_t jIter = 0; jIter < 64; jIter++)
+            {
+                double expected = 0.0;
+                for(uint32_t kIter = 0; kIter < 256; kIter++)
+                {
+                    expected += static_cast<double>(A(iIter, kIter)) * static_cast<double>(B(kIter, jIter));
+                }
+                error += std::fabs(C(iIter, jIter) - expected);
+                if(precision == matrixKernels::accumulation::wide)
+                {
+                    // the same sum in the same order, rounded once
+                    EXPECT_EQ(static_cast<float>(expected), C(iIter, jIter));
+                    if(jIter == 0)
+                    {
+                        EXPECT_EQ(static_cast<float>(expected), vectorOfC[iIter]);
+                    }
+                }
+            }
+            if(precision == matrixKernels::accumulation::wide)
+            {
+                EXPECT_EQ(static_cast<float>(rowSum), sums[iIter]);
+            }
+            else
+            {
+                EXPECT_NEAR(rowSum, sums[iIter], 1e-4);
+            }
+        }
+        EXPECT_LT(error / (64 * 64), 1e-5);
+    }
+    matrixKernels::setAccumulation(matrixKernels::accumulation::native);
+
+    // bfloat16 A is widened exactly, so it multiplies like its float value
+    matrix<bfloat16> narrowA(64, 256);
+    matrix<float> widenedA(64, 256);
+    matrixKernels::convertToBfloat16(A.data(), narrowA.data(), 64 * 256);
+    for(uint32_t iIter = 0; iIter < 64 * 256; iIter++)
+    {
+        widenedA[iIter] = static_cast<float>(narrowA.data()[iIter]);
+        EXPECT_NEAR(A[iIter], widenedA[iIter], std::ldexp(1.0f, -8));
+    }
+    for(const matrix<float>* right : {&B, &vectorOfB})
+    {
+        matrix<float> expected;
+        matrix<float> result;
+        matrix<float>::matrixMultiplication(widenedA, *right, expected);
+        matrix<float>::matrixMultiplication(narrowA, *right, result);
+        ASSERT_EQ(expected.getNumColumns(), result.getNumColumns());
+        EXPECT_EQ(0, std::memcmp(expected.data(), result.data(), sizeof(float) * 64 * expected.getNumColumns()));
+    }
+}
+
+TEST(matrixTest, test_quantized_kernels_match_exact_integers_across_simd_levels)
+{
+    const matrixKernels::simdLevel original = matrixKernels::activeSimdLevel();
+
+    // 7 rows leaves a partial block of 4, 800 inputs a partial 64 byte step
+    // for VNNI. The extremes, 255 * -127 everywhere, must not saturate
+    const uint32_t numRows = 7;
+    const uint32_t numSamples = 3;
+    const uint32_t paddedLength = matrixKernels::quantizedPaddedLength(800);
+    EXPECT_EQ(800u, paddedLength);
+    EXPECT_EQ(16u, matrixKernels::quantizedPaddedLength(1));
+    std::vector<int8_t> weights(numRows * paddedLength);
+    std::vector<uint8_t> activations(numSamples * paddedLength);
+    for(uint32_t iIter = 0; iIter < weights.size(); iIter++)
+    {
+        weights[iIter] = static_cast<int8_t>((iIter < paddedLength) ? -127 : static_cast<int32_t>((iIter * 37) % 255) - 127);
+    }
+    for(uint32_t iIter = 0; iIter < activations.size(); iIter++)
+    {
+        activations[iIter] = static_cast<uint8_t>((iIter < paddedLength) ? 255 : (iIter * 91) % 256);
+    }
+
+    std::vector<int32_t> expected(numSamples * numRows);
+    for(uint32_t bIter = 0; bIter < numSamples; bIter++)
+    {
+        for(uint32_t rIter = 0; rIter < numRows; rIter++)
+        {
+            int64_t sum = 0;
+            for(uint32_t kIter = 0; kIter < paddedLength; kIter++)
+            {
+                sum += static_cast<int64_t>(weights[(rIter * paddedLength) + kIter]) * activations[(bIter * paddedLength) + kIter];
+            }
+            expected[(bIter * numRows) + rIter] = static_cast<int32_t>(sum);
+        }
+    }
+    EXPECT_EQ(-127 * 255 * 800, expected[0]);
+
+    for(uint32_t level = 0; level <= static_cast<uint32_t>(matrixKernels::simdLevel::avx512); level++)
+    {
+        matrixKernels::setSimdLevel(static_cast<matrixKernels::simdLevel>(level));
+        std::vector<int32_t> result(numSamples * numRows, 0);
+        matrixKernels::quantizedGemm(weights.data(), numRows, paddedLength, activations.data(), numSamples, result.data());
+        EXPECT_EQ(expected, result)<<matrixKernels::activeQuantizedRowDotsName();
+    }
+
+    matrixKernels::setSimdLevel(original);
+}
+
+TEST(matrixTest, test_byte_conversion_matches_scalar_across_simd_levels)
+{
+    const matrixKernels::simdLevel original = matrixKernels::activeSimdLevel();
+
+    // 787 bytes leaves a tail after every vector width, offset and scale
+    // like a standardized MNIST pixel
+    const size_t numBytes = 787;
+    const float offset = 33.3184f;
+    const float scale = 1.0f / 78.5675f;
+    std::vector<uint8_t> bytes(numBytes);
+    for(size_t iIter = 0; iIter < numBytes; iIter++)
+    {
+        bytes[iIter] = static_cast<uint8_t>((iIter * 97) % 256);
+    }
+    bytes[1] = 255;
+
+    std::vector<float> expected(numBytes);
+    matrixKernels::scalarConvertBytes(bytes.data(), offset, scale, expected.data(), numBytes);
+    EXPECT_EQ((0.0f - offset) * scale, expected[0]);
+    EXPECT_EQ((255.0f - offset) * scale, expected[1]);
+
+    for(uint32_t level = 0; level <= static_cast<uint32_t>(matrixKernels::simdLevel::avx512); level++)
+    {
+        matrixKernels::setSimdLevel(static_cast<matrixKernels::simdLevel>(level));
+        std::vector<float> result(numBytes + 1, -1.0f);
+        matrixKernels::convertBytes(bytes.data(), offset, scale, result.data(), numBytes);
+        EXPECT_EQ(0, std::memcmp(expected.data(), result.data(), numBytes * sizeof(float)))<<matrixKernels::simdLevelName(matrixKernels::activeSimdLevel());
+        // nothing past the end is written
+        EXPECT_EQ(-1.0f, result[numBytes]);
+    }
+
+    matrixKernels::setSimdLevel(original);
+}
+
+TEST(matrixTest, test_random_engines_fills_and_epoch_sampler)
+{
+    // Philox4x32-10 known answers from the Random123 distribution
+    const matrixRandom::philox4x32::block zero = matrixRandom::philox4x32::generate({0, 0, 0, 0}, {0, 0});
+    EXPECT_EQ((matrixRandom::philox4x32::block{0x6627e8d5u, 0xe169c58du, 0xbc57ac4cu, 0x9b00dbd8u}), zero);
+    const matrixRandom::philox4x32::block pi = matrixRandom::philox4x32::generate({0x243f6a88u, 0x85a308d3u, 0x13198a2eu, 0x03707344u}, {0xa4093822u, 0x299f31d0u});
+    EXPECT_EQ((matrixRandom::philox4x32::block{0xd16cfe09u, 0x94fdccebu, 0x5001e420u, 0x24126ea1u}), pi);
+
+    // a stream is 2^128 draws of the seed's engine further on
+    matrixRandom::xoshiro256 jumped(7);
+    jumped.jump();
+    matrixRandom::xoshiro256 streamOne(7, 1);
+    matrixRandom::xoshiro256 streamZero(7);
+    EXPECT_EQ(jumped(), streamOne());
+    EXPECT_NE(streamZero(), streamOne());
+    for(uint32_t iIter = 0; iIter < 1000; iIter++)
+    {
+        EXPECT_LT(matrixRandom::uniformBelow(streamZero, 10), 10u);
+    }
+
+    // large enough for the thread pool, the same values at any thread count
+    threadPool& pool = threadPool::instance();
+    const uint32_t originalThreads = pool.getNumThreads();
+    matrix<double> serial(300, 301);
+    matrix<double> parallel(300, 301);
+    pool.setNumThreads(1);
+    serial.fillRandom(-0.5, 0.5, 11, 3);
+    pool.setNumThreads(4);
+    parallel.fillRandom(-0.5, 0.5, 11, 3);
+    EXPECT_EQ(0, std::memcmp(serial.data(), parallel.data(), 300 * 301 * sizeof(double)));
+    _Float64 sum = 0.0;
+    for(const double& value : serial)
+    {
+        EXPECT_GE(value, -0.5);
+        EXPECT_LT(value, 0.5);
+        sum += value;
+    }
+    EXPECT_NEAR(0.0, sum / (300 * 301), 0.01);
+
+    pool.setNumThreads(1);
+    serial.fillNormal(1.0, 2.0, 11, 4);
+    pool.setNumThreads(4);
+    parallel.fillNormal(1.0, 2.0, 11, 4);
+    pool.setNumThreads(originalThreads);
+    EXPECT_EQ(0, std::memcmp(serial.data(), parallel.data(), 300 * 301 * sizeof(double)));
+    _Float64 mean = 0.0;
+    _Float64 squares = 0.0;
+    for(const double& value : serial)
+    {
+        mean += value;
+        squares += value * value;
+    }
+    mean /= 300 * 301;
+    EXPECT_NEAR(1.0, mean, 0.02);
+    EXPECT_NEAR(2.0, std::sqrt((squares / (300 * 301)) - (mean * mean)), 0.02);
+
+    // fills without a seed differ from each other and repeat with the seed
+    matrixRandom::setDefaultSeed(5);
+    matrix<float> first(4, 5);
+    matrix<float> second(4, 5);
+    first.fillRandom(0.0f, 1.0f);
+    second.fillRandom(0.0f, 1.0f);
+    EXPECT_NE(0, std::memcmp(first.data(), second.data(), 20 * sizeof(float)));
+    matrixRandom::setDefaultSeed(5);
+    matrix<float> repeated(4, 5);
+    repeated.fillRandom(0.0f, 1.0f);
+    EXPECT_EQ(0, std::memcmp(first.data(), repeated.data(), 20 * sizeof(float)));
+
+    // three workers cover every sample exactly once per epoch, without talking
+    const uint32_t numSamples = 100;
+    std::vector<matrixRandom::epochSampler> workers;
+    for(uint32_t wIter = 0; wIter < 3; wIter++)
+    {
+        workers.emplace_back(numSamples, 13, wIter, 3);
+    }
+    for(uint32_t epoch = 0; epoch < 2; epoch++)
+    {
+        std::vector<uint32_t> seen(numSamples, 0);
+        std::vector<uint32_t> order;
+        for(matrixRandom::epochSampler& worker : workers)
+        {
+            for(uint32_t iIter = worker.getBegin(); iIter < worker.getEnd(); iIter++)
+            {
+                const uint32_t sample = worker.next();
+                seen[sample]++;
+                order.push_back(sample);
+            }
+        }
+        EXPECT_EQ(std::vector<uint32_t>(numSamples, 1), seen);
+        EXPECT_EQ(workers[0].getOrder(), order);
+        EXPECT_EQ(epoch, workers[2].getEpoch());
+    }
+    // the next epoch is shuffled again
+    const std::vector<uint32_t> previous = workers[0].getOrder();
+    workers[0].next();
+    EXPECT_EQ(2u, workers[0].getEpoch());
+    EXPECT_NE(previous, workers[0].getOrder());
+
+    // picks with replacement repeat with the seed and stream, streams differ
+    matrixRandom::sampleSequence picks(numSamples, 13, 0);
+    matrixRandom::sampleSequence repeatedPicks(numSamples, 13, 0);
+    matrixRandom::sampleSequence otherStream(numSamples, 13, 1);
+    std::vector<uint32_t> drawn;
+    std::vector<uint32_t> drawnByOtherStream;
+    for(uint32_t iIter = 0; iIter < 1000; iIter++)
+    {
+        drawn.push_back(picks.next());
+        EXPECT_LT(drawn.back(), numSamples);
+        EXPECT_EQ(drawn.back(), repeatedPicks.next());
+        drawnByOtherStream.push_back(otherStream.next());
+    }
+    EXPECT_NE(drawn, drawnByOtherStream);
+}
@@ -0,0 +1,305 @@
+/**
+ * Prefetching mini-batch loader.
+ * Copyright (C) 2024  Matthew Hardenburgh, matthew@hardenburgh.io
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef BATCH_LOADER_H
+#define BATCH_LOADER_H
+
+#include "mnistDataReader.h"
+#include "matrix.h"
+
+#include <stdint.h>
+#include <cassert>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+ * A batchLoader takes sampling, gathering and conversion out of the training
+ * loop. Producer threads build whole batches ahead of the trainer, which
+ * only pops them:
+ *
+ *     batchLoader<T> loader(training, batchSize, numBatches, samples, prefetch);
+ *     for(...)
+ *     {
+ *         const loadedBatch<T>& batch = loader.next();
+ *         ... forward(batch.inputLayer), compare with batch.labels ...
+ *     }
+ *
+ * The batches live in depth slots allocated once, batch b always in slot
+ * b % depth. Every slot has a sequence number that says which batch it is
+ * free for or holds, so the slots form a bounded ring that hands batches to
+ * the trainer in order without a lock. A producer claims the next batch
+ * number and draws its indices from the shared sample sequence under a mutex
+ * only the producers take, so batch b gets the same samples as inline
+ * sampling would give it, at any number of producers. Gathering, conversion and the
+ * transpose run outside the mutex, in parallel.
+ *
+ * Waiting backs off from yielding to short sleeps, the trainer only reads
+ * the clock when it has to wait, and that time is counted as a stall.
+ */
+
+/**
+ * @brief how far and on how many threads to load ahead
+*/
+struct prefetchOptions
+{
+    // batches loaded ahead of the trainer, 0 loads them inline
+    uint32_t depth = 0;
+    uint32_t numThreads = 1;
+};
+
+/**
+ * @brief counters that show whether the trainer ever waited on data
+*/
+struct loaderStatistics
+{
+    uint64_t batches = 0;
+    // next() calls that found their batch not loaded yet
+    uint64_t stalls = 0;
+    _Float64 stallSeconds = 0.0;
+    // batches loaded ahead when next() was called, averaged over the calls
+    _Float64 averageQueueDepth = 0.0;
+    // producers waiting for the trainer to free a slot, summed over producers
+    _Float64 producerWaitSeconds = 0.0;
+};
+
+/**
+ * @brief one batch as the trainer consumes it
+*/
+template <class T> struct loadedBatch
+{
+    std::vector<uint32_t> indices;
+    // B x 784, one image per row as the reader gathers them
+    matrix<T> samples;
+    // 784 x B, one image per column as the network takes them
+    matrix<T> inputLayer;
+    // 10 x B, one-hot
+    matrix<T> labels;
+};
+
+/**
+ * @brief loads mini-batches of the samples a sequence picks on threads of
+ *        its own, see the top of this file
+*/
+template <class T> class batchLoader
+{
+    public:
+        /**
+         * @brief allocates the slots and starts the producers
+         * @param dataset images and labels, has to outlive the loader
+         * @param batchSize samples per batch, B
+         * @param numBatches batches to load, next() is called this often
+         * @param samples picks the samples, the same ones in the same order as
+         *        inline sampling. Not to be used by anyone else until the
+         *        loader is gone
+         * @param options number of slots and producers, both at least 1
+        */
+        batchLoader(const mnistDataReader& dataset, uint32_t batchSize, uint32_t numBatches, matrixRandom::sampleSequence& samples, const prefetchOptions& options) :
+            m_dataset(dataset),
+            m_samples(samples),
+            m_batchSize(batchSize),
+            m_numBatches(numBatches),
+            m_depth(options.depth),
+            m_slots(new slot[std::max(options.depth, 1u)])
+        {
+            if((options.depth == 0) || (options.numThreads == 0) || (batchSize == 0))
+            {
+                std::cout<<__PRETTY_FUNCTION__<<": depth, threads and batch size must be at least 1!!!!"<<std::endl;
+                assert(false);
+                m_depth = std::max(m_depth, 1u);
+            }
+
+            const uint32_t numInputs = dataset.getImageSize();
+            for(uint32_t sIter = 0; sIter < m_depth; sIter++)
+            {
+                slot& current = m_slots[sIter];
+                current.sequence.store(freeFor(sIter), std::memory_order_relaxed);
+                current.batch.indices.resize(batchSize);
+                current.batch.samples = matrix<T>(batchSize, numInputs);
+                current.batch.inputLayer = matrix<T>(numInputs, batchSize);
+                current.batch.labels = matrix<T>(10, batchSize);
+            }
+
+            for(uint32_t tIter = 0; tIter < std::max(options.numThreads, 1u); tIter++)
+            {
+                m_producers.emplace_back([this]() { produce(); });
+            }
+        }
+
+        batchLoader(const batchLoader&) = delete;
+        batchLoader& operator=(const batchLoader&) = delete;
+
+        ~batchLoader()
+        {
+            m_stopping.store(true, std::memory_order_relaxed);
+            for(std::thread& producer : m_producers)
+            {
+                producer.join();
+            }
+        }
+
+        /**
+         * @brief hands the previous batch back and waits for the next one
+         * @return the batch, valid until the next call
+        */
+        const loadedBatch<T>& next()
+        {
+            if(m_taken > 0)
+            {
+                const uint64_t previous = m_taken - 1;
+                m_slots[previous % m_depth].sequence.store(freeFor(previous + m_depth), std::memory_order_release);
+            }
+            if(m_taken >= m_numBatches)
+            {
+                std::cout<<__PRETTY_FUNCTION__<<": all "<<m_numBatches<<" batches were taken already!!!!"<<std::endl;
+                assert(false);
+            }
+
+            const uint64_t current = m_taken++;
+            slot& loaded = m_slots[current % m_depth];
+            m_queueDepthSum += m_published.load(std::memory_order_relaxed) - std::min(m_published.load(std::memory_order_relaxed), current);
+            if(loaded.sequence.load(std::memory_order_acquire) != holding(current))
+            {
+                const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+                waitFor(loaded.sequence, holding(current));
+                m_stalls++;
+                m_stallSeconds += std::chrono::duration<_Float64>(std::chrono::steady_clock::now() - start).count();
+            }
+            return loaded.batch;
+        }
+
+        /**
+         * @brief counters so far, call from the trainer's thread
+        */
+        loaderStatistics getStatistics() const
+        {
+            loaderStatistics statistics;
+            statistics.batches = m_taken;
+            statistics.stalls = m_stalls;
+            statistics.stallSeconds = m_stallSeconds;
+            statistics.averageQueueDepth = (m_taken > 0) ? (static_cast<_Float64>(m_queueDepthSum) / m_taken) : 0.0;
+            statistics.producerWaitSeconds = m_producerWaitNanoseconds.load(std::memory_order_relaxed) * 1e-9;
+            return statistics;
+        }
+
+    private:
+        struct slot
+        {
+            alignas(64) std::atomic<uint64_t> sequence;
+            loadedBatch<T> batch;
+        };
+
+        const mnistDataReader& m_dataset;
+        matrixRandom::sampleSequence& m_samples;
+        uint32_t m_batchSize;
+        uint32_t m_numBatches;
+        uint32_t m_depth;
+        std::unique_ptr<slot[]> m_slots;
+        std::vector<std::thread> m_producers;
+        std::atomic<bool> m_stopping{false};
+
+        // producers only, under m_sampleMutex
+        std::mutex m_sampleMutex;
+        uint64_t m_claimed = 0;
+
+        alignas(64) std::atomic<uint64_t> m_published{0};
+        std::atomic<uint64_t> m_producerWaitNanoseconds{0};
+
+        // trainer only
+        alignas(64) uint64_t m_taken = 0;
+        uint64_t m_stalls = 0;
+        _Float64 m_stallSeconds = 0.0;
+        uint64_t m_queueDepthSum = 0;
+
+        // a slot's sequence is free for batch b, or holds batch b
+        static uint64_t freeFor(uint64_t batch) { return batch << 1; }
+        static uint64_t holding(uint64_t batch) { return (batch << 1) | 1; }
+
+        /**
+         * @brief wait until sequence is value, false if the loader is stopping
+        */
+        bool waitFor(const std::atomic<uint64_t>& sequence, uint64_t value) const
+        {
+            for(uint32_t attempt = 0; sequence.load(std::memory_order_acquire) != value; attempt++)
+            {
+                if(m_stopping.load(std::memory_order_relaxed))
+                {
+                    return false;
+                }
+                // a sleep has to stay well under the time a batch takes to
+                // train, or the producers fall behind a trainer that was idle
+                if(attempt < 64)
+                {
+                    std::this_thread::yield();
+                }
+                else
+                {
+                    std::this_thread::sleep_for(std::chrono::microseconds(std::min(attempt - 63, 50u)));
+                }
+            }
+            return true;
+        }
+
+        void produce()
+        {
+            std::vector<uint32_t> indices(m_batchSize);
+            while(!m_stopping.load(std::memory_order_relaxed))
+            {
+                uint64_t current = 0;
+                {
+                    std::lock_guard<std::mutex> lock(m_sampleMutex);
+                    if(m_claimed >= m_numBatches)
+                    {
+                        return;
+                    }
+                    current = m_claimed++;
+                    for(uint32_t& index : indices)
+                    {
+                        index = m_samples.next();
+                    }
+                }
+
+                slot& free = m_slots[current % m_depth];
+                if(free.sequence.load(std::memory_order_acquire) != freeFor(current))
+                {
+                    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+                    const bool freed = waitFor(free.sequence, freeFor(current));
+                    m_producerWaitNanoseconds.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count(), std::memory_order_relaxed);
+                    if(!freed)
+                    {
+                        return;
+                    }
+                }
+
+                loadedBatch<T>& batch = free.batch;
+                std::copy(indices.begin(), indices.end(), batch.indices.begin());
+                m_dataset.getBatch(batch.indices.data(), m_batchSize, batch.samples, batch.labels);
+                matrix<T>::transpose(batch.samples, batch.inputLayer);
+
+                free.sequence.store(holding(current), std::memory_order_release);
+                m_published.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+};
+
+#endif //BATCH_LOADER_H
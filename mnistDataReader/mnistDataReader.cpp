@@ -22,6 +22,59 @@
 #include <iostream>
 #include <fstream>
 #include <cassert>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <new>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace
+{
+    /**
+     * @brief first 64 bytes of a normalized cache sidecar file, the float
+     *        rows follow. Written in the byte order of the machine
+    */
+    struct normalizedCacheHeader
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t headerBytes;
+        uint32_t numImages;
+        uint32_t imageSize;
+        // floats from one row to the next
+        uint32_t rowStride;
+        float offset;
+        float scale;
+        uint32_t reserved0;
+        // the image file the cache was made from, to notice it changing
+        uint64_t sourceBytes;
+        int64_t sourceModified;
+        uint8_t reserved[8];
+    };
+    static_assert(sizeof(normalizedCacheHeader) == 64, "the cache header is 64 bytes");
+
+    const char normalizedCacheMagic[8] = {'N', 'N', 'F', 'S', 'P', 'X', 'C', 'H'};
+    const uint32_t normalizedCacheVersion = 1;
+
+    /**
+     * @brief size and modification time of a file, false if it has none
+    */
+    bool sourceStamp(const std::string& path, uint64_t& bytes, int64_t& modified)
+    {
+        struct stat status;
+        if(stat(path.c_str(), &status) != 0)
+        {
+            return false;
+        }
+        bytes = static_cast<uint64_t>(status.st_size);
+        modified = (static_cast<int64_t>(status.st_mtim.tv_sec) * 1000000000) + status.st_mtim.tv_nsec;
+        return true;
+    }
+}
 
 mnistDataReader::mnistDataReader()
 {
@@ -29,8 +82,15 @@ mnistDataReader::mnistDataReader()
 }
 
 //can I multi thread this? one thread for reading labels and one thread for reading data?
-mnistDataReader::mnistDataReader(std::string dataFilePath, std::string labelsFilePath, uint32_t numImagesToRead)
+mnistDataReader::mnistDataReader(std::string dataFilePath, std::string labelsFilePath, uint32_t numImagesToRead, mnistLoadMode mode) :
+    m_dataFilePath(dataFilePath)
 {
+    if(mode == mnistLoadMode::mapped)
+    {
+        mapFiles(dataFilePath, labelsFilePath, numImagesToRead);
+        return;
+    }
+
     // can I use a shared pointer?
     char* dataOutOfFile = new char[m_sizeOfUint32];
     char* labelsOutOfFile = new char[m_sizeOfUint32];
@@ -87,7 +147,7 @@ mnistDataReader::mnistDataReader(std::string dataFilePath, std::string labelsFil
     inputLabelFileStream.read(labelsOutOfFile, m_sizeOfUint32);
     sizeOfDataFile = changeEndian(*reinterpret_cast<uint32_t*>(dataOutOfFile));
     sizeOfLabelFile = changeEndian(*reinterpret_cast<uint32_t*>(labelsOutOfFile));
-    delete labelsOutOfFile;
+    delete[] labelsOutOfFile;
 
     std::cout<<__PRETTY_FUNCTION__<<": number of images is "<<sizeOfDataFile<<std::endl;
     std::cout<<__PRETTY_FUNCTION__<<": number of labels is "<<sizeOfLabelFile<<std::endl;
@@ -112,30 +172,37 @@ mnistDataReader::mnistDataReader(std::string dataFilePath, std::string labelsFil
     inputDataFileStream.read(dataOutOfFile, m_sizeOfUint32);
     m_columns = changeEndian(*reinterpret_cast<uint32_t*>(dataOutOfFile));
     std::cout<<__PRETTY_FUNCTION__<<": number of pixels in each column is "<<m_columns<<std::endl;
-    delete dataOutOfFile;
-
-    //copy image pixel data from the MNIST dataset to 784x1 Matrix and stuff into vector
-    dataOutOfFile = new char[m_rows*m_columns];
+    delete[] dataOutOfFile;
+
+    //read the image pixel data from the MNIST dataset straight into the rows of one aligned buffer
+    const size_t imageSize = getImageSize();
+    m_imageStride = ((imageSize + imageAlignment - 1) / imageAlignment) * imageAlignment;
+    const size_t imageBytes = m_imageStride * numImagesToRead;
+    uint8_t* pixels = static_cast<uint8_t*>(::operator new[](imageBytes, std::align_val_t(imageAlignment)));
+    m_imageStorage = std::shared_ptr<uint8_t>(pixels, [](uint8_t* buffer) { ::operator delete[](buffer, std::align_val_t(imageAlignment)); });
+    m_pixels = pixels;
     for(uint32_t iter = 0; iter < numImagesToRead; iter++)
     {
-        inputDataFileStream.read(dataOutOfFile, m_rows*m_columns);
-        matrix<uint8_t> temp(reinterpret_cast<uint8_t*>(dataOutOfFile), m_rows * m_columns, 1);
-        m_images.push_back(temp);
+        uint8_t* row = pixels + (iter * m_imageStride);
+        inputDataFileStream.read(reinterpret_cast<char*>(row), imageSize);
+        std::fill(row + imageSize, row + m_imageStride, uint8_t(0));
     }
 
-    delete dataOutOfFile;
     inputDataFileStream.close();
 
-    // copy label data from the MNIST dataset to a vector
-    labelsOutOfFile = new char[sizeOfLabelFile];
-    inputLabelFileStream.read(labelsOutOfFile, sizeOfLabelFile);
-    for(uint32_t iIter = 0; iIter < sizeOfLabelFile; iIter++)
+    // copy the labels of the images that were read from the MNIST dataset to one array
+    m_labels.resize(numImagesToRead);
+    inputLabelFileStream.read(reinterpret_cast<char*>(m_labels.data()), numImagesToRead);
+    for(uint32_t iIter = 0; iIter < numImagesToRead; iIter++)
     {
-        m_labels.push_back(static_cast<uint32_t>(labelsOutOfFile[iIter]));
-        m_labelsOneHot.push_back(convertToOneHot(m_labels[iIter]));
+        // one-hot labels are built on request, in the network's precision
+        if(m_labels[iIter] > 9)
+        {
+            std::cout<<__PRETTY_FUNCTION__<<": label "<<static_cast<uint32_t>(m_labels[iIter])<<" is not a digit 0 through 9!!!!"<<std::endl;
+            assert(false);
+        }
     }
     inputLabelFileStream.close();
-    delete labelsOutOfFile;
 }
 
 mnistDataReader::~mnistDataReader()
@@ -143,221 +210,324 @@ mnistDataReader::~mnistDataReader()
 
 }
 
-matrix<uint8_t> mnistDataReader::getImage(uint32_t index)
+matrix<uint8_t> mnistDataReader::getImage(uint32_t index) const
 {
-    return m_images.at(index);
+    return matrix<uint8_t>(const_cast<uint8_t*>(getImagePixels(index)), getImageSize(), 1);
 }
 
-matrix<_Float64> mnistDataReader::getImageLabel(uint32_t index)
+matrix<uint8_t> mnistDataReader::getImageView(uint32_t index) const
 {
-    return m_labelsOneHot.at(index);
+    // nothing writes through it, matrix::view just has no const flavor
+    return matrix<uint8_t>::view(const_cast<uint8_t*>(getImagePixels(index)), getImageSize(), 1);
 }
 
-uint32_t mnistDataReader::getUintLabel(uint32_t index)
+const uint8_t* mnistDataReader::getLabels() const
 {
-    return m_labels.at(index);
+    return m_labels.data();
 }
 
-//Convert to onehot binary format
-matrix<_Float64> mnistDataReader::convertToOneHot(uint32_t labelAsNumber)
+uint32_t mnistDataReader::getNumImages() const
 {
-    _Float64* oneHotArray;
-    
-    switch(labelAsNumber)
+    return m_labels.size();
+}
+
+uint32_t mnistDataReader::getImageSize() const
+{
+    return m_rows * m_columns;
+}
+
+size_t mnistDataReader::getImageStride() const
+{
+    return m_imageStride;
+}
+
+mnistNormalization mnistDataReader::unitNormalization()
+{
+    mnistNormalization normalization;
+    normalization.scale = 1.0f / 255.0f;
+    return normalization;
+}
+
+mnistNormalization mnistDataReader::standardization() const
+{
+    // a histogram of the pixel values gives the exact sums
+    uint64_t histogram[256] = {};
+    const uint32_t imageSize = getImageSize();
+    for(uint32_t iIter = 0; iIter < getNumImages(); iIter++)
     {
-        case 0:
-        {
-            _Float64 tempArr[10] = 
-            {
-                1, // 0
-                0, // 1
-                0, // 2
-                0, // 3
-                0, // 4
-                0, // 5
-                0, // 6
-                0, // 7
-                0, // 8
-                0  // 9
-            };
-            oneHotArray = tempArr;
-            break;
-        }  
-        case 1:
-        {
-            _Float64 tempArr[10] = 
-            {
-                0, // 0
-                1, // 1
-                0, // 2
-                0, // 3
-                0, // 4
-                0, // 5
-                0, // 6
-                0, // 7
-                0, // 8
-                0  // 9
-            };
-            oneHotArray = tempArr;
-            break;
-        }
-        case 2:
-        {
-            _Float64 tempArr[10] = 
-            {
-                0, // 0 
-                0, // 1
-                1, // 2
-                0, // 3
-                0, // 4
-                0, // 5
-                0, // 6
-                0, // 7
-                0, // 8
-                0  // 9
-            };
-            oneHotArray = tempArr;
-            break;
-        }
-        case 3:
+        const uint8_t* pixels = getImagePixels(iIter);
+        for(uint32_t kIter = 0; kIter < imageSize; kIter++)
         {
-            _Float64 tempArr[10] = 
-            {
-                0, // 0 
-                0, // 1
-                0, // 2
-                1, // 3
-                0, // 4
-                0, // 5
-                0, // 6
-                0, // 7
-                0, // 8
-                0  // 9
-            };
-            oneHotArray = tempArr;
-            break;
+            histogram[pixels[kIter]]++;
         }
-        case 4:
-        {
-            _Float64 tempArr[10] = 
-            {
-                0, // 0 
-                0, // 1
-                0, // 2
-                0, // 3
-                1, // 4
-                0, // 5
-                0, // 6
-                0, // 7
-                0, // 8
-                0  // 9
-            };
-            oneHotArray = tempArr;
-            break;
-        }
-        case 5:
-        {
-            _Float64 tempArr[10] = 
-            {
-                0, // 0 
-                0, // 1
-                0, // 2
-                0, // 3
-                0, // 4
-                1, // 5
-                0, // 6
-                0, // 7
-                0, // 8
-                0  // 9
-            };
-            oneHotArray = tempArr;
-            break;
-        }
-        case 6:
+    }
+
+    uint64_t count = 0;
+    uint64_t sum = 0;
+    uint64_t sumOfSquares = 0;
+    for(uint64_t value = 0; value < 256; value++)
+    {
+        count += histogram[value];
+        sum += histogram[value] * value;
+        sumOfSquares += histogram[value] * value * value;
+    }
+
+    mnistNormalization normalization;
+    if(count == 0)
+    {
+        return normalization;
+    }
+    const _Float64 mean = static_cast<_Float64>(sum) / count;
+    const _Float64 variance = (static_cast<_Float64>(sumOfSquares) / count) - (mean * mean);
+    normalization.offset = static_cast<float>(mean);
+    normalization.scale = (variance > 0.0) ? static_cast<float>(1.0 / std::sqrt(variance)) : 1.0f;
+    return normalization;
+}
+
+void mnistDataReader::cacheNormalized(const mnistNormalization& normalization, const std::string& sidecarPath)
+{
+    if(!sidecarPath.empty() && mapNormalizedCache(sidecarPath, normalization))
+    {
+        std::cout<<__PRETTY_FUNCTION__<<": mapped the normalized images from "<<sidecarPath<<std::endl;
+        return;
+    }
+
+    // rows padded to whole 64 byte lines like the pixels
+    const uint32_t imageSize = getImageSize();
+    const size_t floatsPerLine = imageAlignment / sizeof(float);
+    m_normalizedStride = ((imageSize + floatsPerLine - 1) / floatsPerLine) * floatsPerLine;
+    const size_t numFloats = m_normalizedStride * getNumImages();
+    float* normalized = static_cast<float*>(::operator new[](numFloats * sizeof(float), std::align_val_t(imageAlignment)));
+    m_normalizedStorage = std::shared_ptr<float>(normalized, [](float* buffer) { ::operator delete[](buffer, std::align_val_t(imageAlignment)); });
+    m_normalized = normalized;
+    m_normalization = normalization;
+
+    parallelFor(0, getNumImages(), 256, [&](uint32_t begin, uint32_t end)
+    {
+        for(uint32_t iIter = begin; iIter < end; iIter++)
         {
-            _Float64 tempArr[10] = 
-            {
-                0, // 0 
-                0, // 1
-                0, // 2
-                0, // 3
-                0, // 4
-                0, // 5
-                1, // 6
-                0, // 7
-                0, // 8
-                0  // 9
-            };
-            oneHotArray = tempArr;
-            break;
+            float* row = normalized + (iIter * m_normalizedStride);
+            matrixKernels::convertBytes(getImagePixels(iIter), normalization.offset, normalization.scale, row, imageSize);
+            std::fill(row + imageSize, row + m_normalizedStride, 0.0f);
         }
-        case 7:
+    });
+
+    if(!sidecarPath.empty() && writeNormalizedCache(sidecarPath))
+    {
+        std::cout<<__PRETTY_FUNCTION__<<": wrote the normalized images to "<<sidecarPath<<std::endl;
+    }
+}
+
+bool mnistDataReader::hasNormalizedCache() const
+{
+    return m_normalized != nullptr;
+}
+
+const mnistNormalization& mnistDataReader::getNormalization() const
+{
+    return m_normalization;
+}
+
+bool mnistDataReader::mapNormalizedCache(const std::string& path, const mnistNormalization& normalization)
+{
+    size_t bytes = 0;
+    uint8_t* mapping = mapFile(path, bytes);
+    if(mapping == nullptr)
+    {
+        return false;
+    }
+
+    normalizedCacheHeader header;
+    uint64_t sourceBytes = 0;
+    int64_t sourceModified = 0;
+    bool valid = (bytes >= sizeof(header)) && sourceStamp(m_dataFilePath, sourceBytes, sourceModified);
+    if(valid)
+    {
+        std::memcpy(&header, mapping, sizeof(header));
+        valid = (std::memcmp(header.magic, normalizedCacheMagic, sizeof(header.magic)) == 0) && (header.version == normalizedCacheVersion) &&
+                (header.headerBytes == sizeof(header)) && (header.numImages == getNumImages()) && (header.imageSize == getImageSize()) &&
+                (header.rowStride >= header.imageSize) && (header.offset == normalization.offset) && (header.scale == normalization.scale) &&
+                (header.sourceBytes == sourceBytes) && (header.sourceModified == sourceModified) &&
+                (bytes == header.headerBytes + (static_cast<size_t>(header.rowStride) * header.numImages * sizeof(float)));
+    }
+    if(!valid)
+    {
+        munmap(mapping, bytes);
+        return false;
+    }
+
+    m_normalizedStorage = std::shared_ptr<float>(reinterpret_cast<float*>(mapping), [bytes](float* buffer) { munmap(buffer, bytes); });
+    m_normalized = reinterpret_cast<const float*>(mapping + header.headerBytes);
+    m_normalizedStride = header.rowStride;
+    m_normalization = normalization;
+    return true;
+}
+
+bool mnistDataReader::writeNormalizedCache(const std::string& path) const
+{
+    normalizedCacheHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, normalizedCacheMagic, sizeof(header.magic));
+    header.version = normalizedCacheVersion;
+    header.headerBytes = sizeof(header);
+    header.numImages = getNumImages();
+    header.imageSize = getImageSize();
+    header.rowStride = static_cast<uint32_t>(m_normalizedStride);
+    header.offset = m_normalization.offset;
+    header.scale = m_normalization.scale;
+    if(!sourceStamp(m_dataFilePath, header.sourceBytes, header.sourceModified))
+    {
+        return false;
+    }
+
+    const std::string temporaryPath = path + ".tmp";
+    std::ofstream file(temporaryPath.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+    if(!file.is_open())
+    {
+        std::cout<<__PRETTY_FUNCTION__<<": could not open "<<temporaryPath<<"!!!!"<<std::endl;
+        return false;
+    }
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char*>(m_normalized), static_cast<std::streamsize>(m_normalizedStride * header.numImages * sizeof(float)));
+    file.close();
+
+    if(!file || (std::rename(temporaryPath.c_str(), path.c_str()) != 0))
+    {
+        std::cout<<__PRETTY_FUNCTION__<<": could not write "<<path<<"!!!!"<<std::endl;
+        std::remove(temporaryPath.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool mnistDataReader::isMapped() const
+{
+    return m_mappedBytes > 0;
+}
+
+size_t mnistDataReader::getMappedBytes() const
+{
+    return m_mappedBytes;
+}
+
+bool mnistDataReader::adviseAccess(mnistAccessPattern pattern)
+{
+    if(!isMapped())
+    {
+        return true;
+    }
+
+    int advice = MADV_NORMAL;
+    switch(pattern)
+    {
+        case mnistAccessPattern::sequential: advice = MADV_SEQUENTIAL; break;
+        case mnistAccessPattern::random:     advice = MADV_RANDOM; break;
+        case mnistAccessPattern::willNeed:   advice = MADV_WILLNEED; break;
+        default:                             break;
+    }
+    return madvise(m_imageStorage.get(), m_mappedBytes, advice) == 0;
+}
+
+void mnistDataReader::mapFiles(const std::string& dataFilePath, const std::string& labelsFilePath, uint32_t numImagesToRead)
+{
+    // the image header is magic, images, rows and columns, the label header magic and labels
+    const size_t imageHeaderBytes = 4 * m_sizeOfUint32;
+    const size_t labelHeaderBytes = 2 * m_sizeOfUint32;
+
+    if(numImagesToRead == 0)
+    {
+        std::cout<<__PRETTY_FUNCTION__<<": hey dummy you're reading 0 images from the file, why???"<<std::endl;
+        assert(false);
+    }
+
+    size_t imageBytes = 0;
+    size_t labelBytes = 0;
+    uint8_t* images = mapFile(dataFilePath, imageBytes);
+    uint8_t* labels = mapFile(labelsFilePath, labelBytes);
+    if(images != nullptr)
+    {
+        m_imageStorage = std::shared_ptr<uint8_t>(images, [imageBytes](uint8_t* mapping) { munmap(mapping, imageBytes); });
+        m_mappedBytes = imageBytes;
+    }
+    if((images == nullptr) || (labels == nullptr) || (imageBytes < imageHeaderBytes) || (labelBytes < labelHeaderBytes))
+    {
+        std::cout<<__PRETTY_FUNCTION__<<": could not map files"<<std::endl;
+        assert(false);
+        if(labels != nullptr)
         {
-            _Float64 tempArr[10] = 
-            {
-                0, // 0 
-                0, // 1
-                0, // 2
-                0, // 3
-                0, // 4
-                0, // 5
-                0, // 6
-                1, // 7
-                0, // 8
-                0  // 9
-            };
-            oneHotArray = tempArr;
-            break;
+            munmap(labels, labelBytes);
         }
-        case 8:
+        return;
+    }
+
+    const uint32_t numImages = readBigEndian(images + m_sizeOfUint32);
+    const uint32_t numLabels = readBigEndian(labels + m_sizeOfUint32);
+    m_rows = readBigEndian(images + (2 * m_sizeOfUint32));
+    m_columns = readBigEndian(images + (3 * m_sizeOfUint32));
+    const size_t imageSize = static_cast<size_t>(m_rows) * m_columns;
+
+    if((readBigEndian(images) != m_mnistImageChecksum) || (readBigEndian(labels) != m_mnistLabelChecksum))
+    {
+        std::cout<<__PRETTY_FUNCTION__<<": mnist checksum failed!"<<std::endl;
+        assert(false);
+    }
+    if((numImagesToRead > numImages) || (numImagesToRead > numLabels) || (imageSize == 0) ||
+       (imageHeaderBytes + (imageSize * numImagesToRead) > imageBytes) || (labelHeaderBytes + numImagesToRead > labelBytes))
+    {
+        std::cout<<__PRETTY_FUNCTION__<<": "<<numImagesToRead<<" images of "<<m_rows<<"x"<<m_columns<<" pixels do not fit in "<<dataFilePath<<" and "<<labelsFilePath<<std::endl;
+        assert(false);
+        munmap(labels, labelBytes);
+        return;
+    }
+
+    // the images stay packed the way the file has them
+    m_pixels = images + imageHeaderBytes;
+    m_imageStride = imageSize;
+
+    m_labels.assign(labels + labelHeaderBytes, labels + labelHeaderBytes + numImagesToRead);
+    for(uint32_t iIter = 0; iIter < numImagesToRead; iIter++)
+    {
+        if(m_labels[iIter] > 9)
         {
-            _Float64 tempArr[10] = 
-            {
-                0, // 0 
-                0, // 1
-                0, // 2
-                0, // 3
-                0, // 4
-                0, // 5
-                0, // 6
-                0, // 7
-                1, // 8
-                0  // 9
-            };
-            oneHotArray = tempArr;
-            break;
+            std::cout<<__PRETTY_FUNCTION__<<": label "<<static_cast<uint32_t>(m_labels[iIter])<<" is not a digit 0 through 9!!!!"<<std::endl;
+            assert(false);
         }
-        case 9:
+    }
+    munmap(labels, labelBytes);
+
+    std::cout<<__PRETTY_FUNCTION__<<": mapped "<<numImagesToRead<<" images of "<<m_rows<<"x"<<m_columns<<" pixels, "<<imageBytes<<" bytes"<<std::endl;
+}
+
+uint8_t* mnistDataReader::mapFile(const std::string& path, size_t& bytes)
+{
+    const int descriptor = open(path.c_str(), O_RDONLY);
+    struct stat status;
+    if((descriptor < 0) || (fstat(descriptor, &status) != 0) || (status.st_size <= 0))
+    {
+        if(descriptor >= 0)
         {
-            _Float64 tempArr[10] = 
-            {
-                0, // 0 
-                0, // 1
-                0, // 2
-                0, // 3
-                0, // 4
-                0, // 5
-                0, // 6
-                0, // 7
-                0, // 8
-                1  // 9
-            };
-            oneHotArray = tempArr;
-            break;
+            close(descriptor);
         }
+        return nullptr;
     }
+    bytes = static_cast<size_t>(status.st_size);
+    void* mapping = mmap(nullptr, bytes, PROT_READ, MAP_SHARED, descriptor, 0);
+    // the mapping keeps the file open on its own
+    close(descriptor);
+    return (mapping == MAP_FAILED) ? nullptr : static_cast<uint8_t*>(mapping);
+}
 
-    matrix<_Float64> tempOneHotEncode(oneHotArray, 10, 1);
-
-    return tempOneHotEncode;
+uint32_t mnistDataReader::readBigEndian(const uint8_t* bytes)
+{
+    return (static_cast<uint32_t>(bytes[0]) << 24) | (static_cast<uint32_t>(bytes[1]) << 16) | (static_cast<uint32_t>(bytes[2]) << 8) | static_cast<uint32_t>(bytes[3]);
 }
 
 // if you want to know it worked or not
-void mnistDataReader::printImage(uint32_t imageIndex)
+void mnistDataReader::printImage(uint32_t imageIndex) const
 {
-    matrix<uint8_t> temp = m_images.at(imageIndex);
+    matrix<uint8_t> temp = getImageView(imageIndex);
 
-    std::cout<<"Labels is: " << m_labels[imageIndex]<<std::endl;
+    std::cout<<"Labels is: " << getUintLabel(imageIndex)<<std::endl;
 
     for(uint32_t iIter = 0; iIter < m_rows * m_columns; iIter++)
     {
@@ -383,7 +553,7 @@ uint32_t mnistDataReader::changeEndian(uint32_t input)
     return retVal;
 }
 
-uint32_t mnistDataReader::normalize(uint32_t input)
+uint32_t mnistDataReader::normalize(uint32_t input) const
 {
     _Float64 maxOfInput = 255.0; //max pixel value
     _Float64 minOfInput = 0.0;
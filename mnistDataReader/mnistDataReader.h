@@ -21,16 +21,85 @@
 #define MNIST_DATA_READER_H
 
 #include "matrix.h"
+#include <algorithm>
+#include <cstddef>
+#include <memory>
 #include <string>
 #include <vector>
+#include <iostream>
+#include <cassert>
+
+/**
+ * @brief how the reader gets the images out of the IDX file
+ * @details read copies every image into a matrix of its own. mapped maps the
+ *          file read only and every image is a view into the mapping, so
+ *          loading touches no pixels and processes mapping the same file
+ *          share its pages
+*/
+enum class mnistLoadMode : uint32_t
+{
+    read = 0,
+    mapped = 1
+};
+
+/**
+ * @brief how the images of a mapped reader are going to be accessed, passed
+ *        on to madvise
+*/
+enum class mnistAccessPattern : uint32_t
+{
+    normal = 0,
+    // in order once, like the test set. Read ahead aggressively
+    sequential = 1,
+    // picked at random, like training. No read ahead
+    random = 2,
+    // all of them soon, start reading them in now
+    willNeed = 3
+};
+
+/**
+ * @brief what the network sees of a pixel: (pixel - offset) * scale
+*/
+struct mnistNormalization
+{
+    float offset = 0.0f;
+    float scale = 1.0f;
+
+    /**
+     * @brief the raw 0 to 255 pixels
+    */
+    bool isIdentity() const
+    {
+        return (offset == 0.0f) && (scale == 1.0f);
+    }
+};
 
 /**
  * We need to be able to read in the MNIST data. We know that each image is 784 
  * pixels and that there are a set number of images
+ *
+ * The images are rows of one block of pixels, image i starts at
+ * getImagePixels(0) + i * getImageStride(). Read images are copied into a
+ * buffer aligned to imageAlignment bytes with every row padded with zeros to
+ * a multiple of it, mapped images keep the file's layout, packed one after
+ * the other. The labels are one contiguous array of digits.
+ *
+ * cacheNormalized() converts every pixel to float once, (pixel - offset) *
+ * scale with the simd kernels of convertBytes(), into rows of a second block.
+ * From then on getImages() and getBatch() hand out the normalized pixels,
+ * a float network just copies them. The cache can be kept in a file next to
+ * the dataset that later runs map instead of converting again.
+ *
+ * Nothing is written after the constructor, so any number of threads can use
+ * the const members of one reader at the same time.
  */
 class mnistDataReader
 {
     public:
+        /**
+         * @brief read images start, and their rows are padded, to this many bytes
+        */
+        static constexpr uint32_t imageAlignment = 64;
     
         /**
          * @brief empty constructor
@@ -41,8 +110,9 @@ class mnistDataReader
          * @param dataFilePath path to where the MNIST image data is stored
          * @param labelsFilePath path to where the MNIST label data is stored
          * @param numImagesToRead number of images with labels to read
+         * @param mode copy the images out of the file or map it
         */
-        mnistDataReader(std::string dataFilePath, std::string labelsFilePath, uint32_t numImagesToRead);
+        mnistDataReader(std::string dataFilePath, std::string labelsFilePath, uint32_t numImagesToRead, mnistLoadMode mode = mnistLoadMode::read);
         /**
          * @brief deconstructor
         */
@@ -51,28 +121,180 @@ class mnistDataReader
         /**
          * @brief fetches image at given index
          * @param index index of image to fetch
-         * @return matrix of image data at given index
+         * @return copy of the image, 784x1
+        */
+        matrix<uint8_t> getImage(uint32_t index) const;
+        /**
+         * @brief image at given index without copying it
+         * @param index index of image to fetch
+         * @return non-owning view of the image, 784x1, valid as long as the
+         *         reader is. Read only
+        */
+        matrix<uint8_t> getImageView(uint32_t index) const;
+        /**
+         * @brief pixels of the image at given index
+         * @param index index of image to fetch
+         * @return the image's first pixel, getImageSize() of them follow
+        */
+        const uint8_t* getImagePixels(uint32_t index) const
+        {
+            checkIndex(index, __PRETTY_FUNCTION__);
+            return m_pixels + (index * m_imageStride);
+        }
+        /**
+         * @brief normalized pixels of the image at given index
+         * @param index index of image to fetch
+         * @return the image's first pixel, getImageSize() of them follow.
+         *         nullptr without cacheNormalized()
+        */
+        const float* getNormalizedPixels(uint32_t index) const
+        {
+            checkIndex(index, __PRETTY_FUNCTION__);
+            return (m_normalized == nullptr) ? nullptr : (m_normalized + (index * m_normalizedStride));
+        }
+        /**
+         * @brief gather images into a buffer of the caller's, converted to T.
+         *        Normalized if there is a cache, see cacheNormalized()
+         * @param indices indices of the images to fetch
+         * @param numIndices number of images, B
+         * @param images B x 784, image b is row b
+        */
+        template <class T> void getImages(const uint32_t* indices, uint32_t numIndices, matrix<T>& images) const
+        {
+            const uint32_t imageSize = getImageSize();
+            if((images.getNumRows() != numIndices) || (images.getNumColumns() != imageSize))
+            {
+                std::cout<<__PRETTY_FUNCTION__<<": "<<numIndices<<" images need a "<<numIndices<<"x"<<imageSize<<" buffer, got "<<images.getNumRows()<<"x"<<images.getNumColumns()<<"!!!!"<<std::endl;
+                assert(false);
+                return;
+            }
+
+            for(uint32_t bIter = 0; bIter < numIndices; bIter++)
+            {
+                T* row = images.data() + (static_cast<size_t>(bIter) * imageSize);
+                if(m_normalized != nullptr)
+                {
+                    const float* pixels = getNormalizedPixels(indices[bIter]);
+                    std::copy(pixels, pixels + imageSize, row);
+                }
+                else
+                {
+                    const uint8_t* pixels = getImagePixels(indices[bIter]);
+                    std::copy(pixels, pixels + imageSize, row);
+                }
+            }
+        }
+        /**
+         * @brief gather a batch of images with their labels into buffers of
+         *        the caller's, converted to T. Normalized if there is a
+         *        cache, see cacheNormalized()
+         * @param indices indices of the images to fetch
+         * @param numIndices number of images, B
+         * @param images B x 784, image b is row b
+         * @param labels 10 x B, the one-hot label of image b is column b
+        */
+        template <class T> void getBatch(const uint32_t* indices, uint32_t numIndices, matrix<T>& images, matrix<T>& labels) const
+        {
+            if((labels.getNumRows() != 10) || (labels.getNumColumns() != numIndices))
+            {
+                std::cout<<__PRETTY_FUNCTION__<<": a batch of "<<numIndices<<" needs 10x"<<numIndices<<" labels, got "<<labels.getNumRows()<<"x"<<labels.getNumColumns()<<"!!!!"<<std::endl;
+                assert(false);
+                return;
+            }
+
+            getImages(indices, numIndices, images);
+            labels.fillZeros();
+            for(uint32_t bIter = 0; bIter < numIndices; bIter++)
+            {
+                labels.data()[(static_cast<size_t>(m_labels[indices[bIter]]) * numIndices) + bIter] = T(1);
+            }
+        }
+        /**
+         * @brief pixels scaled to [0, 1]
+        */
+        static mnistNormalization unitNormalization();
+        /**
+         * @brief pixels shifted and scaled to mean 0 and standard deviation 1
+         *        over every pixel of this dataset. Give the training set's to
+         *        the test set too
         */
-        matrix<uint8_t> getImage(uint32_t index);
+        mnistNormalization standardization() const;
+        /**
+         * @brief convert every image to normalized floats once, getImages()
+         *        and getBatch() use them from here on
+         * @param normalization offset and scale of the pixels
+         * @param sidecarPath file the cache is kept in, none if empty. Mapped
+         *        if it holds these images with this normalization, written
+         *        otherwise
+        */
+        void cacheNormalized(const mnistNormalization& normalization, const std::string& sidecarPath = "");
+        /**
+         * @brief whether cacheNormalized() has been called
+        */
+        bool hasNormalizedCache() const;
+        /**
+         * @brief normalization of the cache, the identity without one
+        */
+        const mnistNormalization& getNormalization() const;
         /**
          * @brief fetches label of an image at a given index
          * @param index index of image label to fetch
-         * @return label as a one-hot encoded 10x1 matrix
+         * @return label as a one-hot encoded 10x1 matrix, in the precision
+         *         of the network it is compared against
         */
-        matrix<_Float64> getImageLabel(uint32_t index);
+        template <class T = _Float64> matrix<T> getImageLabel(uint32_t index) const
+        {
+            checkIndex(index, __PRETTY_FUNCTION__);
+            return convertToOneHot<T>(m_labels[index]);
+        }
         /**
          * @brief fetches label of an image at a given index
          * @param index index of image label to fetch
          * @return label as a uint32
         */
-        uint32_t getUintLabel(uint32_t index);
+        uint32_t getUintLabel(uint32_t index) const
+        {
+            checkIndex(index, __PRETTY_FUNCTION__);
+            return m_labels[index];
+        }
+        /**
+         * @brief every label, getNumImages() digits
+        */
+        const uint8_t* getLabels() const;
+        /**
+         * @brief number of images with labels that were read
+        */
+        uint32_t getNumImages() const;
+        /**
+         * @brief pixels in an image, rows times columns
+        */
+        uint32_t getImageSize() const;
+        /**
+         * @brief bytes from one image to the next
+        */
+        size_t getImageStride() const;
+        /**
+         * @brief whether the images are views into a mapping of the file
+        */
+        bool isMapped() const;
+        /**
+         * @brief bytes of the image file that are mapped, 0 when it was read
+        */
+        size_t getMappedBytes() const;
+        /**
+         * @brief tell the kernel how the images are going to be accessed.
+         *        Does nothing when the file was read
+         * @param pattern access pattern
+         * @return false if madvise turned the hint down
+        */
+        bool adviseAccess(mnistAccessPattern pattern);
         /**
          * @brief prints the image with label to std out. Image is represented in
          *        a 28x28 grid of chars, where the greyscale is normalized from
          *        0-255 to 0-9.
          * @param index index of image to print
         */
-        void printImage(uint32_t imageIndex);
+        void printImage(uint32_t imageIndex) const;
 
     private:
 
@@ -81,11 +303,66 @@ class mnistDataReader
         const uint32_t m_sizeOfUint32 = 4; //usually a uint32 is 4 bytes, but not always
         uint32_t m_rows = 0; // number of pixels in each row
         uint32_t m_columns = 0; //number of pixels in each column;
-        std::vector<matrix<uint8_t>> m_images;
-        std::vector<matrix<_Float64>> m_imagesFloats;
-        std::vector<uint32_t> m_labels;
-        std::vector<matrix<_Float64>> m_labelsOneHot;
+        // the aligned buffer the images were read into or the mapped image
+        // file, freed or unmapped when the last copy of the reader is gone
+        std::shared_ptr<uint8_t> m_imageStorage;
+        // first pixel of image 0, inside m_imageStorage
+        const uint8_t* m_pixels = nullptr;
+        size_t m_imageStride = 0;
+        size_t m_mappedBytes = 0;
+        std::vector<uint8_t> m_labels;
+        std::string m_dataFilePath;
+        // the normalized images, rows of m_normalizedStride floats in an
+        // aligned buffer or a mapped sidecar file
+        std::shared_ptr<float> m_normalizedStorage;
+        const float* m_normalized = nullptr;
+        size_t m_normalizedStride = 0;
+        mnistNormalization m_normalization;
 
+        /**
+         * @brief map the image file and the label file, check their headers
+         *        and serve the images straight out of the mapping
+         * @param dataFilePath path to where the MNIST image data is stored
+         * @param labelsFilePath path to where the MNIST label data is stored
+         * @param numImagesToRead number of images with labels to serve
+        */
+        void mapFiles(const std::string& dataFilePath, const std::string& labelsFilePath, uint32_t numImagesToRead);
+        /**
+         * @brief map a whole file read only
+         * @param path file to map
+         * @param bytes set to the size of the file
+         * @return the mapping, nullptr if the file can not be opened or mapped
+        */
+        static uint8_t* mapFile(const std::string& path, size_t& bytes);
+        /**
+         * @brief map a sidecar file of normalized images
+         * @param path sidecar file
+         * @param normalization normalization it has to have been written with
+         * @return false if it is missing or holds other images or another
+         *         normalization
+        */
+        bool mapNormalizedCache(const std::string& path, const mnistNormalization& normalization);
+        /**
+         * @brief write the normalized images to a sidecar file
+         * @param path sidecar file, replaced whole or not at all
+         * @return false if it can not be written
+        */
+        bool writeNormalizedCache(const std::string& path) const;
+        /**
+         * @brief big endian uint32 at bytes
+        */
+        static uint32_t readBigEndian(const uint8_t* bytes);
+        /**
+         * @brief index has to be one of the images that were read
+        */
+        void checkIndex(uint32_t index, const char* function) const
+        {
+            if(index >= m_labels.size())
+            {
+                std::cout<<function<<": index "<<index<<" is out of range of the "<<m_labels.size()<<" images!!!!"<<std::endl;
+                assert(false);
+            }
+        }
         /**
          * @brief change the endianness of the byte that was read out
          * @details Used with the first few bytes that are metadata about the 
@@ -99,13 +376,33 @@ class mnistDataReader
          * @param input a MNIST image data pixel with a value between 0 and 255
          * @return a MINST image data pixel that has been normalized between 0 and 9
         */
-        uint32_t normalize(uint32_t input);
+        uint32_t normalize(uint32_t input) const;
         /**
          * @brief convert MNIST label from a uint32 to a one-hot encoded matrix
          * @param labelAsNumber MNIST image label as a uint32
          * @return MNIST image label as a one-hot encoded matrix
         */
-        matrix<_Float64> convertToOneHot(uint32_t labelAsNumber);
+        template <class T> static matrix<T> convertToOneHot(uint32_t labelAsNumber)
+        {
+            /*
+             * label 3 becomes
+             * 0 0 0 1 0 0 0 0 0 0
+             * as a 10x1 matrix, one row for each digit 0 through 9
+             */
+            matrix<T> tempOneHotEncode(10, 1);
+            tempOneHotEncode.fillZeros();
+
+            if(labelAsNumber > 9)
+            {
+                std::cout<<__PRETTY_FUNCTION__<<": label "<<labelAsNumber<<" is not a digit 0 through 9!!!!"<<std::endl;
+                assert(false);
+                return tempOneHotEncode;
+            }
+
+            tempOneHotEncode.assign(1, labelAsNumber);
+
+            return tempOneHotEncode;
+        }
 };
 
 #endif //MNIST_DATA_READER_H
\ No newline at end of file
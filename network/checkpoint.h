@@ -0,0 +1,387 @@
+/**
+ * Versioned binary checkpoint of a network that loads by mapping the file.
+ * Copyright (C) 2024  Matthew Hardenburgh, matthew@hardenburgh.io
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <stdint.h>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "matrix.h"
+#include "network.h"
+
+/*
+ * A checkpoint holds the topology and parameters of a trained network:
+ *
+ *     saveCheckpoint(model, "model.ckpt", offset, scale);
+ *     std::unique_ptr<mappedNetwork<_Float64>> loaded = loadCheckpoint<_Float64>("model.ckpt");
+ *     loaded->model().forward(images);
+ *
+ * offset 0      checkpointHeader, 64 bytes
+ * offset 64     one checkpointLayer per layer, 32 bytes each
+ * then          per layer, input side first, the N x M weights row major and
+ *               the N biases, each block starting at a multiple of 64 bytes
+ *               and zero padded up to the next
+ *
+ * Numbers are stored in the byte order of the machine that wrote the file,
+ * byteOrder tells a reader with the other one to give up. The checksum is
+ * network::checksum(), FNV-1a over the weights and biases in the order above
+ * without the padding, so a loaded network hashes to what was saved.
+ *
+ * The header also records how the inputs were prepared for the network,
+ * input = (raw - inputOffset) * inputScale, so a reader feeds the loaded
+ * network what it was trained on. 0 and 1 for raw inputs.
+ *
+ * Loading maps the file read only and builds the network over views of the
+ * blocks, nothing is copied. Every process that loads the same file shares
+ * one copy of the parameters in the page cache, and startup is the time it
+ * takes to map it. The network is for inference, its weights and biases are
+ * matrix::readOnlyView()s and step() and everything else that would write
+ * them asserts. Copy it, network<T> copy = loaded->model(), to train from the
+ * checkpoint.
+ *
+ * Files are written next to their destination and renamed into place, a
+ * process mapping the old file keeps a consistent copy of it.
+ */
+
+/**
+ * @brief header at the start of a checkpoint
+*/
+struct checkpointHeader
+{
+    char magic[8];
+    uint32_t version;
+    // 0x01020304 as the writer stored it
+    uint32_t byteOrder;
+    // offset of the layer table
+    uint32_t headerBytes;
+    // checkpointElementType
+    uint32_t elementType;
+    // 0, row major, the only layout so far
+    uint32_t layout;
+    uint32_t numLayers;
+    uint64_t fileBytes;
+    uint64_t checksum;
+    // the network's inputs are (raw - inputOffset) * inputScale
+    float inputOffset;
+    float inputScale;
+    uint8_t reserved[8];
+};
+static_assert(sizeof(checkpointHeader) == 64, "the checkpoint header is 64 bytes");
+
+/**
+ * @brief where a layer's parameters are in a checkpoint
+*/
+struct checkpointLayer
+{
+    uint32_t numInputs;
+    uint32_t numOutputs;
+    // matrixKernels::activationFunction
+    uint32_t function;
+    uint32_t reserved;
+    uint64_t weightsOffset;
+    uint64_t biasesOffset;
+};
+static_assert(sizeof(checkpointLayer) == 32, "a checkpoint layer record is 32 bytes");
+
+static constexpr char checkpointMagic[8] = {'N', 'N', 'F', 'S', 'C', 'K', 'P', 'T'};
+static constexpr uint32_t checkpointVersion = 2;
+static constexpr uint32_t checkpointByteOrder = 0x01020304;
+static constexpr uint64_t checkpointAlignment = 64;
+
+/**
+ * @brief type of the stored weights and biases
+*/
+enum class checkpointElementType : uint32_t
+{
+    float64 = 0,
+    float32 = 1
+};
+
+/**
+ * @brief element type of a network<T> in a checkpoint
+*/
+template <class T> checkpointElementType checkpointElementTypeOf()
+{
+    static_assert(std::is_floating_point<T>::value && ((sizeof(T) == 8) || (sizeof(T) == 4)), "checkpoints hold 32 or 64 bit floats");
+    return (sizeof(T) == 8) ? checkpointElementType::float64 : checkpointElementType::float32;
+}
+
+/**
+ * @brief name of an element type, float64 or float32
+*/
+inline const char* checkpointElementTypeName(checkpointElementType type)
+{
+    return (type == checkpointElementType::float64) ? "float64" : "float32";
+}
+
+/**
+ * @brief round up to the block alignment of a checkpoint
+*/
+inline uint64_t alignCheckpointOffset(uint64_t offset)
+{
+    return ((offset + checkpointAlignment - 1) / checkpointAlignment) * checkpointAlignment;
+}
+
+/**
+ * @brief write a network to a checkpoint file
+ * @param model network to save, only read
+ * @param path file to write, replaced if it exists
+ * @param inputOffset subtracted from the raw inputs before scaling them
+ * @param inputScale multiplies the shifted inputs
+ * @return false if the file could not be written
+*/
+template <class T> bool saveCheckpoint(const network<T>& model, const std::string& path, float inputOffset = 0.0f, float inputScale = 1.0f)
+{
+    checkpointHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, checkpointMagic, sizeof(header.magic));
+    header.version = checkpointVersion;
+    header.byteOrder = checkpointByteOrder;
+    header.headerBytes = sizeof(checkpointHeader);
+    header.elementType = static_cast<uint32_t>(checkpointElementTypeOf<T>());
+    header.layout = 0;
+    header.numLayers = model.getNumLayers();
+    header.checksum = model.checksum();
+    header.inputOffset = inputOffset;
+    header.inputScale = inputScale;
+
+    std::vector<checkpointLayer> layers(model.getNumLayers());
+    uint64_t offset = alignCheckpointOffset(sizeof(checkpointHeader) + (layers.size() * sizeof(checkpointLayer)));
+    for(uint32_t lIter = 0; lIter < model.getNumLayers(); lIter++)
+    {
+        const denseLayer<T>& layer = model.layer(lIter);
+        checkpointLayer& record = layers[lIter];
+        std::memset(&record, 0, sizeof(record));
+        record.numInputs = layer.getNumInputs();
+        record.numOutputs = layer.getNumOutputs();
+        record.function = static_cast<uint32_t>(layer.getActivationFunction());
+        record.weightsOffset = offset;
+        offset = alignCheckpointOffset(offset + (static_cast<uint64_t>(record.numOutputs) * record.numInputs * sizeof(T)));
+        record.biasesOffset = offset;
+        offset = alignCheckpointOffset(offset + (static_cast<uint64_t>(record.numOutputs) * sizeof(T)));
+    }
+    header.fileBytes = offset;
+
+    const std::string temporaryPath = path + ".tmp";
+    std::ofstream file(temporaryPath.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+    if(!file.is_open())
+    {
+        std::cout<<__PRETTY_FUNCTION__<<": could not open "<<temporaryPath<<"!!!!"<<std::endl;
+        return false;
+    }
+
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char*>(layers.data()), layers.size() * sizeof(checkpointLayer));
+    const char padding[checkpointAlignment] = {};
+    auto padTo = [&](uint64_t target)
+    {
+        file.write(padding, target - static_cast<uint64_t>(file.tellp()));
+    };
+    for(uint32_t lIter = 0; lIter < model.getNumLayers(); lIter++)
+    {
+        const denseLayer<T>& layer = model.layer(lIter);
+        padTo(layers[lIter].weightsOffset);
+        file.write(reinterpret_cast<const char*>(layer.weights().data()), static_cast<std::streamsize>(layer.getNumOutputs()) * layer.getNumInputs() * sizeof(T));
+        padTo(layers[lIter].biasesOffset);
+        file.write(reinterpret_cast<const char*>(layer.biases().data()), static_cast<std::streamsize>(layer.getNumOutputs()) * sizeof(T));
+    }
+    padTo(header.fileBytes);
+    file.close();
+
+    if(!file || (std::rename(temporaryPath.c_str(), path.c_str()) != 0))
+    {
+        std::cout<<__PRETTY_FUNCTION__<<": could not write "<<path<<"!!!!"<<std::endl;
+        std::remove(temporaryPath.c_str());
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief read the header of a checkpoint without mapping the rest
+ * @param path checkpoint file
+ * @param header destination for the header
+ * @return false if the file can not be read or is not a checkpoint this
+ *         version understands
+*/
+inline bool readCheckpointHeader(const std::string& path, checkpointHeader& header)
+{
+    std::ifstream file(path.c_str(), std::ios::in | std::ios::binary);
+    if(!file.is_open() || !file.read(reinterpret_cast<char*>(&header), sizeof(header)))
+    {
+        std::cout<<__PRETTY_FUNCTION__<<": could not read "<<path<<"!!!!"<<std::endl;
+        return false;
+    }
+    if(std::memcmp(header.magic, checkpointMagic, sizeof(header.magic)) != 0)
+    {
+        std::cout<<__PRETTY_FUNCTION__<<": "<<path<<" is not a checkpoint!!!!"<<std::endl;
+        return false;
+    }
+    if(header.byteOrder != checkpointByteOrder)
+    {
+        std::cout<<__PRETTY_FUNCTION__<<": "<<path<<" was written on a machine of the other byte order!!!!"<<std::endl;
+        return false;
+    }
+    if((header.version != checkpointVersion) || (header.layout != 0) || (header.headerBytes != sizeof(checkpointHeader)))
+    {
+        std::cout<<__PRETTY_FUNCTION__<<": "<<path<<" is checkpoint version "<<header.version<<", this build reads version "<<checkpointVersion<<"!!!!"<<std::endl;
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief a network whose weights and biases are views of a mapped
+ *        checkpoint. The mapping lives as long as this object
+*/
+template <class T> class mappedNetwork
+{
+    public:
+        mappedNetwork(void* mapping, size_t bytes, network<T>&& model) :
+            m_mapping(mapping),
+            m_bytes(bytes),
+            m_model(std::move(model))
+        {
+        }
+
+        mappedNetwork(const mappedNetwork&) = delete;
+        mappedNetwork& operator=(const mappedNetwork&) = delete;
+
+        ~mappedNetwork()
+        {
+            munmap(m_mapping, m_bytes);
+        }
+
+        /**
+         * @brief the network, its parameters are read only views. forward()
+         *        writes the network's own buffers only
+        */
+        network<T>& model() { return m_model; }
+        const network<T>& model() const { return m_model; }
+
+        /**
+         * @brief bytes of the mapped file
+        */
+        size_t getMappedBytes() const { return m_bytes; }
+
+    private:
+        void* m_mapping;
+        size_t m_bytes;
+        network<T> m_model;
+};
+
+/**
+ * @brief map a checkpoint and build a network over its weights and biases
+ * @param path checkpoint file
+ * @param maxBatchSize largest batch forward() will be given
+ * @param verifyChecksum hash the parameters and compare with the header,
+ *        reads every page of the file once
+ * @return the network, nullptr if the file can not be read, is not a valid
+ *         checkpoint, holds another element type than T or fails the checksum
+*/
+template <class T> std::unique_ptr<mappedNetwork<T>> loadCheckpoint(const std::string& path, uint32_t maxBatchSize = 1, bool verifyChecksum = true)
+{
+    checkpointHeader header;
+    if(!readCheckpointHeader(path, header))
+    {
+        return nullptr;
+    }
+    if(header.elementType != static_cast<uint32_t>(checkpointElementTypeOf<T>()))
+    {
+        std::cout<<__PRETTY_FUNCTION__<<": "<<path<<" holds "<<checkpointElementTypeName(static_cast<checkpointElementType>(header.elementType))
+                 <<" parameters, the network is "<<checkpointElementTypeName(checkpointElementTypeOf<T>())<<"!!!!"<<std::endl;
+        return nullptr;
+    }
+
+    const int descriptor = open(path.c_str(), O_RDONLY);
+    struct stat status;
+    if((descriptor < 0) || (fstat(descriptor, &status) != 0) || (static_cast<uint64_t>(status.st_size) != header.fileBytes) || (header.numLayers == 0))
+    {
+        std::cout<<__PRETTY_FUNCTION__<<": "<<path<<" is truncated or empty!!!!"<<std::endl;
+        if(descriptor >= 0)
+        {
+            close(descriptor);
+        }
+        return nullptr;
+    }
+    void* mapping = mmap(nullptr, header.fileBytes, PROT_READ, MAP_SHARED, descriptor, 0);
+    // the mapping keeps the file open on its own
+    close(descriptor);
+    if(mapping == MAP_FAILED)
+    {
+        std::cout<<__PRETTY_FUNCTION__<<": could not map "<<path<<"!!!!"<<std::endl;
+        return nullptr;
+    }
+
+    unsigned char* bytes = static_cast<unsigned char*>(mapping);
+    const checkpointLayer* records = reinterpret_cast<const checkpointLayer*>(bytes + header.headerBytes);
+    const bool tableFits = (header.headerBytes + (static_cast<uint64_t>(header.numLayers) * sizeof(checkpointLayer))) <= header.fileBytes;
+
+    std::vector<denseLayer<T>> layers;
+    layers.reserve(header.numLayers);
+    for(uint32_t lIter = 0; tableFits && (lIter < header.numLayers); lIter++)
+    {
+        const checkpointLayer& record = records[lIter];
+        const uint64_t weightBytes = static_cast<uint64_t>(record.numOutputs) * record.numInputs * sizeof(T);
+        const uint64_t biasBytes = static_cast<uint64_t>(record.numOutputs) * sizeof(T);
+        const bool valid = (record.numInputs > 0) && (record.numOutputs > 0) && (record.function <= static_cast<uint32_t>(matrixKernels::activationFunction::softmax)) &&
+                           ((record.weightsOffset % checkpointAlignment) == 0) && ((record.biasesOffset % checkpointAlignment) == 0) &&
+                           (record.weightsOffset + weightBytes <= header.fileBytes) && (record.biasesOffset + biasBytes <= header.fileBytes) &&
+                           ((lIter == 0) || (record.numInputs == records[lIter - 1].numOutputs));
+        if(!valid)
+        {
+            break;
+        }
+
+        const T* weights = reinterpret_cast<const T*>(bytes + record.weightsOffset);
+        const T* biases = reinterpret_cast<const T*>(bytes + record.biasesOffset);
+        layers.emplace_back(matrix<T>::readOnlyView(weights, record.numOutputs, record.numInputs), matrix<T>::readOnlyView(biases, record.numOutputs, 1), maxBatchSize,
+                            static_cast<matrixKernels::activationFunction>(record.function));
+    }
+    if(layers.size() != header.numLayers)
+    {
+        std::cout<<__PRETTY_FUNCTION__<<": the layer table of "<<path<<" is corrupt!!!!"<<std::endl;
+        munmap(mapping, header.fileBytes);
+        return nullptr;
+    }
+
+    std::unique_ptr<mappedNetwork<T>> loaded(new mappedNetwork<T>(mapping, header.fileBytes, network<T>(std::move(layers))));
+    if(verifyChecksum && (loaded->model().checksum() != header.checksum))
+    {
+        std::cout<<__PRETTY_FUNCTION__<<": the parameters of "<<path<<" fail their checksum!!!!"<<std::endl;
+        return nullptr;
+    }
+    return loaded;
+}
+
+#endif //CHECKPOINT_H
@@ -0,0 +1,422 @@
+/**
+ * Fully connected layer with an activation function and preallocated buffers.
+ * Copyright (C) 2024  Matthew Hardenburgh, matthew@hardenburgh.io
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef DENSE_LAYER_H
+#define DENSE_LAYER_H
+
+#include <stdint.h>
+#include <cassert>
+#include <cmath>
+#include <iostream>
+#include <utility>
+
+#include "matrix.h"
+
+/*
+ * output = f(weights * input + biases), for a batch of B samples at once,
+ * one sample per column. B = 1 is single sample training. f is sigmoid
+ * unless the layer is built with another activation function, see
+ * activationKernels.h. The exp based ones run in exact mode unless
+ * setActivationMode() switches them to fast, for inference.
+ *
+ * With bf16 weight storage the forward pass multiplies with a bfloat16 copy
+ * of the weights, half the bytes of float to stream, while backward() and
+ * the update keep working on the full precision weights. The copy is rounded
+ * again after every update.
+ *
+ * Every buffer the layer works with (output, delta, gradients, the gradient
+ * handed to the previous layer) is allocated at construction for the largest
+ * batch the layer will see. Smaller batches shrink the buffers in place, so
+ * forward(), backward() and step() never allocate.
+ *
+ * A layer can also be built over the weights and biases of another layer.
+ * It then has buffers of its own but reads and updates the other layer's
+ * parameters, which is how several threads train one set of weights.
+ */
+
+/**
+ * @brief weight initializations, xavier and he are scaled to the layer so the
+ *        activations keep about the same variance from layer to layer
+*/
+enum class weightInitialization : uint32_t
+{
+    // uniform in +-sqrt(6 / (inputs + outputs)), for sigmoid and tanh
+    xavier = 0,
+    // normal with a standard deviation of sqrt(2 / inputs), for relu
+    he = 1,
+    // weights and biases uniform in [-0.5, 0.5], whatever the layer's size
+    uniform = 2
+};
+
+template <class T> class denseLayer
+{
+    public:
+        /**
+         * @brief creates a layer with its own, uninitialized weights and biases
+         * @param numInputs neurons in the previous layer, M
+         * @param numOutputs neurons in this layer, N
+         * @param maxBatchSize largest batch forward() will be given
+         * @param function activation function of the layer
+        */
+        denseLayer(uint32_t numInputs, uint32_t numOutputs, uint32_t maxBatchSize,
+                   matrixKernels::activationFunction function = matrixKernels::activationFunction::sigmoid) :
+            m_weights(numOutputs, numInputs),
+            m_biases(numOutputs, 1),
+            m_function(function)
+        {
+            allocateBuffers(maxBatchSize);
+        }
+
+        /**
+         * @brief creates a layer with buffers of its own that trains the
+         *        weights and biases of parameters in place, with the same
+         *        activation function, mode and weight storage
+         * @param parameters layer whose weights and biases are used, has to
+         *        outlive this layer. Read only parameters stay read only
+         * @param maxBatchSize largest batch forward() will be given
+        */
+        denseLayer(denseLayer& parameters, uint32_t maxBatchSize) :
+            m_weights(shareParameters(parameters.m_weights)),
+            m_biases(shareParameters(parameters.m_biases)),
+            m_function(parameters.m_function),
+            m_mode(parameters.m_mode),
+            m_storage(parameters.m_storage)
+        {
+            if(m_storage == matrixKernels::weightStorage::bf16)
+            {
+                m_weightsBf16 = matrix<matrixKernels::bfloat16>::view(parameters.m_weightsBf16.data(), m_weights.getNumRows(), m_weights.getNumColumns());
+            }
+            allocateBuffers(maxBatchSize);
+        }
+
+        /**
+         * @brief creates a layer over weights and biases that already exist,
+         *        owning matrices or views, a loaded checkpoint for example
+         * @param weights N x M weights, taken over
+         * @param biases N x 1 biases, taken over
+         * @param maxBatchSize largest batch forward() will be given
+         * @param function activation function of the layer
+        */
+        denseLayer(matrix<T>&& weights, matrix<T>&& biases, uint32_t maxBatchSize, matrixKernels::activationFunction function) :
+            m_weights(std::move(weights)),
+            m_biases(std::move(biases)),
+            m_function(function)
+        {
+            if((m_biases.getNumRows() != m_weights.getNumRows()) || (m_biases.getNumColumns() != 1))
+            {
+                std::cout<<__PRETTY_FUNCTION__<<": biases have to be "<<m_weights.getNumRows()<<" x 1!!!!"<<std::endl;
+                assert(false);
+            }
+            allocateBuffers(maxBatchSize);
+        }
+
+        /**
+         * @brief initialize the weights, scaled to the layer's size with
+         *        Xavier and He, which zero the biases. Uniform draws the
+         *        biases too
+         * @details the values are drawn in double and rounded to T with
+         *          counter based generation, so a seed and stream give the same
+         *          values in every precision and at any thread count. The
+         *          biases take the stream with its top bit set
+         * @param scheme Xavier, He or uniform
+         * @param seed seed of the weights
+         * @param stream keeps the layers of one seed apart
+        */
+        void initialize(weightInitialization scheme, uint64_t seed, uint64_t stream)
+        {
+            checkWritable(__PRETTY_FUNCTION__);
+            const double numInputs = getNumInputs();
+            const std::size_t numWeights = static_cast<std::size_t>(m_weights.getNumRows()) * m_weights.getNumColumns();
+            // the scale stays in double, rounding it to T first would give
+            // every precision slightly different weights
+            if(scheme == weightInitialization::he)
+            {
+                matrixRandom::fillNormal(m_weights.data(), numWeights, 0.0, std::sqrt(2.0 / numInputs), seed, stream);
+            }
+            else if(scheme == weightInitialization::uniform)
+            {
+                matrixRandom::fillUniform(m_weights.data(), numWeights, -0.5, 0.5, seed, stream);
+            }
+            else
+            {
+                const double limit = std::sqrt(6.0 / (numInputs + getNumOutputs()));
+                matrixRandom::fillUniform(m_weights.data(), numWeights, -limit, limit, seed, stream);
+            }
+
+            if(scheme == weightInitialization::uniform)
+            {
+                matrixRandom::fillUniform(m_biases.data(), getNumOutputs(), -0.5, 0.5, seed, stream | (uint64_t(1) << 63));
+            }
+            else
+            {
+                m_biases.fillZeros();
+            }
+            refreshWeightStorage();
+        }
+
+        /**
+         * @brief output = f(weights * input + biases)
+         * @param input M x B, has to stay alive and unchanged until backward()
+         * @return the output of the layer, N x B
+        */
+        const matrix<T>& forward(const matrix<T>& input)
+        {
+            checkBatch(input, m_weights.getNumColumns(), __PRETTY_FUNCTION__);
+
+            m_input = &input;
+            if(m_storage == matrixKernels::weightStorage::bf16)
+            {
+                matrix<T>::matrixMultiplication(m_weightsBf16, input, m_output);
+            }
+            else
+            {
+                matrix<T>::matrixMultiplication(m_weights, input, m_output);
+            }
+            m_output.addToEachColumn(m_biases);
+            matrix<T>::activate(m_function, m_mode, m_output, m_output);
+            return m_output;
+        }
+
+        /**
+         * @brief gradients of the cost with respect to the weights, biases and
+         *        input of the layer, summed over the batch. Weights are not
+         *        touched
+         * @details delta = f'(z) .* gradient, from the output
+         *          weightGradient = delta * input^T
+         *          biasGradient = rowSums(delta)
+         *          inputGradient = weights^T * delta
+         * @param gradient gradient of the cost with respect to the output, N x B
+         * @param propagate also compute inputGradient, the first layer of a
+         *        network does not need it
+        */
+        void backward(const matrix<T>& gradient, bool propagate)
+        {
+            checkBackward(gradient);
+
+            matrix<T>::activationDerivative(m_function, m_output, gradient, m_delta);
+            if(propagate)
+            {
+                matrix<T>::matrixMultiplication(T(1), m_weights, true, m_delta, false, T(0), m_inputGradient);
+            }
+            matrix<T>::matrixMultiplication(T(1), m_delta, false, *m_input, true, T(0), m_weightGradient);
+            matrix<T>::rowSums(m_delta, m_biasGradient);
+        }
+
+        /**
+         * @brief gradient descent step with the gradients from backward(),
+         *        weights -= learningRate * weightGradient, same for biases
+         * @param learningRate step size, the gradients are sums over the batch
+        */
+        void step(T learningRate)
+        {
+            matrix<T>::axpy(-learningRate, m_weightGradient, m_weights);
+            matrix<T>::axpy(-learningRate, m_biasGradient, m_biases);
+            refreshWeightStorage();
+        }
+
+        /**
+         * @brief backward() and step() in one pass over the weights, without
+         *        keeping the weight gradient around
+         * @details single samples of a sigmoid layer use
+         *          matrix::sigmoidLayerBackward, everything else accumulates delta * input^T straight into the weights.
+         *          inputGradient still uses the weights from before the step
+         * @param gradient gradient of the cost with respect to the output, N x B
+         * @param learningRate step size, the gradients are sums over the batch
+         * @param propagate also compute inputGradient
+        */
+        void backwardAndStep(const matrix<T>& gradient, T learningRate, bool propagate)
+        {
+            checkBackward(gradient);
+
+            if((m_output.getNumColumns() == 1) && (m_function == matrixKernels::activationFunction::sigmoid))
+            {
+                matrix<T>::sigmoidLayerBackward(m_output, gradient, *m_input, learningRate, m_weights, m_biases, m_delta, propagate ? &m_inputGradient : nullptr);
+                refreshWeightStorage();
+                return;
+            }
+
+            matrix<T>::activationDerivative(m_function, m_output, gradient, m_delta);
+            if(propagate)
+            {
+                matrix<T>::matrixMultiplication(T(1), m_weights, true, m_delta, false, T(0), m_inputGradient);
+            }
+            matrix<T>::matrixMultiplication(-learningRate, m_delta, false, *m_input, true, T(1), m_weights);
+            matrix<T>::rowSums(m_delta, m_biasGradient);
+            matrix<T>::axpy(-learningRate, m_biasGradient, m_biases);
+            refreshWeightStorage();
+        }
+
+        /**
+         * @brief add the gradients of another layer of the same shape to the
+         *        gradients of this one
+         * @param other layer that ran backward() on another part of the batch
+        */
+        void accumulateGradients(const denseLayer& other)
+        {
+            m_weightGradient.addInPlace(other.m_weightGradient);
+            m_biasGradient.addInPlace(other.m_biasGradient);
+        }
+
+        /**
+         * @brief exact or fast exp for the forward pass, training should stay
+         *        exact
+         * @param mode the accuracy mode
+        */
+        void setActivationMode(matrixKernels::activationMode mode)
+        {
+            m_mode = mode;
+        }
+
+        /**
+         * @brief keep a bfloat16 copy of the weights for the forward pass, or
+         *        go back to the weights themselves
+         * @details set it on the layer that owns the weights before building
+         *          layers that share them, they share the copy too
+         * @param storage the weight storage
+        */
+        void setWeightStorage(matrixKernels::weightStorage storage)
+        {
+            m_storage = storage;
+            if(storage == matrixKernels::weightStorage::bf16)
+            {
+                m_weightsBf16 = matrix<matrixKernels::bfloat16>(m_weights.getNumRows(), m_weights.getNumColumns());
+                refreshWeightStorage();
+            }
+            else
+            {
+                m_weightsBf16 = matrix<matrixKernels::bfloat16>();
+            }
+        }
+
+        /**
+         * @brief round the weights into the bfloat16 copy again, for when
+         *        they were changed through weights()
+        */
+        void refreshWeightStorage()
+        {
+            if(m_storage == matrixKernels::weightStorage::bf16)
+            {
+                const matrix<T>& weights = m_weights;
+                matrixKernels::convertToBfloat16(weights.data(), m_weightsBf16.data(), static_cast<size_t>(m_weights.getNumRows()) * m_weights.getNumColumns());
+            }
+        }
+
+        matrixKernels::activationFunction getActivationFunction() const { return m_function; }
+        matrixKernels::activationMode getActivationMode() const { return m_mode; }
+        matrixKernels::weightStorage getWeightStorage() const { return m_storage; }
+        uint32_t getNumInputs() const { return m_weights.getNumColumns(); }
+        uint32_t getNumOutputs() const { return m_weights.getNumRows(); }
+        matrix<T>& weights() { return m_weights; }
+        const matrix<T>& weights() const { return m_weights; }
+        matrix<T>& biases() { return m_biases; }
+        const matrix<T>& biases() const { return m_biases; }
+        const matrix<T>& output() const { return m_output; }
+        const matrix<T>& delta() const { return m_delta; }
+        const matrix<T>& weightGradient() const { return m_weightGradient; }
+        const matrix<T>& biasGradient() const { return m_biasGradient; }
+        const matrix<T>& inputGradient() const { return m_inputGradient; }
+
+    private:
+        matrix<T> m_weights;
+        matrix<T> m_biases;
+        matrix<T> m_output;
+        matrix<T> m_delta;
+        matrix<T> m_weightGradient;
+        matrix<T> m_biasGradient;
+        matrix<T> m_inputGradient;
+        matrixKernels::activationFunction m_function;
+        matrixKernels::activationMode m_mode = matrixKernels::activationMode::exact;
+        matrixKernels::weightStorage m_storage = matrixKernels::weightStorage::native;
+        //rounded copy of m_weights for forward(), empty unless m_storage is bf16
+        matrix<matrixKernels::bfloat16> m_weightsBf16;
+        //input of the last forward(), backward() needs it for the weight gradient
+        const matrix<T>* m_input = nullptr;
+
+        void allocateBuffers(uint32_t maxBatchSize)
+        {
+            if(maxBatchSize < 1)
+            {
+                std::cout<<__PRETTY_FUNCTION__<<": maxBatchSize is less than 1!!!!"<<std::endl;
+                assert(false);
+            }
+
+            const uint32_t numOutputs = m_weights.getNumRows();
+            const uint32_t numInputs = m_weights.getNumColumns();
+            m_output = matrix<T>(numOutputs, maxBatchSize);
+            m_delta = matrix<T>(numOutputs, maxBatchSize);
+            m_weightGradient = matrix<T>(numOutputs, numInputs);
+            m_biasGradient = matrix<T>(numOutputs, 1);
+            m_inputGradient = matrix<T>(numInputs, maxBatchSize);
+        }
+
+        /**
+         * @brief a view of parameters, read only if they are
+        */
+        static matrix<T> shareParameters(matrix<T>& parameters)
+        {
+            if(parameters.isReadOnly())
+            {
+                const matrix<T>& readOnly = parameters;
+                return matrix<T>::readOnlyView(readOnly.data(), parameters.getNumRows(), parameters.getNumColumns());
+            }
+            return matrix<T>::view(parameters.data(), parameters.getNumRows(), parameters.getNumColumns());
+        }
+
+        /**
+         * @brief assert on writing parameters that are read only views
+        */
+        void checkWritable(const char* function) const
+        {
+            if(m_weights.isReadOnly() || m_biases.isReadOnly())
+            {
+                std::cout<<function<<": the weights and biases are read only views, copy the layer to change them!!!!"<<std::endl;
+                assert(false);
+            }
+        }
+
+        void checkBatch(const matrix<T>& batch, uint32_t rows, const char* function) const
+        {
+            if(batch.getNumRows() != rows)
+            {
+                std::cout<<function<<": expected "<<rows<<" rows, got "<<batch.getNumRows()<<"!!!!"<<std::endl;
+                assert(false);
+            }
+            if(batch.getNumColumns() > m_output.getCapacity() / m_weights.getNumRows())
+            {
+                std::cout<<function<<": batch of "<<batch.getNumColumns()<<" is larger than the layer was built for!!!!"<<std::endl;
+                assert(false);
+            }
+        }
+
+        void checkBackward(const matrix<T>& gradient) const
+        {
+            if(m_input == nullptr)
+            {
+                std::cout<<__PRETTY_FUNCTION__<<": backward before forward!!!!"<<std::endl;
+                assert(false);
+            }
+            checkBatch(gradient, m_weights.getNumRows(), __PRETTY_FUNCTION__);
+            if(gradient.getNumColumns() != m_output.getNumColumns())
+            {
+                std::cout<<__PRETTY_FUNCTION__<<": gradient and output must have the same batch size!!!!"<<std::endl;
+                assert(false);
+            }
+        }
+};
+
+#endif //DENSE_LAYER_H
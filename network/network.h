@@ -0,0 +1,298 @@
+/**
+ * Feed forward network of dense layers with a configurable topology.
+ * Copyright (C) 2024  Matthew Hardenburgh, matthew@hardenburgh.io
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef NETWORK_H
+#define NETWORK_H
+
+#include <stdint.h>
+#include <cassert>
+#include <iostream>
+#include <utility>
+#include <vector>
+
+#include "matrix.h"
+#include "denseLayer.h"
+
+/*
+ * A network is built from a list of layer sizes, input first:
+ *
+ *     network<_Float64> model({784, 16, 16, 10}, batchSize);
+ *
+ * is the 784 pixel input, two hidden layers of 16 and the 10 digit output,
+ * three dense layers in all, sigmoid throughout unless other activation
+ * functions are given for the hidden and output layers. A training step is
+ *
+ *     model.forward(images);                  // 784 x B
+ *     costGradient = model.output() - labels; // 10 x B
+ *     model.backward(costGradient);
+ *     model.step(learningRate);
+ *
+ * or backwardAndStep(costGradient, learningRate), which updates each layer in
+ * the same pass that computes its gradients. None of these allocate, every
+ * buffer is sized for maxBatchSize when the network is built.
+ *
+ * Copying a network copies the weights and biases, the copy always owns its
+ * parameters. To have several workers train one set of parameters, build
+ * them with the sharing constructor instead.
+ */
+template <class T> class network
+{
+    public:
+        /**
+         * @brief creates a network with uninitialized weights and biases
+         * @param layerSizes neurons per layer, input layer first, at least two
+         * @param maxBatchSize largest batch forward() will be given
+         * @param hidden activation function of every layer but the last
+         * @param output activation function of the last layer
+        */
+        network(const std::vector<uint32_t>& layerSizes, uint32_t maxBatchSize = 1,
+                matrixKernels::activationFunction hidden = matrixKernels::activationFunction::sigmoid,
+                matrixKernels::activationFunction output = matrixKernels::activationFunction::sigmoid) : m_layerSizes(layerSizes)
+        {
+            if(layerSizes.size() < 2)
+            {
+                std::cout<<__PRETTY_FUNCTION__<<": a network needs at least an input and an output layer!!!!"<<std::endl;
+                assert(false);
+            }
+
+            m_layers.reserve(layerSizes.size() - 1);
+            for(uint32_t iIter = 1; iIter < layerSizes.size(); iIter++)
+            {
+                m_layers.emplace_back(layerSizes[iIter - 1], layerSizes[iIter], maxBatchSize, (iIter + 1 < layerSizes.size()) ? hidden : output);
+            }
+        }
+
+        /**
+         * @brief creates a network with buffers of its own that trains the
+         *        weights and biases of parameters in place
+         * @param parameters network whose weights and biases are used, has to
+         *        outlive this network
+         * @param maxBatchSize largest batch forward() will be given
+        */
+        network(network& parameters, uint32_t maxBatchSize) : m_layerSizes(parameters.m_layerSizes)
+        {
+            m_layers.reserve(parameters.m_layers.size());
+            for(denseLayer<T>& layer : parameters.m_layers)
+            {
+                m_layers.emplace_back(layer, maxBatchSize);
+            }
+        }
+
+        /**
+         * @brief creates a network out of layers that are already built
+         * @param layers dense layers, input side first, each taking as many
+         *        inputs as the one before has outputs
+        */
+        explicit network(std::vector<denseLayer<T>>&& layers) : m_layers(std::move(layers))
+        {
+            if(m_layers.empty())
+            {
+                std::cout<<__PRETTY_FUNCTION__<<": a network needs at least one layer!!!!"<<std::endl;
+                assert(false);
+            }
+
+            m_layerSizes.push_back(m_layers.front().getNumInputs());
+            for(const denseLayer<T>& layer : m_layers)
+            {
+                if(layer.getNumInputs() != m_layerSizes.back())
+                {
+                    std::cout<<__PRETTY_FUNCTION__<<": a layer of "<<layer.getNumInputs()<<" inputs follows a layer of "<<m_layerSizes.back()<<" outputs!!!!"<<std::endl;
+                    assert(false);
+                }
+                m_layerSizes.push_back(layer.getNumOutputs());
+            }
+        }
+
+        /**
+         * @brief initialize every layer Xavier, He or uniform style, see
+         *        denseLayer::initialize. Layer l takes stream l of the seed
+         * @param scheme Xavier, He or uniform
+         * @param seed seed of the weights
+        */
+        void initialize(weightInitialization scheme, uint64_t seed)
+        {
+            for(uint32_t lIter = 0; lIter < m_layers.size(); lIter++)
+            {
+                m_layers[lIter].initialize(scheme, seed, lIter);
+            }
+        }
+
+        /**
+         * @brief run a batch through every layer
+         * @param input first layer size x B, has to stay alive and unchanged
+         *        until backward()
+         * @return output of the last layer, last layer size x B
+        */
+        const matrix<T>& forward(const matrix<T>& input)
+        {
+            const matrix<T>* layerInput = &input;
+            for(denseLayer<T>& layer : m_layers)
+            {
+                layerInput = &layer.forward(*layerInput);
+            }
+            return *layerInput;
+        }
+
+        /**
+         * @brief gradients of every layer for the last forward(), summed over
+         *        the batch
+         * @param costGradient gradient of the cost with respect to the output
+         *        of the network, last layer size x B
+        */
+        void backward(const matrix<T>& costGradient)
+        {
+            const matrix<T>* gradient = &costGradient;
+            for(uint32_t iIter = m_layers.size(); iIter-- > 0;)
+            {
+                m_layers[iIter].backward(*gradient, iIter > 0);
+                gradient = &m_layers[iIter].inputGradient();
+            }
+        }
+
+        /**
+         * @brief gradient descent step with the gradients from backward()
+         * @param learningRate step size, the gradients are sums over the batch
+        */
+        void step(T learningRate)
+        {
+            for(denseLayer<T>& layer : m_layers)
+            {
+                layer.step(learningRate);
+            }
+        }
+
+        /**
+         * @brief backward() and step() fused layer by layer, each layer hands
+         *        on its gradient computed with the weights from before its step
+         * @param costGradient gradient of the cost with respect to the output
+         *        of the network, last layer size x B
+         * @param learningRate step size, the gradients are sums over the batch
+        */
+        void backwardAndStep(const matrix<T>& costGradient, T learningRate)
+        {
+            const matrix<T>* gradient = &costGradient;
+            for(uint32_t iIter = m_layers.size(); iIter-- > 0;)
+            {
+                m_layers[iIter].backwardAndStep(*gradient, learningRate, iIter > 0);
+                gradient = &m_layers[iIter].inputGradient();
+            }
+        }
+
+        /**
+         * @brief add the gradients of another network of the same topology to
+         *        the gradients of this one
+         * @param other network that ran backward() on another part of the batch
+        */
+        void accumulateGradients(const network& other)
+        {
+            for(uint32_t iIter = 0; iIter < m_layers.size(); iIter++)
+            {
+                m_layers[iIter].accumulateGradients(other.m_layers[iIter]);
+            }
+        }
+
+        /**
+         * @brief exact or fast exp in the forward pass of every layer, fast is
+         *        for inference, see activationKernels.h
+         * @param mode the accuracy mode
+        */
+        void setActivationMode(matrixKernels::activationMode mode)
+        {
+            for(denseLayer<T>& layer : m_layers)
+            {
+                layer.setActivationMode(mode);
+            }
+        }
+
+        /**
+         * @brief forward pass on a bfloat16 copy of the weights or on the
+         *        weights themselves, see denseLayer::setWeightStorage
+         * @details set it before building networks that share these
+         *          parameters
+         * @param storage the weight storage
+        */
+        void setWeightStorage(matrixKernels::weightStorage storage)
+        {
+            for(denseLayer<T>& layer : m_layers)
+            {
+                layer.setWeightStorage(storage);
+            }
+        }
+
+        /**
+         * @brief FNV-1a hash over the bytes of every weight and bias, equal
+         *        checksums mean bit-identical parameters
+         * @return the checksum
+        */
+        uint64_t checksum() const
+        {
+            uint64_t hash = 14695981039346656037ull;
+            for(const denseLayer<T>& layer : m_layers)
+            {
+                for(const matrix<T>* parameter : {&layer.weights(), &layer.biases()})
+                {
+                    const unsigned char* bytes = reinterpret_cast<const unsigned char*>(parameter->data());
+                    for(size_t iIter = 0; iIter < parameter->getNumRows() * parameter->getNumColumns() * sizeof(T); iIter++)
+                    {
+                        hash = (hash ^ bytes[iIter]) * 1099511628211ull;
+                    }
+                }
+            }
+            return hash;
+        }
+
+        /**
+         * @brief output of the last forward()
+        */
+        const matrix<T>& output() const
+        {
+            return m_layers.back().output();
+        }
+
+        /**
+         * @brief neurons per layer, input layer first
+        */
+        const std::vector<uint32_t>& getLayerSizes() const
+        {
+            return m_layerSizes;
+        }
+
+        /**
+         * @brief number of dense layers, one less than the number of sizes
+        */
+        uint32_t getNumLayers() const
+        {
+            return m_layers.size();
+        }
+
+        denseLayer<T>& layer(uint32_t index)
+        {
+            return m_layers[index];
+        }
+
+        const denseLayer<T>& layer(uint32_t index) const
+        {
+            return m_layers[index];
+        }
+
+    private:
+        std::vector<uint32_t> m_layerSizes;
+        std::vector<denseLayer<T>> m_layers;
+};
+
+#endif //NETWORK_H
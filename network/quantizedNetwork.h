@@ -0,0 +1,341 @@
+/**
+ * Int8 post-training quantized copy of a network, for inference.
+ * Copyright (C) 2024  Matthew Hardenburgh, matthew@hardenburgh.io
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef QUANTIZED_NETWORK_H
+#define QUANTIZED_NETWORK_H
+
+#include <stdint.h>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <algorithm>
+#include <vector>
+
+#include "matrix.h"
+#include "network.h"
+#include "quantizedKernels.h"
+
+/*
+ * A trained network quantized after the fact:
+ *
+ *     quantizedNetwork quantized(model, calibrationImages);
+ *     const matrix<float>& output = quantized.forward(images); // uint8_t pixels, 784 x B
+ *
+ * Weights are int8, symmetric per row: a row of a layer is scaled so its
+ * largest weight is 127, one float scale per neuron. Activations are uint8
+ * with a scale and zero point per layer, so the [0, 1] of sigmoid and the
+ * [-1, 1] of tanh both use all 256 steps:
+ *
+ *     x = scale * (q - zeroPoint)
+ *
+ * The ranges come from a calibration pass, the float network is run on a
+ * sample of training images and the smallest and largest output of every
+ * hidden layer are kept. The first layer needs none of that, it multiplies
+ * the uint8_t pixels mnistDataReader already stores, scale inputScale and a
+ * zero point of inputOffset. That one does not have to be a whole number,
+ * a network trained on standardized pixels subtracts their mean.
+ *
+ * A layer sums weights * activations in int32, see quantizedKernels.h, and
+ * turns the sum back into real numbers with one multiply and add per neuron.
+ * The zero point term, zeroPoint * sum of the row, does not depend on the
+ * input and is folded into the bias once. The activation function runs in
+ * float, in fast mode, and its output is quantized again for the next
+ * layer. The last layer stays float, that is what is compared.
+ *
+ * Every buffer is allocated at construction for maxBatchSize samples,
+ * forward() never allocates.
+ */
+class quantizedNetwork
+{
+    public:
+        /**
+         * @brief quantize the weights of model and calibrate the activations
+         * @param model trained network, only read
+         * @param calibrationInput images the activation ranges are measured
+         *        on, first layer size x number of images, in the units the
+         *        network was trained on
+         * @param maxBatchSize largest batch forward() will be given
+         * @param inputScale value of one step of the uint8_t input, 1 for a
+         *        network trained on the raw 0 to 255 pixels
+         * @param inputOffset uint8_t input that is 0 to the network, see
+         *        mnistNormalization
+        */
+        template <class T> quantizedNetwork(network<T>& model, const matrix<T>& calibrationInput, uint32_t maxBatchSize = 1, float inputScale = 1.0f, float inputOffset = 0.0f) :
+            m_layerSizes(model.getLayerSizes()),
+            m_maxBatchSize(maxBatchSize)
+        {
+            if(maxBatchSize < 1)
+            {
+                std::cout<<__PRETTY_FUNCTION__<<": maxBatchSize is less than 1!!!!"<<std::endl;
+                assert(false);
+            }
+            if(calibrationInput.getNumRows() != m_layerSizes.front())
+            {
+                std::cout<<__PRETTY_FUNCTION__<<": calibration input has "<<calibrationInput.getNumRows()<<" rows, the network takes "<<m_layerSizes.front()<<"!!!!"<<std::endl;
+                assert(false);
+            }
+
+            // the float network on the calibration images, every layer keeps its output
+            network<T> calibration(model, calibrationInput.getNumColumns());
+            calibration.forward(calibrationInput);
+
+            m_layers.resize(model.getNumLayers());
+            for(uint32_t lIter = 0; lIter < model.getNumLayers(); lIter++)
+            {
+                const denseLayer<T>& source = model.layer(lIter);
+                quantizedLayer& layer = m_layers[lIter];
+
+                layer.function = source.getActivationFunction();
+                if(lIter == 0)
+                {
+                    layer.inputScale = inputScale;
+                    layer.inputZeroPoint = 0;
+                    layer.inputOffset = inputOffset;
+                }
+                else
+                {
+                    calibrate(calibration.layer(lIter - 1).output(), layer.inputScale, layer.inputZeroPoint);
+                }
+                quantizeWeights(source.weights(), source.biases(), layer);
+
+                layer.input = matrix<uint8_t>(maxBatchSize, layer.paddedLength);
+                layer.input.fillZeros();
+                layer.accumulators = matrix<int32_t>(maxBatchSize, source.getNumOutputs());
+                layer.output = matrix<float>(source.getNumOutputs(), maxBatchSize);
+            }
+        }
+
+        /**
+         * @brief run a batch of images through every layer
+         * @param images uint8_t pixels, first layer size x B, one image per
+         *        column like getImageView() returns them
+         * @return output of the last layer, last layer size x B
+        */
+        const matrix<float>& forward(const matrix<uint8_t>& images)
+        {
+            const uint32_t numInputs = m_layerSizes.front();
+            const uint32_t batchSize = images.getNumColumns();
+            if(images.getNumRows() != numInputs)
+            {
+                std::cout<<__PRETTY_FUNCTION__<<": expected "<<numInputs<<" rows, got "<<images.getNumRows()<<"!!!!"<<std::endl;
+                assert(false);
+            }
+            if(batchSize > m_maxBatchSize)
+            {
+                std::cout<<__PRETTY_FUNCTION__<<": batch of "<<batchSize<<" is larger than the network was built for!!!!"<<std::endl;
+                assert(false);
+            }
+
+            // the kernels want one sample per row
+            uint8_t* staged = m_layers.front().input.data();
+            const uint32_t paddedLength = m_layers.front().paddedLength;
+            if(batchSize == 1)
+            {
+                std::memcpy(staged, images.data(), numInputs);
+            }
+            else
+            {
+                for(uint32_t bIter = 0; bIter < batchSize; bIter++)
+                {
+                    for(uint32_t kIter = 0; kIter < numInputs; kIter++)
+                    {
+                        staged[(static_cast<size_t>(bIter) * paddedLength) + kIter] = images.data()[(static_cast<size_t>(kIter) * batchSize) + bIter];
+                    }
+                }
+            }
+
+            for(uint32_t lIter = 0; lIter < m_layers.size(); lIter++)
+            {
+                quantizedLayer& layer = m_layers[lIter];
+                const uint32_t numOutputs = layer.output.getNumRows();
+
+                matrixKernels::quantizedGemm(layer.weights.data(), numOutputs, layer.paddedLength, layer.input.data(), batchSize, layer.accumulators.data());
+
+                layer.output.resize(numOutputs, batchSize);
+                const int32_t* accumulators = layer.accumulators.data();
+                float* output = layer.output.data();
+                for(uint32_t rIter = 0; rIter < numOutputs; rIter++)
+                {
+                    const float scale = layer.rowScales[rIter];
+                    const float bias = layer.biases[rIter];
+                    for(uint32_t bIter = 0; bIter < batchSize; bIter++)
+                    {
+                        output[(static_cast<size_t>(rIter) * batchSize) + bIter] = (scale * static_cast<float>(accumulators[(static_cast<size_t>(bIter) * numOutputs) + rIter])) + bias;
+                    }
+                }
+                matrix<float>::activate(layer.function, matrixKernels::activationMode::fast, layer.output, layer.output);
+
+                if(lIter + 1 < m_layers.size())
+                {
+                    quantizeActivations(layer.output, m_layers[lIter + 1]);
+                }
+            }
+            return m_layers.back().output;
+        }
+
+        /**
+         * @brief output of the last forward()
+        */
+        const matrix<float>& output() const
+        {
+            return m_layers.back().output;
+        }
+
+        /**
+         * @brief bytes of the quantized parameters: int8 weights, padding
+         *        included, and a float scale and bias per neuron
+        */
+        size_t getModelBytes() const
+        {
+            size_t bytes = 0;
+            for(const quantizedLayer& layer : m_layers)
+            {
+                bytes += static_cast<size_t>(layer.weights.getNumRows()) * layer.weights.getNumColumns() * sizeof(int8_t);
+                bytes += static_cast<size_t>(layer.rowScales.getNumRows()) * 2 * sizeof(float);
+            }
+            return bytes;
+        }
+
+        /**
+         * @brief neurons per layer, input layer first
+        */
+        const std::vector<uint32_t>& getLayerSizes() const
+        {
+            return m_layerSizes;
+        }
+
+        /**
+         * @brief scale and zero point the input of a layer is quantized with
+         * @param index layer, 0 is the first dense layer
+        */
+        float getInputScale(uint32_t index) const { return m_layers[index].inputScale; }
+        uint8_t getInputZeroPoint(uint32_t index) const { return m_layers[index].inputZeroPoint; }
+
+    private:
+        struct quantizedLayer
+        {
+            //number of inputs rounded up to quantizedRowAlignment
+            uint32_t paddedLength = 0;
+            matrixKernels::activationFunction function = matrixKernels::activationFunction::sigmoid;
+            float inputScale = 1.0f;
+            uint8_t inputZeroPoint = 0;
+            // the first layer's zero point when it is not a whole number,
+            // folded into the biases with inputZeroPoint
+            float inputOffset = 0.0f;
+            //N x paddedLength, zero past the real inputs
+            matrix<int8_t> weights;
+            //weight scale of the row times inputScale, N x 1
+            matrix<float> rowScales;
+            //bias with the zero point term folded in, N x 1
+            matrix<float> biases;
+            //quantized input, one sample per row, maxBatchSize x paddedLength
+            matrix<uint8_t> input;
+            //int32 sums, one sample per row, maxBatchSize x N
+            matrix<int32_t> accumulators;
+            //N x B, like the output of a denseLayer
+            matrix<float> output;
+        };
+
+        std::vector<uint32_t> m_layerSizes;
+        uint32_t m_maxBatchSize;
+        std::vector<quantizedLayer> m_layers;
+
+        /**
+         * @brief scale and zero point that map the smallest to the largest
+         *        value of outputs, widened to include 0, onto 0 to 255
+        */
+        template <class T> static void calibrate(const matrix<T>& outputs, float& scale, uint8_t& zeroPoint)
+        {
+            float low = 0.0f;
+            float high = 0.0f;
+            for(const T& value : outputs)
+            {
+                low = std::min(low, static_cast<float>(value));
+                high = std::max(high, static_cast<float>(value));
+            }
+
+            scale = (high > low) ? ((high - low) / 255.0f) : 1.0f;
+            zeroPoint = static_cast<uint8_t>(std::clamp(std::lround(-low / scale), 0l, 255l));
+        }
+
+        /**
+         * @brief int8 weights with a scale per row, and the biases with the
+         *        zero point of the input folded in
+        */
+        template <class T> static void quantizeWeights(const matrix<T>& weights, const matrix<T>& biases, quantizedLayer& layer)
+        {
+            const uint32_t numOutputs = weights.getNumRows();
+            const uint32_t numInputs = weights.getNumColumns();
+
+            layer.paddedLength = matrixKernels::quantizedPaddedLength(numInputs);
+            layer.weights = matrix<int8_t>(numOutputs, layer.paddedLength);
+            layer.weights.fillZeros();
+            layer.rowScales = matrix<float>(numOutputs, 1);
+            layer.biases = matrix<float>(numOutputs, 1);
+
+            for(uint32_t rIter = 0; rIter < numOutputs; rIter++)
+            {
+                const T* rowOfWeights = weights.data() + (static_cast<size_t>(rIter) * numInputs);
+                _Float64 largest = 0.0;
+                for(uint32_t kIter = 0; kIter < numInputs; kIter++)
+                {
+                    largest = std::max(largest, std::fabs(static_cast<_Float64>(rowOfWeights[kIter])));
+                }
+                const _Float64 weightScale = (largest > 0.0) ? (largest / 127.0) : 1.0;
+
+                int8_t* quantizedRow = layer.weights.data() + (static_cast<size_t>(rIter) * layer.paddedLength);
+                int64_t rowSum = 0;
+                for(uint32_t kIter = 0; kIter < numInputs; kIter++)
+                {
+                    const long quantized = std::clamp(std::lround(static_cast<_Float64>(rowOfWeights[kIter]) / weightScale), -127l, 127l);
+                    quantizedRow[kIter] = static_cast<int8_t>(quantized);
+                    rowSum += quantized;
+                }
+
+                const _Float64 rowScale = weightScale * layer.inputScale;
+                layer.rowScales[rIter] = static_cast<float>(rowScale);
+                layer.biases[rIter] = static_cast<float>(static_cast<_Float64>(biases.at(rIter)) - (rowScale * (layer.inputZeroPoint + static_cast<_Float64>(layer.inputOffset)) * static_cast<_Float64>(rowSum)));
+            }
+        }
+
+        /**
+         * @brief quantize the N x B float output of a layer into the input
+         *        rows of the next one
+        */
+        static void quantizeActivations(const matrix<float>& output, quantizedLayer& next)
+        {
+            const uint32_t numValues = output.getNumRows();
+            const uint32_t batchSize = output.getNumColumns();
+            const float inverseScale = 1.0f / next.inputScale;
+            const float zeroPoint = next.inputZeroPoint;
+
+            for(uint32_t kIter = 0; kIter < numValues; kIter++)
+            {
+                const float* values = output.data() + (static_cast<size_t>(kIter) * batchSize);
+                for(uint32_t bIter = 0; bIter < batchSize; bIter++)
+                {
+                    // clamped first, so rounding half up is a truncation, no libm call
+                    const float quantized = std::clamp((values[bIter] * inverseScale) + zeroPoint, 0.0f, 255.0f);
+                    next.input.data()[(static_cast<size_t>(bIter) * next.paddedLength) + kIter] = static_cast<uint8_t>(quantized + 0.5f);
+                }
+            }
+        }
+};
+
+#endif //QUANTIZED_NETWORK_H
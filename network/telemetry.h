@@ -0,0 +1,310 @@
+/**
+ * Training telemetry through a lock-free ring and a background aggregator.
+ * Copyright (C) 2024  Matthew Hardenburgh, matthew@hardenburgh.io
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <stdint.h>
+#include <cassert>
+#include <cstddef>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <iostream>
+#include <limits>
+#include <mutex>
+#include <ostream>
+#include <thread>
+#include <vector>
+
+/*
+ * The training loop hands its cost to a trainingTelemetry once per step:
+ *
+ *     trainingTelemetry telemetry(std::cout, std::chrono::milliseconds(1000));
+ *     for(...)
+ *     {
+ *         ...
+ *         telemetry.record(iIter, cost);
+ *     }
+ *     telemetry.stop();
+ *
+ * record() stores a fixed size record (iteration, cost, steady clock time) in
+ * a single producer single consumer ring and returns. It does not lock,
+ * allocate, format or write, and the clock is read through the vDSO, so the
+ * training thread makes no system calls. A full ring drops the record and
+ * counts it rather than make training wait.
+ *
+ * A background thread wakes every interval, drains the ring and prints one
+ * line for the window: the last iteration, the mean, smallest and largest
+ * cost of the window, an exponential moving average over all records, the
+ * iterations per second and the records dropped so far. As text or as JSON,
+ * one object per line.
+ */
+
+/**
+ * @brief one step of training as the hot loop reports it
+*/
+struct telemetryRecord
+{
+    uint64_t iteration;
+    double cost;
+    // steady clock, nanoseconds
+    int64_t timestamp;
+};
+
+/**
+ * @brief bounded lock-free queue between exactly one producer thread and
+ *        one consumer thread
+ * @details head and tail only ever grow, their difference is the fill. Each
+ *          side writes its own index and reads the other's, release and
+ *          acquire order the slot contents with the index. The two indices
+ *          sit on separate cache lines so the threads do not share one
+*/
+template <class R> class spscRing
+{
+    public:
+        /**
+         * @brief creates an empty ring
+         * @param capacity number of records it holds, a power of two
+        */
+        explicit spscRing(size_t capacity) : m_slots(capacity), m_mask(capacity - 1)
+        {
+            if((capacity == 0) || ((capacity & (capacity - 1)) != 0))
+            {
+                std::cout<<__PRETTY_FUNCTION__<<": capacity "<<capacity<<" is not a power of two!!!!"<<std::endl;
+                assert(false);
+            }
+        }
+
+        /**
+         * @brief append a record, producer thread only
+         * @return false if the ring is full, the record is not stored
+        */
+        bool tryPush(const R& record)
+        {
+            const size_t tail = m_tail.load(std::memory_order_relaxed);
+            if(tail - m_head.load(std::memory_order_acquire) == m_slots.size())
+            {
+                return false;
+            }
+            m_slots[tail & m_mask] = record;
+            m_tail.store(tail + 1, std::memory_order_release);
+            return true;
+        }
+
+        /**
+         * @brief take the oldest record, consumer thread only
+         * @return false if the ring is empty
+        */
+        bool tryPop(R& record)
+        {
+            const size_t head = m_head.load(std::memory_order_relaxed);
+            if(head == m_tail.load(std::memory_order_acquire))
+            {
+                return false;
+            }
+            record = m_slots[head & m_mask];
+            m_head.store(head + 1, std::memory_order_release);
+            return true;
+        }
+
+        size_t getCapacity() const { return m_slots.size(); }
+
+    private:
+        std::vector<R> m_slots;
+        size_t m_mask;
+        alignas(64) std::atomic<size_t> m_head{0};
+        alignas(64) std::atomic<size_t> m_tail{0};
+};
+
+/**
+ * @brief how the aggregator prints a window
+*/
+enum class telemetryFormat : uint32_t
+{
+    text = 0,
+    json = 1
+};
+
+/**
+ * @brief collects per step costs off the training thread and prints them
+ *        summarized every interval, see the top of this file
+*/
+class trainingTelemetry
+{
+    public:
+        /**
+         * @brief starts the aggregator thread
+         * @param out stream the windows are printed to, only the aggregator
+         *        writes to it until stop()
+         * @param interval time between printed windows
+         * @param format text or JSON lines
+         * @param capacity records the ring holds, a power of two. Should
+         *        cover an interval of training
+         * @param movingAverageSpan records the moving average spans, its
+         *        weight is 2 / (span + 1)
+        */
+        trainingTelemetry(std::ostream& out, std::chrono::milliseconds interval, telemetryFormat format = telemetryFormat::text,
+                          size_t capacity = 1 << 17, uint32_t movingAverageSpan = 1000) :
+            m_ring(capacity),
+            m_out(out),
+            m_interval(interval),
+            m_format(format),
+            m_weight(2.0 / (movingAverageSpan + 1.0))
+        {
+            m_windowStart = std::chrono::steady_clock::now().time_since_epoch().count();
+            m_aggregator = std::thread([this]() { aggregate(); });
+        }
+
+        trainingTelemetry(const trainingTelemetry&) = delete;
+        trainingTelemetry& operator=(const trainingTelemetry&) = delete;
+
+        ~trainingTelemetry()
+        {
+            stop();
+        }
+
+        /**
+         * @brief report one step, training thread only. Never blocks
+         * @param iteration step number
+         * @param cost cost of the step
+        */
+        void record(uint64_t iteration, double cost)
+        {
+            const telemetryRecord record = {iteration, cost, std::chrono::steady_clock::now().time_since_epoch().count()};
+            if(!m_ring.tryPush(record))
+            {
+                // only the training thread writes it
+                m_dropped.store(m_dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            }
+        }
+
+        /**
+         * @brief print what is left and stop the aggregator thread. Waits for
+         *        it, call it from the training thread once training is done
+        */
+        void stop()
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                if(m_stopping)
+                {
+                    return;
+                }
+                m_stopping = true;
+            }
+            m_wake.notify_one();
+            m_aggregator.join();
+        }
+
+        /**
+         * @brief records handed to record() that did not fit in the ring
+        */
+        uint64_t getDropped() const
+        {
+            return m_dropped.load(std::memory_order_relaxed);
+        }
+
+        /**
+         * @brief records the aggregator has taken out of the ring so far
+        */
+        uint64_t getAggregated() const
+        {
+            return m_aggregated.load(std::memory_order_relaxed);
+        }
+
+    private:
+        spscRing<telemetryRecord> m_ring;
+        std::ostream& m_out;
+        std::chrono::milliseconds m_interval;
+        telemetryFormat m_format;
+        double m_weight;
+        std::atomic<uint64_t> m_dropped{0};
+        std::atomic<uint64_t> m_aggregated{0};
+
+        std::mutex m_mutex;
+        std::condition_variable m_wake;
+        bool m_stopping = false;
+        std::thread m_aggregator;
+
+        // aggregator thread only from here on
+        double m_movingAverage = 0.0;
+        bool m_haveMovingAverage = false;
+        int64_t m_windowStart = 0;
+
+        void aggregate()
+        {
+            bool stopping = false;
+            while(!stopping)
+            {
+                {
+                    std::unique_lock<std::mutex> lock(m_mutex);
+                    m_wake.wait_for(lock, m_interval, [this]() { return m_stopping; });
+                    stopping = m_stopping;
+                }
+                drainWindow();
+            }
+        }
+
+        void drainWindow()
+        {
+            uint64_t count = 0;
+            uint64_t lastIteration = 0;
+            double sum = 0.0;
+            double smallest = std::numeric_limits<double>::infinity();
+            double largest = -std::numeric_limits<double>::infinity();
+            int64_t lastTimestamp = m_windowStart;
+
+            telemetryRecord record;
+            while(m_ring.tryPop(record))
+            {
+                count++;
+                lastIteration = record.iteration;
+                sum += record.cost;
+                smallest = std::min(smallest, record.cost);
+                largest = std::max(largest, record.cost);
+                lastTimestamp = record.timestamp;
+                m_movingAverage = m_haveMovingAverage ? (m_movingAverage + (m_weight * (record.cost - m_movingAverage))) : record.cost;
+                m_haveMovingAverage = true;
+            }
+            m_aggregated.fetch_add(count, std::memory_order_relaxed);
+            if(count == 0)
+            {
+                return;
+            }
+
+            const double seconds = std::max(lastTimestamp - m_windowStart, int64_t(1)) * 1e-9;
+            m_windowStart = lastTimestamp;
+            const double mean = sum / count;
+            const double iterationsPerSecond = count / seconds;
+            if(m_format == telemetryFormat::json)
+            {
+                m_out<<"{\"iteration\":"<<lastIteration<<",\"records\":"<<count<<",\"mean\":"<<mean<<",\"min\":"<<smallest<<",\"max\":"<<largest
+                     <<",\"movingAverage\":"<<m_movingAverage<<",\"iterationsPerSecond\":"<<iterationsPerSecond<<",\"dropped\":"<<getDropped()<<"}\n";
+            }
+            else
+            {
+                m_out<<"iteration "<<lastIteration<<": cost mean "<<mean<<", min "<<smallest<<", max "<<largest<<" over "<<count<<" records, moving average "
+                     <<m_movingAverage<<", "<<iterationsPerSecond<<" iterations/s, "<<getDropped()<<" dropped\n";
+            }
+            m_out.flush();
+        }
+};
+
+#endif //TELEMETRY_H
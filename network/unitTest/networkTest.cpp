@@ -0,0 +1,500 @@
+/**
+ * Unit tests for the network and denseLayer classes
+ * Copyright (C) 2024  Matthew Hardenburgh, matthew@hardenburgh.io
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3 of the License.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <iostream>
+#include <gtest/gtest.h>
+
+#include "network.h"
+#include "quantizedNetwork.h"
+#include "checkpoint.h"
+#include "telemetry.h"
+
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <new>
+#include <random>
+#include <sstream>
+#include <vector>
+
+// matrix storage comes from the aligned array new below, nothing else in
+// these tests uses it
+static std::atomic<uint64_t> matrixAllocations{0};
+
+void* operator new[](std::size_t size, std::align_val_t alignment)
+{
+    matrixAllocations.fetch_add(1, std::memory_order_relaxed);
+    return ::operator new(size, alignment);
+}
+
+void operator delete[](void* data, std::align_val_t alignment) noexcept
+{
+    ::operator delete(data, alignment);
+}
+
+void operator delete[](void* data, std::size_t, std::align_val_t alignment) noexcept
+{
+    ::operator delete(data, alignment);
+}
+
+/**
+ * @brief every weight and bias of model uniform in [low, high), counter based
+ *        like denseLayer::initialize
+*/
+template <class T> static void fillUniform(network<T>& model, double low, double high, uint64_t seed)
+{
+    for(uint32_t lIter = 0; lIter < model.getNumLayers(); lIter++)
+    {
+        matrix<T>& weights = model.layer(lIter).weights();
+        matrix<T>& biases = model.layer(lIter).biases();
+        matrixRandom::fillUniform(weights.data(), static_cast<std::size_t>(weights.getNumRows()) * weights.getNumColumns(), low, high, seed, 2 * lIter);
+        matrixRandom::fillUniform(biases.data(), biases.getNumRows(), low, high, seed, (2 * lIter) + 1);
+    }
+}
+
+/**
+ * @brief half the squared error of the network's output against labels
+*/
+static _Float64 cost(network<_Float64>& model, const matrix<_Float64>& input, const matrix<_Float64>& labels)
+{
+    const matrix<_Float64>& output = model.forward(input);
+    _Float64 sum = 0.0;
+    for(uint32_t iIter = 0; iIter < output.getNumRows() * output.getNumColumns(); iIter++)
+    {
+        sum += 0.5 * (output[iIter] - labels[iIter]) * (output[iIter] - labels[iIter]);
+    }
+    return sum;
+}
+
+/**
+ * @brief compare the gradients of backward() with central differences of cost()
+*/
+static void checkGradients(network<_Float64>& model)
+{
+    matrix<_Float64> input(5, 3);
+    matrix<_Float64> labels(3, 3);
+    input.fillRandom(0.0, 1.0);
+    labels.fillRandom(0.0, 1.0);
+
+    // the gradient of half the squared error is output - labels
+    model.forward(input);
+    matrix<_Float64> costGradient = model.output() - labels;
+    model.backward(costGradient);
+
+    const _Float64 epsilon = 1e-6;
+    for(uint32_t lIter = 0; lIter < model.getNumLayers(); lIter++)
+    {
+        const matrix<_Float64> weightGradient = model.layer(lIter).weightGradient();
+        const matrix<_Float64> biasGradient = model.layer(lIter).biasGradient();
+
+        matrix<_Float64>& weights = model.layer(lIter).weights();
+        for(uint32_t iIter = 0; iIter < weights.getNumRows() * weights.getNumColumns(); iIter++)
+        {
+            const _Float64 original = weights[iIter];
+            weights[iIter] = original + epsilon;
+            const _Float64 costUp = cost(model, input, labels);
+            weights[iIter] = original - epsilon;
+            const _Float64 costDown = cost(model, input, labels);
+            weights[iIter] = original;
+            EXPECT_NEAR((costUp - costDown) / (2.0 * epsilon), weightGradient[iIter], 1e-7);
+        }
+
+        matrix<_Float64>& biases = model.layer(lIter).biases();
+        for(uint32_t iIter = 0; iIter < biases.getNumRows(); iIter++)
+        {
+            const _Float64 original = biases[iIter];
+            biases[iIter] = original + epsilon;
+            const _Float64 costUp = cost(model, input, labels);
+            biases[iIter] = original - epsilon;
+            const _Float64 costDown = cost(model, input, labels);
+            biases[iIter] = original;
+            EXPECT_NEAR((costUp - costDown) / (2.0 * epsilon), biasGradient[iIter], 1e-7);
+        }
+    }
+}
+
+TEST(networkTest, test_backward_matches_finite_differences)
+{
+    using matrixKernels::activationFunction;
+
+    // hidden and output activation, ReLU is left out for its kink at 0
+    const activationFunction activations[][2] =
+    {
+        {activationFunction::sigmoid, activationFunction::sigmoid},
+        {activationFunction::tanh, activationFunction::softmax},
+        {activationFunction::leakyRelu, activationFunction::sigmoid}
+    };
+
+    for(const activationFunction* pair : activations)
+    {
+        network<_Float64> model({5, 4, 3}, 3, pair[0], pair[1]);
+        fillUniform(model, -1.0, 1.0, 3);
+        checkGradients(model);
+    }
+}
+
+TEST(networkTest, test_forward_backward_step_do_not_allocate)
+{
+    network<_Float64> model({784, 16, 16, 10}, 32);
+    model.initialize(weightInitialization::uniform, 5);
+
+    matrix<_Float64> input(784, 32);
+    matrix<_Float64> labels(10, 32);
+    matrix<_Float64> costGradient(10, 32);
+    input.fillRandom(0.0, 255.0);
+    labels.fillZeros();
+
+    // every matrix allocated from here on would be counted
+    const uint64_t allocationsBefore = matrixAllocations.load();
+    for(uint32_t batchSize : {32u, 8u, 1u, 32u})
+    {
+        input.resize(784, batchSize);
+        labels.resize(10, batchSize);
+
+        model.forward(input);
+        costGradient = model.output() - labels;
+        model.backward(costGradient);
+        model.step(0.001);
+
+        model.forward(input);
+        costGradient = model.output() - labels;
+        model.backwardAndStep(costGradient, 0.001);
+    }
+    EXPECT_EQ(allocationsBefore, matrixAllocations.load());
+
+    // and the count does see a matrix that allocates
+    matrix<_Float64> allocated(2, 2);
+    EXPECT_EQ(allocationsBefore + 1, matrixAllocations.load());
+}
+
+TEST(networkTest, test_shared_parameters_and_gradient_accumulation)
+{
+    network<_Float64> model({6, 5, 2}, 1);
+    fillUniform(model, -1.0, 1.0, 11);
+
+    matrix<_Float64> input(6, 4);
+    matrix<_Float64> labels(2, 4);
+    input.fillRandom(0.0, 1.0);
+    labels.fillRandom(0.0, 1.0);
+
+    // a copy owns its parameters, a sharing network works on the model's
+    network<_Float64> reference = model;
+    network<_Float64> shared(model, 4);
+    EXPECT_TRUE(reference.layer(0).weights().ownsData());
+    EXPECT_FALSE(shared.layer(0).weights().ownsData());
+    EXPECT_EQ(model.layer(1).biases().data(), shared.layer(1).biases().data());
+    EXPECT_EQ(model.checksum(), reference.checksum());
+
+    // two halves of the batch on two sharing networks add up to the whole batch
+    network<_Float64> whole(reference, 4);
+    whole.forward(input);
+    matrix<_Float64> costGradient = whole.output() - labels;
+    whole.backward(costGradient);
+
+    network<_Float64> firstHalf(model, 2);
+    network<_Float64> secondHalf(model, 2);
+    matrix<_Float64> inputHalves[2] = {matrix<_Float64>(6, 2), matrix<_Float64>(6, 2)};
+    matrix<_Float64> labelHalves[2] = {matrix<_Float64>(2, 2), matrix<_Float64>(2, 2)};
+    for(uint32_t iIter = 0; iIter < 6; iIter++)
+    {
+        for(uint32_t jIter = 0; jIter < 4; jIter++)
+        {
+            inputHalves[jIter / 2](iIter, jIter % 2) = input.at(iIter, jIter);
+            if(iIter < 2)
+            {
+                labelHalves[jIter / 2](iIter, jIter % 2) = labels.at(iIter, jIter);
+            }
+        }
+    }
+    network<_Float64>* halves[2] = {&firstHalf, &secondHalf};
+    for(uint32_t hIter = 0; hIter < 2; hIter++)
+    {
+        halves[hIter]->forward(inputHalves[hIter]);
+        matrix<_Float64> halfGradient = halves[hIter]->output() - labelHalves[hIter];
+        halves[hIter]->backward(halfGradient);
+    }
+    firstHalf.accumulateGradients(secondHalf);
+
+    for(uint32_t lIter = 0; lIter < model.getNumLayers(); lIter++)
+    {
+        const matrix<_Float64>& expected = whole.layer(lIter).weightGradient();
+        const matrix<_Float64>& result = firstHalf.layer(lIter).weightGradient();
+        for(uint32_t iIter = 0; iIter < expected.getNumRows() * expected.getNumColumns(); iIter++)
+        {
+            EXPECT_NEAR(expected[iIter], result[iIter], 1e-12);
+        }
+    }
+
+    // stepping the sharing network moves the model, the fused step lands on
+    // the same weights as backward() then step()
+    whole.step(0.1);
+    shared.forward(input);
+    costGradient = shared.output() - labels;
+    shared.backwardAndStep(costGradient, 0.1);
+    for(uint32_t lIter = 0; lIter < model.getNumLayers(); lIter++)
+    {
+        const matrix<_Float64>& expected = reference.layer(lIter).weights();
+        const matrix<_Float64>& result = model.layer(lIter).weights();
+        for(uint32_t iIter = 0; iIter < expected.getNumRows() * expected.getNumColumns(); iIter++)
+        {
+            EXPECT_NEAR(expected[iIter], result[iIter], 1e-12);
+        }
+    }
+}
+
+TEST(networkTest, test_bf16_weight_storage_follows_updates)
+{
+    network<float> model({40, 24, 10}, 1);
+    model.initialize(weightInitialization::uniform, 13);
+    model.setWeightStorage(matrixKernels::weightStorage::bf16);
+
+    // a float network with the weights already rounded computes the same
+    // forward pass bit for bit
+    auto rounded = [](const network<float>& source)
+    {
+        network<float> copy = source;
+        copy.setWeightStorage(matrixKernels::weightStorage::native);
+        for(uint32_t lIter = 0; lIter < copy.getNumLayers(); lIter++)
+        {
+            for(float& value : copy.layer(lIter).weights())
+            {
+                value = static_cast<float>(matrixKernels::bfloat16(value));
+            }
+        }
+        return copy;
+    };
+
+    matrix<float> input(40, 1);
+    matrix<float> labels(10, 1);
+    input.fillRandom(0.0f, 1.0f);
+    labels.fillRandom(0.0f, 1.0f);
+
+    network<float> shared(model, 1);
+    EXPECT_EQ(matrixKernels::weightStorage::bf16, shared.layer(0).getWeightStorage());
+    for(uint32_t stepIter = 0; stepIter < 3; stepIter++)
+    {
+        network<float> reference = rounded(model);
+        const matrix<float> expected = reference.forward(input);
+        const matrix<float>& result = shared.forward(input);
+        EXPECT_EQ(0, std::memcmp(expected.data(), result.data(), sizeof(float) * 10));
+
+        // stepping through the sharing network rounds the shared copy again
+        matrix<float> costGradient = result - labels;
+        shared.backwardAndStep(costGradient, 0.5f);
+    }
+
+    // the update itself lands on the full precision weights
+    bool anyBelowBf16 = false;
+    for(const float& value : model.layer(0).weights())
+    {
+        anyBelowBf16 = anyBelowBf16 || (static_cast<float>(matrixKernels::bfloat16(value)) != value);
+    }
+    EXPECT_TRUE(anyBelowBf16);
+}
+
+TEST(networkTest, test_quantized_network_agrees_with_float_network)
+{
+    network<_Float64> model({100, 32, 16, 10}, 1, matrixKernels::activationFunction::tanh, matrixKernels::activationFunction::sigmoid);
+    fillUniform(model, -0.1, 0.1, 17);
+
+    // raw 0 to 255 pixels, like getImage() gives them
+    const uint32_t numImages = 64;
+    std::minstd_rand generator(17);
+    std::uniform_int_distribution<uint32_t> pixel(0, 255);
+    matrix<uint8_t> images(100, numImages);
+    matrix<_Float64> calibration(100, numImages);
+    for(uint32_t iIter = 0; iIter < 100 * numImages; iIter++)
+    {
+        images[iIter] = static_cast<uint8_t>(pixel(generator));
+        calibration[iIter] = images[iIter];
+    }
+
+    quantizedNetwork quantized(model, calibration, numImages);
+    // tanh covers both signs, its zero point lands in the middle
+    EXPECT_EQ(1.0f, quantized.getInputScale(0));
+    EXPECT_EQ(0, quantized.getInputZeroPoint(0));
+    EXPECT_NEAR(128, quantized.getInputZeroPoint(1), 32);
+
+    network<_Float64> reference(model, numImages);
+    const matrix<_Float64>& expected = reference.forward(calibration);
+    const matrix<float> batched = quantized.forward(images);
+
+    matrix<uint8_t> image(100, 1);
+    for(uint32_t bIter = 0; bIter < numImages; bIter++)
+    {
+        for(uint32_t kIter = 0; kIter < 100; kIter++)
+        {
+            image[kIter] = images(kIter, bIter);
+        }
+        // one image at a time gives the same bits as the batch
+        const matrix<float>& single = quantized.forward(image);
+        for(uint32_t jIter = 0; jIter < 10; jIter++)
+        {
+            EXPECT_EQ(batched(jIter, bIter), single[jIter]);
+            EXPECT_NEAR(expected.at(jIter, bIter), single[jIter], 0.02);
+        }
+    }
+
+    // int8 weights padded to 16 inputs, plus a float scale and bias per neuron
+    EXPECT_EQ((112 * 32) + (32 * 16) + (16 * 10) + ((32 + 16 + 10) * 8), quantized.getModelBytes());
+}
+
+TEST(networkTest, test_checkpoint_maps_parameters_without_copying)
+{
+    network<float> model({30, 20, 10}, 4, matrixKernels::activationFunction::tanh, matrixKernels::activationFunction::softmax);
+    model.initialize(weightInitialization::uniform, 19);
+
+    const std::string path = testing::TempDir() + "networkTest.ckpt";
+    ASSERT_TRUE(saveCheckpoint(model, path, 33.3f, 1.0f / 78.5f));
+
+    std::unique_ptr<mappedNetwork<float>> loaded = loadCheckpoint<float>(path, 4);
+    ASSERT_TRUE(loaded != nullptr);
+    network<float>& mapped = loaded->model();
+    EXPECT_EQ(model.getLayerSizes(), mapped.getLayerSizes());
+    EXPECT_EQ(model.checksum(), mapped.checksum());
+    for(uint32_t lIter = 0; lIter < mapped.getNumLayers(); lIter++)
+    {
+        EXPECT_FALSE(mapped.layer(lIter).weights().ownsData());
+        EXPECT_FALSE(mapped.layer(lIter).biases().ownsData());
+        EXPECT_EQ(0u, reinterpret_cast<uintptr_t>(mapped.layer(lIter).weights().data()) % checkpointAlignment);
+        EXPECT_EQ(0u, reinterpret_cast<uintptr_t>(mapped.layer(lIter).biases().data()) % checkpointAlignment);
+        EXPECT_EQ(model.layer(lIter).getActivationFunction(), mapped.layer(lIter).getActivationFunction());
+    }
+
+    matrix<float> input(30, 4);
+    input.fillRandom(0.0f, 1.0f);
+    const matrix<float> expected = model.forward(input);
+    const matrix<float>& result = mapped.forward(input);
+    EXPECT_EQ(0, std::memcmp(expected.data(), result.data(), sizeof(float) * 10 * 4));
+
+    // the mapped parameters are read only, a copy owns its parameters and can train
+    network<float> copy = mapped;
+    EXPECT_TRUE(mapped.layer(0).weights().isReadOnly());
+    EXPECT_TRUE(copy.layer(0).weights().ownsData());
+    EXPECT_FALSE(copy.layer(0).weights().isReadOnly());
+    EXPECT_EQ(model.checksum(), copy.checksum());
+    network<float> worker(mapped, 4);
+    EXPECT_TRUE(worker.layer(0).weights().isReadOnly());
+#ifndef NDEBUG
+    EXPECT_DEATH(mapped.step(0.1f), "Assertion");
+    EXPECT_DEATH(worker.initialize(weightInitialization::he, 1), "Assertion");
+#endif
+
+    // the wrong element type and a flipped weight are both turned away
+    EXPECT_TRUE(loadCheckpoint<_Float64>(path) == nullptr);
+    checkpointHeader header;
+    ASSERT_TRUE(readCheckpointHeader(path, header));
+    EXPECT_EQ(static_cast<uint32_t>(checkpointElementType::float32), header.elementType);
+    EXPECT_EQ(2u, header.numLayers);
+    EXPECT_EQ(33.3f, header.inputOffset);
+    EXPECT_EQ(1.0f / 78.5f, header.inputScale);
+    {
+        std::fstream file(path.c_str(), std::ios::in | std::ios::out | std::ios::binary);
+        file.seekp(header.fileBytes - checkpointAlignment);
+        file.put(0x7f);
+    }
+    EXPECT_TRUE(loadCheckpoint<float>(path) == nullptr);
+    std::remove(path.c_str());
+}
+
+TEST(networkTest, test_telemetry_ring_and_aggregated_window)
+{
+    spscRing<uint32_t> ring(4);
+    uint32_t value = 0;
+    EXPECT_FALSE(ring.tryPop(value));
+    for(uint32_t iIter = 0; iIter < 4; iIter++)
+    {
+        EXPECT_TRUE(ring.tryPush(iIter));
+    }
+    EXPECT_FALSE(ring.tryPush(4));
+    ASSERT_TRUE(ring.tryPop(value));
+    EXPECT_EQ(0u, value);
+    EXPECT_TRUE(ring.tryPush(4));
+    for(uint32_t iIter = 1; iIter <= 4; iIter++)
+    {
+        ASSERT_TRUE(ring.tryPop(value));
+        EXPECT_EQ(iIter, value);
+    }
+    EXPECT_FALSE(ring.tryPop(value));
+
+    // the interval never passes, stop() prints the only window. The ring
+    // holds 4 of the 6 records, the last two are dropped
+    std::ostringstream out;
+    trainingTelemetry telemetry(out, std::chrono::hours(1), telemetryFormat::json, 4, 1);
+    const double costs[] = {0.5, 0.25, 1.0, 0.25, 7.0, 9.0};
+    for(uint32_t iIter = 0; iIter < 6; iIter++)
+    {
+        telemetry.record(iIter, costs[iIter]);
+    }
+    telemetry.stop();
+    EXPECT_EQ(2u, telemetry.getDropped());
+    EXPECT_EQ(4u, telemetry.getAggregated());
+
+    // a span of 1 makes the moving average the last cost
+    const std::string line = out.str();
+    EXPECT_EQ(0u, line.find("{\"iteration\":3,\"records\":4,\"mean\":0.5,\"min\":0.25,\"max\":1,\"movingAverage\":0.25,"));
+    EXPECT_NE(std::string::npos, line.find("\"dropped\":2}\n"));
+    EXPECT_EQ(1, std::count(line.begin(), line.end(), '\n'));
+}
+
+TEST(networkTest, test_xavier_he_and_uniform_initialization)
+{
+    network<float> xavier({400, 200, 10}, 1);
+    xavier.initialize(weightInitialization::xavier, 23);
+    const float limit = std::sqrt(6.0f / (400 + 200));
+    bool anyNearLimit = false;
+    for(const float& value : xavier.layer(0).weights())
+    {
+        EXPECT_LE(std::fabs(value), limit);
+        anyNearLimit = anyNearLimit || (std::fabs(value) > 0.99f * limit);
+    }
+    EXPECT_TRUE(anyNearLimit);
+    for(const float& value : xavier.layer(1).biases())
+    {
+        EXPECT_EQ(0.0f, value);
+    }
+
+    // the same seed gives the same weights in every precision, layers differ
+    network<_Float64> he({400, 200, 10}, 1);
+    he.initialize(weightInitialization::he, 23);
+    network<float> heFloat({400, 200, 10}, 1);
+    heFloat.initialize(weightInitialization::he, 23);
+    const matrix<_Float64>& weights = he.layer(0).weights();
+    _Float64 squares = 0.0;
+    for(uint32_t iIter = 0; iIter < 400 * 200; iIter++)
+    {
+        squares += weights[iIter] * weights[iIter];
+        EXPECT_EQ(static_cast<float>(weights[iIter]), heFloat.layer(0).weights()[iIter]);
+    }
+    EXPECT_NEAR(std::sqrt(2.0 / 400), std::sqrt(squares / (400 * 200)), 0.001);
+    EXPECT_NE(weights[0], he.layer(1).weights()[0]);
+
+    // uniform draws the biases as well, from a stream apart from the weights'
+    network<float> uniform({400, 200, 10}, 1);
+    uniform.initialize(weightInitialization::uniform, 23);
+    for(const float& value : uniform.layer(0).weights())
+    {
+        EXPECT_GE(value, -0.5f);
+        EXPECT_LT(value, 0.5f);
+    }
+    const matrix<float>& biases = uniform.layer(0).biases();
+    EXPECT_NE(0.0f, biases[0]);
+    EXPECT_NE(uniform.layer(0).weights()[0], biases[0]);
+    EXPECT_GE(*std::min_element(biases.begin(), biases.end()), -0.5f);
+    EXPECT_LT(*std::max_element(biases.begin(), biases.end()), 0.5f);
+}